@@ -0,0 +1,158 @@
+//
+//  aabb.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 7/14/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef aabb_h
+#define aabb_h
+
+#include <cfloat>
+#include <algorithm>
+#include "ray.hpp"
+
+// Per ray data needed by the slab test
+// computed once per ray and reused for every box tested against it
+struct rayInv
+{
+    rayInv(const ray& r) : origin(r.origin()),
+                           invDir(1.0f / r.direction().x(),
+                                  1.0f / r.direction().y(),
+                                  1.0f / r.direction().z())
+    {
+        dirIsNeg[0] = invDir.x() < 0.0f;
+        dirIsNeg[1] = invDir.y() < 0.0f;
+        dirIsNeg[2] = invDir.z() < 0.0f;
+    }
+
+    vec3 origin;
+    vec3 invDir;
+    int dirIsNeg[3];
+};
+
+// Axis aligned bounding box
+// Represented by its min and max corners (pMin, pMax)
+// An 'empty' box is inverted (pMin = +inf, pMax = -inf) so that
+// growing it by any point or box simply yields that point or box
+//
+// Kept to 6 plain floats (24 bytes, trivially copyable) so that
+// arrays of boxes / BVH nodes pack tightly into cache lines
+class aabb
+{
+public:
+    aabb() : pMin(FLT_MAX), pMax(-FLT_MAX) {}
+    aabb(const vec3& a,
+         const vec3& b) : pMin(a),
+                          pMax(b) {}
+
+    inline bool isEmpty() const
+    {
+        return pMin.x() > pMax.x() || pMin.y() > pMax.y() || pMin.z() > pMax.z();
+    }
+
+    inline void grow(const vec3& p)
+    {
+        for (int a = 0; a < 3; a++) {
+            pMin[a] = std::min(pMin[a], p[a]);
+            pMax[a] = std::max(pMax[a], p[a]);
+        }
+    }
+
+    inline void grow(const aabb& b)
+    {
+        for (int a = 0; a < 3; a++) {
+            pMin[a] = std::min(pMin[a], b.pMin[a]);
+            pMax[a] = std::max(pMax[a], b.pMax[a]);
+        }
+    }
+
+    // shrink to the overlap with b (empty if they don't overlap)
+    inline void clip(const aabb& b)
+    {
+        for (int a = 0; a < 3; a++) {
+            pMin[a] = std::max(pMin[a], b.pMin[a]);
+            pMax[a] = std::min(pMax[a], b.pMax[a]);
+        }
+    }
+
+    inline vec3 centroid() const { return 0.5f * (pMin + pMax); }
+    inline vec3 extent() const { return pMax - pMin; }
+
+    // surface area is what the SAH uses as the probability of a
+    // random ray hitting the box (relative to its parent)
+    inline float surfaceArea() const
+    {
+        if (isEmpty()) {
+            return 0.0f;
+        }
+        const vec3 d = extent();
+        return 2.0f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
+    // axis along which the box is the longest
+    inline int maxExtentAxis() const
+    {
+        const vec3 d = extent();
+        if (d.x() > d.y() && d.x() > d.z()) {
+            return 0;
+        }
+        return (d.y() > d.z()) ? 1 : 2;
+    }
+
+    // min corner for i == 0, max corner for i == 1
+    inline const vec3& operator[](int i) const { return i ? pMax : pMin; }
+
+    // Slab test
+    // The box is the intersection of 3 slabs (pair of parallel planes)
+    // Ray enters slab at t0 = (pMin - O) / D and exits at t1 = (pMax - O) / D
+    // (swapped when D is -'ve). The ray hits the box if the overlap of all
+    // [t0, t1] intervals with [t_min, t_max] is not empty.
+    //
+    // Branch free: the sign of D picks which corner gives the near / far
+    // plane (instead of swapping), and the intervals are combined with
+    // min / max selects rather than early outs.
+    inline bool hit(const rayInv& r,
+                    float t_min,
+                    float t_max) const
+    {
+        const float txNear = ((*this)[r.dirIsNeg[0]].x() - r.origin.x()) * r.invDir.x();
+        const float txFar = ((*this)[1 - r.dirIsNeg[0]].x() - r.origin.x()) * r.invDir.x();
+        const float tyNear = ((*this)[r.dirIsNeg[1]].y() - r.origin.y()) * r.invDir.y();
+        const float tyFar = ((*this)[1 - r.dirIsNeg[1]].y() - r.origin.y()) * r.invDir.y();
+        const float tzNear = ((*this)[r.dirIsNeg[2]].z() - r.origin.z()) * r.invDir.z();
+        const float tzFar = ((*this)[1 - r.dirIsNeg[2]].z() - r.origin.z()) * r.invDir.z();
+
+        float tNear = txNear > t_min ? txNear : t_min;
+        tNear = tyNear > tNear ? tyNear : tNear;
+        tNear = tzNear > tNear ? tzNear : tNear;
+        float tFar = txFar < t_max ? txFar : t_max;
+        tFar = tyFar < tFar ? tyFar : tFar;
+        tFar = tzFar < tFar ? tzFar : tFar;
+        return tNear <= tFar;
+    }
+
+    vec3 pMin;
+    vec3 pMax;
+};
+
+static_assert(sizeof(aabb) == 6 * sizeof(float), "aabb must stay 6 packed floats");
+
+inline aabb surroundingBox(const aabb& a, const aabb& b)
+{
+    aabb box = a;
+    box.grow(b);
+    return box;
+}
+
+// the parts of box on either side of the plane p[axis] = pos
+inline void splitBox(const aabb& box, int axis, float pos, aabb& left, aabb& right)
+{
+    left = box;
+    right = box;
+    left.pMax[axis] = std::min(box.pMax[axis], pos);
+    right.pMin[axis] = std::max(box.pMin[axis], pos);
+}
+
+#endif /* aabb_h */
@@ -0,0 +1,457 @@
+//
+//  accelcache.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 9/29/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef accelcache_h
+#define accelcache_h
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "hitable_list.hpp"
+#include "mesh.hpp"
+#include "meshloader.hpp"
+
+// On disk cache of built acceleration structures (and mesh buffers)
+//
+// Building the BVH of a big mesh (or scene) takes far longer than a short
+// render, so the result is saved and later runs load it instead: a mesh
+// cache holds the mesh's vertex / face buffers and its BVH (no OBJ / PLY
+// parsing, no build), a scene cache holds the scene's binary BVH over its
+// objects (the objects themselves are still made by the program).
+//
+// Files are keyed by a 64 bit content hash of what they were built from
+// (hashFile() of the mesh file, sceneContentHash() of the scene objects),
+// which also names them (accelCachePath()). A file whose magic, version,
+// kind or key don't match, or whose sections don't fit the file, is
+// rejected and the caller builds as usual.
+//
+// Layout: header, section table, then sections, each aligned to
+// kSectionAlignment. Everything is addressed by offset from the start of
+// the file (nothing position dependent), so a memory mapping of the file is
+// used as is: sections are copied straight out of it into the (owning)
+// vectors of the mesh / tree. Data is stored in the byte order of the
+// machine that wrote it, a different one fails the version check.
+enum {
+    kAccelCacheVersion = 1,
+    kSectionAlignment = 64,
+};
+
+enum accelCacheKind
+{
+    kMeshCache = 1,
+    kSceneCache = 2,
+};
+
+enum accelCacheSectionId
+{
+    kSectionPositionX,
+    kSectionPositionY,
+    kSectionPositionZ,
+    kSectionNormalX,
+    kSectionNormalY,
+    kSectionNormalZ,
+    kSectionTexU,
+    kSectionTexV,
+    kSectionIndices,
+    kSectionBounds,
+    kSectionBVHNodes,
+    kSectionBVHPrimIndices,
+};
+
+struct accelCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint64_t key;
+    uint32_t nSections;
+    uint32_t pad;
+};
+
+struct accelCacheSection
+{
+    uint32_t id;
+    // bytes per element, checked against the type read back
+    uint32_t elemSize;
+    uint64_t count;
+    // from the start of the file
+    uint64_t offset;
+};
+
+static const char kAccelCacheMagic[8] = { 'R', 'T', 'A', 'C', 'C', 'E', 'L', 0 };
+
+// 64 bit content hash: FNV-1a over 8 byte words, finished with the
+// MurmurHash3 avalanche so that every input bit affects every output bit.
+// Not cryptographic, only meant to tell different inputs apart.
+class contentHash
+{
+public:
+    void add(const void *data, size_t size)
+    {
+        const char *p = (const char *)data;
+        for (; size >= 8; p += 8, size -= 8) {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            mix(word);
+        }
+        uint64_t tail = size;
+        memcpy(&tail, p, size);
+        mix(tail ^ ((uint64_t)size << 56));
+    }
+
+    template <typename T>
+    void add(const std::vector<T>& v)
+    {
+        const uint64_t count = v.size();
+        add(&count, sizeof(count));
+        add(v.data(), sizeof(T) * v.size());
+    }
+
+    uint64_t value() const
+    {
+        uint64_t h = state;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+private:
+    inline void mix(uint64_t word)
+    {
+        state = (state ^ word) * 0x100000001b3ull;
+    }
+
+    uint64_t state = 0xcbf29ce484222325ull;
+};
+
+// hash of the contents of the file at path (false if it can't be read)
+inline bool hashFile(const char *path, uint64_t& key)
+{
+    mappedFile file;
+    if (!file.map(path)) {
+        return false;
+    }
+    contentHash hash;
+    hash.add(file.data(), file.size());
+    key = hash.value();
+    return true;
+}
+
+// Hash of what a scene BVH is built from: the bounds of all objects, in
+// order (unbounded ones included, as a marker), and the builder used.
+// Objects that keep their bounds but change in other ways (materials,
+// a triangle flipped inside its box) still hit the same cache, as they
+// need the same tree.
+inline uint64_t sceneContentHash(const scene& world, bvhBuilder builder = kSAHBuilder)
+{
+    contentHash hash;
+    const uint32_t kind = kSceneCache;
+    hash.add(&kind, sizeof(kind));
+    hash.add(&builder, sizeof(builder));
+    for (const object* obj : world.objects) {
+        aabb box;
+        const uint32_t bounded = obj->boundingBox(box) ? 1 : 0;
+        hash.add(&bounded, sizeof(bounded));
+        if (bounded) {
+            hash.add(&box, sizeof(box));
+        }
+    }
+    return hash.value();
+}
+
+// <dir>/<key in hex>.rtaccel
+inline std::string accelCachePath(const char *dir, uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.rtaccel", (unsigned long long)key);
+    return std::string(dir) + "/" + name;
+}
+
+// Collects sections, then writes them out in one go
+// (to a temporary file renamed over path, so readers never see half of one)
+class accelCacheWriter
+{
+public:
+    template <typename T>
+    void addSection(accelCacheSectionId id, const std::vector<T>& v)
+    {
+        sections.push_back({ (uint32_t)id, (uint32_t)sizeof(T), (uint64_t)v.size(), 0 });
+        data.push_back(v.data());
+    }
+
+    template <typename T>
+    void addSection(accelCacheSectionId id, const T *v, size_t count)
+    {
+        sections.push_back({ (uint32_t)id, (uint32_t)sizeof(T), (uint64_t)count, 0 });
+        data.push_back(v);
+    }
+
+    bool write(const char *path, accelCacheKind kind, uint64_t key)
+    {
+        accelCacheHeader header;
+        memcpy(header.magic, kAccelCacheMagic, sizeof(header.magic));
+        header.version = kAccelCacheVersion;
+        header.kind = kind;
+        header.key = key;
+        header.nSections = (uint32_t)sections.size();
+        header.pad = 0;
+
+        uint64_t offset = alignUp(sizeof(header) + sizeof(accelCacheSection) * sections.size());
+        for (accelCacheSection& s : sections) {
+            s.offset = offset;
+            offset = alignUp(offset + s.elemSize * s.count);
+        }
+
+        const std::string tmpPath = std::string(path) + ".tmp";
+        FILE *f = fopen(tmpPath.c_str(), "wb");
+        if (!f) {
+            fprintf(stderr, "\nCan't write %s", tmpPath.c_str());
+            return false;
+        }
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                  fwrite(sections.data(), sizeof(accelCacheSection), sections.size(), f) == sections.size();
+        uint64_t pos = sizeof(header) + sizeof(accelCacheSection) * sections.size();
+        static const char zeros[kSectionAlignment] = {};
+        for (size_t i = 0; ok && i < sections.size(); i++) {
+            const accelCacheSection& s = sections[i];
+            ok = fwrite(zeros, 1, s.offset - pos, f) == s.offset - pos &&
+                 fwrite(data[i], s.elemSize, s.count, f) == s.count;
+            pos = s.offset + s.elemSize * s.count;
+        }
+        ok = fclose(f) == 0 && ok;
+        if (!ok || rename(tmpPath.c_str(), path) != 0) {
+            fprintf(stderr, "\nFailed writing %s", path);
+            remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static inline uint64_t alignUp(uint64_t offset)
+    {
+        return (offset + kSectionAlignment - 1) & ~(uint64_t)(kSectionAlignment - 1);
+    }
+
+    std::vector<accelCacheSection> sections;
+    std::vector<const void *> data;
+};
+
+// Maps a cache file and checks it before anything is read from it
+class accelCacheReader
+{
+public:
+    bool open(const char *path, accelCacheKind kind, uint64_t key)
+    {
+        if (!file.map(path)) {
+            return false;
+        }
+        if (file.size() < sizeof(accelCacheHeader)) {
+            return false;
+        }
+        accelCacheHeader header;
+        memcpy(&header, file.data(), sizeof(header));
+        if (memcmp(header.magic, kAccelCacheMagic, sizeof(header.magic)) != 0 ||
+            header.version != kAccelCacheVersion || header.kind != (uint32_t)kind || header.key != key ||
+            file.size() < sizeof(header) + sizeof(accelCacheSection) * (uint64_t)header.nSections) {
+            return false;
+        }
+        sections.resize(header.nSections);
+        memcpy(sections.data(), file.data() + sizeof(header), sizeof(accelCacheSection) * sections.size());
+        for (const accelCacheSection& s : sections) {
+            if (s.offset > file.size() || s.elemSize == 0 ||
+                s.count > (file.size() - s.offset) / s.elemSize) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // copy section id into v, false if missing or of another element type
+    template <typename T>
+    bool read(accelCacheSectionId id, std::vector<T>& v) const
+    {
+        for (const accelCacheSection& s : sections) {
+            if (s.id == (uint32_t)id) {
+                if (s.elemSize != sizeof(T)) {
+                    return false;
+                }
+                v.resize(s.count);
+                memcpy(v.data(), file.data() + s.offset, sizeof(T) * s.count);
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    mappedFile file;
+    std::vector<accelCacheSection> sections;
+};
+
+// true if every node / primitive reference of tree is in range and the
+// nodes form a tree traverse() can walk: the first child of an interior
+// node follows it and the second comes after that (so no node points at
+// itself or back up the tree), every node is reached once, and no path is
+// deeper than the traversal stack
+// (a file can match its key and still have been cut short or damaged)
+inline bool isValidTree(const bvhTree& tree, uint32_t nPrims)
+{
+    const size_t nNodes = tree.nodes.size();
+    if (nNodes == 0) {
+        return false;
+    }
+    for (uint32_t i = 0; i < nNodes; i++) {
+        const bvhNode& node = tree.nodes[i];
+        if (node.isLeaf() ? (uint64_t)node.offset + node.nPrims > tree.primIndices.size()
+                          : i + 1 >= nNodes || node.offset <= i + 1 || node.offset >= nNodes || node.axis > 2) {
+            return false;
+        }
+    }
+    for (uint32_t idx : tree.primIndices) {
+        if (idx >= nPrims) {
+            return false;
+        }
+    }
+
+    // walk it once: children only point forward, so this ends, but shared
+    // subtrees would be reached more than once
+    struct stackEntry
+    {
+        uint32_t node;
+        uint32_t depth;
+    };
+    std::vector<stackEntry> stack(1, stackEntry{ 0, 1 });
+    size_t nVisited = 0;
+    while (!stack.empty()) {
+        const stackEntry entry = stack.back();
+        stack.pop_back();
+        if (++nVisited > nNodes || entry.depth > bvhTree::kStackSize) {
+            return false;
+        }
+        const bvhNode& node = tree.nodes[entry.node];
+        if (!node.isLeaf()) {
+            stack.push_back(stackEntry{ node.offset, entry.depth + 1 });
+            stack.push_back(stackEntry{ entry.node + 1, entry.depth + 1 });
+        }
+    }
+    return true;
+}
+
+// mesh buffers and BVH (build it first); materials are left to the caller
+inline bool saveMeshCache(const char *path, const triangleMesh& mesh, uint64_t key)
+{
+    accelCacheWriter writer;
+    writer.addSection(kSectionPositionX, mesh.px);
+    writer.addSection(kSectionPositionY, mesh.py);
+    writer.addSection(kSectionPositionZ, mesh.pz);
+    writer.addSection(kSectionNormalX, mesh.nx);
+    writer.addSection(kSectionNormalY, mesh.ny);
+    writer.addSection(kSectionNormalZ, mesh.nz);
+    writer.addSection(kSectionTexU, mesh.tu);
+    writer.addSection(kSectionTexV, mesh.tv);
+    writer.addSection(kSectionIndices, mesh.indices);
+    writer.addSection(kSectionBounds, &mesh.bounds, 1);
+    writer.addSection(kSectionBVHNodes, mesh.accel.nodes);
+    writer.addSection(kSectionBVHPrimIndices, mesh.accel.primIndices);
+    return writer.write(path, kMeshCache, key);
+}
+
+// fill mesh (buffers and BVH) from a cache saved for key
+// the mesh's materials are kept as they are
+inline bool loadMeshCache(const char *path, triangleMesh& mesh, uint64_t key)
+{
+    accelCacheReader reader;
+    if (!reader.open(path, kMeshCache, key)) {
+        return false;
+    }
+    std::vector<aabb> bounds;
+    bool ok = reader.read(kSectionPositionX, mesh.px) &&
+              reader.read(kSectionPositionY, mesh.py) &&
+              reader.read(kSectionPositionZ, mesh.pz) &&
+              reader.read(kSectionNormalX, mesh.nx) &&
+              reader.read(kSectionNormalY, mesh.ny) &&
+              reader.read(kSectionNormalZ, mesh.nz) &&
+              reader.read(kSectionTexU, mesh.tu) &&
+              reader.read(kSectionTexV, mesh.tv) &&
+              reader.read(kSectionIndices, mesh.indices) &&
+              reader.read(kSectionBounds, bounds) && bounds.size() == 1 &&
+              reader.read(kSectionBVHNodes, mesh.accel.nodes) &&
+              reader.read(kSectionBVHPrimIndices, mesh.accel.primIndices);
+    if (ok) {
+        // normals and uvs are optional, but all there or all missing
+        const uint32_t nVertices = mesh.numVertices();
+        const size_t nNormals = mesh.nx.empty() ? 0 : nVertices;
+        const size_t nUVs = mesh.tu.empty() ? 0 : nVertices;
+        ok = mesh.py.size() == nVertices && mesh.pz.size() == nVertices &&
+             mesh.nx.size() == nNormals && mesh.ny.size() == nNormals && mesh.nz.size() == nNormals &&
+             mesh.tu.size() == nUVs && mesh.tv.size() == nUVs &&
+             mesh.indices.size() % 3 == 0 && isValidTree(mesh.accel, mesh.numTriangles());
+        for (size_t i = 0; ok && i < mesh.indices.size(); i++) {
+            ok = mesh.indices[i] < nVertices;
+        }
+    }
+    if (!ok) {
+        mesh.px.clear(); mesh.py.clear(); mesh.pz.clear();
+        mesh.nx.clear(); mesh.ny.clear(); mesh.nz.clear();
+        mesh.tu.clear(); mesh.tv.clear();
+        mesh.indices.clear();
+        mesh.accel = bvhTree();
+        return false;
+    }
+    mesh.bounds = bounds[0];
+    return true;
+}
+
+// the scene's binary BVH (build it with buildBVH() at width 2, 4 or 8,
+// not compressed, which drops the binary tree)
+inline bool saveSceneCache(const char *path, const scene& world, uint64_t key)
+{
+    if (!world.accel.isBuilt()) {
+        return false;
+    }
+    accelCacheWriter writer;
+    writer.addSection(kSectionBVHNodes, world.accel.nodes);
+    writer.addSection(kSectionBVHPrimIndices, world.accel.primIndices);
+    return writer.write(path, kSceneCache, key);
+}
+
+// set up the scene's BVH from a cache saved for key, as buildBVH() would
+inline bool loadSceneCache(const char *path,
+                           scene& world,
+                           uint64_t key,
+                           uint32_t width = kDefaultBVHWidth,
+                           bool compressed = false)
+{
+    accelCacheReader reader;
+    if (!reader.open(path, kSceneCache, key)) {
+        return false;
+    }
+    bvhTree tree;
+    if (!reader.read(kSectionBVHNodes, tree.nodes) ||
+        !reader.read(kSectionBVHPrimIndices, tree.primIndices)) {
+        return false;
+    }
+    uint32_t nBounded = 0;
+    for (const object* obj : world.objects) {
+        aabb box;
+        nBounded += obj->boundingBox(box) ? 1 : 0;
+    }
+    if (!isValidTree(tree, nBounded)) {
+        return false;
+    }
+    world.useBVH(tree, width, compressed);
+    return true;
+}
+
+#endif /* accelcache_h */
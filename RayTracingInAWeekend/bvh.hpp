@@ -0,0 +1,400 @@
+//
+//  bvh.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 7/14/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef bvh_h
+#define bvh_h
+
+#include <vector>
+#include <cstdint>
+#include "aabb.hpp"
+#include "packet.hpp"
+
+// Bounding volume hierarchy node
+// Nodes are stored depth first in a flat array, so the first child of an
+// interior node is always the very next node and only the index of the
+// second child needs to be stored.
+// . leaf:     offset = index of first primitive in bvhTree::primIndices
+//             nPrims = number of primitives in the leaf
+// . interior: offset = index of second child
+//             nPrims = 0
+//             axis   = split axis, used to visit the nearer child first
+struct bvhNode
+{
+    aabb bounds;
+    uint32_t offset;
+    uint16_t nPrims;
+    uint8_t axis;
+    uint8_t pad;
+
+    inline bool isLeaf() const { return nPrims > 0; }
+};
+
+// two nodes per 64 byte cache line
+static_assert(sizeof(bvhNode) == 32, "bvhNode should stay 32 bytes");
+
+// Split axis of an interior node whose children have bounds first and
+// second: the axis their centroids are furthest apart on. Traversal takes
+// the first child to be on the low side of it, so swapChildren is set
+// when second lies below first.
+inline int childOrderAxis(const aabb& first, const aabb& second, bool& swapChildren)
+{
+    const vec3 gap = second.centroid() - first.centroid();
+    int axis = 0;
+    for (int a = 1; a < 3; a++) {
+        if (fabs(gap[a]) > fabs(gap[axis])) {
+            axis = a;
+        }
+    }
+    swapChildren = gap[axis] < 0.0f;
+    return axis;
+}
+
+// Binary BVH built with the surface area heuristic (SAH)
+//
+// The tree only knows about primitive bounds and indices, so it can sit
+// over anything that can be boxed (objects in a scene, triangles of a mesh).
+// Actual primitive intersection is left to the caller (see traverse())
+//
+// SAH cost of splitting node N into children L and R:
+// C = C_trav + (SA(L) / SA(N)) * |L| * C_isect + (SA(R) / SA(N)) * |R| * C_isect
+// where SA(X) / SA(N) is the probability that a ray hitting N also hits X.
+// Candidate split planes are evaluated at bin boundaries (binned SAH), along
+// all 3 axes, and a leaf is made whenever no split is cheaper than
+// intersecting all primitives in the node.
+class bvhTree
+{
+public:
+    enum {
+        kNumBins = 32,
+        kMaxPrimsInLeaf = 4,
+        // past this depth splits fall back to median, bounding tree
+        // depth (and so the traversal stack) regardless of SAH choices
+        kMaxSAHDepth = 64,
+        kStackSize = 128,
+    };
+
+    // relative cost of visiting a node vs intersecting a primitive
+    static constexpr float kTraversalCost = 1.0f;
+    static constexpr float kIntersectCost = 1.0f;
+
+    bvhTree() {}
+
+    // (re)build tree over primitives whose bounds are given
+    // primitive i is referred to by index i during traversal
+    void build(const std::vector<aabb>& primBounds)
+    {
+        nodes.clear();
+        primIndices.clear();
+        if (primBounds.empty()) {
+            return;
+        }
+
+        std::vector<buildPrim> prims(primBounds.size());
+        for (uint32_t i = 0; i < primBounds.size(); i++) {
+            prims[i].bounds = primBounds[i];
+            prims[i].centroid = primBounds[i].centroid();
+            prims[i].index = i;
+        }
+
+        nodes.reserve(2 * prims.size());
+        buildRecursive(prims, 0, (uint32_t)prims.size(), 0);
+
+        primIndices.resize(prims.size());
+        for (uint32_t i = 0; i < prims.size(); i++) {
+            primIndices[i] = prims[i].index;
+        }
+    }
+
+    inline bool isBuilt() const { return !nodes.empty(); }
+
+    // Walk tree front to back and call
+    //     bool intersect(uint32_t primIdx, const ray& r, float t_min, float& t_max)
+    // for every primitive in a leaf that the ray reaches. intersect must return
+    // true on a hit and shrink t_max to the hit distance, which in turn culls
+    // any node further away than the closest hit found so far.
+    // root: walk only the subtree under this node
+    // anyHit: stop at the first hit instead (occlusion queries, see
+    // object::occluded()), intersect need not shrink t_max then
+    template <bool anyHit = false, typename Intersector>
+    bool traverse(const ray& r,
+                  float t_min,
+                  float t_max,
+                  Intersector intersect,
+                  uint32_t root = 0) const
+    {
+        if (nodes.empty()) {
+            return false;
+        }
+
+        const rayInv rInv(r);
+
+        bool hitAnything = false;
+        uint32_t stack[kStackSize];
+        uint32_t stackPtr = 0;
+        uint32_t current = root;
+        while (true) {
+            const bvhNode& node = nodes[current];
+            if (node.bounds.hit(rInv, t_min, t_max)) {
+                if (node.isLeaf()) {
+                    for (uint32_t i = 0; i < node.nPrims; i++) {
+                        if (intersect(primIndices[node.offset + i], r, t_min, t_max)) {
+                            if (anyHit) {
+                                return true;
+                            }
+                            hitAnything = true;
+                        }
+                    }
+                    if (stackPtr == 0) {
+                        break;
+                    }
+                    current = stack[--stackPtr];
+                } else {
+                    // visit the child closer to the ray origin first
+                    // so that t_max shrinks as early as possible
+                    if (rInv.dirIsNeg[node.axis]) {
+                        stack[stackPtr++] = current + 1;
+                        current = node.offset;
+                    } else {
+                        stack[stackPtr++] = node.offset;
+                        current = current + 1;
+                    }
+                }
+            } else {
+                if (stackPtr == 0) {
+                    break;
+                }
+                current = stack[--stackPtr];
+            }
+        }
+
+        return hitAnything;
+    }
+
+    // Packet version of traverse(), for the rays of p set in active
+    // The rays walk the tree together: each node is tested against all the
+    // rays that reached its parent, and only those that hit its box go on
+    // to its children (near child first, by the first such ray's direction).
+    // intersect is called as
+    //     uint32_t intersect(uint32_t primIdx, rayPacket<N>& p, uint32_t lanes)
+    // for every primitive in a leaf the packet reaches, and must return the
+    // lanes that hit it, after shrinking their p.tMax to the hit distance.
+    //
+    // Once a node is reached by kMaxDivergedRays rays or fewer (the packet
+    // has diverged), they finish its subtree one at a time with traverse(),
+    // rather than dragging a mostly empty packet down it.
+    // Returns the lanes that hit anything.
+    template <int N, typename PacketIntersector>
+    uint32_t traversePacket(rayPacket<N>& p,
+                            uint32_t active,
+                            PacketIntersector intersect) const
+    {
+        if (nodes.empty() || active == 0) {
+            return 0;
+        }
+
+        struct stackEntry
+        {
+            uint32_t node;
+            uint32_t lanes;
+        };
+        stackEntry stack[kStackSize];
+        uint32_t stackPtr = 0;
+        stack[stackPtr++] = { 0, active };
+
+        uint32_t hitLanes = 0;
+        while (stackPtr > 0) {
+            const stackEntry entry = stack[--stackPtr];
+            const bvhNode& node = nodes[entry.node];
+            const uint32_t lanes = p.hitBox(node.bounds, entry.lanes);
+            if (lanes == 0) {
+                continue;
+            }
+
+            if (__builtin_popcount(lanes) <= rayPacket<N>::kMaxDivergedRays) {
+                for (uint32_t bits = lanes; bits; bits &= bits - 1) {
+                    const int lane = __builtin_ctz(bits);
+                    auto intersectOne = [&](uint32_t idx, const ray& r, float t_min, float& t_max) {
+                        if (intersect(idx, p, 1u << lane)) {
+                            t_max = p.tMax[lane];
+                            return true;
+                        }
+                        return false;
+                    };
+                    if (traverse(p.getRay(lane), p.tMin, p.tMax[lane], intersectOne, entry.node)) {
+                        hitLanes |= 1u << lane;
+                    }
+                }
+                continue;
+            }
+
+            if (node.isLeaf()) {
+                for (uint32_t i = 0; i < node.nPrims; i++) {
+                    hitLanes |= intersect(primIndices[node.offset + i], p, lanes);
+                }
+            } else {
+                // pushed far child first, so the near one is popped next
+                const bool dirIsNeg = p.dir[node.axis][__builtin_ctz(lanes)] < 0.0f;
+                stack[stackPtr++] = { dirIsNeg ? entry.node + 1 : node.offset, lanes };
+                stack[stackPtr++] = { dirIsNeg ? node.offset : entry.node + 1, lanes };
+            }
+        }
+
+        return hitLanes;
+    }
+
+    // SAH cost of the whole tree, normalized by root surface area
+    // useful to compare the quality of different builds
+    float sahCost() const
+    {
+        if (nodes.empty()) {
+            return 0.0f;
+        }
+        const float rootArea = nodes[0].bounds.surfaceArea();
+        float cost = 0.0f;
+        for (const bvhNode& node : nodes) {
+            const float p = rootArea > 0.0f ? node.bounds.surfaceArea() / rootArea : 1.0f;
+            cost += p * (node.isLeaf() ? node.nPrims * kIntersectCost : kTraversalCost);
+        }
+        return cost;
+    }
+
+    std::vector<bvhNode> nodes;
+    std::vector<uint32_t> primIndices;
+
+private:
+    struct buildPrim
+    {
+        aabb bounds;
+        vec3 centroid;
+        uint32_t index;
+    };
+
+    struct bin
+    {
+        aabb bounds;
+        uint32_t count = 0;
+    };
+
+    uint32_t makeLeaf(uint32_t nodeIdx, uint32_t start, uint32_t end)
+    {
+        nodes[nodeIdx].offset = start;
+        nodes[nodeIdx].nPrims = (uint16_t)(end - start);
+        nodes[nodeIdx].axis = 0;
+        return nodeIdx;
+    }
+
+    // builds subtree over prims [start, end), returns index of its root
+    uint32_t buildRecursive(std::vector<buildPrim>& prims,
+                            uint32_t start,
+                            uint32_t end,
+                            uint32_t depth)
+    {
+        const uint32_t nodeIdx = (uint32_t)nodes.size();
+        nodes.emplace_back();
+
+        aabb bounds, centroidBounds;
+        for (uint32_t i = start; i < end; i++) {
+            bounds.grow(prims[i].bounds);
+            centroidBounds.grow(prims[i].centroid);
+        }
+        nodes[nodeIdx].bounds = bounds;
+
+        const uint32_t nPrims = end - start;
+        if (nPrims == 1) {
+            return makeLeaf(nodeIdx, start, end);
+        }
+
+        // find cheapest split plane across all axes
+        const float leafCost = nPrims * kIntersectCost;
+        const float invArea = 1.0f / std::max(bounds.surfaceArea(), FLT_MIN);
+        float bestCost = FLT_MAX;
+        int bestAxis = -1;
+        int bestSplit = 0;
+        if (depth < kMaxSAHDepth) {
+            for (int axis = 0; axis < 3; axis++) {
+                const float cMin = centroidBounds.pMin[axis];
+                const float cMax = centroidBounds.pMax[axis];
+                if (cMax <= cMin) {
+                    continue;
+                }
+
+                bin bins[kNumBins];
+                const float scale = kNumBins / (cMax - cMin);
+                for (uint32_t i = start; i < end; i++) {
+                    int b = std::min((int)kNumBins - 1,
+                                     (int)((prims[i].centroid[axis] - cMin) * scale));
+                    bins[b].count++;
+                    bins[b].bounds.grow(prims[i].bounds);
+                }
+
+                // sweep from the right to gather area / count to the right
+                // of every split plane, then from the left to evaluate cost
+                float rightArea[kNumBins - 1];
+                uint32_t rightCount[kNumBins - 1];
+                aabb acc;
+                uint32_t count = 0;
+                for (int b = kNumBins - 1; b > 0; b--) {
+                    acc.grow(bins[b].bounds);
+                    count += bins[b].count;
+                    rightArea[b - 1] = acc.surfaceArea();
+                    rightCount[b - 1] = count;
+                }
+
+                acc = aabb();
+                count = 0;
+                for (int b = 0; b < kNumBins - 1; b++) {
+                    acc.grow(bins[b].bounds);
+                    count += bins[b].count;
+                    const float cost = kTraversalCost +
+                                       (count * acc.surfaceArea() +
+                                        rightCount[b] * rightArea[b]) * invArea * kIntersectCost;
+                    if (count > 0 && rightCount[b] > 0 && cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = b + 1;
+                    }
+                }
+            }
+        }
+
+        if (nPrims <= kMaxPrimsInLeaf && (bestAxis < 0 || leafCost <= bestCost)) {
+            return makeLeaf(nodeIdx, start, end);
+        }
+
+        uint32_t mid;
+        int axis = bestAxis;
+        if (bestAxis >= 0) {
+            const float cMin = centroidBounds.pMin[axis];
+            const float scale = kNumBins / (centroidBounds.pMax[axis] - cMin);
+            buildPrim *midPtr = std::partition(&prims[start], &prims[end - 1] + 1,
+                [=](const buildPrim& p) {
+                    int b = std::min((int)kNumBins - 1, (int)((p.centroid[axis] - cMin) * scale));
+                    return b < bestSplit;
+                });
+            mid = (uint32_t)(midPtr - &prims[0]);
+        } else {
+            // too deep, or all centroids coincide:
+            // split in the middle of the longest axis by count
+            axis = centroidBounds.maxExtentAxis();
+            mid = start + nPrims / 2;
+            std::nth_element(&prims[start], &prims[mid], &prims[end - 1] + 1,
+                [=](const buildPrim& a, const buildPrim& b) {
+                    return a.centroid[axis] < b.centroid[axis];
+                });
+        }
+
+        buildRecursive(prims, start, mid, depth + 1);
+        const uint32_t secondChild = buildRecursive(prims, mid, end, depth + 1);
+        nodes[nodeIdx].offset = secondChild;
+        nodes[nodeIdx].nPrims = 0;
+        nodes[nodeIdx].axis = (uint8_t)axis;
+        return nodeIdx;
+    }
+};
+
+#endif /* bvh_h */
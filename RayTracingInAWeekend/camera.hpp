@@ -90,10 +90,12 @@ public:
     // return ray object given a u,v scan coord across the projection plane
     // u,v are normalized to [0, 1] and must be scaled by plane dimensions
     // for offset from origin
+    // smp provides the random lens offset (a 2D sample on the lens disk)
     ray getRayAt(float u,
-                 float v)
+                 float v,
+                 sampler& smp)
     {
-        vec3 radVec = lensRadius * unitSphereRandomRadVec();
+        vec3 radVec = lensRadius * unitDiskRandomVec(smp);
         vec3 offset = right * radVec.x() + up * radVec.y();
         return ray(origin + offset,
                    lowerLeft + u * horizontal + v * vertical - origin - offset);
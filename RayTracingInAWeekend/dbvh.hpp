@@ -0,0 +1,460 @@
+//
+//  dbvh.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 9/15/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef dbvh_h
+#define dbvh_h
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "bvh.hpp"
+
+// Dynamic BVH node
+// Nodes are linked by index (parent and both children), so that subtrees
+// can be moved around in place as primitives come and go.
+// Leaves hold exactly one primitive, found in O(1) from its index.
+struct dynamicBvhNode
+{
+    aabb bounds;
+    uint32_t parent;
+    // interior nodes only, child[0] is on the low side of axis
+    uint32_t child[2];
+    // primitive of a leaf, kNullNode for interior nodes
+    uint32_t prim;
+    // longest path down to a leaf (0 for leaves)
+    uint16_t height;
+    uint8_t axis;
+    uint8_t pad;
+
+    inline bool isLeaf() const { return prim != UINT32_MAX; }
+};
+
+// BVH that is kept up to date as primitives move, appear and disappear,
+// instead of being rebuilt (for interactive edits of a live scene)
+//
+// . build():  full binned SAH build (bvhTree), the best quality there is
+// . update(): a primitive moved, its leaf is marked dirty and refit()
+//             then recomputes bounds bottom-up from the dirty leaves only
+//             (stopping where bounds no longer change)
+// . insert(): new leaf goes next to the sibling that grows the total
+//             tree area the least (branch and bound search, Bittner et
+//             al. 2012 / Box2D), then ancestors are refit and rebalanced
+//             with AVL style rotations so tree depth stays logarithmic
+// . remove(): the leaf's sibling takes its parent's place
+//
+// Refits and insertions slowly degrade the tree (boxes of moved objects
+// stretch over more and more empty space), costRatio() compares the current
+// SAH cost to that of the last full build so callers know when to rebuild.
+class dynamicBvhTree
+{
+public:
+    enum {
+        kNullNode = UINT32_MAX,
+        kStackSize = bvhTree::kStackSize,
+    };
+
+    dynamicBvhTree() {}
+
+    // (re)build tree over primitives whose bounds are given
+    // primitive i is referred to by index i during traversal
+    void build(const std::vector<aabb>& primBounds)
+    {
+        nodes.clear();
+        primLeaf.assign(primBounds.size(), kNullNode);
+        dirtyLeaves.clear();
+        freeList = kNullNode;
+        root = kNullNode;
+        nPrims = 0;
+        weightedArea = 0.0;
+        builtCost = 0.0f;
+        if (primBounds.empty()) {
+            return;
+        }
+
+        bvhTree sah;
+        sah.build(primBounds);
+        nodes.reserve(2 * primBounds.size());
+        root = convert(sah, 0, primBounds);
+        nodes[root].parent = kNullNode;
+        nPrims = (uint32_t)primBounds.size();
+        builtCost = sahCost();
+    }
+
+    inline bool isBuilt() const { return root != kNullNode; }
+
+    // add primitive prim (any index not in the tree yet) with bounds
+    void insert(uint32_t prim, const aabb& bounds)
+    {
+        if (prim >= primLeaf.size()) {
+            primLeaf.resize(prim + 1, kNullNode);
+        }
+        const uint32_t leaf = allocNode();
+        nodes[leaf].prim = prim;
+        setBounds(leaf, bounds);
+        nodes[leaf].height = 0;
+        nodes[leaf].axis = 0;
+        primLeaf[prim] = leaf;
+        nPrims++;
+
+        if (root == kNullNode) {
+            root = leaf;
+            nodes[leaf].parent = kNullNode;
+            return;
+        }
+
+        const uint32_t sibling = findBestSibling(bounds);
+        const uint32_t oldParent = nodes[sibling].parent;
+        const uint32_t parent = allocNode();
+        nodes[parent].parent = oldParent;
+        nodes[parent].child[0] = sibling;
+        nodes[parent].child[1] = leaf;
+        nodes[parent].prim = kNullNode;
+        nodes[sibling].parent = parent;
+        nodes[leaf].parent = parent;
+        replaceChild(oldParent, sibling, parent);
+        fixNode(parent);
+
+        rebalanceFrom(oldParent);
+    }
+
+    // take primitive prim out of the tree
+    void remove(uint32_t prim)
+    {
+        const uint32_t leaf = primLeaf[prim];
+        primLeaf[prim] = kNullNode;
+        nPrims--;
+
+        if (leaf == root) {
+            freeNode(leaf);
+            root = kNullNode;
+            return;
+        }
+
+        const uint32_t parent = nodes[leaf].parent;
+        const uint32_t sibling = nodes[parent].child[nodes[parent].child[0] == leaf ? 1 : 0];
+        const uint32_t grandParent = nodes[parent].parent;
+        nodes[sibling].parent = grandParent;
+        replaceChild(grandParent, parent, sibling);
+        freeNode(leaf);
+        freeNode(parent);
+
+        rebalanceFrom(grandParent);
+    }
+
+    // primitive prim moved (or changed shape), bounds are its new bounds
+    // the tree is only valid again after refit()
+    void update(uint32_t prim, const aabb& bounds)
+    {
+        const uint32_t leaf = primLeaf[prim];
+        setBounds(leaf, bounds);
+        dirtyLeaves.push_back(leaf);
+    }
+
+    // recompute bounds above leaves update()d since the last refit
+    void refit()
+    {
+        for (uint32_t leaf : dirtyLeaves) {
+            // leaf may have been removed (and its node reused) since
+            if (nodes[leaf].isLeaf() && primLeaf[nodes[leaf].prim] == leaf) {
+                for (uint32_t idx = nodes[leaf].parent; idx != kNullNode; idx = nodes[idx].parent) {
+                    const aabb old = nodes[idx].bounds;
+                    fixNode(idx);
+                    if (sameBox(old, nodes[idx].bounds)) {
+                        break;
+                    }
+                }
+            }
+        }
+        dirtyLeaves.clear();
+    }
+
+    inline bool needsRefit() const { return !dirtyLeaves.empty(); }
+
+    // Walk tree front to back and call
+    //     bool intersect(uint32_t primIdx, const ray& r, float t_min, float& t_max)
+    // for every primitive whose leaf the ray reaches, as bvhTree::traverse()
+    // (anyHit: stop at the first hit)
+    template <bool anyHit = false, typename Intersector>
+    bool traverse(const ray& r,
+                  float t_min,
+                  float t_max,
+                  Intersector intersect) const
+    {
+        if (root == kNullNode) {
+            return false;
+        }
+
+        const rayInv rInv(r);
+
+        bool hitAnything = false;
+        uint32_t stack[kStackSize];
+        uint32_t stackPtr = 0;
+        uint32_t current = root;
+        while (true) {
+            const dynamicBvhNode& node = nodes[current];
+            if (node.bounds.hit(rInv, t_min, t_max)) {
+                if (node.isLeaf()) {
+                    if (intersect(node.prim, r, t_min, t_max)) {
+                        if (anyHit) {
+                            return true;
+                        }
+                        hitAnything = true;
+                    }
+                    if (stackPtr == 0) {
+                        break;
+                    }
+                    current = stack[--stackPtr];
+                } else {
+                    // closer child first
+                    const int first = rInv.dirIsNeg[node.axis];
+                    stack[stackPtr++] = node.child[1 - first];
+                    current = node.child[first];
+                }
+            } else {
+                if (stackPtr == 0) {
+                    break;
+                }
+                current = stack[--stackPtr];
+            }
+        }
+
+        return hitAnything;
+    }
+
+    // SAH cost of the whole tree, normalized by root surface area
+    // (same measure as bvhTree::sahCost(), with one primitive per leaf)
+    // O(1), the sum over nodes is kept up to date as the tree changes
+    float sahCost() const
+    {
+        if (root == kNullNode) {
+            return 0.0f;
+        }
+        const float rootArea = nodes[root].bounds.surfaceArea();
+        return rootArea > 0.0f ? (float)(weightedArea / rootArea) : 0.0f;
+    }
+
+    // current SAH cost relative to the cost right after the last build()
+    // 1 for a fresh tree, grows as refits / insertions degrade it
+    float costRatio() const
+    {
+        return builtCost > 0.0f ? sahCost() / builtCost : 1.0f;
+    }
+
+    inline uint32_t numPrims() const { return nPrims; }
+
+    // longest path from the root down to a leaf (in nodes)
+    inline uint32_t depth() const { return root == kNullNode ? 0 : nodes[root].height + 1u; }
+
+    // bytes used by nodes and the primitive -> leaf map
+    size_t memoryUsage() const
+    {
+        return sizeof(dynamicBvhNode) * nodes.capacity() + sizeof(uint32_t) * primLeaf.capacity();
+    }
+
+    std::vector<dynamicBvhNode> nodes;
+    uint32_t root = kNullNode;
+
+private:
+    static inline bool sameBox(const aabb& a, const aabb& b)
+    {
+        return a.pMin.x() == b.pMin.x() && a.pMin.y() == b.pMin.y() && a.pMin.z() == b.pMin.z() &&
+               a.pMax.x() == b.pMax.x() && a.pMax.y() == b.pMax.y() && a.pMax.z() == b.pMax.z();
+    }
+
+    uint32_t allocNode()
+    {
+        if (freeList != kNullNode) {
+            const uint32_t idx = freeList;
+            freeList = nodes[idx].parent;
+            return idx;
+        }
+        nodes.emplace_back();
+        return (uint32_t)nodes.size() - 1;
+    }
+
+    static inline float nodeCost(const dynamicBvhNode& node)
+    {
+        return node.isLeaf() ? bvhTree::kIntersectCost : bvhTree::kTraversalCost;
+    }
+
+    // every change of bounds goes through here, to keep weightedArea
+    void setBounds(uint32_t idx, const aabb& bounds)
+    {
+        dynamicBvhNode& node = nodes[idx];
+        weightedArea += (double)nodeCost(node) * (bounds.surfaceArea() - node.bounds.surfaceArea());
+        node.bounds = bounds;
+    }
+
+    // free nodes are chained through parent (and flagged as interior
+    // nodes so that stale dirty leaves are recognized)
+    void freeNode(uint32_t idx)
+    {
+        setBounds(idx, aabb());
+        nodes[idx].prim = kNullNode;
+        nodes[idx].parent = freeList;
+        freeList = idx;
+    }
+
+    // parent's link to oldChild now points to newChild (or root does)
+    void replaceChild(uint32_t parent, uint32_t oldChild, uint32_t newChild)
+    {
+        if (parent == kNullNode) {
+            root = newChild;
+        } else {
+            nodes[parent].child[nodes[parent].child[0] == oldChild ? 0 : 1] = newChild;
+        }
+    }
+
+    // bounds, height and child order (see childOrderAxis()) of interior
+    // node idx from its children
+    void fixNode(uint32_t idx)
+    {
+        dynamicBvhNode& node = nodes[idx];
+        const dynamicBvhNode& a = nodes[node.child[0]];
+        const dynamicBvhNode& b = nodes[node.child[1]];
+        setBounds(idx, surroundingBox(a.bounds, b.bounds));
+        node.height = 1 + std::max(a.height, b.height);
+        bool swapChildren;
+        node.axis = (uint8_t)childOrderAxis(a.bounds, b.bounds, swapChildren);
+        if (swapChildren) {
+            std::swap(node.child[0], node.child[1]);
+        }
+    }
+
+    // Sibling for a new leaf with bounds, minimizing the total area the tree
+    // grows by: the new parent's area, plus the area every ancestor grows by
+    // (inherited cost). A subtree is skipped once even the best case (new
+    // leaf's own area plus what's inherited) can't beat the best so far.
+    uint32_t findBestSibling(const aabb& bounds) const
+    {
+        const float leafArea = bounds.surfaceArea();
+        uint32_t best = root;
+        float bestCost = surroundingBox(nodes[root].bounds, bounds).surfaceArea();
+
+        struct candidate
+        {
+            uint32_t node;
+            float inheritedCost;
+        };
+        std::vector<candidate> stack(1, candidate{ root, 0.0f });
+        while (!stack.empty()) {
+            const candidate c = stack.back();
+            stack.pop_back();
+            const dynamicBvhNode& node = nodes[c.node];
+            const float directCost = surroundingBox(node.bounds, bounds).surfaceArea();
+            const float cost = directCost + c.inheritedCost;
+            if (cost < bestCost) {
+                best = c.node;
+                bestCost = cost;
+            }
+            const float inheritedCost = c.inheritedCost + directCost - node.bounds.surfaceArea();
+            if (!node.isLeaf() && leafArea + inheritedCost < bestCost) {
+                stack.push_back(candidate{ node.child[0], inheritedCost });
+                stack.push_back(candidate{ node.child[1], inheritedCost });
+            }
+        }
+        return best;
+    }
+
+    // If one child of a is more than one level taller than the other,
+    // rotate the taller child up into a's place (a takes the shorter of
+    // its grandchildren). Returns the node now where a was.
+    uint32_t rotate(uint32_t a)
+    {
+        dynamicBvhNode& nodeA = nodes[a];
+        if (nodeA.isLeaf() || nodeA.height < 2) {
+            return a;
+        }
+        const int tall = nodes[nodeA.child[1]].height > nodes[nodeA.child[0]].height ? 1 : 0;
+        const uint32_t up = nodeA.child[tall];
+        const uint32_t low = nodeA.child[1 - tall];
+        if (nodes[up].height <= nodes[low].height + 1) {
+            return a;
+        }
+
+        dynamicBvhNode& nodeUp = nodes[up];
+        const int keepSlot = nodes[nodeUp.child[1]].height > nodes[nodeUp.child[0]].height ? 1 : 0;
+        const uint32_t keep = nodeUp.child[keepSlot];
+        const uint32_t give = nodeUp.child[1 - keepSlot];
+
+        const uint32_t parent = nodeA.parent;
+        replaceChild(parent, a, up);
+        nodeUp.parent = parent;
+        nodeUp.child[0] = a;
+        nodeUp.child[1] = keep;
+        nodeA.parent = up;
+        nodeA.child[0] = low;
+        nodeA.child[1] = give;
+        nodes[give].parent = a;
+        fixNode(a);
+        fixNode(up);
+        return up;
+    }
+
+    // refit and rebalance from idx up to the root
+    void rebalanceFrom(uint32_t idx)
+    {
+        while (idx != kNullNode) {
+            fixNode(idx);
+            idx = rotate(idx);
+            idx = nodes[idx].parent;
+        }
+    }
+
+    // subtree of binary node idx, leaves split one primitive each
+    uint32_t convert(const bvhTree& sah, uint32_t idx, const std::vector<aabb>& primBounds)
+    {
+        const bvhNode& node = sah.nodes[idx];
+        if (node.isLeaf()) {
+            return convertLeaf(&sah.primIndices[node.offset], node.nPrims, primBounds);
+        }
+        const uint32_t a = convert(sah, idx + 1, primBounds);
+        const uint32_t b = convert(sah, node.offset, primBounds);
+        return makeInterior(a, b);
+    }
+
+    uint32_t convertLeaf(const uint32_t *prims, uint32_t n, const std::vector<aabb>& primBounds)
+    {
+        if (n == 1) {
+            const uint32_t leaf = allocNode();
+            nodes[leaf].prim = prims[0];
+            setBounds(leaf, primBounds[prims[0]]);
+            nodes[leaf].height = 0;
+            nodes[leaf].axis = 0;
+            primLeaf[prims[0]] = leaf;
+            return leaf;
+        }
+        const uint32_t a = convertLeaf(prims, n / 2, primBounds);
+        const uint32_t b = convertLeaf(prims + n / 2, n - n / 2, primBounds);
+        return makeInterior(a, b);
+    }
+
+    uint32_t makeInterior(uint32_t a, uint32_t b)
+    {
+        const uint32_t idx = allocNode();
+        nodes[idx].child[0] = a;
+        nodes[idx].child[1] = b;
+        nodes[idx].prim = kNullNode;
+        nodes[a].parent = idx;
+        nodes[b].parent = idx;
+        fixNode(idx);
+        return idx;
+    }
+
+    // leaf of every primitive (kNullNode if not in the tree)
+    std::vector<uint32_t> primLeaf;
+    std::vector<uint32_t> dirtyLeaves;
+    uint32_t freeList = kNullNode;
+    uint32_t nPrims = 0;
+    // sum of node areas x node costs, kept up to date as bounds change
+    // (sahCost() without walking the tree)
+    double weightedArea = 0.0;
+    float builtCost = 0.0f;
+};
+
+#endif /* dbvh_h */
@@ -0,0 +1,565 @@
+//
+//  flatscene.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 10/15/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef flatscene_h
+#define flatscene_h
+
+#include <vector>
+#include <unordered_map>
+#include "renderer.hpp"
+#include "sphere.hpp"
+#include "triangle.hpp"
+
+// Flat (devirtualized) copy of a scene
+//
+// scene holds objects, materials and textures as heap allocated classes
+// reached through pointers, and every hit(), scatter() and texelAt() is a
+// virtual call: nothing inlines across them, and following a path jumps
+// all over the heap. Here the same scene is laid out by value instead:
+// . primitives in one contiguous array per type (spheres, triangles), and
+//   the BVH's leaves refer to them by primitiveRef (type tag + index)
+// . materials in a table of tagged unions (flatMaterial), one per material
+//   of the scene, referred to by 16 bit materialId from the primitives
+// . textures likewise (flatTexture, textureId)
+// and every call on them is a switch on the type tag, with the per type
+// code (intersectSphere(), mollerTrumbore(), scatterLambertian() ...)
+// shared with the classes, so hits and scattered rays are the same as
+// the scene's.
+//
+// Only what the tags cover can be flattened: spheres and triangles (with
+// the default policies, see basicSphere / basicTriangle), the four built
+// in materials (materialType) and flatShade / checkerBoard
+// textures. See fromScene().
+
+typedef uint16_t materialId;
+typedef uint16_t textureId;
+
+// primitive type in the top 2 bits, index in its array below
+typedef uint32_t primitiveRef;
+
+enum flatPrimitiveType : uint32_t
+{
+    kFlatSphere,
+    kFlatTriangle,
+};
+
+constexpr uint32_t kPrimitiveTypeShift = 30;
+constexpr uint32_t kPrimitiveIndexMask = (1u << kPrimitiveTypeShift) - 1;
+
+inline primitiveRef makePrimitiveRef(flatPrimitiveType type, uint32_t index)
+{
+    return ((uint32_t)type << kPrimitiveTypeShift) | index;
+}
+
+struct flatSphere
+{
+    vec3 center;
+    float radius;
+    materialId mat;
+};
+
+// as intersected by mollerTrumbore(): first vertex and the edges from it
+struct flatTriangle
+{
+    vec3 v0;
+    vec3 e1;
+    vec3 e2;
+    vec3 norm;
+    materialId mat;
+};
+
+enum flatTextureType : uint8_t
+{
+    kFlatShadeTexture,
+    kCheckerBoardTexture,
+};
+
+// checkerBoard's two shades are always flat, so they're kept inline
+// (color0 is a flatShade's color)
+struct flatTexture
+{
+    flatTextureType type;
+    float color0[3];
+    float color1[3];
+};
+
+struct flatMaterial
+{
+    struct lambertianParams
+    {
+        float albedo[3];
+    };
+    struct textureParams
+    {
+        textureId albedo;
+    };
+    struct metalParams
+    {
+        float albedo[3];
+        float fuzziness;
+    };
+    struct dielectricParams
+    {
+        float refractiveIdx;
+    };
+
+    // kLambertian .. kDielectric (never kOtherMaterial)
+    materialType type;
+    union {
+        lambertianParams diffuse;
+        textureParams textured;
+        metalParams metallic;
+        dielectricParams glass;
+    };
+};
+
+// Closest hit found so far (first phase, see primitiveHit)
+struct flatHit
+{
+    float t;
+    float b1;
+    float b2;
+    primitiveRef prim;
+};
+
+class flatScene
+{
+public:
+    // Flatten world (its objects and what they reference), with a BVH of
+    // the given width (2, 4, 8) over the primitives in the same order as
+    // world.buildBVH() would have them.
+    // Returns false (and leaves this empty) if world has anything there's
+    // no flat type for: instances, meshes, scenes, other materials /
+    // textures (or more materials / textures than 16 bit ids cover).
+    bool fromScene(const scene& world, uint32_t width = kDefaultBVHWidth);
+
+    // first phase: closest hit in (t_min, t_max) into h
+    inline bool closestHit(const ray& r, float t_min, float t_max, flatHit& h) const;
+
+    // Closest hit with its hit record (rec.surfaceMat is left alone, the
+    // material is mat) computing uvs only for textured materials
+    inline bool hit(const ray& r, float t_min, float t_max, intersectParams& rec, materialId& mat) const;
+
+    // any hit in (t_min, t_max)
+    inline bool occluded(const ray& r, float t_min, float t_max) const;
+
+    // material::scatter() of materials[mat]
+    inline bool scatter(materialId mat,
+                        const ray& ray_in,
+                        const intersectParams& rec,
+                        vec3& attenuation,
+                        ray& scattered,
+                        sampler& smp) const;
+
+    // texture::texelAt() of textures[tex]
+    inline vec3 texelAt(textureId tex, float u, float v, const vec3& p) const;
+
+    void clear();
+
+    size_t memoryUsage() const;
+
+    std::vector<flatSphere> spheres;
+    std::vector<flatTriangle> triangles;
+    std::vector<flatMaterial> materials;
+    std::vector<flatTexture> textures;
+
+    // BVH leaves index primRefs, which point into the arrays above
+    std::vector<primitiveRef> primRefs;
+    bvhTree accel;
+    bvh4Tree accel4;
+    bvh8Tree accel8;
+    uint32_t accelWidth = 2;
+
+private:
+    // single primitive tests, switched on the type in ref
+    inline bool intersectPrimitive(primitiveRef ref, const ray& r, float t_min, float t_max, flatHit& h) const;
+    inline bool occludedBy(primitiveRef ref, const ray& r, float t_min, float t_max) const;
+
+    template <typename Intersect>
+    inline bool traverse(const ray& r, float t_min, float t_max, Intersect intersect) const;
+    template <typename Intersect>
+    inline bool traverseAny(const ray& r, float t_min, float t_max, Intersect intersect) const;
+
+    bool addMaterial(const material* mat,
+                     std::unordered_map<const material*, materialId>& materialIds,
+                     std::unordered_map<const texture*, textureId>& textureIds,
+                     materialId& id);
+    bool addTexture(const texture* tex,
+                    std::unordered_map<const texture*, textureId>& textureIds,
+                    textureId& id);
+};
+
+inline bool flatScene::intersectPrimitive(primitiveRef ref,
+                                          const ray& r,
+                                          float t_min,
+                                          float t_max,
+                                          flatHit& h) const
+{
+    const uint32_t index = ref & kPrimitiveIndexMask;
+    switch (ref >> kPrimitiveTypeShift) {
+        case kFlatSphere: {
+            const flatSphere& s = spheres[index];
+            float root;
+            if (!intersectSphere<sphere::roots>(s.center, s.radius, r, t_min, t_max, root)) {
+                return false;
+            }
+            h.t = root;
+            break;
+        }
+        case kFlatTriangle: {
+            // same policies as triangle (only those are flattened)
+            const flatTriangle& tri = triangles[index];
+            float t, u, v;
+            if (!triangle::intersector::intersect(r, tri.v0, tri.e1, tri.e2, triangle::facing::kCull,
+                                                  t_min, t_max, t, u, v)) {
+                return false;
+            }
+            h.t = t;
+            h.b1 = u;
+            h.b2 = v;
+            break;
+        }
+        default:
+            return false;
+    }
+    h.prim = ref;
+    return true;
+}
+
+inline bool flatScene::occludedBy(primitiveRef ref, const ray& r, float t_min, float t_max) const
+{
+    flatHit h;
+    return intersectPrimitive(ref, r, t_min, t_max, h);
+}
+
+template <typename Intersect>
+inline bool flatScene::traverse(const ray& r, float t_min, float t_max, Intersect intersect) const
+{
+    if (accelWidth == 8) {
+        return accel8.traverse(r, t_min, t_max, intersect);
+    } else if (accelWidth == 4) {
+        return accel4.traverse(r, t_min, t_max, intersect);
+    }
+    return accel.traverse(r, t_min, t_max, intersect);
+}
+
+template <typename Intersect>
+inline bool flatScene::traverseAny(const ray& r, float t_min, float t_max, Intersect intersect) const
+{
+    if (accelWidth == 8) {
+        return accel8.traverse<true>(r, t_min, t_max, intersect);
+    } else if (accelWidth == 4) {
+        return accel4.traverse<true>(r, t_min, t_max, intersect);
+    }
+    return accel.traverse<true>(r, t_min, t_max, intersect);
+}
+
+inline bool flatScene::closestHit(const ray& r, float t_min, float t_max, flatHit& h) const
+{
+    if (primRefs.empty()) {
+        return false;
+    }
+    return traverse(r, t_min, t_max, [&](uint32_t idx, const ray& r, float t_min, float& t_max) {
+        if (intersectPrimitive(primRefs[idx], r, t_min, t_max, h)) {
+            t_max = h.t;
+            return true;
+        }
+        return false;
+    });
+}
+
+inline bool flatScene::occluded(const ray& r, float t_min, float t_max) const
+{
+    if (primRefs.empty()) {
+        return false;
+    }
+    return traverseAny(r, t_min, t_max, [&](uint32_t idx, const ray& r, float t_min, float& t_max) {
+        return occludedBy(primRefs[idx], r, t_min, t_max);
+    });
+}
+
+inline bool flatScene::hit(const ray& r,
+                           float t_min,
+                           float t_max,
+                           intersectParams& rec,
+                           materialId& mat) const
+{
+    flatHit h;
+    if (!closestHit(r, t_min, t_max, h)) {
+        return false;
+    }
+
+    // second phase, same attributes as completeHit()
+    const uint32_t index = h.prim & kPrimitiveIndexMask;
+    if ((h.prim >> kPrimitiveTypeShift) == kFlatSphere) {
+        const flatSphere& s = spheres[index];
+        mat = s.mat;
+        const uint32_t attributes = materials[mat].type == kLambertianTexture ? kSurfaceUV : 0;
+        sphereHitRecord(s.center, s.radius, r, h.t, attributes, rec);
+    } else {
+        const flatTriangle& tri = triangles[index];
+        mat = tri.mat;
+        triangleHitRecord<triangle::normalPolicy>(tri.norm, r.point_at_parameter(h.t), h.t, h.b1, h.b2, rec);
+    }
+    return true;
+}
+
+inline vec3 flatScene::texelAt(textureId tex, float u, float v, const vec3& p) const
+{
+    const flatTexture& t = textures[tex];
+    switch (t.type) {
+        case kCheckerBoardTexture:
+            if (!isOddChecker(u, v)) {
+                return vec3(t.color1[0], t.color1[1], t.color1[2]);
+            }
+            break;
+        case kFlatShadeTexture:
+            break;
+    }
+    return vec3(t.color0[0], t.color0[1], t.color0[2]);
+}
+
+inline bool flatScene::scatter(materialId mat,
+                               const ray& ray_in,
+                               const intersectParams& rec,
+                               vec3& attenuation,
+                               ray& scattered,
+                               sampler& smp) const
+{
+    const flatMaterial& m = materials[mat];
+    switch (m.type) {
+        case kLambertian:
+            attenuation = vec3(m.diffuse.albedo[0], m.diffuse.albedo[1], m.diffuse.albedo[2]);
+            return scatterLambertian(rec, scattered, smp);
+        case kLambertianTexture:
+            attenuation = texelAt(m.textured.albedo, rec.u, rec.v, rec.p);
+            return scatterLambertian(rec, scattered, smp);
+        case kMetal:
+            attenuation = vec3(m.metallic.albedo[0], m.metallic.albedo[1], m.metallic.albedo[2]);
+            return scatterMetal(m.metallic.fuzziness, ray_in, rec, scattered, smp);
+        case kDielectric:
+            // no absorbtion
+            attenuation = vec3(1.0, 1.0, 1.0);
+            return scatterDielectric(m.glass.refractiveIdx, ray_in, rec, scattered, smp);
+        default:
+            return false;
+    }
+}
+
+void flatScene::clear()
+{
+    spheres.clear();
+    triangles.clear();
+    materials.clear();
+    textures.clear();
+    primRefs.clear();
+    accel = bvhTree();
+    accel4 = bvh4Tree();
+    accel8 = bvh8Tree();
+    accelWidth = 2;
+}
+
+bool flatScene::addTexture(const texture* tex,
+                           std::unordered_map<const texture*, textureId>& textureIds,
+                           textureId& id)
+{
+    auto it = textureIds.find(tex);
+    if (it != textureIds.end()) {
+        id = it->second;
+        return true;
+    }
+    if (textures.size() > UINT16_MAX) {
+        return false;
+    }
+
+    flatTexture t;
+    if (const flatShade *shade = dynamic_cast<const flatShade*>(tex)) {
+        t.type = kFlatShadeTexture;
+        for (int c = 0; c < 3; c++) {
+            t.color0[c] = t.color1[c] = shade->color[c];
+        }
+    } else if (const checkerBoard *checker = dynamic_cast<const checkerBoard*>(tex)) {
+        t.type = kCheckerBoardTexture;
+        for (int c = 0; c < 3; c++) {
+            t.color0[c] = checker->shade0->color[c];
+            t.color1[c] = checker->shade1->color[c];
+        }
+    } else {
+        return false;
+    }
+    id = (textureId)textures.size();
+    textures.push_back(t);
+    textureIds[tex] = id;
+    return true;
+}
+
+bool flatScene::addMaterial(const material* mat,
+                            std::unordered_map<const material*, materialId>& materialIds,
+                            std::unordered_map<const texture*, textureId>& textureIds,
+                            materialId& id)
+{
+    auto it = materialIds.find(mat);
+    if (it != materialIds.end()) {
+        id = it->second;
+        return true;
+    }
+    if (!mat || materials.size() > UINT16_MAX) {
+        return false;
+    }
+
+    flatMaterial m;
+    m.type = mat->type;
+    switch (mat->type) {
+        case kLambertian: {
+            const vec3& albedo = static_cast<const lambertian*>(mat)->albedo;
+            for (int c = 0; c < 3; c++) {
+                m.diffuse.albedo[c] = albedo[c];
+            }
+            break;
+        }
+        case kLambertianTexture:
+            if (!addTexture(static_cast<const lambertianTexture*>(mat)->albedo, textureIds, m.textured.albedo)) {
+                return false;
+            }
+            break;
+        case kMetal: {
+            const metal *met = static_cast<const metal*>(mat);
+            for (int c = 0; c < 3; c++) {
+                m.metallic.albedo[c] = met->albedo[c];
+            }
+            m.metallic.fuzziness = met->fuzziness;
+            break;
+        }
+        case kDielectric:
+            m.glass.refractiveIdx = static_cast<const dielectric*>(mat)->refractiveIdx;
+            break;
+        default:
+            return false;
+    }
+    id = (materialId)materials.size();
+    materials.push_back(m);
+    materialIds[mat] = id;
+    return true;
+}
+
+bool flatScene::fromScene(const scene& world, uint32_t width)
+{
+    clear();
+
+    std::unordered_map<const material*, materialId> materialIds;
+    std::unordered_map<const texture*, textureId> textureIds;
+    std::vector<aabb> bounds;
+    bounds.reserve(world.objects.size());
+    for (const object* obj : world.objects) {
+        aabb box;
+        if (const sphere *s = dynamic_cast<const sphere*>(obj)) {
+            flatSphere fs;
+            fs.center = s->center;
+            fs.radius = s->radius;
+            if (spheres.size() > kPrimitiveIndexMask ||
+                !addMaterial(s->surfaceMat, materialIds, textureIds, fs.mat)) {
+                clear();
+                return false;
+            }
+            primRefs.push_back(makePrimitiveRef(kFlatSphere, (uint32_t)spheres.size()));
+            spheres.push_back(fs);
+        } else if (const triangle *tri = dynamic_cast<const triangle*>(obj)) {
+            flatTriangle ft;
+            ft.v0 = tri->vtx0;
+            ft.e1 = tri->e1;
+            ft.e2 = tri->e2;
+            ft.norm = tri->norm;
+            if (triangles.size() > kPrimitiveIndexMask ||
+                !addMaterial(tri->surfaceMat, materialIds, textureIds, ft.mat)) {
+                clear();
+                return false;
+            }
+            primRefs.push_back(makePrimitiveRef(kFlatTriangle, (uint32_t)triangles.size()));
+            triangles.push_back(ft);
+        } else {
+            clear();
+            return false;
+        }
+        // the object's own bounds (not recomputed from v0 + edges, which
+        // can round differently)
+        obj->boundingBox(box);
+        bounds.push_back(box);
+    }
+
+    if (bounds.empty()) {
+        return true;
+    }
+    accel.build(bounds);
+    if (width == 8) {
+        accel8.build(accel);
+        accelWidth = 8;
+    } else if (width == 4) {
+        accel4.build(accel);
+        accelWidth = 4;
+    }
+    return true;
+}
+
+size_t flatScene::memoryUsage() const
+{
+    size_t bytes = sizeof(flatSphere) * spheres.capacity() +
+                   sizeof(flatTriangle) * triangles.capacity() +
+                   sizeof(flatMaterial) * materials.capacity() +
+                   sizeof(flatTexture) * textures.capacity() +
+                   sizeof(primitiveRef) * primRefs.capacity();
+    if (accelWidth == 8) {
+        return bytes + accel8.memoryUsage();
+    } else if (accelWidth == 4) {
+        return bytes + accel4.memoryUsage();
+    }
+    return bytes + sizeof(bvhNode) * accel.nodes.capacity() + sizeof(uint32_t) * accel.primIndices.capacity();
+}
+
+// colorAtRay() (same bounces, sample dimensions and russian roulette) on a
+// flat scene, so the same samples give the same color
+vec3 colorAtRay(const ray& r,
+                const flatScene& world,
+                sampler& smp,
+                bool russianRoulette,
+                renderStats& stats)
+{
+    vec3 throughput(1.0f);
+    ray current = r;
+    stats.nPaths++;
+    for (uint32_t bounceDepth = 0; ; bounceDepth++) {
+        stats.nSegments++;
+        intersectParams rec;
+        materialId mat;
+        if (!world.hit(current, minHitDistance, MAXFLOAT, rec, mat)) {
+            return throughput * bgColorAtRay(current);
+        }
+
+        ray scattered;
+        vec3 attenuation;
+        smp.setDimension(bounceDimension(bounceDepth));
+        if (bounceDepth >= maxBounces ||
+            !world.scatter(mat, current, rec, attenuation, scattered, smp)) {
+            // absorbed or exceeds max bounce
+            return vec3(0.0f);
+        }
+        throughput *= attenuation;
+
+        if (russianRoulette && bounceDepth >= rouletteStartBounce) {
+            smp.setDimension(bounceDimension(bounceDepth) + kDimensionsPerBounce - 1);
+            const float survive = std::min(1.0f, std::max(throughput.x(),
+                                                 std::max(throughput.y(), throughput.z())));
+            if (smp.get1D() >= survive) {
+                return vec3(0.0f);
+            }
+            throughput /= survive;
+        }
+        current = scattered;
+    }
+}
+
+#endif /* flatscene_h */
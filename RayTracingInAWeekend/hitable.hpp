@@ -10,8 +10,11 @@
 #define hitable_h
 
 #include "ray.hpp"
+#include "aabb.hpp"
+#include "packet.hpp"
 
 class material;
+class object;
 
 struct intersectParams
 {
@@ -22,16 +25,176 @@ public:
     vec3 p;
     vec3 normal;
     material *surfaceMat;
+    // hit on a two sided surface (mesh face), whose normal may have been
+    // turned toward the ray: see orientNormal()
+    bool twoSided;
+    bool normalFlipped;
 };
 
+// Surface attributes a material reads from intersectParams besides t, p,
+// normal and surfaceMat (which are always filled in), see
+// material::attributes
+enum surfaceAttribute : uint32_t
+{
+    kSurfaceUV = 1 << 0,
+    kAllSurfaceAttributes = kSurfaceUV,
+};
+
+// instances a hit can be nested in (instance of a scene of instances ...)
+constexpr uint32_t kMaxInstanceDepth = 8;
+
+// Closest hit found so far while searching (first phase of hit())
+//
+// Only what's needed to pick the closest hit and to come back to it:
+// t, the primitive (object, and face of a mesh), its barycentrics and the
+// instances it was reached through. Objects overwrite it only on a closer
+// hit, so a search never copies full hit records around; point, normal,
+// uv and material are worked out once, for the final hit, by
+// completeHit() (second phase).
+struct primitiveHit
+{
+    float t;
+    // barycentrics of the hit on a triangle (weights of v1, v2)
+    float b1;
+    float b2;
+    // face of a mesh
+    uint32_t primId;
+    // object that was hit (sphere, triangle, mesh)
+    const object *prim;
+    // instances above prim, innermost first
+    uint32_t nInstances;
+    const object *instances[kMaxInstanceDepth];
+};
+
+// Second phase of a hit: fills in rec for h (found by closestHit() along
+// r), computing only the attributes its material needs.
+// (defined in material.hpp, which needs object)
+inline void completeHit(const ray& r, const primitiveHit& h, intersectParams& rec);
+
 class object
 {
 public:
+    // objects are created with new and deleted through object*
+    virtual ~object() {}
+
+    // Closest hit in (t_min, t_max), with its hit record
+    // Same as closestHit() then completeHit(): objects only implement
+    // those two phases (and hitMaterial() / hitAttributes()).
     virtual bool hit(const ray& r,
                      float t_min,
                      float t_max,
-                     intersectParams& rec) const = 0;
+                     intersectParams& rec) const
+    {
+        primitiveHit h;
+        if (!closestHit(r, t_min, t_max, h)) {
+            return false;
+        }
+        completeHit(r, h, rec);
+        return true;
+    }
+
+    // First phase: closest hit in (t_min, t_max), if any, into h
+    // h is only written when a hit is found, and it's always closer than
+    // t_max, so the caller can pass in the closest hit so far (t_max = h.t)
+    // and keep searching.
+    virtual bool closestHit(const ray& r,
+                            float t_min,
+                            float t_max,
+                            primitiveHit& h) const = 0;
+
+    // Second phase, for the object recorded in h (h.prim, or the instance
+    // at h.instances[level]): material of the hit, and t, p, normal plus
+    // the asked for attributes (surfaceAttribute bits) in rec along r.
+    // Objects that are never recorded (scenes) keep these.
+    virtual material* hitMaterial(const primitiveHit& h, uint32_t level) const
+    {
+        return nullptr;
+    }
+    virtual void hitAttributes(const ray& r,
+                               const primitiveHit& h,
+                               uint32_t level,
+                               uint32_t attributes,
+                               intersectParams& rec) const
+    {
+        rec.t = h.t;
+    }
+
+    // Any hit query: is there a hit anywhere in (t_min, t_max)?
+    // For shadow / visibility / ambient occlusion rays, which need no
+    // closest hit or hit record: overrides return on the first hit found
+    // and skip computing hit points, normals, uvs.
+    virtual bool occluded(const ray& r,
+                          float t_min,
+                          float t_max) const
+    {
+        primitiveHit h;
+        return closestHit(r, t_min, t_max, h);
+    }
+
+    // axis aligned box enclosing the whole surface of the object
+    // returns false if the object has no bounds (nothing to enclose)
+    virtual bool boundingBox(aabb& box) const = 0;
+
+    // box enclosing the object over the time interval [t0, t1]
+    // i.e. all positions a moving object sweeps through in that time.
+    // Objects that don't move have the same bounds at all times.
+    virtual bool boundingBox(float t0,
+                             float t1,
+                             aabb& box) const
+    {
+        return boundingBox(box);
+    }
+
+    // Bounds of the parts of the object inside refBounds (part of its
+    // bounds) on either side of the plane p[axis] = pos, used by spatial
+    // split BVH builds (sbvh.hpp). Splitting the box itself is always
+    // correct; objects that can do better (triangles) return tighter boxes.
+    virtual void splitBounds(const aabb& refBounds,
+                             int axis,
+                             float pos,
+                             aabb& left,
+                             aabb& right) const
+    {
+        splitBox(refBounds, axis, pos, left, right);
+    }
+
+    // Packet version of hit() (see packet.hpp), for the rays of p set in
+    // active: every one that hits between p.tMin and its p.tMax gets tMax
+    // shrunk to the hit and rec[lane] filled in. Returns the lanes that hit.
+    // Objects with a SIMD intersection test override these, the rest trace
+    // each ray on its own.
+    virtual uint32_t hitPacket(rayPacket4& p, uint32_t active, intersectParams *rec) const
+    {
+        return hitEachRay(p, active, rec);
+    }
+    virtual uint32_t hitPacket(rayPacket8& p, uint32_t active, intersectParams *rec) const
+    {
+        return hitEachRay(p, active, rec);
+    }
+    virtual uint32_t hitPacket(rayPacket16& p, uint32_t active, intersectParams *rec) const
+    {
+        return hitEachRay(p, active, rec);
+    }
+
+protected:
+    template <int N>
+    uint32_t hitEachRay(rayPacket<N>& p, uint32_t active, intersectParams *rec) const
+    {
+        uint32_t hitLanes = 0;
+        for (uint32_t bits = active; bits; bits &= bits - 1) {
+            const int lane = __builtin_ctz(bits);
+            intersectParams laneRec;
+            if (hit(p.getRay(lane), p.tMin, p.tMax[lane], laneRec)) {
+                p.tMax[lane] = laneRec.t;
+                rec[lane] = laneRec;
+                hitLanes |= 1u << lane;
+            }
+        }
+        return hitLanes;
+    }
 };
 
+// completeHit() needs material
+#include "material.hpp"
 
 #endif /* hitable_h */
@@ -10,34 +10,466 @@
 #define hitable_list_h
 
 #include "hitable.hpp"
+#include "bvh.hpp"
+#include "wbvh.hpp"
+#include "cbvh.hpp"
+#include "sbvh.hpp"
+#include "lbvh.hpp"
+#include "dbvh.hpp"
 #include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+// 8 wide nodes only pay off with native 8 wide vectors (AVX)
+#if SIMD_AVX
+const uint32_t kDefaultBVHWidth = 8;
+#else
+const uint32_t kDefaultBVHWidth = 4;
+#endif
+
+// how the binary tree under every BVH layout is built
+// . kSAHBuilder:          binned SAH object splits (bvhTree::build())
+// . kSpatialSplitBuilder: SBVH, objects may be split across children
+//                         (sbvh.hpp), for scenes with big / long / slanted
+//                         triangles whose bounds overlap a lot
+// . kLinearBuilder:       LBVH from Morton order, built in parallel
+//                         (lbvh.hpp), for fast rebuilds of big scenes
+enum bvhBuilder
+{
+    kSAHBuilder,
+    kSpatialSplitBuilder,
+    kLinearBuilder,
+};
+
+// dynamic BVH is rebuilt from scratch once refits / edits have made its
+// SAH cost this much worse than right after a full build
+const float kDefaultMaxBVHCostRatio = 1.3f;
 
 class scene: public object  {
 public:
     scene() {}
     scene(std::vector<object*> &l) {objects = l;}
-    virtual bool hit(const ray& r, float tmin, float tmax, intersectParams& rec) const;
-    
+    virtual bool closestHit(const ray& r, float tmin, float tmax, primitiveHit& h) const;
+    // unbounded objects first, then whichever BVH hit() would walk, until
+    // any object reports a hit
+    virtual bool occluded(const ray& r, float tmin, float tmax) const;
+    virtual bool boundingBox(aabb& box) const;
+    virtual bool boundingBox(float t0, float t1, aabb& box) const;
+
+    // Packets walk the binary tree (accel, kept alongside the uncompressed
+    // wide trees) together; with a dynamic or compressed BVH each ray is
+    // traced on its own instead.
+    virtual uint32_t hitPacket(rayPacket4& p, uint32_t active, intersectParams *rec) const;
+    virtual uint32_t hitPacket(rayPacket8& p, uint32_t active, intersectParams *rec) const;
+    virtual uint32_t hitPacket(rayPacket16& p, uint32_t active, intersectParams *rec) const;
+
+    // Build acceleration structure (BVH) over objects
+    // Until this is called (and after objects are added / removed / moved)
+    // hit() falls back to testing every object in the scene.
+    //
+    // width: children per node. 2 traverses the binary SAH tree itself,
+    // 4 / 8 collapse it into a wide BVH (see wbvh.hpp) tested one node
+    // (all children) per SIMD slab test.
+    // compressed: quantize the wide tree's child bounds to 8 bits (see
+    // cbvh.hpp) and keep only that, for scenes where BVH memory matters
+    // more than the decode cost (width 4 / 8 only).
+    // pool: threads for kLinearBuilder (one is made when not given)
+    void buildBVH(uint32_t width = kDefaultBVHWidth,
+                  bool compressed = false,
+                  bvhBuilder builder = kSAHBuilder,
+                  threadPool *pool = nullptr);
+
+    // Same as buildBVH(), with the binary tree given (taken over, tree is
+    // left empty) instead of built, e.g. one loaded by loadSceneCache():
+    // it must index this scene's bounded objects in order.
+    void useBVH(bvhTree& tree, uint32_t width = kDefaultBVHWidth, bool compressed = false);
+
+    // Build a dynamic BVH (see dbvh.hpp) over objects instead, for scenes
+    // edited between frames: objects can then be added, removed and moved
+    // with the calls below without a rebuild. Call refitBVH() once objects
+    // of a frame have moved, before tracing.
+    void buildDynamicBVH();
+
+    // add / remove an object, keeping the dynamic BVH (if any) up to date
+    // a BVH from buildBVH() can't be updated and is dropped instead
+    void addObject(object* obj);
+    void removeObject(object* obj);
+
+    // obj's geometry changed (moved / resized), picked up by refitBVH()
+    void objectMoved(object* obj);
+
+    // Bring the dynamic BVH up to date with moved objects. If its SAH cost
+    // has grown past maxCostRatio x that of the last full build, it's
+    // rebuilt instead. Returns true if it was rebuilt.
+    bool refitBVH(float maxCostRatio = kDefaultMaxBVHCostRatio);
+
+    inline bool isAccelBuilt() const
+    {
+        return accelDynamic || accel.isBuilt() || compressedAccel4.isBuilt() || compressedAccel8.isBuilt();
+    }
+
+    // bytes used by whichever BVH hit() traverses
+    size_t accelMemoryUsage() const;
+
     std::vector<object*> objects;
+
+    // BVH over bounded objects, indexing into bvhObjects
+    // (the wide trees are only built when asked for, and share its indices)
+    bvhTree accel;
+    bvh4Tree accel4;
+    bvh8Tree accel8;
+    cbvh4Tree compressedAccel4;
+    cbvh8Tree compressedAccel8;
+    uint32_t accelWidth = 2;
+    bool accelCompressed = false;
+    // dynamic BVH, indexing into bvhObjects (slots of removed objects are
+    // nullptr until reused)
+    dynamicBvhTree dynamicAccel;
+    bool accelDynamic = false;
+    std::vector<object*> bvhObjects;
+    // objects with no bounds can't go in the BVH, these are always tested
+    std::vector<object*> unboundedObjects;
+
+private:
+    template <int N>
+    uint32_t intersectPacket(rayPacket<N>& p, uint32_t active, intersectParams *rec) const;
+
+    // drop all BVHs, hit() tests every object until one is built again
+    void clearAccel();
+
+    // clearAccel(), then split objects into bvhObjects / unboundedObjects
+    // returns the bounds of bvhObjects
+    std::vector<aabb> collectObjects();
+
+    // wide / compressed trees from accel, as asked for in buildBVH()
+    void collapseBVH(uint32_t width, bool compressed);
+
+    // bvhObjects slot of every object in the dynamic BVH
+    std::unordered_map<const object*, uint32_t> objectSlots;
+    std::vector<uint32_t> freeSlots;
 };
 
 // Given a ray, for each object in the scene:
 // . test if ray intersects its surface (facing the camera)
 // . If yes, check if it the closest object to the camera
-// . If yes, update the intersection record and ray parameter (t)
-//   corresponding to this surface point
-bool scene::hit(const ray& r, float t_min, float t_max, intersectParams& rec) const {
-    intersectParams temp_rec;
+// . If yes, it records itself in h, and the ray parameter (t) of the
+//   hit becomes the end of the interval searched from then on
+// The hit record is only filled in for the closest hit, by hit()
+// (object::hit(), completeHit()).
+//
+// With a BVH built, only objects whose bounds the ray reaches are tested
+// (closest first, so far away ones are mostly culled)
+bool scene::closestHit(const ray& r, float t_min, float t_max, primitiveHit& h) const {
     bool hit_anything = false;
-    double closest_so_far = t_max;
-    for (uint32_t i = 0; i < objects.size(); i++) {
-        if (objects[i]->hit(r, t_min, closest_so_far, temp_rec)) {
+    float closest_so_far = t_max;
+
+    const std::vector<object*>& linearObjects = isAccelBuilt() ? unboundedObjects : objects;
+    for (uint32_t i = 0; i < linearObjects.size(); i++) {
+        if (linearObjects[i]->closestHit(r, t_min, closest_so_far, h)) {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = h.t;
         }
     }
+
+    if (isAccelBuilt()) {
+        const std::vector<object*>& prims = bvhObjects;
+        auto intersect = [&](uint32_t idx, const ray& r, float t_min, float& t_max) {
+            if (prims[idx]->closestHit(r, t_min, t_max, h)) {
+                t_max = h.t;
+                return true;
+            }
+            return false;
+        };
+        bool accelHit;
+        if (accelDynamic) {
+            accelHit = dynamicAccel.traverse(r, t_min, closest_so_far, intersect);
+        } else if (accelCompressed) {
+            accelHit = accelWidth == 8 ? compressedAccel8.traverse(r, t_min, closest_so_far, intersect)
+                                       : compressedAccel4.traverse(r, t_min, closest_so_far, intersect);
+        } else if (accelWidth == 8) {
+            accelHit = accel8.traverse(r, t_min, closest_so_far, intersect);
+        } else if (accelWidth == 4) {
+            accelHit = accel4.traverse(r, t_min, closest_so_far, intersect);
+        } else {
+            accelHit = accel.traverse(r, t_min, closest_so_far, intersect);
+        }
+        if (accelHit) {
+            hit_anything = true;
+        }
+    }
+
     return hit_anything;
 }
 
+bool scene::occluded(const ray& r, float t_min, float t_max) const {
+    const std::vector<object*>& linearObjects = isAccelBuilt() ? unboundedObjects : objects;
+    for (uint32_t i = 0; i < linearObjects.size(); i++) {
+        if (linearObjects[i]->occluded(r, t_min, t_max)) {
+            return true;
+        }
+    }
+
+    if (!isAccelBuilt()) {
+        return false;
+    }
+    const std::vector<object*>& prims = bvhObjects;
+    auto intersect = [&](uint32_t idx, const ray& r, float t_min, float& t_max) {
+        return prims[idx]->occluded(r, t_min, t_max);
+    };
+    if (accelDynamic) {
+        return dynamicAccel.traverse<true>(r, t_min, t_max, intersect);
+    } else if (accelCompressed) {
+        return accelWidth == 8 ? compressedAccel8.traverse<true>(r, t_min, t_max, intersect)
+                               : compressedAccel4.traverse<true>(r, t_min, t_max, intersect);
+    } else if (accelWidth == 8) {
+        return accel8.traverse<true>(r, t_min, t_max, intersect);
+    } else if (accelWidth == 4) {
+        return accel4.traverse<true>(r, t_min, t_max, intersect);
+    }
+    return accel.traverse<true>(r, t_min, t_max, intersect);
+}
+
+uint32_t scene::hitPacket(rayPacket4& p, uint32_t active, intersectParams *rec) const {
+    return intersectPacket(p, active, rec);
+}
+
+uint32_t scene::hitPacket(rayPacket8& p, uint32_t active, intersectParams *rec) const {
+    return intersectPacket(p, active, rec);
+}
+
+uint32_t scene::hitPacket(rayPacket16& p, uint32_t active, intersectParams *rec) const {
+    return intersectPacket(p, active, rec);
+}
+
+template <int N>
+uint32_t scene::intersectPacket(rayPacket<N>& p, uint32_t active, intersectParams *rec) const {
+    if (accelDynamic || (isAccelBuilt() && !accel.isBuilt())) {
+        return hitEachRay(p, active, rec);
+    }
+
+    // objects shrink tMax and overwrite rec of a lane only on a closer hit
+    uint32_t hitLanes = 0;
+    const std::vector<object*>& linearObjects = isAccelBuilt() ? unboundedObjects : objects;
+    for (const object* obj : linearObjects) {
+        hitLanes |= obj->hitPacket(p, active, rec);
+    }
+
+    if (isAccelBuilt()) {
+        const std::vector<object*>& prims = bvhObjects;
+        hitLanes |= accel.traversePacket(p, active, [&](uint32_t idx, rayPacket<N>& p, uint32_t lanes) {
+            return prims[idx]->hitPacket(p, lanes, rec);
+        });
+    }
+    return hitLanes;
+}
+
+bool scene::boundingBox(aabb& box) const {
+    box = aabb();
+    bool bounded = false;
+    for (const object* obj : objects) {
+        aabb objBox;
+        if (!obj->boundingBox(objBox)) {
+            // one unbounded object makes the whole scene unbounded
+            return false;
+        }
+        box.grow(objBox);
+        bounded = true;
+    }
+    return bounded;
+}
+
+bool scene::boundingBox(float t0, float t1, aabb& box) const {
+    box = aabb();
+    bool bounded = false;
+    for (const object* obj : objects) {
+        aabb objBox;
+        if (!obj->boundingBox(t0, t1, objBox)) {
+            return false;
+        }
+        box.grow(objBox);
+        bounded = true;
+    }
+    return bounded;
+}
+
+void scene::buildBVH(uint32_t width, bool compressed, bvhBuilder builder, threadPool *pool) {
+    const std::vector<aabb> bounds = collectObjects();
+
+    if (builder == kSpatialSplitBuilder) {
+        const std::vector<object*>& prims = bvhObjects;
+        buildSpatialSplitBVH(accel, bounds,
+                             [&](uint32_t idx, const aabb& refBounds, int axis, float pos, aabb& left, aabb& right) {
+                                 prims[idx]->splitBounds(refBounds, axis, pos, left, right);
+                             });
+    } else if (builder == kLinearBuilder) {
+        if (pool) {
+            buildLinearBVH(accel, bounds, *pool);
+        } else {
+            threadPool localPool;
+            buildLinearBVH(accel, bounds, localPool);
+        }
+    } else {
+        accel.build(bounds);
+    }
+
+    collapseBVH(width, compressed);
+}
+
+void scene::useBVH(bvhTree& tree, uint32_t width, bool compressed) {
+    collectObjects();
+    accel.nodes.swap(tree.nodes);
+    accel.primIndices.swap(tree.primIndices);
+    collapseBVH(width, compressed);
+}
+
+void scene::collapseBVH(uint32_t width, bool compressed) {
+    accelCompressed = compressed && (width == 4 || width == 8);
+    if (width == 8) {
+        accel8.build(accel);
+        accelWidth = 8;
+    } else if (width == 4) {
+        accel4.build(accel);
+        accelWidth = 4;
+    } else {
+        accelWidth = 2;
+    }
+
+    // the compressed tree is all that's kept, drop the float ones
+    if (accelCompressed) {
+        if (width == 8) {
+            compressedAccel8.build(accel8);
+        } else {
+            compressedAccel4.build(accel4);
+        }
+        accel = bvhTree();
+        accel4 = bvh4Tree();
+        accel8 = bvh8Tree();
+    }
+}
+
+void scene::clearAccel() {
+    accel = bvhTree();
+    accel4 = bvh4Tree();
+    accel8 = bvh8Tree();
+    compressedAccel4 = cbvh4Tree();
+    compressedAccel8 = cbvh8Tree();
+    dynamicAccel = dynamicBvhTree();
+    accelWidth = 2;
+    accelCompressed = false;
+    accelDynamic = false;
+    bvhObjects.clear();
+    unboundedObjects.clear();
+    objectSlots.clear();
+    freeSlots.clear();
+}
+
+std::vector<aabb> scene::collectObjects() {
+    clearAccel();
+
+    std::vector<aabb> bounds;
+    bounds.reserve(objects.size());
+    for (object* obj : objects) {
+        aabb box;
+        if (obj->boundingBox(box)) {
+            bvhObjects.push_back(obj);
+            bounds.push_back(box);
+        } else {
+            unboundedObjects.push_back(obj);
+        }
+    }
+    return bounds;
+}
+
+void scene::buildDynamicBVH() {
+    const std::vector<aabb> bounds = collectObjects();
+    for (uint32_t i = 0; i < bvhObjects.size(); i++) {
+        objectSlots[bvhObjects[i]] = i;
+    }
+
+    dynamicAccel.build(bounds);
+    accelDynamic = true;
+}
+
+void scene::addObject(object* obj) {
+    objects.push_back(obj);
+    if (!accelDynamic) {
+        clearAccel();
+        return;
+    }
+
+    aabb box;
+    if (!obj->boundingBox(box)) {
+        unboundedObjects.push_back(obj);
+        return;
+    }
+    uint32_t slot;
+    if (freeSlots.empty()) {
+        slot = (uint32_t)bvhObjects.size();
+        bvhObjects.push_back(obj);
+    } else {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+        bvhObjects[slot] = obj;
+    }
+    objectSlots[obj] = slot;
+    dynamicAccel.insert(slot, box);
+}
+
+void scene::removeObject(object* obj) {
+    objects.erase(std::remove(objects.begin(), objects.end(), obj), objects.end());
+    if (!accelDynamic) {
+        clearAccel();
+        return;
+    }
+
+    auto it = objectSlots.find(obj);
+    if (it == objectSlots.end()) {
+        unboundedObjects.erase(std::remove(unboundedObjects.begin(), unboundedObjects.end(), obj),
+                               unboundedObjects.end());
+        return;
+    }
+    dynamicAccel.remove(it->second);
+    bvhObjects[it->second] = nullptr;
+    freeSlots.push_back(it->second);
+    objectSlots.erase(it);
+}
+
+void scene::objectMoved(object* obj) {
+    if (!accelDynamic) {
+        clearAccel();
+        return;
+    }
+
+    auto it = objectSlots.find(obj);
+    aabb box;
+    if (it != objectSlots.end() && obj->boundingBox(box)) {
+        dynamicAccel.update(it->second, box);
+    }
+}
+
+bool scene::refitBVH(float maxCostRatio) {
+    if (!accelDynamic) {
+        return false;
+    }
+    dynamicAccel.refit();
+    if (dynamicAccel.costRatio() > maxCostRatio) {
+        buildDynamicBVH();
+        return true;
+    }
+    return false;
+}
+
+size_t scene::accelMemoryUsage() const {
+    if (accelDynamic) {
+        return dynamicAccel.memoryUsage();
+    } else if (accelCompressed) {
+        return accelWidth == 8 ? compressedAccel8.memoryUsage() : compressedAccel4.memoryUsage();
+    } else if (accelWidth == 8) {
+        return accel8.memoryUsage();
+    } else if (accelWidth == 4) {
+        return accel4.memoryUsage();
+    }
+    return sizeof(bvhNode) * accel.nodes.capacity() + sizeof(uint32_t) * accel.primIndices.capacity();
+}
+
 #endif /* hitable_list_h */
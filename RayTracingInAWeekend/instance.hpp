@@ -0,0 +1,161 @@
+//
+//  instance.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 9/22/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef instance_h
+#define instance_h
+
+#include "hitable.hpp"
+#include "material.hpp"
+#include "transform.hpp"
+
+// Transformed copy of a shared object (two level instancing)
+//
+// The prototype is the bottom level: any object, usually one with its own
+// BVH (a triangleMesh, or a scene of objects after scene::buildBVH()).
+// It's only referenced, so any number of instances cost one prototype plus
+// ~150 bytes each. The scene's BVH over its objects (instances included)
+// is the top level.
+//
+// Rays are taken into object space at the instance (origin and direction
+// through the inverse transform, direction not renormalized so that t is
+// the same in both spaces), and hits brought back to world space.
+//
+// The prototype must be complete (mesh BVH built, etc.) when the instance
+// is made, as its bounds are taken then; see updateBounds().
+class instance : public object
+{
+public:
+    instance() = delete;
+    // mat: overrides the prototype's materials if not null
+    instance(const object *proto,
+             const transform& toWorld,
+             material *mat = nullptr) : prototype(proto),
+                                        objectToWorld(toWorld),
+                                        worldToObject(toWorld.inverse()),
+                                        surfaceMat(mat)
+    {
+        updateBounds();
+    }
+
+    // The prototype records its primitive, and the instance adds itself
+    // on top (instances nested deeper than kMaxInstanceDepth aren't
+    // supported, the levels past it are left out)
+    bool closestHit(const ray& r, float t_min, float t_max, primitiveHit& h) const
+    {
+        if (!prototype->closestHit(toObject(r), t_min, t_max, h)) {
+            return false;
+        }
+        if (h.nInstances < kMaxInstanceDepth) {
+            h.instances[h.nInstances++] = this;
+        }
+        return true;
+    }
+
+    // this instance is h.instances[level], the level below is the
+    // prototype's (or the primitive itself, at level 0)
+    material* hitMaterial(const primitiveHit& h, uint32_t level) const
+    {
+        if (surfaceMat) {
+            return surfaceMat;
+        }
+        return level > 0 ? h.instances[level - 1]->hitMaterial(h, level - 1) : h.prim->hitMaterial(h, 0);
+    }
+
+    void hitAttributes(const ray& r,
+                       const primitiveHit& h,
+                       uint32_t level,
+                       uint32_t attributes,
+                       intersectParams& rec) const
+    {
+        const ray local(toObject(r));
+        if (level > 0) {
+            h.instances[level - 1]->hitAttributes(local, h, level - 1, attributes, rec);
+        } else {
+            h.prim->hitAttributes(local, h, 0, attributes, rec);
+        }
+        rec.p = r.point_at_parameter(rec.t);
+        rec.normal = unit_vector(worldToObject.applyNormal(rec.normal));
+    }
+
+    // t is the same in both spaces, so the interval carries over as is
+    bool occluded(const ray& r, float t_min, float t_max) const
+    {
+        return prototype->occluded(toObject(r), t_min, t_max);
+    }
+
+    uint32_t hitPacket(rayPacket4& p, uint32_t active, intersectParams *rec) const
+    {
+        return intersectPacket(p, active, rec);
+    }
+    uint32_t hitPacket(rayPacket8& p, uint32_t active, intersectParams *rec) const
+    {
+        return intersectPacket(p, active, rec);
+    }
+    uint32_t hitPacket(rayPacket16& p, uint32_t active, intersectParams *rec) const
+    {
+        return intersectPacket(p, active, rec);
+    }
+
+    using object::boundingBox;
+    bool boundingBox(aabb& box) const
+    {
+        box = bounds;
+        return hasBounds;
+    }
+
+    // re-read the prototype's bounds (after it changed, or the transform did)
+    void updateBounds()
+    {
+        aabb protoBounds;
+        hasBounds = prototype->boundingBox(protoBounds);
+        bounds = hasBounds ? objectToWorld.applyBox(protoBounds) : aabb();
+    }
+
+    const object *prototype;
+    transform objectToWorld;
+    transform worldToObject;
+    material *surfaceMat;
+
+private:
+    inline ray toObject(const ray& r) const
+    {
+        return ray(worldToObject.applyPoint(r.origin()), worldToObject.applyVector(r.direction()));
+    }
+
+    // whole packet taken into object space, so the prototype can still
+    // trace it as a packet
+    template <int N>
+    uint32_t intersectPacket(rayPacket<N>& p, uint32_t active, intersectParams *rec) const
+    {
+        rayPacket<N> local;
+        local.tMin = p.tMin;
+        for (int lane = 0; lane < N; lane++) {
+            const ray r = p.getRay(lane);
+            local.setRay(lane, toObject(r));
+            local.tMax[lane] = p.tMax[lane];
+        }
+        const uint32_t hitLanes = prototype->hitPacket(local, active, rec);
+        for (uint32_t bits = hitLanes; bits; bits &= bits - 1) {
+            const int lane = __builtin_ctz(bits);
+            p.tMax[lane] = local.tMax[lane];
+            const ray r = p.getRay(lane);
+            rec[lane].p = r.point_at_parameter(rec[lane].t);
+            rec[lane].normal = unit_vector(worldToObject.applyNormal(rec[lane].normal));
+            if (surfaceMat) {
+                rec[lane].surfaceMat = surfaceMat;
+                orientNormal(r, surfaceMat, rec[lane]);
+            }
+        }
+        return hitLanes;
+    }
+
+    aabb bounds;
+    bool hasBounds;
+};
+
+#endif /* instance_h */
@@ -0,0 +1,578 @@
+//
+//  lbvh.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 9/8/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef lbvh_h
+#define lbvh_h
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include "bvh.hpp"
+#include "threadpool.hpp"
+
+// Linear BVH (LBVH) builder, for scenes that are rebuilt every frame
+//
+// Instead of sweeping split candidates at every node (bvhTree::build()),
+// primitives are put in Morton order (centroids quantized to a grid and
+// their coordinate bits interleaved, so that nearby primitives get nearby
+// codes) and the tree follows the bits of the sorted codes: the first bit
+// where a range's codes differ splits it in two.
+//
+// Every step runs on the thread pool:
+// 1. Morton codes of centroids, 30 bit (10 per axis) or 63 bit (21 per axis)
+// 2. LSD radix sort, 8 bits per pass (per block histograms, then scatter)
+// 3. all interior nodes at once: node i finds its own range and split
+//    point from the sorted codes alone (Karras, "Maximizing parallelism in
+//    the construction of BVHs, octrees, and k-d trees", 2012)
+// 4. bottom-up pass from the leaves (a node is done by whichever thread
+//    reaches it second): bounds, SAH cost, and optionally treelet
+//    restructuring (Karras & Aila, "Fast parallel construction of
+//    high-quality bounding volume hierarchies", 2013): the up to 7 biggest
+//    subtrees below the node are rearranged into the best SAH shape found
+//    by dynamic programming over all subsets, for every node with at least
+//    kMinTreeletPrims primitives. Small subtrees are collapsed into leaves
+//    where that is cheaper.
+// 5. flatten into bvhTree's depth first layout, subtrees in parallel
+//
+// The result is a regular bvhTree, usable by wide / compressed collapse.
+struct lbvhSettings
+{
+    // 30 or 63
+    uint32_t mortonBits = 30;
+    // restructure treelets to recover SAH quality (roughly doubles build time)
+    bool optimizeTreelets = true;
+};
+
+class linearBvhBuilder
+{
+public:
+    enum {
+        kTreeletSize = 7,
+        // smaller subtrees are left in Morton order: there are a lot of
+        // them and most end up collapsed into a leaf or two anyway
+        kMinTreeletPrims = 32,
+        kMaxPrimsInLeaf = bvhTree::kMaxPrimsInLeaf,
+        // tasks per thread, enough for work stealing to even things out
+        kTasksPerThread = 8,
+        kNoNode = UINT32_MAX,
+    };
+
+    linearBvhBuilder(bvhTree& tree,
+                     threadPool& pool,
+                     const lbvhSettings& settings) : tree(tree),
+                                                     pool(pool),
+                                                     settings(settings) {}
+
+    void build(const std::vector<aabb>& primBounds)
+    {
+        tree.nodes.clear();
+        tree.primIndices.clear();
+        nPrims = (uint32_t)primBounds.size();
+        if (nPrims == 0) {
+            return;
+        }
+        bounds = &primBounds;
+
+        computeMortonCodes();
+        sortMortonCodes();
+        buildHierarchy();
+        computeBounds();
+        flatten();
+    }
+
+private:
+    // Intermediate tree, with explicit child / parent links so that
+    // treelets can be rearranged before the final layout is known.
+    // Interior nodes are 0 .. n - 2 (0 is the root), leaf k is n - 1 + k
+    // and holds the k-th primitive in Morton order.
+    struct buildNode
+    {
+        aabb bounds;
+        uint32_t child[2];
+        uint32_t parent;
+        // primitives under the node
+        uint32_t nPrims;
+        // nodes the subtree takes once flattened
+        uint32_t nNodes;
+        // SAH cost of the subtree (not normalized by root area)
+        float cost;
+        // emitted as a single leaf holding all its primitives
+        bool collapsed;
+    };
+
+    inline bool isPrimLeaf(uint32_t idx) const { return idx >= nPrims - 1; }
+
+    // split [0, n) into roughly equal blocks, kTasksPerThread per thread
+    template <typename Fn>
+    void parallelBlocks(uint32_t n, Fn fn)
+    {
+        const uint32_t nBlocks = std::max(1u, std::min(n / 1024, pool.size() * kTasksPerThread));
+        pool.parallelFor(nBlocks, [&](uint32_t block, uint32_t threadIdx) {
+            fn((uint32_t)((uint64_t)n * block / nBlocks), (uint32_t)((uint64_t)n * (block + 1) / nBlocks));
+        });
+    }
+
+    // spread the low 10 / 21 bits of v out to every 3rd bit
+    static inline uint64_t expandBits10(uint64_t v)
+    {
+        v = (v | (v << 16)) & 0x030000ffull;
+        v = (v | (v << 8)) & 0x0300f00full;
+        v = (v | (v << 4)) & 0x030c30c3ull;
+        v = (v | (v << 2)) & 0x09249249ull;
+        return v;
+    }
+
+    static inline uint64_t expandBits21(uint64_t v)
+    {
+        v = (v | (v << 32)) & 0x1f00000000ffffull;
+        v = (v | (v << 16)) & 0x1f0000ff0000ffull;
+        v = (v | (v << 8)) & 0x100f00f00f00f00full;
+        v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+        v = (v | (v << 2)) & 0x1249249249249249ull;
+        return v;
+    }
+
+    // x goes in bit 3k + 2, y in 3k + 1, z in 3k
+    void computeMortonCodes()
+    {
+        const std::vector<aabb>& primBounds = *bounds;
+
+        std::vector<aabb> blockBounds(pool.size() * kTasksPerThread);
+        std::atomic<uint32_t> nextBlock(0);
+        parallelBlocks(nPrims, [&](uint32_t first, uint32_t last) {
+            aabb b;
+            for (uint32_t i = first; i < last; i++) {
+                b.grow(primBounds[i].centroid());
+            }
+            blockBounds[nextBlock++] = b;
+        });
+        aabb centroidBounds;
+        for (const aabb& b : blockBounds) {
+            centroidBounds.grow(b);
+        }
+
+        const bool wide = settings.mortonBits > 30;
+        const float gridSize = wide ? (float)(1 << 21) : (float)(1 << 10);
+        const uint32_t maxCell = wide ? (1 << 21) - 1 : (1 << 10) - 1;
+        float scale[3];
+        for (int a = 0; a < 3; a++) {
+            const float extent = centroidBounds.pMax[a] - centroidBounds.pMin[a];
+            scale[a] = extent > 0.0f ? gridSize / extent : 0.0f;
+        }
+
+        codes.resize(nPrims);
+        order.resize(nPrims);
+        parallelBlocks(nPrims, [&](uint32_t first, uint32_t last) {
+            for (uint32_t i = first; i < last; i++) {
+                const vec3 c = primBounds[i].centroid();
+                uint64_t cell[3];
+                for (int a = 0; a < 3; a++) {
+                    cell[a] = std::min(maxCell, (uint32_t)((c[a] - centroidBounds.pMin[a]) * scale[a]));
+                }
+                codes[i] = wide ? (expandBits21(cell[0]) << 2) | (expandBits21(cell[1]) << 1) | expandBits21(cell[2])
+                                : (expandBits10(cell[0]) << 2) | (expandBits10(cell[1]) << 1) | expandBits10(cell[2]);
+                order[i] = i;
+            }
+        });
+    }
+
+    // LSD radix sort of codes (and primitive order along with them)
+    void sortMortonCodes()
+    {
+        const uint32_t nBits = settings.mortonBits > 30 ? 63 : 30;
+        const uint32_t nBlocks = std::max(1u, std::min(nPrims / 1024, pool.size() * kTasksPerThread));
+        std::vector<uint64_t> codesOut(nPrims);
+        std::vector<uint32_t> orderOut(nPrims);
+        std::vector<uint32_t> offsets(nBlocks * 256);
+
+        for (uint32_t shift = 0; shift < nBits; shift += 8) {
+            // per block digit histograms
+            std::fill(offsets.begin(), offsets.end(), 0);
+            pool.parallelFor(nBlocks, [&](uint32_t block, uint32_t threadIdx) {
+                uint32_t *histogram = &offsets[block * 256];
+                const uint32_t first = (uint32_t)((uint64_t)nPrims * block / nBlocks);
+                const uint32_t last = (uint32_t)((uint64_t)nPrims * (block + 1) / nBlocks);
+                for (uint32_t i = first; i < last; i++) {
+                    histogram[(codes[i] >> shift) & 0xff]++;
+                }
+            });
+
+            // digit major prefix sum: where each block writes each digit
+            uint32_t sum = 0;
+            bool allSame = false;
+            for (uint32_t digit = 0; digit < 256; digit++) {
+                uint32_t digitCount = 0;
+                for (uint32_t block = 0; block < nBlocks; block++) {
+                    const uint32_t count = offsets[block * 256 + digit];
+                    offsets[block * 256 + digit] = sum;
+                    sum += count;
+                    digitCount += count;
+                }
+                allSame |= digitCount == nPrims;
+            }
+            // nothing to reorder on this digit
+            if (allSame) {
+                continue;
+            }
+
+            pool.parallelFor(nBlocks, [&](uint32_t block, uint32_t threadIdx) {
+                uint32_t *offset = &offsets[block * 256];
+                const uint32_t first = (uint32_t)((uint64_t)nPrims * block / nBlocks);
+                const uint32_t last = (uint32_t)((uint64_t)nPrims * (block + 1) / nBlocks);
+                for (uint32_t i = first; i < last; i++) {
+                    const uint32_t dst = offset[(codes[i] >> shift) & 0xff]++;
+                    codesOut[dst] = codes[i];
+                    orderOut[dst] = order[i];
+                }
+            });
+            codes.swap(codesOut);
+            order.swap(orderOut);
+        }
+    }
+
+    // length of the common prefix of sorted codes i and j (-1 out of range)
+    // equal codes are told apart by their index, so all keys are unique
+    inline int delta(int64_t i, int64_t j) const
+    {
+        if (j < 0 || j >= nPrims) {
+            return -1;
+        }
+        const uint64_t x = codes[i] ^ codes[j];
+        if (x == 0) {
+            return 64 + __builtin_clz((uint32_t)(i ^ j));
+        }
+        return __builtin_clzll(x);
+    }
+
+    // every interior node finds its range and split on its own (Karras 2012)
+    void buildHierarchy()
+    {
+        nodes.resize(2 * nPrims - 1);
+        nodes[0].parent = kNoNode;
+        if (nPrims == 1) {
+            return;
+        }
+
+        parallelBlocks(nPrims - 1, [&](uint32_t first, uint32_t last) {
+            for (int64_t i = first; i < last; i++) {
+                // direction of the range: towards the neighbour sharing more bits
+                const int d = delta(i, i + 1) - delta(i, i - 1) >= 0 ? 1 : -1;
+                const int deltaMin = delta(i, i - d);
+
+                // upper bound on range length, then binary search its end
+                int64_t lMax = 2;
+                while (delta(i, i + lMax * d) > deltaMin) {
+                    lMax *= 2;
+                }
+                int64_t l = 0;
+                for (int64_t t = lMax / 2; t >= 1; t /= 2) {
+                    if (delta(i, i + (l + t) * d) > deltaMin) {
+                        l += t;
+                    }
+                }
+                const int64_t j = i + l * d;
+
+                // split: last position sharing more than deltaNode bits with i
+                const int deltaNode = delta(i, j);
+                int64_t s = 0;
+                for (int64_t t = (l + 1) / 2; ; t = (t + 1) / 2) {
+                    if (delta(i, i + (s + t) * d) > deltaNode) {
+                        s += t;
+                    }
+                    if (t == 1) {
+                        break;
+                    }
+                }
+                const int64_t split = i + s * d + std::min(d, 0);
+
+                const uint32_t left = std::min(i, j) == split ? nPrims - 1 + (uint32_t)split : (uint32_t)split;
+                const uint32_t right = std::max(i, j) == split + 1 ? nPrims - 1 + (uint32_t)split + 1 : (uint32_t)split + 1;
+                nodes[i].child[0] = left;
+                nodes[i].child[1] = right;
+                nodes[left].parent = (uint32_t)i;
+                nodes[right].parent = (uint32_t)i;
+            }
+        });
+    }
+
+    // bounds, counts, cost and collapse choice of interior node idx,
+    // from its (finished) children
+    void finishNode(uint32_t idx)
+    {
+        buildNode& node = nodes[idx];
+        const buildNode& a = nodes[node.child[0]];
+        const buildNode& b = nodes[node.child[1]];
+        node.bounds = surroundingBox(a.bounds, b.bounds);
+        node.nPrims = a.nPrims + b.nPrims;
+        const float area = node.bounds.surfaceArea();
+        node.cost = bvhTree::kTraversalCost * area + a.cost + b.cost;
+        node.nNodes = 1 + a.nNodes + b.nNodes;
+        node.collapsed = false;
+        if (node.nPrims <= kMaxPrimsInLeaf) {
+            const float leafCost = bvhTree::kIntersectCost * area * node.nPrims;
+            if (leafCost <= node.cost) {
+                node.cost = leafCost;
+                node.nNodes = 1;
+                node.collapsed = true;
+            }
+        }
+    }
+
+    // rearrange the treelet rooted at interior node root into its best SAH
+    // shape (Karras & Aila 2013), finishing all its interior nodes
+    void optimizeTreelet(uint32_t root)
+    {
+        // grow the treelet by opening up its biggest subtree until it has
+        // kTreeletSize leaves (or only primitives are left)
+        uint32_t leaves[kTreeletSize];
+        uint32_t interior[kTreeletSize - 1];
+        uint32_t nLeaves = 2, nInterior = 1;
+        leaves[0] = nodes[root].child[0];
+        leaves[1] = nodes[root].child[1];
+        interior[0] = root;
+        while (nLeaves < kTreeletSize) {
+            int best = -1;
+            float bestArea = -1.0f;
+            for (uint32_t i = 0; i < nLeaves; i++) {
+                if (!isPrimLeaf(leaves[i]) && nodes[leaves[i]].bounds.surfaceArea() > bestArea) {
+                    best = (int)i;
+                    bestArea = nodes[leaves[i]].bounds.surfaceArea();
+                }
+            }
+            if (best < 0) {
+                break;
+            }
+            const uint32_t opened = leaves[best];
+            interior[nInterior++] = opened;
+            leaves[best] = nodes[opened].child[0];
+            leaves[nLeaves++] = nodes[opened].child[1];
+        }
+        if (nLeaves < 3) {
+            finishNode(root);
+            return;
+        }
+
+        // best cost of every subset of leaves as one subtree
+        const uint32_t nSubsets = 1 << nLeaves;
+        float area[1 << kTreeletSize];
+        float cost[1 << kTreeletSize];
+        uint8_t partition[1 << kTreeletSize];
+        for (uint32_t s = 1; s < nSubsets; s++) {
+            aabb b;
+            for (uint32_t i = 0; i < nLeaves; i++) {
+                if (s & (1 << i)) {
+                    b.grow(nodes[leaves[i]].bounds);
+                }
+            }
+            area[s] = b.surfaceArea();
+        }
+        for (uint32_t i = 0; i < nLeaves; i++) {
+            cost[1 << i] = nodes[leaves[i]].cost;
+        }
+        // subsets in increasing size, so all their parts are done first
+        for (uint32_t size = 2; size <= nLeaves; size++) {
+            for (uint32_t s = 1; s < nSubsets; s++) {
+                if ((uint32_t)__builtin_popcount(s) != size) {
+                    continue;
+                }
+                // only parts holding the lowest leaf, the rest are mirrors
+                const uint32_t lowest = s & (0u - s);
+                float bestCost = FLT_MAX;
+                uint32_t bestPart = 0;
+                for (uint32_t p = (s - 1) & s; p; p = (p - 1) & s) {
+                    if (!(p & lowest)) {
+                        continue;
+                    }
+                    const float c = cost[p] + cost[s ^ p];
+                    if (c < bestCost) {
+                        bestCost = c;
+                        bestPart = p;
+                    }
+                }
+                cost[s] = bvhTree::kTraversalCost * area[s] + bestCost;
+                partition[s] = (uint8_t)bestPart;
+            }
+        }
+
+        // rebuild the treelet from the chosen partitions, reusing its
+        // interior nodes (root stays where it is for its parent)
+        uint32_t nUsed = 1;
+        std::function<void(uint32_t, uint32_t)> assign = [&](uint32_t s, uint32_t idx) {
+            const uint32_t parts[2] = { partition[s], s ^ partition[s] };
+            for (int c = 0; c < 2; c++) {
+                uint32_t child;
+                if (__builtin_popcount(parts[c]) == 1) {
+                    child = leaves[__builtin_ctz(parts[c])];
+                } else {
+                    child = interior[nUsed++];
+                    assign(parts[c], child);
+                }
+                nodes[idx].child[c] = child;
+                nodes[child].parent = idx;
+            }
+            finishNode(idx);
+        };
+        assign(nSubsets - 1, root);
+    }
+
+    // bottom-up from every leaf; the second thread to reach a node
+    // finishes it and carries on upwards, the first one stops there
+    void computeBounds()
+    {
+        const std::vector<aabb>& primBounds = *bounds;
+        std::vector<std::atomic<uint32_t>> visits(nPrims);
+        for (std::atomic<uint32_t>& v : visits) {
+            v.store(0, std::memory_order_relaxed);
+        }
+
+        parallelBlocks(nPrims, [&](uint32_t first, uint32_t last) {
+            for (uint32_t k = first; k < last; k++) {
+                const uint32_t leaf = nPrims - 1 + k;
+                buildNode& node = nodes[leaf];
+                node.bounds = primBounds[order[k]];
+                node.nPrims = 1;
+                node.nNodes = 1;
+                node.cost = bvhTree::kIntersectCost * node.bounds.surfaceArea();
+                node.collapsed = true;
+
+                uint32_t idx = nPrims > 1 ? node.parent : kNoNode;
+                while (idx != kNoNode) {
+                    if (visits[idx].fetch_add(1, std::memory_order_acq_rel) == 0) {
+                        break;
+                    }
+                    const buildNode& n = nodes[idx];
+                    if (settings.optimizeTreelets &&
+                        nodes[n.child[0]].nPrims + nodes[n.child[1]].nPrims >= kMinTreeletPrims) {
+                        optimizeTreelet(idx);
+                    } else {
+                        finishNode(idx);
+                    }
+                    idx = nodes[idx].parent;
+                }
+            }
+        });
+    }
+
+    // primitives under node idx, left to right, written from dst on
+    void gatherPrims(uint32_t idx, uint32_t dst)
+    {
+        if (isPrimLeaf(idx)) {
+            tree.primIndices[dst] = order[idx - (nPrims - 1)];
+            return;
+        }
+        const uint32_t first = nodes[idx].child[0];
+        gatherPrims(first, dst);
+        gatherPrims(nodes[idx].child[1], dst + nodes[first].nPrims);
+    }
+
+    // writes node idx at pos (and its primitives at primOffset),
+    // returns false for interior nodes, whose children still need writing
+    bool emitNode(uint32_t idx, uint32_t pos, uint32_t primOffset, uint32_t children[2])
+    {
+        const buildNode& node = nodes[idx];
+        bvhNode& out = tree.nodes[pos];
+        out.bounds = node.bounds;
+        out.pad = 0;
+        if (node.collapsed) {
+            out.offset = primOffset;
+            out.nPrims = (uint16_t)node.nPrims;
+            out.axis = 0;
+            gatherPrims(idx, primOffset);
+            return true;
+        }
+
+        // children in the order traversal expects, see childOrderAxis()
+        children[0] = node.child[0];
+        children[1] = node.child[1];
+        bool swapChildren;
+        const int axis = childOrderAxis(nodes[children[0]].bounds, nodes[children[1]].bounds, swapChildren);
+        if (swapChildren) {
+            std::swap(children[0], children[1]);
+        }
+        out.offset = pos + 1 + nodes[children[0]].nNodes;
+        out.nPrims = 0;
+        out.axis = (uint8_t)axis;
+        return false;
+    }
+
+    void emitSubtree(uint32_t idx, uint32_t pos, uint32_t primOffset)
+    {
+        uint32_t children[2];
+        if (emitNode(idx, pos, primOffset, children)) {
+            return;
+        }
+        emitSubtree(children[0], pos + 1, primOffset);
+        emitSubtree(children[1], pos + 1 + nodes[children[0]].nNodes, primOffset + nodes[children[0]].nPrims);
+    }
+
+    // top of the tree serially, until subtrees are small enough to be
+    // one task each, then the subtrees in parallel
+    void flatten()
+    {
+        const uint32_t root = nPrims > 1 ? 0 : nPrims - 1;
+        tree.nodes.resize(nodes[root].nNodes);
+        tree.primIndices.resize(nPrims);
+
+        struct subtree
+        {
+            uint32_t idx, pos, primOffset;
+        };
+        const uint32_t taskPrims = std::max(1024u, nPrims / (pool.size() * kTasksPerThread));
+        std::vector<subtree> tasks;
+        std::vector<subtree> pending = { { root, 0, 0 } };
+        while (!pending.empty()) {
+            const subtree s = pending.back();
+            pending.pop_back();
+            if (nodes[s.idx].nPrims <= taskPrims) {
+                tasks.push_back(s);
+                continue;
+            }
+            uint32_t children[2];
+            if (!emitNode(s.idx, s.pos, s.primOffset, children)) {
+                pending.push_back({ children[0], s.pos + 1, s.primOffset });
+                pending.push_back({ children[1], s.pos + 1 + nodes[children[0]].nNodes,
+                                    s.primOffset + nodes[children[0]].nPrims });
+            }
+        }
+
+        pool.parallelFor((uint32_t)tasks.size(), [&](uint32_t task, uint32_t threadIdx) {
+            emitSubtree(tasks[task].idx, tasks[task].pos, tasks[task].primOffset);
+        });
+
+        nodes.clear();
+        nodes.shrink_to_fit();
+        codes.clear();
+        codes.shrink_to_fit();
+        order.clear();
+        order.shrink_to_fit();
+    }
+
+    bvhTree& tree;
+    threadPool& pool;
+    lbvhSettings settings;
+    const std::vector<aabb> *bounds = nullptr;
+    uint32_t nPrims = 0;
+    // sorted Morton codes, and the primitive each belongs to
+    std::vector<uint64_t> codes;
+    std::vector<uint32_t> order;
+    std::vector<buildNode> nodes;
+};
+
+// (re)build tree over primitives whose bounds are given, as an LBVH
+inline void buildLinearBVH(bvhTree& tree,
+                           const std::vector<aabb>& primBounds,
+                           threadPool& pool,
+                           const lbvhSettings& settings = lbvhSettings())
+{
+    linearBvhBuilder builder(tree, pool, settings);
+    builder.build(primBounds);
+}
+
+#endif /* lbvh_h */
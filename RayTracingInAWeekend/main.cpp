@@ -10,11 +10,15 @@
 #include <fstream>
 #include <random>
 #include <chrono>
+#include <cstring>
 #include "hitable_list.hpp"
 #include "ray.hpp"
-#include "sphere.hpp"
-#include "triangle.hpp"
 #include "camera.hpp"
+#include "renderer.hpp"
+#include "wavefront.hpp"
+#include "scenes.hpp"
+#include "meshloader.hpp"
+#include "accelcache.hpp"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
@@ -23,34 +27,8 @@
 #include "stb_image.h"
 
 #define OUTPUT_DEBUG_GRADIENT 0
-constexpr uint32_t maxBounces = 50;
-constexpr uint32_t nPixelSamples = 200;
 constexpr char outputFormat[] = ".bmp";
 
-// simple 4 tupule struct to represent pixel of final image plane
-// RGBA channel ordering
-class PixelRGBA {
-public:
-    uint8_t r, g, b, a;
-    
-    PixelRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a) : r(r), g(g), b(b), a(a) {}
-    PixelRGBA() { PixelRGBA(0, 0, 0, 0); }
-    static int getNumComponents() { return 4; }
-};
-
-// A snapshot is simply an image of the world taken from a certain angle
-// Also a label to identify the shot
-class snapshot {
-public:
-    camera cam;
-    std::string label;
-    
-    snapshot() = delete;
-    snapshot(camera c,
-             const char* id) :  cam(c),
-                                label(id) {}
-};
-
 // Global image parameters
 const int outImageWidth = 400;
 const int outImageHeight = 200;
@@ -77,123 +55,77 @@ void RGGradientInto(PixelRGBA *col)
     }
 }
 
-// Background color
-// If ray hits infinity without hitting any object, return this
-// background is a light blue gradient
-vec3 bgColorAtRay(const ray& r)
+// Command line:
+// --threads N  number of render threads (default: all hardware threads)
+// --tile N     tile size in pixels (default: 16)
+// --seed N     random seed (default: 0)
+// --spp N      samples per pixel (default: 200)
+// --rr 0|1     russian roulette path termination (default: 1)
+// --adaptive 0|1    adaptive sampling (default: 0)
+// --min-spp N       adaptive: min samples per pixel (default: 16)
+// --max-spp N       adaptive: max samples per pixel (default: 800)
+// --target-error F  adaptive: relative error to stop at (default: 0.05)
+// --heatmap 0|1     also write out samples per pixel image (default: 0)
+// --sampler independent|stratified|sobol|bluenoise (default: independent)
+// --packet 0|4|8|16  trace camera rays in packets of this many (default: 0)
+// --wavefront 0|1    wavefront path tracer, fixed spp only: turns
+//                    --adaptive off (default: 0)
+// --mesh path.obj|path.ply  add a (grey diffuse) mesh to the scene, in its
+//                           own coordinates (default: none)
+// --accel-cache dir  load built BVHs (and mesh buffers) from dir, or save
+//                    them there when not found (default: always build)
+void parseArgs(int argc,
+               const char * argv[],
+               renderSettings& settings,
+               bool& heatmap,
+               bool& wavefront,
+               const char *& meshPath,
+               const char *& cacheDir)
 {
-    // This returns lerped blue fade
-    vec3 unitDir = unit_vector(r.direction());
-    float t = 0.5f * (unitDir.y() + 1.0f);
-    return (1.0f - t) * vec3(1.0f, 1.0f, 1.0f) + t * vec3(0.5f, 0.7f, 1.0f);
-}
-
-// Return color at Ray
-// for each intersection, gather color for material at point of intersection
-// and any subsequent refelected / refracted attenuated ray
-// Do this no more than bounceDepth times per ray
-//
-// If it hits nothing - return bg color
-vec3 colorAtRay(const ray& r,
-                scene& world,
-                uint32_t bounceDepth)
-{
-    intersectParams rec;
-    if (world.hit(r, 0.0001f, MAXFLOAT, rec)) {
-        ray scattered;
-        vec3 attenuation;
-        if (bounceDepth < maxBounces &&
-            rec.surfaceMat->scatter(r, rec, attenuation, scattered)) {
-            return attenuation * colorAtRay(scattered, world, bounceDepth + 1);
-        } else {
-            // exceeds max bounce
-            return vec3(0.0f);
-        }
-    }
-    
-    return bgColorAtRay(r);
-}
-
-// For a given camera / scene - do ray trace
-// and gsther collected samples into RGBA destination buffer
-// Fires 'nPixelSamples' offset randomly per pixel.
-// and applies gamma correction
-void traceInto(PixelRGBA *rgbaTarget,
-               scene& world,
-               camera& cam)
-{
-    // use std uniform random distribution to generate
-    // ray offsets. Not the best option, but it's a start
-    std::default_random_engine gen;
-    std::uniform_real_distribution<float> distr;
-
-    for (int j = outImageHeight - 1; j >= 0; j--) {
-        for (int i = 0; i < outImageWidth; i++) {
-            vec3 gather(0, 0, 0);
-            for (uint32_t s = 0; s < nPixelSamples; s++) {
-                float u = (float(i) + distr(gen)) / float(outImageWidth);
-                float v = (float(j) + distr(gen)) / float(outImageHeight);
-                ray r = cam.getRayAt(u, v);
-                gather += colorAtRay(r, world, 0);
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const uint32_t value = (uint32_t)strtoul(argv[i + 1], nullptr, 10);
+        if (!strcmp(argv[i], "--threads")) {
+            settings.nThreads = value;
+        } else if (!strcmp(argv[i], "--tile")) {
+            settings.tileSize = value;
+        } else if (!strcmp(argv[i], "--seed")) {
+            settings.seed = value;
+        } else if (!strcmp(argv[i], "--spp")) {
+            settings.nSamples = std::max(1u, value);
+        } else if (!strcmp(argv[i], "--rr")) {
+            settings.russianRoulette = value != 0;
+        } else if (!strcmp(argv[i], "--adaptive")) {
+            settings.adaptive = value != 0;
+        } else if (!strcmp(argv[i], "--min-spp")) {
+            settings.minSamples = value;
+        } else if (!strcmp(argv[i], "--max-spp")) {
+            settings.maxSamples = std::max(1u, value);
+        } else if (!strcmp(argv[i], "--target-error")) {
+            settings.targetError = strtof(argv[i + 1], nullptr);
+        } else if (!strcmp(argv[i], "--packet")) {
+            settings.packetSize = (value == 4 || value == 8 || value == 16) ? value : 0;
+        } else if (!strcmp(argv[i], "--heatmap")) {
+            heatmap = value != 0;
+        } else if (!strcmp(argv[i], "--wavefront")) {
+            wavefront = value != 0;
+        } else if (!strcmp(argv[i], "--mesh")) {
+            meshPath = argv[i + 1];
+        } else if (!strcmp(argv[i], "--accel-cache")) {
+            cacheDir = argv[i + 1];
+        } else if (!strcmp(argv[i], "--sampler")) {
+            for (samplerType type : { kIndependentSampler, kStratifiedSampler,
+                                      kSobolSampler, kBlueNoiseSampler }) {
+                if (!strcmp(argv[i + 1], samplerName(type))) {
+                    settings.sampling = type;
+                }
             }
-
-            vec3 col = gather / float(nPixelSamples);
-            // gamma correction
-            constexpr float gamma = 1.0f / 2.2f;
-            col = vec3(pow(col[0], gamma), pow(col[1], gamma), pow(col[2], gamma));
-            // convert [0, 1] -> [0, 255] ranges for rgb
-            int ir = int(255.99f * col[0]);
-            int ig = int(255.99f * col[1]);
-            int ib = int(255.99f * col[2]);
-            
-            // write to image target;
-            PixelRGBA *p = &rgbaTarget[(outImageHeight - j - 1) * outImageWidth + i];
-            p->r = ir;
-            p->g = ig;
-            p->b = ib;
-            p->a = 255;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
         }
     }
-}
-
-// Create scene data
-void generateScene(scene &world)
-{
-    // hovering triangle
-    world.objects.emplace_back(new triangle(vec3(-3.0f, 0.0f, -3.0f),
-                                            vec3( 3.0f, 1.0f, -2.0f),
-                                            vec3(-2.0f, 2.0f, -1.5f),
-                                            new metal(vec3(0.8, 0.1, 0.5))));
-    // center metallic sphere
-    world.objects.emplace_back(new sphere(vec3(0.0f, 0.0f, -1.0f),
-                                          0.5f,
-                                          new metal(vec3(0.1, 0.2, 0.5))));
-    // left refracting sphere
-    world.objects.emplace_back(new sphere(vec3(-1.0f, 0.0f, -1.0f),
-                                          0.5f,
-                                          new dielectric(1.5)));
-    // right back fuzzy metal
-    world.objects.emplace_back(new sphere(vec3(1.0f, 0.0f, -2.0f),
-                                          0.6f,
-                                          new metal(vec3(0.8, 0.8, 0.8), 0.9f)));
-    {
-        // checkerboard hovering sphere
-        flatShade* shade0 = new flatShade(vec3(0.9, 0.5, 0.0f));
-        flatShade* shade1 = new flatShade(vec3(0.9, 0.9, 0.9));
-        checkerBoard* checkTex = new checkerBoard(shade0, shade1);
-        world.objects.emplace_back(new sphere(vec3(3.0f, 2.0f, -3.0f),
-                                              1.5f,
-                                              new lambertianTexture(checkTex)));
-    }
-    
-    // Green white patterned base
-    {
-        flatShade* shade0 = new flatShade(vec3(0.2, 0.3, 0.1));
-        flatShade* shade1 = new flatShade(vec3(0.9, 0.9, 0.9));
-        checkerBoard* checkTex = new checkerBoard(shade0, shade1);
-        world.objects.emplace_back(new sphere(vec3(0.0f, -100.5f, -1.0f),
-                                              100.0f,
-                                              new lambertianTexture(checkTex)));
+    if (wavefront && settings.adaptive) {
+        fprintf(stderr, "--wavefront traces a fixed spp, ignoring --adaptive\n");
+        settings.adaptive = false;
     }
 }
 
@@ -202,6 +134,15 @@ int main(int argc, const char * argv[]) {
     int nx = outImageWidth;
     int ny = outImageHeight;
 
+    renderSettings settings;
+    settings.width = nx;
+    settings.height = ny;
+    bool heatmap = false;
+    bool wavefront = false;
+    const char *meshPath = nullptr;
+    const char *cacheDir = nullptr;
+    parseArgs(argc, argv, settings, heatmap, wavefront, meshPath, cacheDir);
+
 #if OUTPUT_DEBUG_GRADIENT
     {
         // Debug:
@@ -216,51 +157,90 @@ int main(int argc, const char * argv[]) {
 #endif
     
     {
+        threadPool pool(settings.nThreads);
+
         // create world
         scene world;
         fprintf(stderr, "\n\nGenerating world data ... ");
         generateScene(world);
         fprintf(stderr, "Done.");
+        if (meshPath) {
+            fprintf(stderr, "\nLoading mesh %s ... ", meshPath);
+            auto start = std::chrono::steady_clock::now();
+            triangleMesh *mesh = new triangleMesh(new lambertian(vec3(0.5f)));
+            uint64_t key = 0;
+            const std::string cachePath = cacheDir && hashFile(meshPath, key) ? accelCachePath(cacheDir, key) : "";
+            if (!cachePath.empty() && loadMeshCache(cachePath.c_str(), *mesh, key)) {
+                world.objects.push_back(mesh);
+                fprintf(stderr, "Done (%u vertices, %u faces, from %s).",
+                        mesh->numVertices(), mesh->numTriangles(), cachePath.c_str());
+                fprintf(stderr, "\nLoad = %lld milliseconds, peak RSS = %zu MB",
+                        (long long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count(),
+                        peakResidentBytes() >> 20);
+            } else if (loadMesh(meshPath, *mesh, pool)) {
+                auto loaded = std::chrono::steady_clock::now();
+                mesh->buildBVH();
+                auto built = std::chrono::steady_clock::now();
+                world.objects.push_back(mesh);
+                fprintf(stderr, "Done (%u vertices, %u faces).", mesh->numVertices(), mesh->numTriangles());
+                fprintf(stderr, "\nLoad = %lld milliseconds, mesh BVH = %lld milliseconds, peak RSS = %zu MB",
+                        (long long)std::chrono::duration_cast<std::chrono::milliseconds>(loaded - start).count(),
+                        (long long)std::chrono::duration_cast<std::chrono::milliseconds>(built - loaded).count(),
+                        peakResidentBytes() >> 20);
+                if (!cachePath.empty()) {
+                    saveMeshCache(cachePath.c_str(), *mesh, key);
+                }
+            } else {
+                fprintf(stderr, "\nFailed, rendering without it.");
+                delete mesh;
+            }
+        }
+        fprintf(stderr, "\nBuilding BVH ... ");
+        const uint64_t sceneKey = cacheDir ? sceneContentHash(world) : 0;
+        const std::string sceneCachePath = cacheDir ? accelCachePath(cacheDir, sceneKey) : "";
+        if (!cacheDir || !loadSceneCache(sceneCachePath.c_str(), world, sceneKey)) {
+            world.buildBVH();
+            if (cacheDir) {
+                saveSceneCache(sceneCachePath.c_str(), world, sceneKey);
+            }
+        }
+        fprintf(stderr, "Done (%zu binary nodes, %u wide).", world.accel.nodes.size(), world.accelWidth);
         
         // trace
         PixelRGBA col[nx * ny];
+        std::vector<uint32_t> sampleCounts(nx * ny);
         // Each snapshot corresponds to some camera view of the world / scene
-        std::vector<snapshot> snapshots = {
-            snapshot(camera(50.0f,
-                            aspect),
-                     "RayTrace_Image_1"),
-
-            snapshot(camera(15.0f,
-                            aspect,
-                            vec3(5.0f, 1.0f, 3.0f), // from
-                            vec3(0.0f, 1.0f, -1.0f), // At
-                            0.125f, // aperture
-                            10.0f // focal dist
-                     ),
-                     "RayTrace_Image_2"),
-            
-            snapshot(camera(25.0f,
-                            aspect,
-                            vec3(-3.5f, 0.0f, 0.0f), // from
-                            vec3(0.0f, 1.0f, -1.0f), // At
-                            0.125f, // aperture
-                            10.0f // focal dist
-                            ),
-                     "RayTrace_Image_3"),
-        };
+        std::vector<snapshot> snapshots = generateSnapshots(aspect);
         
         // generate above snapshots of the scene
-        fprintf(stderr, "\nTracing into %u x %u images, with %u samples per pixel.",
-                                outImageWidth, outImageHeight, nPixelSamples);
+        if (settings.adaptive) {
+            fprintf(stderr, "\nTracing into %u x %u images, with %u - %u samples per pixel (target error %g).",
+                    outImageWidth, outImageHeight, settings.minSamples, settings.maxSamples,
+                    settings.targetError);
+        } else {
+            fprintf(stderr, "\nTracing into %u x %u images, with %u samples per pixel.",
+                                outImageWidth, outImageHeight, settings.nSamples);
+        }
+        fprintf(stderr, "\nUsing %u threads, %u x %u tiles, %s sampler, russian roulette %s.",
+                pool.size(), settings.tileSize, settings.tileSize,
+                samplerName(settings.sampling),
+                settings.russianRoulette ? "on" : "off");
         for (snapshot& snap : snapshots) {
             // trace scene and measure time to do so
             fprintf(stderr, "\n\nGenerating scene %s ... ", snap.label.c_str());
             auto start = std::chrono::steady_clock::now();
-            traceInto(col, world, snap.cam);
+            renderStats stats = wavefront ?
+                                traceWavefront(col, settings, world, snap.cam, pool, sampleCounts.data()) :
+                                traceInto(col, settings, world, snap.cam, pool, sampleCounts.data());
             auto end = std::chrono::steady_clock::now();
             fprintf(stderr, "Done.");
             fprintf(stderr, "\nTime to Trace = %lld milliseconds",
-                    std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+                    (long long)std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+            fprintf(stderr, "\nAverage path length = %.3f segments, %.3f us per sample",
+                    (double)stats.nSegments / (double)stats.nPaths,
+                    std::chrono::duration<double, std::micro>(end - start).count() / (double)stats.nPaths);
+            fprintf(stderr, "\nAverage samples per pixel = %.1f",
+                    (double)stats.nPaths / (double)(nx * ny));
             
             // write into image
             fprintf(stderr, "\nOutputting image ... ");
@@ -270,6 +250,19 @@ int main(int argc, const char * argv[]) {
                            PixelRGBA::getNumComponents(),
                            data);
             fprintf(stderr, "Done.");
+
+            if (heatmap) {
+                fprintf(stderr, "\nOutputting sample count heatmap ... ");
+                const uint32_t maxSpp = settings.adaptive ? settings.maxSamples : settings.nSamples;
+                const uint32_t minSpp = settings.adaptive ? settings.minSamples : 0;
+                sampleHeatmapInto(col, sampleCounts.data(), nx * ny, minSpp, maxSpp);
+                std::string heatmapLabel = snap.label.substr(0, snap.label.size() - strlen(outputFormat));
+                stbi_write_bmp(heatmapLabel.append("_spp").append(outputFormat).c_str(),
+                               outImageWidth, outImageHeight,
+                               PixelRGBA::getNumComponents(),
+                               data);
+                fprintf(stderr, "Done.");
+            }
         }
         fprintf(stderr, "\nAll Done!\n");
     }
@@ -33,15 +33,158 @@ struct intersectParams;
 //
 // Currently we only generate a single scattered ray (This too can be subject to
 // multiple spawn and gathers otherwise
+//
+// Any randomness in the interaction is drawn from smp
+//
+// type tells the concrete materials below apart, so that hits can be
+// grouped by material and each group shaded with direct (non virtual)
+// scatter calls (see wavefront.hpp). Other materials are kOtherMaterial.
+//
+// attributes: surfaceAttribute bits scatter reads from the hit record
+// (uvs only for textures), the others aren't computed (see completeHit())
+enum materialType : uint8_t
+{
+    kLambertian,
+    kLambertianTexture,
+    kMetal,
+    kDielectric,
+    kOtherMaterial,
+    kNumMaterialTypes,
+};
+
 class material
 {
 public:
+    material(materialType t = kOtherMaterial,
+             uint32_t attrs = kAllSurfaceAttributes) : type(t),
+                                                       attributes(attrs) {}
+    virtual ~material() {}
+
     virtual bool scatter(const ray& ray_in,
                          const intersectParams& rec,
                          vec3& attenuation,
-                         ray& scattered) const = 0;
+                         ray& scattered,
+                         sampler& smp) const = 0;
+
+    materialType type;
+    uint32_t attributes;
 };
 
+// Two sided surfaces (mesh faces) may be hit from behind: shade the side
+// the ray is on, or diffuse bounces would go through the surface and metal
+// would absorb every path. Dielectrics keep the normal as it is, they tell
+// entering from leaving by which side of it the ray comes from.
+//
+// Called again with the new material when it's replaced after the hit
+// (instance overrides): a flip made for the previous one is undone first.
+inline void orientNormal(const ray& r, const material* mat, intersectParams& rec)
+{
+    if (!rec.twoSided) {
+        return;
+    }
+    if (rec.normalFlipped) {
+        rec.normal = -rec.normal;
+    }
+    rec.normalFlipped = dot(rec.normal, r.direction()) > 0.0f && mat->type != kDielectric;
+    if (rec.normalFlipped) {
+        rec.normal = -rec.normal;
+    }
+}
+
+inline void completeHit(const ray& r, const primitiveHit& h, intersectParams& rec)
+{
+    // start at the outermost instance, which takes the ray down to the
+    // primitive's space and the attributes back up
+    const object *top = h.nInstances > 0 ? h.instances[h.nInstances - 1] : h.prim;
+    const uint32_t level = h.nInstances > 0 ? h.nInstances - 1 : 0;
+    material *mat = top->hitMaterial(h, level);
+    top->hitAttributes(r, h, level, mat ? mat->attributes : kAllSurfaceAttributes, rec);
+    rec.surfaceMat = mat;
+    // the primitive oriented the normal for its own material, mat may be
+    // an instance's override
+    orientNormal(r, mat, rec);
+}
+
+// Scattered ray of each built in material, as free functions of its
+// parameters (attenuation is up to the caller), shared by the material
+// classes below and the flat scene's material table (flatscene.hpp)
+
+// effectively scatter with some probability
+// that probability depends on the pdf of the random fucntion
+// used in unitSphereRandomRadVec
+inline bool scatterLambertian(const intersectParams& rec,
+                              ray& scattered,
+                              sampler& smp)
+{
+    vec3 bounce = rec.p + rec.normal + unitSphereRandomRadVec(smp);
+    scattered = ray(rec.p, bounce - rec.p);
+    return true;
+}
+
+inline bool scatterMetal(float fuzziness,
+                         const ray& ray_in,
+                         const intersectParams& rec,
+                         ray& scattered,
+                         sampler& smp)
+{
+    const vec3 reflectedRay = reflect(unit_vector(ray_in.direction()), rec.normal);
+    scattered = ray(rec.p, reflectedRay + fuzziness * unitSphereRandomRadVec(smp));
+    return (dot(scattered.direction(), rec.normal) > 0);
+}
+
+inline bool scatterDielectric(float refractiveIdx,
+                              const ray& ray_in,
+                              const intersectParams& rec,
+                              ray& scattered,
+                              sampler& smp)
+{
+    vec3 outward_normal;
+    // refracted obeys snell slaw:
+    // n_i * sin(θ_i) = n_t * sin(θ_t)
+    /// when light passes from 'incident' (i) medium to 'transmitted' (t) medium
+    // here we assume in medium is always air, so n_in = 1
+    float ni_over_nt; // = sin(θ_t) / sin(θ_i)
+    float cosine;
+    
+    if (dot(ray_in.direction(), rec.normal) > 0) {
+        // normal case
+        outward_normal = -rec.normal;
+        ni_over_nt = refractiveIdx;
+        cosine = dot(ray_in.direction(), rec.normal) / ray_in.direction().length();
+        cosine = sqrt(1 - refractiveIdx * refractiveIdx * (1.0f - cosine * cosine));
+    }
+    else {
+        // ray is opposite side of surface normal
+        // due to internal reflection
+        outward_normal = rec.normal;
+        ni_over_nt = 1.0 / refractiveIdx;
+        cosine = -dot(ray_in.direction(), rec.normal) / ray_in.direction().length();
+    }
+
+    // Calculate refracted vector
+    float reflectProb = 1.0f;
+    vec3 refracted;
+    if (refract(ray_in.direction(),
+                outward_normal,
+                ni_over_nt,
+                refracted)) {
+        // Use schlick approx to approximate fresnel contribution to specular reflection
+        // if refracted
+        reflectProb = schlick(cosine, refractiveIdx);
+    }
+    
+    // refract or reflect randomly, depending on specular factor
+    if (smp.get1D() < reflectProb) {
+        // reflecteds as in metal
+        vec3 reflected = reflect(ray_in.direction(), rec.normal);
+        scattered = ray(rec.p, reflected);
+    } else {
+        scattered = ray(rec.p, refracted);
+    }
+    
+    return true;
+}
+
 // Lambertian is basic diffuse scattering
 // scatter incoming ray in a random direction
 // each bounce adds an attenuation
@@ -49,20 +192,16 @@ class lambertian : public material
 {
 public:
     lambertian() = delete;
-    lambertian(const vec3& a) : albedo(a) {}
+    lambertian(const vec3& a) : material(kLambertian, 0), albedo(a) {}
     
     virtual bool scatter(const ray& ray_in,
                          const intersectParams& rec,
                          vec3& attenuation,
-                         ray& scattered) const
+                         ray& scattered,
+                         sampler& smp) const
     {
-        // effectively scatter with some probability
-        // that probability depends on the pdf of the random fucntion
-        // used in unitSphereRandomRadVec
-        vec3 bounce = rec.p + rec.normal + unitSphereRandomRadVec();
-        scattered = ray(rec.p, bounce - rec.p);
         attenuation = albedo;
-        return true;
+        return scatterLambertian(rec, scattered, smp);
     }
     
     vec3 albedo;
@@ -74,14 +213,12 @@ class lambertianTexture : public material
 {
 public:
     lambertianTexture() = delete;
-    lambertianTexture(texture* a) : albedo(a) {}
+    lambertianTexture(texture* a) : material(kLambertianTexture, kSurfaceUV), albedo(a) {}
     
-    virtual bool scatter(const ray& ray_in, const intersectParams& rec, vec3& attenuation, ray& scattered) const
+    virtual bool scatter(const ray& ray_in, const intersectParams& rec, vec3& attenuation, ray& scattered, sampler& smp) const
     {
-        vec3 bounce = rec.p + rec.normal + unitSphereRandomRadVec();
-        scattered = ray(rec.p, bounce - rec.p);
         attenuation = albedo->texelAt(rec.u, rec.v, rec.p);
-        return true;
+        return scatterLambertian(rec, scattered, smp);
     }
     
     texture* albedo;
@@ -98,20 +235,21 @@ class metal : public material
 {
 public:
     metal() = delete;
-    metal(const vec3& a, float fuzz) : albedo(a),
+    metal(const vec3& a, float fuzz) : material(kMetal, 0),
+                                       albedo(a),
                                        fuzziness(std::max(fuzz, 1.0f)) {}
-    metal(const vec3& a): albedo(a),
+    metal(const vec3& a): material(kMetal, 0),
+                          albedo(a),
                           fuzziness(0.0f) {}
     
     virtual bool scatter(const ray& ray_in,
                          const intersectParams& rec,
                          vec3& attenuation,
-                         ray& scattered) const
+                         ray& scattered,
+                         sampler& smp) const
     {
-        const vec3 reflectedRay = reflect(unit_vector(ray_in.direction()), rec.normal);
-        scattered = ray(rec.p, reflectedRay + fuzziness * unitSphereRandomRadVec());
         attenuation = albedo;
-        return (dot(scattered.direction(), rec.normal) > 0);
+        return scatterMetal(fuzziness, ray_in, rec, scattered, smp);
     }
     
     vec3 albedo;
@@ -123,58 +261,15 @@ public:
 // scattered ray only (not both)
 class dielectric : public material {
 public:
-    dielectric(float ri) : refractiveIdx(ri) {}
+    dielectric(float ri) : material(kDielectric, 0), refractiveIdx(ri) {}
     virtual bool scatter(const ray& ray_in,
                          const intersectParams& rec,
                          vec3& attenuation,
-                         ray& scattered) const  {
-        vec3 outward_normal;
+                         ray& scattered,
+                         sampler& smp) const  {
         // no absorbtion
         attenuation = vec3(1.0, 1.0, 1.0);
-        // refracted obeys snell slaw:
-        // n_i * sin(θ_i) = n_t * sin(θ_t)
-        /// when light passes from 'incident' (i) medium to 'transmitted' (t) medium
-        // here we assume in medium is always air, so n_in = 1
-        float ni_over_nt; // = sin(θ_t) / sin(θ_i)
-        float cosine;
-        
-        if (dot(ray_in.direction(), rec.normal) > 0) {
-            // normal case
-            outward_normal = -rec.normal;
-            ni_over_nt = refractiveIdx;
-            cosine = dot(ray_in.direction(), rec.normal) / ray_in.direction().length();
-            cosine = sqrt(1 - refractiveIdx * refractiveIdx * (1.0f - cosine * cosine));
-        }
-        else {
-            // ray is opposite side of surface normal
-            // due to internal reflection
-            outward_normal = rec.normal;
-            ni_over_nt = 1.0 / refractiveIdx;
-            cosine = -dot(ray_in.direction(), rec.normal) / ray_in.direction().length();
-        }
-
-        // Calculate refracted vector
-        float reflectProb = 1.0f;
-        vec3 refracted;
-        if (refract(ray_in.direction(),
-                    outward_normal,
-                    ni_over_nt,
-                    refracted)) {
-            // Use schlick approx to approximate fresnel contribution to specular reflection
-            // if refracted
-            reflectProb = schlick(cosine, refractiveIdx);
-        }
-        
-        // refract or reflect randomly, depending on specular factor
-        if (drand48() < reflectProb) {
-            // reflecteds as in metal
-            vec3 reflected = reflect(ray_in.direction(), rec.normal);
-            scattered = ray(rec.p, reflected);
-        } else {
-            scattered = ray(rec.p, refracted);
-        }
-        
-        return true;
+        return scatterDielectric(refractiveIdx, ray_in, rec, scattered, smp);
     }
 
     float refractiveIdx;
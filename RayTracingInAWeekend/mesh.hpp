@@ -0,0 +1,526 @@
+//
+//  mesh.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 8/4/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef mesh_h
+#define mesh_h
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "hitable.hpp"
+#include "triangle.hpp"
+#include "bvh.hpp"
+#include "sbvh.hpp"
+#include "lbvh.hpp"
+
+// 8 wide packed leaves only pay off with native 8 wide vectors (AVX)
+#if SIMD_AVX
+const uint32_t kDefaultPackWidth = 8;
+#else
+const uint32_t kDefaultPackWidth = 4;
+#endif
+
+// Indexed triangle mesh
+// One object for the whole mesh instead of one triangle object per face.
+// Vertices are shared between faces and stored as structure of arrays
+// (all x, then all y, then all z), faces are 3 vertex indices each.
+// Per vertex normals and uvs are optional (empty when not given).
+//
+// A face costs 12 bytes of indices plus its share of vertices and BVH
+// (~95 bytes in all on a closed mesh) vs ~170 bytes as a triangle object
+// with its heap block, pointers and BVH entries. Faces are found through
+// the mesh's own BVH and intersected inline, without a virtual call per
+// triangle.
+//
+// After the BVH is built, faces can also be packed (packFaces()) into
+// leaves of 4 / 8 faces with precomputed edges (triangle4 / triangle8),
+// each tested against a ray with one SIMD Moller Trumbore.
+//
+// Materials are assigned to face ranges: a range starts at firstFace and
+// runs up to the start of the next one. Faces before the first range are
+// shaded with a plain grey diffuse.
+//
+// The ray / face test (Intersector) and back face handling (Facing) are
+// template policies, see triangle.hpp. triangleMesh is the default:
+// Moller Trumbore, two sided faces. Packed leaves are always Moller
+// Trumbore (with the mesh's Facing).
+template <typename Intersector = mollerTrumboreIntersector,
+          typename Facing = twoSidedFaces>
+class basicTriangleMesh : public object
+{
+public:
+    typedef Intersector intersector;
+    typedef Facing facing;
+
+    struct materialRange
+    {
+        uint32_t firstFace;
+        material *mat;
+    };
+
+    basicTriangleMesh() {}
+    basicTriangleMesh(material *mat) { setMaterial(0, mat); }
+
+    inline uint32_t numVertices() const { return (uint32_t)px.size(); }
+    inline uint32_t numTriangles() const { return (uint32_t)(indices.size() / 3); }
+    inline bool hasNormals() const { return !nx.empty(); }
+    inline bool hasUVs() const { return !tu.empty(); }
+
+    inline vec3 position(uint32_t i) const { return vec3(px[i], py[i], pz[i]); }
+    inline vec3 normal(uint32_t i) const { return vec3(nx[i], ny[i], nz[i]); }
+
+    // returns index of the new vertex
+    uint32_t addVertex(const vec3& p)
+    {
+        px.push_back(p.x());
+        py.push_back(p.y());
+        pz.push_back(p.z());
+        return numVertices() - 1;
+    }
+
+    void addTriangle(uint32_t i0, uint32_t i1, uint32_t i2)
+    {
+        indices.push_back(i0);
+        indices.push_back(i1);
+        indices.push_back(i2);
+    }
+
+    // faces from firstFace onwards (until the next range) use mat
+    void setMaterial(uint32_t firstFace, material *mat)
+    {
+        materialRange range = { firstFace, mat };
+        auto it = std::lower_bound(materials.begin(), materials.end(), range,
+            [](const materialRange& a, const materialRange& b) {
+                return a.firstFace < b.firstFace;
+            });
+        if (it != materials.end() && it->firstFace == firstFace) {
+            it->mat = mat;
+        } else {
+            materials.insert(it, range);
+        }
+    }
+
+    // faces without a material (none set, or before the first range)
+    // get defaultMaterial()
+    inline material* materialAt(uint32_t face) const
+    {
+        if (materials.size() == 1 && materials[0].firstFace == 0) {
+            return materials[0].mat ? materials[0].mat : defaultMaterial();
+        }
+        auto it = std::upper_bound(materials.begin(), materials.end(), face,
+            [](uint32_t f, const materialRange& range) {
+                return f < range.firstFace;
+            });
+        material *mat = it == materials.begin() ? nullptr : (it - 1)->mat;
+        return mat ? mat : defaultMaterial();
+    }
+
+    // plain grey diffuse, so that every hit has a material to scatter with
+    static material* defaultMaterial()
+    {
+        static lambertian grey(vec3(0.5f));
+        return &grey;
+    }
+
+    // Build BVH over faces
+    // Must be called again after vertices / faces are changed.
+    // Until then hit() falls back to testing every face.
+    // spatialSplits: SBVH build (sbvh.hpp), faces may be referenced from
+    // several leaves; worth it for meshes with long / slanted faces.
+    void buildBVH(bool spatialSplits = false)
+    {
+        unpackFaces();
+        const std::vector<aabb> faceBounds = updateBounds();
+        if (spatialSplits) {
+            buildSpatialSplitBVH(accel, faceBounds,
+                [this](uint32_t face, const aabb& refBounds, int axis, float pos, aabb& left, aabb& right) {
+                    splitTriangleBounds(position(indices[3 * face]),
+                                        position(indices[3 * face + 1]),
+                                        position(indices[3 * face + 2]),
+                                        refBounds, axis, pos, left, right);
+                });
+        } else {
+            accel.build(faceBounds);
+        }
+    }
+
+    // Same, as an LBVH (lbvh.hpp) built on pool: much faster to build for
+    // big meshes, somewhat slower to traverse
+    void buildBVH(threadPool& pool, const lbvhSettings& settings = lbvhSettings())
+    {
+        unpackFaces();
+        const std::vector<aabb> faceBounds = updateBounds();
+        buildLinearBVH(accel, faceBounds, pool, settings);
+    }
+
+    // Pack faces into leaves of width (4 or 8) faces, neighbours in the
+    // order of the BVH (buildBVH() first), with a BVH over the leaves.
+    // closestHit() / occluded() then test a leaf at a time; packets still
+    // go face by face through accel. Width 0 (or no BVH) unpacks.
+    // Must be called again after every buildBVH().
+    void packFaces(uint32_t width = kDefaultPackWidth)
+    {
+        unpackFaces();
+        if (!accel.isBuilt()) {
+            return;
+        }
+        if (width == 8) {
+            packFaces(packed8);
+        } else if (width == 4) {
+            packFaces(packed4);
+        } else {
+            return;
+        }
+        packWidth = width;
+    }
+
+    inline uint32_t packedWidth() const { return packWidth; }
+
+    // Faces are two sided by default (twoSidedFaces): loaded meshes can't
+    // be trusted to have consistent winding, and dielectrics need the back
+    // faces anyway. The normal is turned toward the ray, see orientNormal().
+    //
+    // Only t, face index and barycentrics are kept while searching;
+    // the rest of the hit record is filled in once for the closest hit
+    // (hitAttributes()).
+    bool closestHit(const ray& r,
+                    float t_min,
+                    float t_max,
+                    primitiveHit& h) const
+    {
+        uint32_t hitFace = 0;
+        float hitT = t_max, hitU = 0.0f, hitV = 0.0f;
+        auto intersect = [&](uint32_t face, const ray& r, float t_min, float& t_max) {
+            const vec3 v0 = position(indices[3 * face]);
+            const vec3 e1 = position(indices[3 * face + 1]) - v0;
+            const vec3 e2 = position(indices[3 * face + 2]) - v0;
+            float t, u, v;
+            if (Intersector::intersect(r, v0, e1, e2, Facing::kCull, t_min, t_max, t, u, v)) {
+                t_max = hitT = t;
+                hitFace = face;
+                hitU = u;
+                hitV = v;
+                return true;
+            }
+            return false;
+        };
+
+        bool didHit = false;
+        if (packWidth == 8) {
+            didHit = closestPackedHit(packed8, r, t_min, t_max, hitFace, hitT, hitU, hitV);
+        } else if (packWidth == 4) {
+            didHit = closestPackedHit(packed4, r, t_min, t_max, hitFace, hitT, hitU, hitV);
+        } else if (accel.isBuilt()) {
+            didHit = accel.traverse(r, t_min, t_max, intersect);
+        } else {
+            for (uint32_t f = 0; f < numTriangles(); f++) {
+                if (intersect(f, r, t_min, t_max)) {
+                    didHit = true;
+                }
+            }
+        }
+        if (!didHit) {
+            return false;
+        }
+
+        h.t = hitT;
+        h.b1 = hitU;
+        h.b2 = hitV;
+        h.primId = hitFace;
+        h.prim = this;
+        h.nInstances = 0;
+        return true;
+    }
+
+    material* hitMaterial(const primitiveHit& h, uint32_t level) const
+    {
+        return materialAt(h.primId);
+    }
+
+    void hitAttributes(const ray& r,
+                       const primitiveHit& h,
+                       uint32_t level,
+                       uint32_t attributes,
+                       intersectParams& rec) const
+    {
+        rec.t = h.t;
+        fillHitRecord(r, h.primId, h.b1, h.b2, rec, attributes);
+    }
+
+    // any face in (t_min, t_max) will do: the first one found ends the walk
+    bool occluded(const ray& r,
+                  float t_min,
+                  float t_max) const
+    {
+        auto intersect = [&](uint32_t face, const ray& r, float t_min, float& t_max) {
+            const vec3 v0 = position(indices[3 * face]);
+            const vec3 e1 = position(indices[3 * face + 1]) - v0;
+            const vec3 e2 = position(indices[3 * face + 2]) - v0;
+            float t, u, v;
+            return Intersector::intersect(r, v0, e1, e2, Facing::kCull, t_min, t_max, t, u, v);
+        };
+
+        if (packWidth == 8) {
+            return packedOccluded(packed8, r, t_min, t_max);
+        } else if (packWidth == 4) {
+            return packedOccluded(packed4, r, t_min, t_max);
+        } else if (accel.isBuilt()) {
+            return accel.traverse<true>(r, t_min, t_max, intersect);
+        }
+        for (uint32_t f = 0; f < numTriangles(); f++) {
+            if (intersect(f, r, t_min, t_max)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Packet hit(): faces are tested against a chunk of rays at a time,
+    // and hit records filled in for the closest hit of each ray at the end
+    uint32_t hitPacket(rayPacket4& p, uint32_t active, intersectParams *rec) const
+    {
+        return intersectPacket(p, active, rec);
+    }
+    uint32_t hitPacket(rayPacket8& p, uint32_t active, intersectParams *rec) const
+    {
+        return intersectPacket(p, active, rec);
+    }
+    uint32_t hitPacket(rayPacket16& p, uint32_t active, intersectParams *rec) const
+    {
+        return intersectPacket(p, active, rec);
+    }
+
+    using object::boundingBox;
+    bool boundingBox(aabb& box) const
+    {
+        if (numTriangles() == 0) {
+            return false;
+        }
+        if (accel.isBuilt()) {
+            box = bounds;
+            return true;
+        }
+        box = aabb();
+        for (uint32_t i = 0; i < numVertices(); i++) {
+            box.grow(position(i));
+        }
+        return true;
+    }
+
+    // bytes used by vertex, face, material and BVH data
+    size_t memoryUsage() const
+    {
+        return sizeof(float) * (px.capacity() + py.capacity() + pz.capacity() +
+                                nx.capacity() + ny.capacity() + nz.capacity() +
+                                tu.capacity() + tv.capacity()) +
+               sizeof(uint32_t) * (indices.capacity() + accel.primIndices.capacity()) +
+               sizeof(materialRange) * materials.capacity() +
+               sizeof(bvhNode) * accel.nodes.capacity() +
+               sizeof(triangle4) * packed4.capacity() +
+               sizeof(triangle8) * packed8.capacity() +
+               sizeof(uint32_t) * packedAccel.primIndices.capacity() +
+               sizeof(bvhNode) * packedAccel.nodes.capacity();
+    }
+
+    // vertex positions
+    std::vector<float> px, py, pz;
+    // optional per vertex normals
+    std::vector<float> nx, ny, nz;
+    // optional per vertex texture coords
+    std::vector<float> tu, tv;
+    // 3 vertex indices per face
+    std::vector<uint32_t> indices;
+    // sorted by firstFace
+    std::vector<materialRange> materials;
+
+    bvhTree accel;
+    aabb bounds;
+
+    // packed leaves (packFaces()) of packWidth faces, and a BVH over them
+    std::vector<triangle4> packed4;
+    std::vector<triangle8> packed8;
+    bvhTree packedAccel;
+    uint32_t packWidth = 0;
+
+private:
+    void unpackFaces()
+    {
+        packed4.clear();
+        packed8.clear();
+        packedAccel = bvhTree();
+        packWidth = 0;
+    }
+
+    // consecutive faces of accel.primIndices into packs of packT::kWidth
+    template <typename packT>
+    void packFaces(std::vector<packT>& packs)
+    {
+        const uint32_t nFaces = (uint32_t)accel.primIndices.size();
+        packs.resize((nFaces + packT::kWidth - 1) / packT::kWidth);
+        std::vector<aabb> packBounds(packs.size());
+        for (uint32_t i = 0; i < nFaces; i++) {
+            const uint32_t face = accel.primIndices[i];
+            const vec3 v0 = position(indices[3 * face]);
+            const vec3 v1 = position(indices[3 * face + 1]);
+            const vec3 v2 = position(indices[3 * face + 2]);
+            packs[i / packT::kWidth].set(i % packT::kWidth, v0, v1, v2, face);
+            packBounds[i / packT::kWidth].grow(v0);
+            packBounds[i / packT::kWidth].grow(v1);
+            packBounds[i / packT::kWidth].grow(v2);
+        }
+        packedAccel.build(packBounds);
+    }
+
+    template <typename packT>
+    bool closestPackedHit(const std::vector<packT>& packs,
+                          const ray& r,
+                          float t_min,
+                          float t_max,
+                          uint32_t& hitFace,
+                          float& hitT,
+                          float& hitU,
+                          float& hitV) const
+    {
+        return packedAccel.traverse(r, t_min, t_max,
+            [&](uint32_t pack, const ray& r, float t_min, float& t_max) {
+                float u, v;
+                const int lane = packs[pack].closestHit(r, Facing::kCull, t_min, t_max, u, v);
+                if (lane < 0) {
+                    return false;
+                }
+                hitFace = packs[pack].primId[lane];
+                hitT = t_max;
+                hitU = u;
+                hitV = v;
+                return true;
+            });
+    }
+
+    template <typename packT>
+    bool packedOccluded(const std::vector<packT>& packs, const ray& r, float t_min, float t_max) const
+    {
+        return packedAccel.traverse<true>(r, t_min, t_max,
+            [&](uint32_t pack, const ray& r, float t_min, float& t_max) {
+                typename packT::floatN t, u, v;
+                return packs[pack].intersect(r, Facing::kCull, t_min, t_max, t, u, v).any();
+            });
+    }
+
+    // recompute mesh bounds, returns the bounds of every face
+    std::vector<aabb> updateBounds()
+    {
+        bounds = aabb();
+        std::vector<aabb> faceBounds(numTriangles());
+        for (uint32_t f = 0; f < numTriangles(); f++) {
+            faceBounds[f].grow(position(indices[3 * f]));
+            faceBounds[f].grow(position(indices[3 * f + 1]));
+            faceBounds[f].grow(position(indices[3 * f + 2]));
+            bounds.grow(faceBounds[f]);
+        }
+        return faceBounds;
+    }
+
+    template <int N>
+    uint32_t intersectPacket(rayPacket<N>& p, uint32_t active, intersectParams *rec) const
+    {
+        typedef typename rayPacket<N>::floatN floatN;
+        enum { kChunkWidth = rayPacket<N>::kChunkWidth };
+        uint32_t hitFace[N];
+        float hitU[N], hitV[N];
+        auto intersect = [&](uint32_t face, rayPacket<N>& p, uint32_t lanes) {
+            const vec3 v0 = position(indices[3 * face]);
+            const vec3 e1 = position(indices[3 * face + 1]) - v0;
+            const vec3 e2 = position(indices[3 * face + 2]) - v0;
+            uint32_t hitLanes = 0;
+            for (int chunk = 0; chunk < rayPacket<N>::kChunks; chunk++) {
+                const uint32_t bits = rayPacket<N>::chunkLanes(lanes, chunk);
+                if (bits == 0) {
+                    continue;
+                }
+                floatN t, u, v;
+                const uint32_t chunkHits = (uint32_t)Intersector::intersect(p.origin(chunk), p.direction(chunk),
+                                                                            v0, e1, e2, Facing::kCull,
+                                                                            floatN(p.tMin), p.farT(chunk),
+                                                                            t, u, v).bits() & bits;
+                if (chunkHits == 0) {
+                    continue;
+                }
+                const int base = chunk * kChunkWidth;
+                float ts[kChunkWidth], us[kChunkWidth], vs[kChunkWidth];
+                t.store(ts);
+                u.store(us);
+                v.store(vs);
+                for (uint32_t laneBits = chunkHits; laneBits; laneBits &= laneBits - 1) {
+                    const int i = __builtin_ctz(laneBits);
+                    p.tMax[base + i] = ts[i];
+                    hitFace[base + i] = face;
+                    hitU[base + i] = us[i];
+                    hitV[base + i] = vs[i];
+                }
+                hitLanes |= chunkHits << base;
+            }
+            return hitLanes;
+        };
+
+        uint32_t hitLanes = 0;
+        if (accel.isBuilt()) {
+            hitLanes = accel.traversePacket(p, active, intersect);
+        } else {
+            for (uint32_t f = 0; f < numTriangles(); f++) {
+                hitLanes |= intersect(f, p, active);
+            }
+        }
+
+        for (uint32_t bits = hitLanes; bits; bits &= bits - 1) {
+            const int lane = __builtin_ctz(bits);
+            rec[lane].t = p.tMax[lane];
+            fillHitRecord(p.getRay(lane), hitFace[lane], hitU[lane], hitV[lane], rec[lane]);
+        }
+        return hitLanes;
+    }
+
+    void fillHitRecord(const ray& r,
+                       uint32_t face,
+                       float u,
+                       float v,
+                       intersectParams& rec,
+                       uint32_t attributes = kAllSurfaceAttributes) const
+    {
+        const uint32_t i0 = indices[3 * face];
+        const uint32_t i1 = indices[3 * face + 1];
+        const uint32_t i2 = indices[3 * face + 2];
+        const float w = 1.0f - u - v;
+
+        rec.p = r.point_at_parameter(rec.t);
+        if (hasNormals()) {
+            rec.normal = unit_vector(w * normal(i0) + u * normal(i1) + v * normal(i2));
+        } else {
+            const vec3 v0 = position(i0);
+            rec.normal = unit_vector(cross(position(i1) - v0, position(i2) - v0));
+        }
+        if ((attributes & kSurfaceUV) == 0) {
+            // not needed, but cheap: keep something defined
+            rec.u = u;
+            rec.v = v;
+        } else if (hasUVs()) {
+            rec.u = w * tu[i0] + u * tu[i1] + v * tu[i2];
+            rec.v = w * tv[i0] + u * tv[i1] + v * tv[i2];
+        } else {
+            rec.u = u;
+            rec.v = v;
+        }
+        rec.surfaceMat = materialAt(face);
+        rec.twoSided = true;
+        rec.normalFlipped = false;
+        orientNormal(r, rec.surfaceMat, rec);
+    }
+};
+
+typedef basicTriangleMesh<> triangleMesh;
+
+#endif /* mesh_h */
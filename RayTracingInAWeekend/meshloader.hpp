@@ -0,0 +1,1080 @@
+//
+//  meshloader.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 8/11/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef meshloader_h
+#define meshloader_h
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <unordered_map>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "mesh.hpp"
+#include "threadpool.hpp"
+
+// Mesh loaders (Wavefront OBJ, binary PLY)
+//
+// Files are memory mapped rather than read, so the OS pages them in as the
+// parser walks over them and nothing is copied into an intermediate buffer.
+// Parsing is split into chunks that run in parallel on a threadPool, and
+// vertices / faces go straight into the triangleMesh buffers (sized up front)
+// with no per triangle allocation.
+//
+// Loaders return false on failure, after printing why to stderr.
+// They only fill the mesh, call triangleMesh::buildBVH() afterwards.
+
+// read only memory mapping of a whole file
+class mappedFile
+{
+public:
+    mappedFile() : ptr(nullptr), length(0) {}
+    ~mappedFile() { unmap(); }
+
+    mappedFile(const mappedFile&) = delete;
+    mappedFile& operator=(const mappedFile&) = delete;
+
+    bool map(const char *path)
+    {
+        unmap();
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            close(fd);
+            return false;
+        }
+        void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        // every chunk is read front to back
+        madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+        ptr = (const char *)p;
+        length = (size_t)st.st_size;
+        return true;
+    }
+
+    void unmap()
+    {
+        if (ptr) {
+            munmap((void *)ptr, length);
+            ptr = nullptr;
+            length = 0;
+        }
+    }
+
+    inline const char* data() const { return ptr; }
+    inline size_t size() const { return length; }
+
+private:
+    const char *ptr;
+    size_t length;
+};
+
+// high water mark of resident memory of this process, in bytes
+inline size_t peakResidentBytes()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return (size_t)usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+// Text parsing helpers
+// All take the current position and the end of the buffer (the mapping
+// is not 0 terminated) and return the position after what they consumed.
+
+inline bool isBlank(char c) { return c == ' ' || c == '\t'; }
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+inline bool isLineEnd(char c) { return c == '\n' || c == '\r'; }
+
+inline const char* skipBlanks(const char *p, const char *end)
+{
+    while (p < end && isBlank(*p)) {
+        p++;
+    }
+    return p;
+}
+
+inline const char* skipLine(const char *p, const char *end)
+{
+    const char *nl = (const char *)memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
+
+inline const char* parseInt(const char *p, const char *end, int64_t& out)
+{
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = *p == '-';
+        p++;
+    }
+    int64_t value = 0;
+    while (p < end && isDigit(*p)) {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+    out = neg ? -value : value;
+    return p;
+}
+
+// decimal / scientific notation, no locale (strtof) or 0 termination needed
+// keeps up to 19 significant digits, which is well past float precision
+inline const char* parseFloat(const char *p, const char *end, float& out)
+{
+    static const double powersOf10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = *p == '-';
+        p++;
+    }
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int nDigits = 0;
+    while (p < end && isDigit(*p)) {
+        if (nDigits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            nDigits += mantissa != 0;
+        } else {
+            exponent++;
+        }
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && isDigit(*p)) {
+            if (nDigits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                nDigits += mantissa != 0;
+                exponent--;
+            }
+            p++;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        int64_t e;
+        p = parseInt(p + 1, end, e);
+        exponent += (int)std::max<int64_t>(-400, std::min<int64_t>(400, e));
+    }
+
+    double value = (double)mantissa;
+    if (exponent < 0) {
+        value = -exponent <= 22 ? value / powersOf10[-exponent] : value * pow(10.0, exponent);
+    } else if (exponent > 0) {
+        value = exponent <= 22 ? value * powersOf10[exponent] : value * pow(10.0, exponent);
+    }
+    out = (float)(neg ? -value : value);
+    return p;
+}
+
+// Wavefront OBJ
+//
+// Supported: v, vt, vn, f (polygons are fan triangulated, negative i.e.
+// relative indices are allowed). Everything else (groups, usemtl, lines,
+// smoothing groups, ...) is skipped, the whole mesh uses its one material.
+//
+// Two passes over the chunks, both in parallel:
+// 1. count v / vt / vn lines and triangles per chunk, the running totals
+//    give every chunk its first vertex and first face in the output
+// 2. parse, writing vertices and faces to their final place
+//
+// The mesh has one index per vertex, OBJ has separate ones for positions,
+// uvs and normals. When a file's uv / normal indices are the same as the
+// position ones (or absent) they are used as is, otherwise vertices are
+// split per unique (position, uv, normal) combination in a final serial pass.
+namespace objDetail
+{
+    // no uv / normal given for a face corner
+    constexpr uint32_t kNoIndex = UINT32_MAX;
+    // index 0, or relative index before the first element
+    constexpr uint32_t kBadIndex = UINT32_MAX - 1;
+
+    struct chunk
+    {
+        const char *begin;
+        const char *end;
+        // counts within the chunk (pass 1)
+        uint32_t nPositions = 0;
+        uint32_t nUVs = 0;
+        uint32_t nNormals = 0;
+        uint64_t nTriangles = 0;
+        // first of each in the whole file (prefix sums of the counts)
+        uint32_t firstPosition = 0;
+        uint32_t firstUV = 0;
+        uint32_t firstNormal = 0;
+        uint64_t firstTriangle = 0;
+        bool failed = false;
+    };
+
+    // line type from its first characters, p is past leading blanks
+    enum lineType { kOther, kPosition, kUV, kNormal, kFace };
+
+    inline lineType classify(const char *p, const char *end, const char *&after)
+    {
+        if (end - p < 2) {
+            return kOther;
+        }
+        if (p[0] == 'v') {
+            if (isBlank(p[1])) {
+                after = p + 2;
+                return kPosition;
+            }
+            if (end - p >= 3 && isBlank(p[2])) {
+                after = p + 3;
+                return p[1] == 't' ? kUV : (p[1] == 'n' ? kNormal : kOther);
+            }
+        } else if (p[0] == 'f' && isBlank(p[1])) {
+            after = p + 2;
+            return kFace;
+        }
+        return kOther;
+    }
+
+    // corners of a face line (whitespace separated tokens)
+    inline uint32_t countCorners(const char *p, const char *end)
+    {
+        uint32_t n = 0;
+        while (true) {
+            p = skipBlanks(p, end);
+            if (p >= end || isLineEnd(*p) || *p == '#') {
+                return n;
+            }
+            n++;
+            while (p < end && !isBlank(*p) && !isLineEnd(*p)) {
+                p++;
+            }
+        }
+    }
+
+    inline void countChunk(chunk& c)
+    {
+        const char *p = c.begin;
+        while (p < c.end) {
+            p = skipBlanks(p, c.end);
+            const char *after = p;
+            switch (classify(p, c.end, after)) {
+                case kPosition: c.nPositions++; break;
+                case kUV: c.nUVs++; break;
+                case kNormal: c.nNormals++; break;
+                case kFace: {
+                    const uint32_t n = countCorners(after, c.end);
+                    c.nTriangles += n >= 3 ? n - 2 : 0;
+                    break;
+                }
+                case kOther: break;
+            }
+            p = skipLine(p, c.end);
+        }
+    }
+
+    // 1 based (or negative = relative to count so far) -> 0 based
+    inline uint32_t resolveIndex(int64_t idx, uint32_t countSoFar)
+    {
+        if (idx < 0) {
+            idx += countSoFar + 1;
+        }
+        return idx > 0 && idx < kBadIndex ? (uint32_t)(idx - 1) : kBadIndex;
+    }
+
+    // corner: v, v/t, v//n or v/t/n
+    inline const char* parseCorner(const char *p,
+                                   const char *end,
+                                   uint32_t nPositions,
+                                   uint32_t nUVs,
+                                   uint32_t nNormals,
+                                   uint32_t& v,
+                                   uint32_t& t,
+                                   uint32_t& n)
+    {
+        int64_t idx;
+        p = parseInt(p, end, idx);
+        v = resolveIndex(idx, nPositions);
+        t = n = kNoIndex;
+        if (p < end && *p == '/') {
+            p++;
+            if (p < end && *p != '/') {
+                p = parseInt(p, end, idx);
+                t = resolveIndex(idx, nUVs);
+            }
+            if (p < end && *p == '/') {
+                p = parseInt(p + 1, end, idx);
+                n = resolveIndex(idx, nNormals);
+            }
+        }
+        while (p < end && !isBlank(*p) && !isLineEnd(*p)) {
+            p++;
+        }
+        return p;
+    }
+
+    // uv / normal index of every face corner, only kept when the file has them
+    struct cornerAttributes
+    {
+        std::vector<uint32_t> uv;
+        std::vector<uint32_t> normal;
+    };
+
+    inline void parseChunk(chunk& c,
+                           triangleMesh& mesh,
+                           std::vector<float>& uvs,
+                           std::vector<float>& normals,
+                           cornerAttributes& corners)
+    {
+        uint32_t nPositions = c.firstPosition;
+        uint32_t nUVs = c.firstUV;
+        uint32_t nNormals = c.firstNormal;
+        uint64_t tri = c.firstTriangle;
+        const uint32_t nTotalPositions = mesh.numVertices();
+        const bool keepUVs = !corners.uv.empty();
+        const bool keepNormals = !corners.normal.empty();
+
+        const char *p = c.begin;
+        while (p < c.end) {
+            p = skipBlanks(p, c.end);
+            const char *after = p;
+            switch (classify(p, c.end, after)) {
+                case kPosition: {
+                    float x, y, z;
+                    after = parseFloat(skipBlanks(after, c.end), c.end, x);
+                    after = parseFloat(skipBlanks(after, c.end), c.end, y);
+                    parseFloat(skipBlanks(after, c.end), c.end, z);
+                    mesh.px[nPositions] = x;
+                    mesh.py[nPositions] = y;
+                    mesh.pz[nPositions] = z;
+                    nPositions++;
+                    break;
+                }
+                case kUV: {
+                    float u = 0.0f, v = 0.0f;
+                    after = parseFloat(skipBlanks(after, c.end), c.end, u);
+                    parseFloat(skipBlanks(after, c.end), c.end, v);
+                    uvs[2 * nUVs] = u;
+                    uvs[2 * nUVs + 1] = v;
+                    nUVs++;
+                    break;
+                }
+                case kNormal: {
+                    float x, y, z;
+                    after = parseFloat(skipBlanks(after, c.end), c.end, x);
+                    after = parseFloat(skipBlanks(after, c.end), c.end, y);
+                    parseFloat(skipBlanks(after, c.end), c.end, z);
+                    normals[3 * nNormals] = x;
+                    normals[3 * nNormals + 1] = y;
+                    normals[3 * nNormals + 2] = z;
+                    nNormals++;
+                    break;
+                }
+                case kFace: {
+                    // fan: (c0, c1, c2), (c0, c2, c3), ...
+                    uint32_t v[3], t[3], n[3];
+                    uint32_t corner = 0;
+                    const char *q = after;
+                    while (true) {
+                        q = skipBlanks(q, c.end);
+                        if (q >= c.end || isLineEnd(*q) || *q == '#') {
+                            break;
+                        }
+                        const uint32_t slot = corner < 3 ? corner : 2;
+                        if (corner >= 3) {
+                            v[1] = v[2];
+                            t[1] = t[2];
+                            n[1] = n[2];
+                        }
+                        q = parseCorner(q, c.end, nPositions, nUVs, nNormals, v[slot], t[slot], n[slot]);
+                        if (v[slot] >= nTotalPositions) {
+                            c.failed = true;
+                            return;
+                        }
+                        corner++;
+                        if (corner >= 3) {
+                            for (int k = 0; k < 3; k++) {
+                                mesh.indices[3 * tri + k] = v[k];
+                                if (keepUVs) {
+                                    corners.uv[3 * tri + k] = t[k];
+                                }
+                                if (keepNormals) {
+                                    corners.normal[3 * tri + k] = n[k];
+                                }
+                            }
+                            tri++;
+                        }
+                    }
+                    break;
+                }
+                case kOther: break;
+            }
+            p = skipLine(p, c.end);
+        }
+    }
+
+    // true if every corner's attribute index equals its position index
+    // (or is missing), i.e. attributes can be used per vertex as they are
+    inline bool sharesPositionIndex(const std::vector<uint32_t>& attr,
+                                    const std::vector<uint32_t>& indices,
+                                    uint32_t nAttributes)
+    {
+        for (size_t i = 0; i < attr.size(); i++) {
+            if (attr[i] != kNoIndex && (attr[i] != indices[i] || attr[i] >= nAttributes)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    struct cornerKey
+    {
+        uint32_t v, t, n;
+        bool operator==(const cornerKey& o) const { return v == o.v && t == o.t && n == o.n; }
+    };
+
+    struct cornerKeyHash
+    {
+        size_t operator()(const cornerKey& k) const
+        {
+            uint64_t h = k.v * 0x9E3779B97F4A7C15ull;
+            h ^= (uint64_t)k.t + 0x7F4A7C159E3779B9ull + (h << 6) + (h >> 2);
+            h ^= (uint64_t)k.n + 0x94D049BB133111EBull + (h << 6) + (h >> 2);
+            return (size_t)h;
+        }
+    };
+
+    // one output vertex per unique (position, uv, normal) corner
+    inline bool splitVertices(triangleMesh& mesh,
+                              const std::vector<float>& uvs,
+                              const std::vector<float>& normals,
+                              const cornerAttributes& corners)
+    {
+        const bool keepUVs = !corners.uv.empty();
+        const bool keepNormals = !corners.normal.empty();
+        const uint32_t nUVs = (uint32_t)(uvs.size() / 2);
+        const uint32_t nNormals = (uint32_t)(normals.size() / 3);
+
+        std::vector<float> px, py, pz, nx, ny, nz, tu, tv;
+        std::vector<uint32_t> indices(mesh.indices.size());
+        std::unordered_map<cornerKey, uint32_t, cornerKeyHash> remap;
+        remap.reserve(mesh.numVertices());
+        for (size_t i = 0; i < mesh.indices.size(); i++) {
+            const cornerKey key = { mesh.indices[i],
+                                    keepUVs ? corners.uv[i] : kNoIndex,
+                                    keepNormals ? corners.normal[i] : kNoIndex };
+            if ((key.t != kNoIndex && key.t >= nUVs) ||
+                (key.n != kNoIndex && key.n >= nNormals)) {
+                return false;
+            }
+            auto it = remap.find(key);
+            if (it == remap.end()) {
+                it = remap.emplace(key, (uint32_t)px.size()).first;
+                px.push_back(mesh.px[key.v]);
+                py.push_back(mesh.py[key.v]);
+                pz.push_back(mesh.pz[key.v]);
+                if (keepUVs) {
+                    tu.push_back(key.t != kNoIndex ? uvs[2 * key.t] : 0.0f);
+                    tv.push_back(key.t != kNoIndex ? uvs[2 * key.t + 1] : 0.0f);
+                }
+                if (keepNormals) {
+                    // corners without a normal get the normal of their face
+                    vec3 n;
+                    if (key.n != kNoIndex) {
+                        n = vec3(normals[3 * key.n], normals[3 * key.n + 1], normals[3 * key.n + 2]);
+                    } else {
+                        const size_t face = i / 3;
+                        const vec3 v0 = mesh.position(mesh.indices[3 * face]);
+                        n = cross(mesh.position(mesh.indices[3 * face + 1]) - v0,
+                                  mesh.position(mesh.indices[3 * face + 2]) - v0);
+                    }
+                    nx.push_back(n.x());
+                    ny.push_back(n.y());
+                    nz.push_back(n.z());
+                }
+            }
+            indices[i] = it->second;
+        }
+        mesh.px.swap(px);
+        mesh.py.swap(py);
+        mesh.pz.swap(pz);
+        mesh.nx.swap(nx);
+        mesh.ny.swap(ny);
+        mesh.nz.swap(nz);
+        mesh.tu.swap(tu);
+        mesh.tv.swap(tv);
+        mesh.indices.swap(indices);
+        return true;
+    }
+}
+
+// chunks of at least this many bytes are handed to each parallel task
+constexpr size_t kMinParseChunkBytes = 1 << 20;
+
+bool loadOBJ(const char *path, triangleMesh& mesh, threadPool& pool)
+{
+    using namespace objDetail;
+
+    mappedFile file;
+    if (!file.map(path)) {
+        fprintf(stderr, "\nCould not open %s", path);
+        return false;
+    }
+
+    // split on line boundaries, a few chunks per thread so that
+    // work stealing can even out dense / sparse parts of the file
+    const char *begin = file.data();
+    const char *end = begin + file.size();
+    const size_t nChunksWanted = std::max<size_t>(1, std::min<size_t>(8 * pool.size(),
+                                                                      file.size() / kMinParseChunkBytes));
+    std::vector<chunk> chunks;
+    const char *p = begin;
+    for (size_t i = 1; i <= nChunksWanted && p < end; i++) {
+        const char *split = i == nChunksWanted ? end : begin + file.size() * i / nChunksWanted;
+        split = split <= p ? p : split;
+        split = split < end ? skipLine(split, end) : end;
+        chunk c;
+        c.begin = p;
+        c.end = split;
+        chunks.push_back(c);
+        p = split;
+    }
+
+    pool.parallelFor((uint32_t)chunks.size(), [&](uint32_t i, uint32_t threadIdx) {
+        countChunk(chunks[i]);
+    });
+
+    uint64_t nPositions = 0, nUVs = 0, nNormals = 0, nTriangles = 0;
+    for (chunk& c : chunks) {
+        c.firstPosition = (uint32_t)nPositions;
+        c.firstUV = (uint32_t)nUVs;
+        c.firstNormal = (uint32_t)nNormals;
+        c.firstTriangle = nTriangles;
+        nPositions += c.nPositions;
+        nUVs += c.nUVs;
+        nNormals += c.nNormals;
+        nTriangles += c.nTriangles;
+    }
+    if (nPositions > UINT32_MAX || nTriangles > UINT32_MAX / 3) {
+        fprintf(stderr, "\n%s: too many vertices / faces", path);
+        return false;
+    }
+
+    mesh.px.assign(nPositions, 0.0f);
+    mesh.py.assign(nPositions, 0.0f);
+    mesh.pz.assign(nPositions, 0.0f);
+    mesh.nx.clear();
+    mesh.ny.clear();
+    mesh.nz.clear();
+    mesh.tu.clear();
+    mesh.tv.clear();
+    mesh.indices.assign(3 * nTriangles, 0);
+    std::vector<float> uvs(2 * nUVs);
+    std::vector<float> normals(3 * nNormals);
+    cornerAttributes corners;
+    if (nUVs > 0) {
+        corners.uv.assign(3 * nTriangles, kNoIndex);
+    }
+    if (nNormals > 0) {
+        corners.normal.assign(3 * nTriangles, kNoIndex);
+    }
+
+    pool.parallelFor((uint32_t)chunks.size(), [&](uint32_t i, uint32_t threadIdx) {
+        parseChunk(chunks[i], mesh, uvs, normals, corners);
+    });
+    for (const chunk& c : chunks) {
+        if (c.failed) {
+            fprintf(stderr, "\n%s: face refers to a vertex that doesn't exist", path);
+            return false;
+        }
+    }
+
+    const bool uvsShared = corners.uv.empty() ||
+                           (nUVs == nPositions && sharesPositionIndex(corners.uv, mesh.indices, (uint32_t)nUVs));
+    const bool normalsShared = corners.normal.empty() ||
+                               (nNormals == nPositions && sharesPositionIndex(corners.normal, mesh.indices, (uint32_t)nNormals));
+    if (uvsShared && normalsShared) {
+        if (!corners.uv.empty()) {
+            mesh.tu.resize(nUVs);
+            mesh.tv.resize(nUVs);
+            for (uint32_t i = 0; i < nUVs; i++) {
+                mesh.tu[i] = uvs[2 * i];
+                mesh.tv[i] = uvs[2 * i + 1];
+            }
+        }
+        if (!corners.normal.empty()) {
+            mesh.nx.resize(nNormals);
+            mesh.ny.resize(nNormals);
+            mesh.nz.resize(nNormals);
+            for (uint32_t i = 0; i < nNormals; i++) {
+                mesh.nx[i] = normals[3 * i];
+                mesh.ny[i] = normals[3 * i + 1];
+                mesh.nz[i] = normals[3 * i + 2];
+            }
+        }
+    } else if (!splitVertices(mesh, uvs, normals, corners)) {
+        fprintf(stderr, "\n%s: face refers to a uv / normal that doesn't exist", path);
+        return false;
+    }
+
+    return true;
+}
+
+// Binary PLY (little or big endian)
+//
+// vertex element: x, y, z and optionally nx, ny, nz and u, v (or s, t /
+// texture_u, texture_v), any scalar types. face element: a list property
+// vertex_indices (or vertex_index), polygons are fan triangulated.
+// Other elements / properties are skipped.
+//
+// Vertices are a fixed size record, so they are converted in parallel
+// blocks straight from the mapping. Faces are too when every face is a
+// triangle with a fixed size record (by far the common case, checked up
+// front), otherwise they are read serially.
+namespace plyDetail
+{
+    enum scalarType { kInvalid, kInt8, kUInt8, kInt16, kUInt16, kInt32, kUInt32, kFloat32, kFloat64 };
+
+    inline scalarType parseType(const std::string& name)
+    {
+        if (name == "char" || name == "int8") return kInt8;
+        if (name == "uchar" || name == "uint8") return kUInt8;
+        if (name == "short" || name == "int16") return kInt16;
+        if (name == "ushort" || name == "uint16") return kUInt16;
+        if (name == "int" || name == "int32") return kInt32;
+        if (name == "uint" || name == "uint32") return kUInt32;
+        if (name == "float" || name == "float32") return kFloat32;
+        if (name == "double" || name == "float64") return kFloat64;
+        return kInvalid;
+    }
+
+    inline size_t typeSize(scalarType type)
+    {
+        switch (type) {
+            case kInt8: case kUInt8: return 1;
+            case kInt16: case kUInt16: return 2;
+            case kInt32: case kUInt32: case kFloat32: return 4;
+            case kFloat64: return 8;
+            default: return 0;
+        }
+    }
+
+    // reads a value of the given type, byte swapped if the file's
+    // endianness differs from ours
+    inline double readScalar(const char *p, scalarType type, bool swap)
+    {
+        unsigned char b[8] = {};
+        const size_t n = typeSize(type);
+        for (size_t i = 0; i < n; i++) {
+            b[i] = (unsigned char)p[swap ? n - 1 - i : i];
+        }
+        switch (type) {
+            case kInt8: { int8_t v; memcpy(&v, b, 1); return v; }
+            case kUInt8: { uint8_t v; memcpy(&v, b, 1); return v; }
+            case kInt16: { int16_t v; memcpy(&v, b, 2); return v; }
+            case kUInt16: { uint16_t v; memcpy(&v, b, 2); return v; }
+            case kInt32: { int32_t v; memcpy(&v, b, 4); return v; }
+            case kUInt32: { uint32_t v; memcpy(&v, b, 4); return v; }
+            case kFloat32: { float v; memcpy(&v, b, 4); return v; }
+            case kFloat64: { double v; memcpy(&v, b, 8); return v; }
+            default: return 0.0;
+        }
+    }
+
+    struct property
+    {
+        std::string name;
+        scalarType type = kInvalid;
+        // lists: type of the count, type is the type of the items
+        bool isList = false;
+        scalarType countType = kInvalid;
+        // byte offset within a fixed size record
+        size_t offset = 0;
+    };
+
+    struct element
+    {
+        std::string name;
+        uint64_t count = 0;
+        std::vector<property> properties;
+
+        // size of one record, 0 if it contains lists (variable size)
+        size_t fixedSize() const
+        {
+            size_t size = 0;
+            for (const property& prop : properties) {
+                if (prop.isList) {
+                    return 0;
+                }
+                size += typeSize(prop.type);
+            }
+            return size;
+        }
+
+        const property* find(const char *name) const
+        {
+            for (const property& prop : properties) {
+                if (prop.name == name) {
+                    return &prop;
+                }
+            }
+            return nullptr;
+        }
+
+        // first of several alternative names
+        const property* find(const char *a, const char *b, const char *c = nullptr) const
+        {
+            const property *prop = find(a);
+            prop = prop ? prop : find(b);
+            return prop || !c ? prop : find(c);
+        }
+    };
+
+    // size of one variable size record starting at p, 0 if it runs past end
+    inline size_t recordSize(const element& elem, const char *p, const char *end, bool swap)
+    {
+        size_t size = 0;
+        for (const property& prop : elem.properties) {
+            if (prop.isList) {
+                if (p + size + typeSize(prop.countType) > end) {
+                    return 0;
+                }
+                const uint64_t n = (uint64_t)readScalar(p + size, prop.countType, swap);
+                size += typeSize(prop.countType) + n * typeSize(prop.type);
+            } else {
+                size += typeSize(prop.type);
+            }
+        }
+        return p + size > end ? 0 : size;
+    }
+
+    inline bool parseHeader(const char *&p,
+                            const char *end,
+                            bool& bigEndian,
+                            std::vector<element>& elements,
+                            std::string& error)
+    {
+        if (end - p < 4 || strncmp(p, "ply", 3) != 0 || !isLineEnd(p[3])) {
+            error = "not a PLY file";
+            return false;
+        }
+        bool haveFormat = false;
+        while (p < end) {
+            const char *lineEnd = (const char *)memchr(p, '\n', end - p);
+            if (!lineEnd) {
+                break;
+            }
+            std::string line(p, lineEnd);
+            p = lineEnd + 1;
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+
+            std::vector<std::string> words;
+            size_t pos = 0;
+            while (pos < line.size()) {
+                const size_t start = line.find_first_not_of(" \t", pos);
+                if (start == std::string::npos) {
+                    break;
+                }
+                pos = line.find_first_of(" \t", start);
+                words.push_back(line.substr(start, pos == std::string::npos ? std::string::npos : pos - start));
+            }
+            if (words.empty()) {
+                continue;
+            }
+
+            if (words[0] == "end_header") {
+                if (!haveFormat) {
+                    error = "missing format";
+                    return false;
+                }
+                return true;
+            } else if (words[0] == "format" && words.size() >= 2) {
+                if (words[1] == "binary_little_endian") {
+                    bigEndian = false;
+                } else if (words[1] == "binary_big_endian") {
+                    bigEndian = true;
+                } else {
+                    error = "only binary PLY files are supported";
+                    return false;
+                }
+                haveFormat = true;
+            } else if (words[0] == "element" && words.size() >= 3) {
+                element elem;
+                elem.name = words[1];
+                elem.count = strtoull(words[2].c_str(), nullptr, 10);
+                elements.push_back(elem);
+            } else if (words[0] == "property" && !elements.empty()) {
+                property prop;
+                if (words.size() >= 5 && words[1] == "list") {
+                    prop.isList = true;
+                    prop.countType = parseType(words[2]);
+                    prop.type = parseType(words[3]);
+                    prop.name = words[4];
+                    if (prop.countType == kInvalid || prop.countType == kFloat32 || prop.countType == kFloat64) {
+                        prop.countType = kInvalid;
+                    }
+                } else if (words.size() >= 3) {
+                    prop.type = parseType(words[1]);
+                    prop.name = words[2];
+                }
+                if (prop.type == kInvalid || (prop.isList && prop.countType == kInvalid)) {
+                    error = "unknown property type";
+                    return false;
+                }
+                element& elem = elements.back();
+                for (const property& other : elem.properties) {
+                    prop.offset += other.isList ? 0 : typeSize(other.type);
+                }
+                elem.properties.push_back(prop);
+            }
+            // comment, obj_info etc. are skipped
+        }
+        error = "missing end_header";
+        return false;
+    }
+
+    // vertex records in [first, last) -> mesh buffers
+    inline void readVertices(const element& elem,
+                             const char *data,
+                             size_t stride,
+                             bool swap,
+                             uint64_t first,
+                             uint64_t last,
+                             triangleMesh& mesh)
+    {
+        const property *x = elem.find("x");
+        const property *y = elem.find("y");
+        const property *z = elem.find("z");
+        const property *nx = elem.find("nx");
+        const property *ny = elem.find("ny");
+        const property *nz = elem.find("nz");
+        const property *u = elem.find("u", "s", "texture_u");
+        const property *v = elem.find("v", "t", "texture_v");
+        const bool hasNormals = !mesh.nx.empty();
+        const bool hasUVs = !mesh.tu.empty();
+        for (uint64_t i = first; i < last; i++) {
+            const char *rec = data + i * stride;
+            mesh.px[i] = (float)readScalar(rec + x->offset, x->type, swap);
+            mesh.py[i] = (float)readScalar(rec + y->offset, y->type, swap);
+            mesh.pz[i] = (float)readScalar(rec + z->offset, z->type, swap);
+            if (hasNormals) {
+                mesh.nx[i] = (float)readScalar(rec + nx->offset, nx->type, swap);
+                mesh.ny[i] = (float)readScalar(rec + ny->offset, ny->type, swap);
+                mesh.nz[i] = (float)readScalar(rec + nz->offset, nz->type, swap);
+            }
+            if (hasUVs) {
+                mesh.tu[i] = (float)readScalar(rec + u->offset, u->type, swap);
+                mesh.tv[i] = (float)readScalar(rec + v->offset, v->type, swap);
+            }
+        }
+    }
+}
+
+bool loadPLY(const char *path, triangleMesh& mesh, threadPool& pool)
+{
+    using namespace plyDetail;
+
+    mappedFile file;
+    if (!file.map(path)) {
+        fprintf(stderr, "\nCould not open %s", path);
+        return false;
+    }
+
+    const char *p = file.data();
+    const char *end = p + file.size();
+    bool bigEndian = false;
+    std::vector<element> elements;
+    std::string error;
+    if (!parseHeader(p, end, bigEndian, elements, error)) {
+        fprintf(stderr, "\n%s: %s", path, error.c_str());
+        return false;
+    }
+    const uint16_t endianTest = 1;
+    const bool swap = bigEndian == (*(const uint8_t *)&endianTest == 1);
+
+    mesh.px.clear();
+    mesh.py.clear();
+    mesh.pz.clear();
+    mesh.nx.clear();
+    mesh.ny.clear();
+    mesh.nz.clear();
+    mesh.tu.clear();
+    mesh.tv.clear();
+    mesh.indices.clear();
+
+    // elements are stored back to back, in header order
+    for (const element& elem : elements) {
+        const size_t stride = elem.fixedSize();
+        const uint64_t nBlocks = std::max<uint64_t>(1, std::min<uint64_t>(8 * pool.size(),
+                                     elem.count * std::max<size_t>(stride, 1) / kMinParseChunkBytes));
+
+        if (elem.name == "vertex") {
+            if (!elem.find("x") || !elem.find("y") || !elem.find("z") || stride == 0) {
+                fprintf(stderr, "\n%s: vertices need x, y, z (and no lists)", path);
+                return false;
+            }
+            if ((uint64_t)(end - p) / stride < elem.count || elem.count > UINT32_MAX) {
+                fprintf(stderr, "\n%s: file is truncated", path);
+                return false;
+            }
+            mesh.px.resize(elem.count);
+            mesh.py.resize(elem.count);
+            mesh.pz.resize(elem.count);
+            if (elem.find("nx") && elem.find("ny") && elem.find("nz")) {
+                mesh.nx.resize(elem.count);
+                mesh.ny.resize(elem.count);
+                mesh.nz.resize(elem.count);
+            }
+            if (elem.find("u", "s", "texture_u") && elem.find("v", "t", "texture_v")) {
+                mesh.tu.resize(elem.count);
+                mesh.tv.resize(elem.count);
+            }
+            const char *data = p;
+            pool.parallelFor((uint32_t)nBlocks, [&](uint32_t block, uint32_t threadIdx) {
+                readVertices(elem, data, stride, swap,
+                             elem.count * block / nBlocks, elem.count * (block + 1) / nBlocks, mesh);
+            });
+            p += elem.count * stride;
+        } else if (elem.name == "face") {
+            const property *list = elem.find("vertex_indices", "vertex_index");
+            if (!list || !list->isList) {
+                fprintf(stderr, "\n%s: faces need a vertex_indices list", path);
+                return false;
+            }
+
+            // all triangles, every record the same size?
+            size_t triStride = 0;
+            size_t listOffset = 0;
+            for (const property& prop : elem.properties) {
+                if (&prop == list) {
+                    listOffset = triStride;
+                    triStride += typeSize(prop.countType) + 3 * typeSize(prop.type);
+                } else if (prop.isList) {
+                    triStride = 0;
+                    break;
+                } else {
+                    triStride += typeSize(prop.type);
+                }
+            }
+            std::atomic<bool> allTriangles(triStride > 0 && (uint64_t)(end - p) / triStride >= elem.count);
+            if (allTriangles) {
+                const char *data = p;
+                pool.parallelFor((uint32_t)nBlocks, [&](uint32_t block, uint32_t threadIdx) {
+                    for (uint64_t i = elem.count * block / nBlocks;
+                         i < elem.count * (block + 1) / nBlocks && allTriangles; i++) {
+                        if (readScalar(data + i * triStride + listOffset, list->countType, swap) != 3.0) {
+                            allTriangles = false;
+                        }
+                    }
+                });
+            }
+
+            if (allTriangles) {
+                if (elem.count > UINT32_MAX / 3) {
+                    fprintf(stderr, "\n%s: too many faces", path);
+                    return false;
+                }
+                mesh.indices.resize(3 * elem.count);
+                const char *data = p + listOffset + typeSize(list->countType);
+                const size_t itemSize = typeSize(list->type);
+                pool.parallelFor((uint32_t)nBlocks, [&](uint32_t block, uint32_t threadIdx) {
+                    for (uint64_t i = elem.count * block / nBlocks; i < elem.count * (block + 1) / nBlocks; i++) {
+                        const char *rec = data + i * triStride;
+                        for (int k = 0; k < 3; k++) {
+                            mesh.indices[3 * i + k] = (uint32_t)readScalar(rec + k * itemSize, list->type, swap);
+                        }
+                    }
+                });
+                p += elem.count * triStride;
+            } else {
+                for (uint64_t i = 0; i < elem.count; i++) {
+                    const size_t size = recordSize(elem, p, end, swap);
+                    if (size == 0) {
+                        fprintf(stderr, "\n%s: file is truncated", path);
+                        return false;
+                    }
+                    const char *q = p;
+                    for (const property& prop : elem.properties) {
+                        if (!prop.isList) {
+                            q += typeSize(prop.type);
+                            continue;
+                        }
+                        const uint32_t n = (uint32_t)readScalar(q, prop.countType, swap);
+                        q += typeSize(prop.countType);
+                        if (&prop == list) {
+                            const size_t itemSize = typeSize(prop.type);
+                            const uint32_t v0 = (uint32_t)readScalar(q, prop.type, swap);
+                            for (uint32_t k = 2; k < n; k++) {
+                                mesh.addTriangle(v0,
+                                                 (uint32_t)readScalar(q + (k - 1) * itemSize, prop.type, swap),
+                                                 (uint32_t)readScalar(q + k * itemSize, prop.type, swap));
+                            }
+                        }
+                        q += n * typeSize(prop.type);
+                    }
+                    p += size;
+                }
+            }
+        } else if (stride > 0) {
+            if ((uint64_t)(end - p) / stride < elem.count) {
+                fprintf(stderr, "\n%s: file is truncated", path);
+                return false;
+            }
+            p += elem.count * stride;
+        } else {
+            for (uint64_t i = 0; i < elem.count; i++) {
+                const size_t size = recordSize(elem, p, end, swap);
+                if (size == 0) {
+                    fprintf(stderr, "\n%s: file is truncated", path);
+                    return false;
+                }
+                p += size;
+            }
+        }
+    }
+
+    const uint32_t nVertices = mesh.numVertices();
+    for (uint32_t idx : mesh.indices) {
+        if (idx >= nVertices) {
+            fprintf(stderr, "\n%s: face refers to a vertex that doesn't exist", path);
+            return false;
+        }
+    }
+    return true;
+}
+
+// picks the loader from the file extension (.obj / .ply)
+bool loadMesh(const char *path, triangleMesh& mesh, threadPool& pool)
+{
+    const char *ext = strrchr(path, '.');
+    if (ext && !strcasecmp(ext, ".obj")) {
+        return loadOBJ(path, mesh, pool);
+    }
+    if (ext && !strcasecmp(ext, ".ply")) {
+        return loadPLY(path, mesh, pool);
+    }
+    fprintf(stderr, "\n%s: unknown mesh format (expected .obj or .ply)", path);
+    return false;
+}
+
+#endif /* meshloader_h */
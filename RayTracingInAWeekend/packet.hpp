@@ -0,0 +1,131 @@
+//
+//  packet.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 10/6/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef packet_h
+#define packet_h
+
+#include <cstdint>
+#include <type_traits>
+#include "simd.hpp"
+#include "ray.hpp"
+#include "aabb.hpp"
+
+// Packet of N (4, 8 or 16) rays traced together
+//
+// Meant for coherent rays (camera rays through neighbouring pixels), which
+// mostly reach the same BVH nodes and primitives: one SIMD test then does
+// the work of N scalar ones (see bvhTree::traversePacket()).
+//
+// Rays are stored as structure of arrays, N floats per component, and
+// processed kChunkWidth lanes at a time (floatx4 for 4 ray packets,
+// floatx8 otherwise, so 16 ray packets are two chunks).
+// Which rays take part in an operation is given by a lane mask (bit i set:
+// ray i is active); lanes outside it are computed but never written.
+//
+// All rays share tMin; tMax is per ray, and is shrunk to the closest
+// hit found so far as the packet is traced.
+template <int N>
+struct rayPacket
+{
+    static_assert(N == 4 || N == 8 || N == 16, "packets are 4, 8 or 16 rays");
+
+    typedef typename std::conditional<N == 4, floatx4, floatx8>::type floatN;
+    typedef vec3xN<floatN> vec3N;
+
+    enum {
+        kSize = N,
+        kChunkWidth = floatN::kWidth,
+        kChunks = N / kChunkWidth,
+        // a node reached by this many rays or fewer is left to them one
+        // at a time (the packet has diverged)
+        kMaxDivergedRays = N <= 8 ? 1 : 2,
+    };
+
+    static constexpr uint32_t kAllLanes = (uint32_t)((1ull << N) - 1);
+
+    inline void setRay(int lane, const ray& r)
+    {
+        for (int a = 0; a < 3; a++) {
+            org[a][lane] = r.origin()[a];
+            dir[a][lane] = r.direction()[a];
+            invDir[a][lane] = 1.0f / r.direction()[a];
+        }
+    }
+
+    inline ray getRay(int lane) const
+    {
+        return ray(vec3(org[0][lane], org[1][lane], org[2][lane]),
+                   vec3(dir[0][lane], dir[1][lane], dir[2][lane]));
+    }
+
+    // lanes of chunk c set in lanes, as chunk mask bits (lowest = first lane)
+    static inline uint32_t chunkLanes(uint32_t lanes, int c)
+    {
+        return (lanes >> (c * kChunkWidth)) & ((1u << kChunkWidth) - 1);
+    }
+
+    inline vec3N origin(int c) const
+    {
+        const int base = c * kChunkWidth;
+        return vec3N::load(org[0] + base, org[1] + base, org[2] + base);
+    }
+
+    inline vec3N direction(int c) const
+    {
+        const int base = c * kChunkWidth;
+        return vec3N::load(dir[0] + base, dir[1] + base, dir[2] + base);
+    }
+
+    inline floatN farT(int c) const
+    {
+        return floatN::load(tMax + c * kChunkWidth);
+    }
+
+    // Slab test of every active ray against box (see aabb::hit)
+    // Rays may point different ways, so near / far planes are sorted with
+    // min / max per lane instead of being picked by direction sign.
+    // Returns the active lanes that hit the box within [tMin, tMax].
+    inline uint32_t hitBox(const aabb& box, uint32_t active) const
+    {
+        uint32_t lanes = 0;
+        for (int c = 0; c < kChunks; c++) {
+            const uint32_t bits = chunkLanes(active, c);
+            if (bits == 0) {
+                continue;
+            }
+            const int base = c * kChunkWidth;
+            floatN tNear(tMin);
+            floatN tFar = farT(c);
+            for (int a = 0; a < 3; a++) {
+                const floatN o = floatN::load(org[a] + base);
+                const floatN inv = floatN::load(invDir[a] + base);
+                const floatN t0 = (floatN(box.pMin[a]) - o) * inv;
+                const floatN t1 = (floatN(box.pMax[a]) - o) * inv;
+                tNear = max(tNear, min(t0, t1));
+                tFar = min(tFar, max(t0, t1));
+            }
+            lanes |= (uint32_t)((tNear <= tFar).bits() & bits) << base;
+        }
+        return lanes;
+    }
+
+    float org[3][N];
+    float dir[3][N];
+    float invDir[3][N];
+    float tMax[N];
+    float tMin;
+};
+
+template <int N>
+constexpr uint32_t rayPacket<N>::kAllLanes;
+
+typedef rayPacket<4> rayPacket4;
+typedef rayPacket<8> rayPacket8;
+typedef rayPacket<16> rayPacket16;
+
+#endif /* packet_h */
@@ -0,0 +1,463 @@
+//
+//  renderer.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 7/21/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef renderer_h
+#define renderer_h
+
+#include "hitable_list.hpp"
+#include "material.hpp"
+#include "camera.hpp"
+#include "threadpool.hpp"
+
+constexpr uint32_t maxBounces = 50;
+constexpr uint32_t nPixelSamples = 200;
+
+// simple 4 tupule struct to represent pixel of final image plane
+// RGBA channel ordering
+class PixelRGBA {
+public:
+    uint8_t r, g, b, a;
+
+    PixelRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a) : r(r), g(g), b(b), a(a) {}
+    PixelRGBA() { PixelRGBA(0, 0, 0, 0); }
+    static int getNumComponents() { return 4; }
+};
+
+// Image and tracing parameters
+// Image is split into tileSize x tileSize tiles which are
+// rendered in parallel on nThreads threads.
+// The same seed always produces the same image, whatever the
+// thread count / tile size.
+struct renderSettings
+{
+    int width = 400;
+    int height = 200;
+    uint32_t nSamples = nPixelSamples;
+    uint32_t tileSize = 16;
+    uint32_t nThreads = 0; // 0: all hardware threads
+    uint32_t seed = 0;
+    samplerType sampling = kIndependentSampler;
+    // terminate low throughput paths early (unbiased)
+    bool russianRoulette = true;
+
+    // Adaptive sampling (replaces the fixed nSamples per pixel)
+    // every pixel takes at least minSamples, then keeps sampling until the
+    // error estimate of its mean drops under targetError or maxSamples is hit
+    bool adaptive = false;
+    uint32_t minSamples = 16;
+    uint32_t maxSamples = 4 * nPixelSamples;
+    float targetError = 0.05f;
+
+    // Trace camera rays in packets of this many (4, 8 or 16 rays, through
+    // blocks of 2 x 2, 4 x 2 or 4 x 4 pixels), 0: one ray at a time.
+    // Only the first segment of a path goes in a packet, bounces are
+    // traced one ray at a time either way. Same image, packets or not
+    // (unless built with FMA, which SIMD and scalar code use differently).
+    uint32_t packetSize = 0;
+};
+
+// convergence is only re-checked every few samples
+constexpr uint32_t adaptiveBatchSize = 8;
+// below this brightness the error is measured in absolute rather
+// than relative terms (keeps near black pixels from sampling forever)
+constexpr float adaptiveMinLuminance = 0.1f;
+
+// Path counters gathered while tracing
+// average path length = nSegments / nPaths
+struct renderStats
+{
+    uint64_t nPaths = 0;
+    uint64_t nSegments = 0;
+
+    renderStats& operator+=(const renderStats& other)
+    {
+        nPaths += other.nPaths;
+        nSegments += other.nSegments;
+        return *this;
+    }
+};
+
+// paths can't be culled by russian roulette before this many bounces
+constexpr uint32_t rouletteStartBounce = 3;
+
+// hits closer than this to a ray's origin are ignored (so that bounced
+// rays don't hit the surface they start on again)
+constexpr float minHitDistance = 0.0001f;
+
+// Background color
+// If ray hits infinity without hitting any object, return this
+// background is a light blue gradient
+vec3 bgColorAtRay(const ray& r)
+{
+    // This returns lerped blue fade
+    vec3 unitDir = unit_vector(r.direction());
+    float t = 0.5f * (unitDir.y() + 1.0f);
+    return (1.0f - t) * vec3(1.0f, 1.0f, 1.0f) + t * vec3(0.5f, 0.7f, 1.0f);
+}
+
+// Return color at Ray
+// for each intersection, gather color for material at point of intersection
+// and any subsequent refelected / refracted attenuated ray
+// Do this no more than maxBounces times per ray
+//
+// If it hits nothing - return bg color
+// smp supplies the random numbers for the whole path
+//
+// The path is followed iteratively, carrying the product of attenuations
+// seen so far (throughput) instead of recursing per bounce.
+// Past the first few bounces a path survives each bounce with probability
+// p = max component of throughput (russian roulette), and is divided by p
+// when it does. Dim paths, which can barely contribute, mostly end early
+// while the expected value stays the same (E = p * (L / p) + (1 - p) * 0).
+//
+// colorAtHit() picks up a path whose first segment r was already traced
+// (didHit / rec, from a packet), colorAtRay() traces it too.
+vec3 colorAtHit(const ray& r,
+                bool didHit,
+                intersectParams rec,
+                scene& world,
+                sampler& smp,
+                bool russianRoulette,
+                renderStats& stats)
+{
+    vec3 throughput(1.0f);
+    ray current = r;
+    stats.nPaths++;
+    for (uint32_t bounceDepth = 0; ; bounceDepth++) {
+        stats.nSegments++;
+        if (bounceDepth > 0) {
+            didHit = world.hit(current, minHitDistance, MAXFLOAT, rec);
+        }
+        if (!didHit) {
+            return throughput * bgColorAtRay(current);
+        }
+
+        ray scattered;
+        vec3 attenuation;
+        smp.setDimension(bounceDimension(bounceDepth));
+        if (bounceDepth >= maxBounces ||
+            !rec.surfaceMat->scatter(current, rec, attenuation, scattered, smp)) {
+            // absorbed or exceeds max bounce
+            return vec3(0.0f);
+        }
+        throughput *= attenuation;
+
+        if (russianRoulette && bounceDepth >= rouletteStartBounce) {
+            smp.setDimension(bounceDimension(bounceDepth) + kDimensionsPerBounce - 1);
+            const float survive = std::min(1.0f, std::max(throughput.x(),
+                                                 std::max(throughput.y(), throughput.z())));
+            if (smp.get1D() >= survive) {
+                return vec3(0.0f);
+            }
+            throughput /= survive;
+        }
+        current = scattered;
+    }
+}
+
+vec3 colorAtRay(const ray& r,
+                scene& world,
+                sampler& smp,
+                bool russianRoulette,
+                renderStats& stats)
+{
+    intersectParams rec;
+    const bool didHit = world.hit(r, minHitDistance, MAXFLOAT, rec);
+    return colorAtHit(r, didHit, rec, world, smp, russianRoulette, stats);
+}
+
+inline float luminance(const vec3& c)
+{
+    return 0.2126f * c.r() + 0.7152f * c.g() + 0.0722f * c.b();
+}
+
+// Running mean / variance of sample luminance (Welford's algorithm)
+// Decides when a pixel has converged:
+// standard error of the mean = sqrt(variance / n), and the pixel is done
+// when that is within targetError of the mean
+struct pixelVariance
+{
+    uint32_t n = 0;
+    float mean = 0.0f;
+    float m2 = 0.0f;
+
+    inline void add(float x)
+    {
+        n++;
+        const float delta = x - mean;
+        mean += delta / n;
+        m2 += delta * (x - mean);
+    }
+
+    inline float standardError() const
+    {
+        return n > 1 ? sqrt(m2 / ((n - 1) * n)) : MAXFLOAT;
+    }
+
+    inline bool converged(float targetError) const
+    {
+        return standardError() <= targetError * std::max(mean, adaptiveMinLuminance);
+    }
+};
+
+// Store pixel (i, j) (image row j counted from the bottom) from the sum of
+// its s samples: mean, gamma corrected, to rgbaTarget. s and the linear
+// mean also go to sampleCounts / radiance when given.
+inline void writePixel(PixelRGBA *rgbaTarget,
+                       int width,
+                       int height,
+                       int i,
+                       int j,
+                       const vec3& gather,
+                       uint32_t s,
+                       uint32_t *sampleCounts,
+                       vec3 *radiance)
+{
+    if (sampleCounts) {
+        sampleCounts[(height - j - 1) * width + i] = s;
+    }
+
+    vec3 col = gather / float(s);
+    if (radiance) {
+        radiance[(height - j - 1) * width + i] = col;
+    }
+    // gamma correction
+    constexpr float gamma = 1.0f / 2.2f;
+    col = vec3(pow(col[0], gamma), pow(col[1], gamma), pow(col[2], gamma));
+    // convert [0, 1] -> [0, 255] ranges for rgb
+    int ir = int(255.99f * col[0]);
+    int ig = int(255.99f * col[1]);
+    int ib = int(255.99f * col[2]);
+
+    // write to image target;
+    PixelRGBA *p = &rgbaTarget[(height - j - 1) * width + i];
+    p->r = ir;
+    p->g = ig;
+    p->b = ib;
+    p->a = 255;
+}
+
+// Trace pixels [x0, x1) x [y0, y1) of a tile with packets of N camera rays,
+// each through a block of pixels, sample by sample (see traceInto())
+// Samples are drawn per pixel exactly as when tracing one ray at a time,
+// so pixels come out the same. With adaptive sampling a converged pixel's
+// lane is masked off while the rest of its block keeps going.
+// finishPixel(x, y, sum of samples, number of samples) is called for
+// every pixel once it's done.
+template <int N, typename PixelWriter>
+void tracePacketTile(int x0,
+                     int y0,
+                     int x1,
+                     int y1,
+                     const renderSettings& settings,
+                     uint32_t maxSamples,
+                     scene& world,
+                     camera& cam,
+                     sampler& smp,
+                     renderStats& stats,
+                     PixelWriter finishPixel)
+{
+    const int blockWidth = N == 4 ? 2 : 4;
+    const int blockHeight = N / blockWidth;
+
+    rayPacket<N> packet;
+    intersectParams rec[N];
+    for (int by = y0; by < y1; by += blockHeight) {
+        for (int bx = x0; bx < x1; bx += blockWidth) {
+            int px[N], py[N];
+            vec3 gather[N];
+            pixelVariance variance[N];
+            uint32_t nSamples[N];
+            uint32_t pixels = 0;
+            for (int lane = 0; lane < N; lane++) {
+                px[lane] = bx + lane % blockWidth;
+                py[lane] = by + lane / blockWidth;
+                gather[lane] = vec3(0, 0, 0);
+                nSamples[lane] = 0;
+                if (px[lane] < x1 && py[lane] < y1) {
+                    pixels |= 1u << lane;
+                }
+            }
+
+            uint32_t active = pixels;
+            for (uint32_t s = 0; s < maxSamples && active; s++) {
+                packet.tMin = minHitDistance;
+                for (uint32_t bits = active; bits; bits &= bits - 1) {
+                    const int lane = __builtin_ctz(bits);
+                    smp.startPixelSample((uint32_t)px[lane], (uint32_t)py[lane], s);
+                    float du, dv;
+                    smp.setDimension(kPixelDimension);
+                    smp.get2D(du, dv);
+                    float u = (float(px[lane]) + du) / float(settings.width);
+                    float v = (float(py[lane]) + dv) / float(settings.height);
+                    smp.setDimension(kLensDimension);
+                    packet.setRay(lane, cam.getRayAt(u, v, smp));
+                    packet.tMax[lane] = MAXFLOAT;
+                }
+
+                const uint32_t hitLanes = world.hitPacket(packet, active, rec);
+
+                for (uint32_t bits = active; bits; bits &= bits - 1) {
+                    const int lane = __builtin_ctz(bits);
+                    smp.startPixelSample((uint32_t)px[lane], (uint32_t)py[lane], s);
+                    vec3 sampleColor = colorAtHit(packet.getRay(lane), (hitLanes >> lane) & 1, rec[lane],
+                                                  world, smp, settings.russianRoulette, stats);
+                    gather[lane] += sampleColor;
+                    nSamples[lane] = s + 1;
+
+                    if (settings.adaptive) {
+                        variance[lane].add(luminance(sampleColor));
+                        if (nSamples[lane] >= settings.minSamples &&
+                            nSamples[lane] % adaptiveBatchSize == 0 &&
+                            variance[lane].converged(settings.targetError)) {
+                            active &= ~(1u << lane);
+                        }
+                    }
+                }
+            }
+
+            for (uint32_t bits = pixels; bits; bits &= bits - 1) {
+                const int lane = __builtin_ctz(bits);
+                finishPixel(px[lane], py[lane], gather[lane], nSamples[lane]);
+            }
+        }
+    }
+}
+
+// For a given camera / scene - do ray trace
+// and gsther collected samples into RGBA destination buffer
+// Fires 'nSamples' offset randomly per pixel.
+// and applies gamma correction
+//
+// Tiles are handed out to the thread pool, which balances the load by
+// work stealing (tiles covering the sky are far cheaper than ones covering
+// glass). Each tile has its own sampler (settings.sampling), and sample
+// values only depend on (seed, pixel, sample, dimension), not on what ran
+// before them on the same thread.
+//
+// With adaptive sampling on, flat pixels (sky, diffuse walls) stop after
+// a few samples and the time saved goes to noisy ones (glossy / glass),
+// up to maxSamples. The number of samples each pixel took is written to
+// sampleCounts, if given (width * height entries, same layout as the image)
+// Likewise the linear (pre gamma) pixel colors go to radiance, if given.
+//
+// Camera rays are traced in packets when settings.packetSize is set
+// (see tracePacketTile()).
+//
+// Returns path statistics summed over all threads
+renderStats traceInto(PixelRGBA *rgbaTarget,
+                      const renderSettings& settings,
+                      scene& world,
+                      camera& cam,
+                      threadPool& pool,
+                      uint32_t *sampleCounts = nullptr,
+                      vec3 *radiance = nullptr)
+{
+    const int width = settings.width;
+    const int height = settings.height;
+    const int tileSize = (int)std::max(1u, settings.tileSize);
+    const int nTilesX = (width + tileSize - 1) / tileSize;
+    const int nTilesY = (height + tileSize - 1) / tileSize;
+
+    const uint32_t maxSamples = std::max(1u, settings.adaptive ? settings.maxSamples :
+                                                                 settings.nSamples);
+
+    // one set of counters per thread, no sharing while tracing
+    std::vector<renderStats> threadStats(pool.size());
+
+    pool.parallelFor(nTilesX * nTilesY, [&](uint32_t tile, uint32_t threadIdx) {
+        const int x0 = (tile % nTilesX) * tileSize;
+        const int y0 = (tile / nTilesX) * tileSize;
+        const int x1 = std::min(x0 + tileSize, width);
+        const int y1 = std::min(y0 + tileSize, height);
+        std::unique_ptr<sampler> tileSampler(createSampler(settings.sampling,
+                                                           settings.seed,
+                                                           maxSamples));
+        sampler& smp = *tileSampler;
+        renderStats& stats = threadStats[threadIdx];
+
+        auto finishPixel = [&](int i, int j, const vec3& gather, uint32_t s) {
+            writePixel(rgbaTarget, width, height, i, j, gather, s, sampleCounts, radiance);
+        };
+
+        switch (settings.packetSize) {
+            case 4:
+                tracePacketTile<4>(x0, y0, x1, y1, settings, maxSamples, world, cam, smp, stats, finishPixel);
+                return;
+            case 8:
+                tracePacketTile<8>(x0, y0, x1, y1, settings, maxSamples, world, cam, smp, stats, finishPixel);
+                return;
+            case 16:
+                tracePacketTile<16>(x0, y0, x1, y1, settings, maxSamples, world, cam, smp, stats, finishPixel);
+                return;
+            default:
+                break;
+        }
+
+        for (int j = y0; j < y1; j++) {
+            for (int i = x0; i < x1; i++) {
+                vec3 gather(0, 0, 0);
+                pixelVariance variance;
+                uint32_t s = 0;
+                while (s < maxSamples) {
+                    smp.startPixelSample((uint32_t)i, (uint32_t)j, s);
+                    float du, dv;
+                    smp.setDimension(kPixelDimension);
+                    smp.get2D(du, dv);
+                    float u = (float(i) + du) / float(width);
+                    float v = (float(j) + dv) / float(height);
+                    smp.setDimension(kLensDimension);
+                    ray r = cam.getRayAt(u, v, smp);
+                    vec3 sampleColor = colorAtRay(r, world, smp, settings.russianRoulette, stats);
+                    gather += sampleColor;
+                    s++;
+
+                    if (settings.adaptive) {
+                        variance.add(luminance(sampleColor));
+                        if (s >= settings.minSamples &&
+                            s % adaptiveBatchSize == 0 &&
+                            variance.converged(settings.targetError)) {
+                            break;
+                        }
+                    }
+                }
+
+                finishPixel(i, j, gather, s);
+            }
+        }
+    });
+
+    renderStats total;
+    for (const renderStats& stats : threadStats) {
+        total += stats;
+    }
+    return total;
+}
+
+// Debug:
+// Visualize samples taken per pixel (sampleCounts from traceInto)
+// blue (minSpp) -> green -> red (maxSpp)
+void sampleHeatmapInto(PixelRGBA *rgbaTarget,
+                       const uint32_t *sampleCounts,
+                       uint32_t nPixels,
+                       uint32_t minSpp,
+                       uint32_t maxSpp)
+{
+    const float range = (float)std::max(1u, maxSpp - std::min(minSpp, maxSpp));
+    for (uint32_t i = 0; i < nPixels; i++) {
+        float t = ((float)sampleCounts[i] - (float)minSpp) / range;
+        t = std::min(1.0f, std::max(0.0f, t));
+        PixelRGBA *p = &rgbaTarget[i];
+        p->r = (uint8_t)(255.99f * std::max(0.0f, 2.0f * t - 1.0f));
+        p->g = (uint8_t)(255.99f * (1.0f - fabs(2.0f * t - 1.0f)));
+        p->b = (uint8_t)(255.99f * std::max(0.0f, 1.0f - 2.0f * t));
+        p->a = 255;
+    }
+}
+
+#endif /* renderer_h */
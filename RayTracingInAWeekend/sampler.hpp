@@ -0,0 +1,521 @@
+//
+//  sampler.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 7/28/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef sampler_h
+#define sampler_h
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+// pcg4d hash
+// "Hash Functions for GPU Rendering", Jarzynski & Olano, JCGT 2020
+// 4 x 32 bit in, 4 x 32 bit out. Every output bit depends on every input bit
+// so it can be used as a counter based generator: hashing consecutive
+// counters gives independent looking random numbers.
+inline void pcg4d(uint32_t v[4])
+{
+    for (int i = 0; i < 4; i++) {
+        v[i] = v[i] * 1664525u + 1013904223u;
+    }
+    v[0] += v[1] * v[3];
+    v[1] += v[2] * v[0];
+    v[2] += v[0] * v[1];
+    v[3] += v[1] * v[2];
+    for (int i = 0; i < 4; i++) {
+        v[i] ^= v[i] >> 16;
+    }
+    v[0] += v[1] * v[3];
+    v[1] += v[2] * v[0];
+    v[2] += v[0] * v[1];
+    v[3] += v[1] * v[2];
+}
+
+// [0, 2^32) -> [0, 1)
+// top 24 bits fill the float mantissa exactly, so 1.0 is never returned
+inline float uint32ToUnitFloat(uint32_t x)
+{
+    return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+inline uint32_t reverseBits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Dimension layout of a path sample
+// Every path vertex gets a fixed block of dimensions, whatever the
+// material actually uses, so dimension d always means the same thing
+// for every sample of a pixel (which is what makes low discrepancy
+// sequences pay off). Pairs that are sampled together start on even
+// dimensions.
+enum : uint32_t {
+    kPixelDimension = 0,    // 2D pixel jitter
+    kLensDimension = 2,     // 2D lens position
+    kFirstBounceDimension = 4,
+    kDimensionsPerBounce = 4, // 3 for the scattering direction, 1 for roulette
+};
+
+inline uint32_t bounceDimension(uint32_t bounce)
+{
+    return kFirstBounceDimension + bounce * kDimensionsPerBounce;
+}
+
+// Pluggable sample generator
+// A sampler hands out numbers in [0, 1) for the pixel sample set by
+// startPixelSample(), one dimension at a time. Which number comes back is
+// a pure function of (seed, pixel, sample index, dimension), so samplers
+// share no state: every render tile clones its own, needs no locks, and
+// the image doesn't depend on how the work was spread over threads.
+class sampler
+{
+public:
+    sampler(uint32_t seed) : seed(seed),
+                             pixelX(0),
+                             pixelY(0),
+                             sample(0),
+                             dimension(0) {}
+    virtual ~sampler() {}
+
+    // copy with the same settings, for use on another thread
+    virtual sampler* clone() const = 0;
+
+    // start drawing numbers for a new sample in a pixel
+    virtual void startPixelSample(uint32_t x,
+                                  uint32_t y,
+                                  uint32_t sampleIdx)
+    {
+        pixelX = x;
+        pixelY = y;
+        sample = sampleIdx;
+        dimension = 0;
+    }
+
+    // jump to the given dimension (see dimension layout above)
+    inline void setDimension(uint32_t dim) { dimension = dim; }
+
+    inline float get1D()
+    {
+        return sampleDimension(dimension++);
+    }
+
+    inline void get2D(float& u0, float& u1)
+    {
+        u0 = sampleDimension(dimension++);
+        u1 = sampleDimension(dimension++);
+    }
+
+    uint32_t seed;
+    uint32_t pixelX;
+    uint32_t pixelY;
+    uint32_t sample;
+    uint32_t dimension;
+
+protected:
+    // value of the current pixel sample in dimension dim, in [0, 1)
+    virtual float sampleDimension(uint32_t dim) = 0;
+
+    // unique key per pixel, for hashing
+    inline uint32_t pixelKey() const { return pixelX | (pixelY << 16); }
+};
+
+// Plain Monte Carlo: every dimension independently uniform
+// One pcg4d hash of (pixel, sample, dim / 4, seed) yields 4 dimensions
+class independentSampler : public sampler
+{
+public:
+    independentSampler(uint32_t seed = 0) : sampler(seed),
+                                            cachedBlock(~0u) {}
+
+    sampler* clone() const { return new independentSampler(*this); }
+
+    void startPixelSample(uint32_t x, uint32_t y, uint32_t sampleIdx)
+    {
+        sampler::startPixelSample(x, y, sampleIdx);
+        cachedBlock = ~0u;
+    }
+
+protected:
+    float sampleDimension(uint32_t dim)
+    {
+        if ((dim >> 2) != cachedBlock) {
+            cachedBlock = dim >> 2;
+            block[0] = pixelKey();
+            block[1] = sample;
+            block[2] = cachedBlock;
+            block[3] = seed;
+            pcg4d(block);
+        }
+        return uint32ToUnitFloat(block[dim & 3]);
+    }
+
+private:
+    uint32_t cachedBlock;
+    uint32_t block[4];
+};
+
+// Stratified (correlated multi-jittered) sampling
+// "Correlated Multi-Jittered Sampling", Andrew Kensler, Pixar 2013
+// The nSamples samples of a pixel fall one per cell of an m x n grid
+// (2D stratified) and also one per row / column (1D stratified) in every
+// pair of dimensions. Cells / rows are shuffled with a different hashed
+// permutation for each pixel and dimension pair, so pairs don't correlate.
+// Samples past nSamples start a new, differently shuffled set.
+class stratifiedSampler : public sampler
+{
+public:
+    stratifiedSampler(uint32_t seed,
+                      uint32_t nSamples) : sampler(seed),
+                                           nSamples(std::max(1u, nSamples)),
+                                           cachedPair(~0u) {}
+
+    sampler* clone() const { return new stratifiedSampler(*this); }
+
+    void startPixelSample(uint32_t x, uint32_t y, uint32_t sampleIdx)
+    {
+        sampler::startPixelSample(x, y, sampleIdx);
+        cachedPair = ~0u;
+    }
+
+    // permutation of [0, l) picked by p (cycle walking hash)
+    static uint32_t permute(uint32_t i, uint32_t l, uint32_t p)
+    {
+        uint32_t w = l - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        do {
+            i ^= p; i *= 0xe170893d; i ^= p >> 16;
+            i ^= (i & w) >> 4; i ^= p >> 8; i *= 0x0929eb3f;
+            i ^= p >> 23; i ^= (i & w) >> 1; i *= 1 | p >> 27;
+            i *= 0x6935fa69; i ^= (i & w) >> 11; i *= 0x74dcb303;
+            i ^= (i & w) >> 2; i *= 0x9e501cc3; i ^= (i & w) >> 2;
+            i *= 0xc860a3df; i &= w; i ^= i >> 5;
+        } while (i >= l);
+        return (i + p) % l;
+    }
+
+    static float randFloat(uint32_t i, uint32_t p)
+    {
+        i ^= p; i ^= i >> 17; i ^= i >> 10; i *= 0xb36534e5;
+        i ^= i >> 12; i ^= i >> 21; i *= 0x93fc4795; i ^= 0xdf6e307f;
+        i ^= i >> 17; i *= 1 | p >> 18;
+        return uint32ToUnitFloat(i);
+    }
+
+protected:
+    float sampleDimension(uint32_t dim)
+    {
+        if ((dim >> 1) != cachedPair) {
+            cachedPair = dim >> 1;
+
+            uint32_t h[4] = { pixelKey(), cachedPair, sample / nSamples, seed };
+            pcg4d(h);
+            const uint32_t p = h[0];
+
+            const uint32_t N = nSamples;
+            const uint32_t m = std::max(1u, (uint32_t)sqrtf((float)N));
+            const uint32_t n = (N + m - 1) / m;
+            const uint32_t s = permute(sample % N, N, p * 0x51633e2d);
+            const uint32_t sx = permute(s % m, m, p * 0x68bc21eb);
+            const uint32_t sy = permute(s / m, n, p * 0x02e5be93);
+            const float jx = randFloat(s, p * 0x967a889b);
+            const float jy = randFloat(s, p * 0x368cc8b7);
+            pair[0] = (sx + (sy + jx) / n) / m;
+            pair[1] = (s + jy) / N;
+            pair[0] = std::min(pair[0], 0x1.fffffep-1f);
+            pair[1] = std::min(pair[1], 0x1.fffffep-1f);
+        }
+        return pair[dim & 1];
+    }
+
+private:
+    uint32_t nSamples;
+    uint32_t cachedPair;
+    float pair[2];
+};
+
+// Owen scrambled Sobol' sampling
+// "Practical Hash-based Owen Scrambling", Brent Burley, JCGT 2020
+// Each pair of dimensions uses the first two Sobol' dimensions, a (0, 2)
+// sequence, which is well stratified for any power of two prefix.
+// The sample index is shuffled and the point Owen scrambled with hashes
+// that differ per dimension pair (padding), so pairs are decorrelated
+// without tables of direction numbers for hundreds of dimensions.
+class sobolSampler : public sampler
+{
+public:
+    sobolSampler(uint32_t seed = 0) : sampler(seed),
+                                      cachedPair(~0u) {}
+
+    sampler* clone() const { return new sobolSampler(*this); }
+
+    void startPixelSample(uint32_t x, uint32_t y, uint32_t sampleIdx)
+    {
+        sampler::startPixelSample(x, y, sampleIdx);
+        cachedPair = ~0u;
+    }
+
+    // i'th point of Sobol' dimension 0 or 1
+    static uint32_t sobol(uint32_t index, uint32_t dim)
+    {
+        if (dim == 0) {
+            // van der Corput
+            return reverseBits(index);
+        }
+        // primitive polynomial x + 1: v[k] = v[k - 1] ^ (v[k - 1] >> 1)
+        uint32_t x = 0;
+        for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+            if (index & 1) {
+                x ^= v;
+            }
+        }
+        return x;
+    }
+
+    static uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed)
+    {
+        x ^= x * 0x3d20adea;
+        x += seed;
+        x *= (seed >> 16) | 1;
+        x ^= x * 0x05526c56;
+        x ^= x * 0x53a22864;
+        return x;
+    }
+
+    // Owen scramble: flips of each bit depend only on the bits above it
+    static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+    {
+        return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+    }
+
+protected:
+    // hash words for a dimension pair
+    // [0] shuffles the sample index, [1], [2] scramble each dimension
+    virtual void pairHash(uint32_t pairIdx, uint32_t h[4]) const
+    {
+        h[0] = pixelKey();
+        h[1] = pairIdx;
+        h[2] = seed;
+        h[3] = 0x50b01u;
+        pcg4d(h);
+    }
+
+    float sampleDimension(uint32_t dim)
+    {
+        if ((dim >> 1) != cachedPair) {
+            cachedPair = dim >> 1;
+            uint32_t h[4];
+            pairHash(cachedPair, h);
+            const uint32_t index = nestedUniformScramble(sample, h[0]);
+            pair[0] = nestedUniformScramble(sobol(index, 0), h[1]);
+            pair[1] = nestedUniformScramble(sobol(index, 1), h[2]);
+        }
+        return uint32ToUnitFloat(pair[dim & 1]);
+    }
+
+    uint32_t cachedPair;
+    uint32_t pair[2];
+};
+
+// Blue noise dithered sampling
+// "Blue-noise Dithered Sampling", Georgiev & Fajardo, SIGGRAPH 2016 talk
+// All pixels share one scrambled Sobol' sequence and each pixel toroidally
+// shifts it (Cranley-Patterson rotation) by the value of a blue noise
+// texture at that pixel. Every pixel still gets well stratified samples,
+// but neighbouring pixels get very different shifts, so what error is
+// left looks like fine grained blue noise rather than white noise / blotches.
+class blueNoiseSampler : public sobolSampler
+{
+public:
+    enum { kTileSize = 64 };
+
+    blueNoiseSampler(uint32_t seed = 0) : sobolSampler(seed),
+                                          tile(&blueNoiseTile()) {}
+
+    sampler* clone() const { return new blueNoiseSampler(*this); }
+
+    // Blue noise tile generated by void and cluster
+    // "The void-and-cluster method for dither array generation", Ulichney 1993
+    // Value at each texel is its rank / texel count, i.e. the tile is a
+    // uniform [0, 1) dither array whose every threshold gives an evenly
+    // spread (blue noise) set of points.
+    // Generated once on first use (~ 4k x 4k kernel evaluations)
+    static const std::vector<float>& blueNoiseTile()
+    {
+        static const std::vector<float> tile = generateVoidAndCluster(kTileSize, 1.5f);
+        return tile;
+    }
+
+protected:
+    // same sequence for every pixel, decorrelated by the blue noise shift
+    void pairHash(uint32_t pairIdx, uint32_t h[4]) const
+    {
+        h[0] = 0;
+        h[1] = pairIdx;
+        h[2] = seed;
+        h[3] = 0xb100eu;
+        pcg4d(h);
+    }
+
+    float sampleDimension(uint32_t dim)
+    {
+        const float u = sobolSampler::sampleDimension(dim);
+
+        // a different offset into the tile for each dimension
+        uint32_t h[4] = { dim, seed, 0, 0 };
+        pcg4d(h);
+        const uint32_t tx = (pixelX + h[0]) % kTileSize;
+        const uint32_t ty = (pixelY + h[1]) % kTileSize;
+        float shifted = u + (*tile)[ty * kTileSize + tx];
+        shifted -= (shifted >= 1.0f) ? 1.0f : 0.0f;
+        return std::min(shifted, 0x1.fffffep-1f);
+    }
+
+private:
+    static std::vector<float> generateVoidAndCluster(uint32_t size, float sigma)
+    {
+        const uint32_t n = size * size;
+
+        // toroidal gaussian energy kernel, indexed by wrapped offset
+        std::vector<float> kernel(n);
+        for (uint32_t y = 0; y < size; y++) {
+            for (uint32_t x = 0; x < size; x++) {
+                const float dx = (float)std::min(x, size - x);
+                const float dy = (float)std::min(y, size - y);
+                kernel[y * size + x] = expf(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+            }
+        }
+
+        std::vector<uint8_t> pattern(n, 0);
+        std::vector<float> energy(n, 0.0f);
+        auto splat = [&](uint32_t idx, float sign) {
+            const uint32_t px = idx % size, py = idx / size;
+            for (uint32_t y = 0; y < size; y++) {
+                const uint32_t ky = ((y + size - py) % size) * size;
+                for (uint32_t x = 0; x < size; x++) {
+                    energy[y * size + x] += sign * kernel[ky + (x + size - px) % size];
+                }
+            }
+        };
+        // tightest cluster: set texel with most energy
+        // largest void: empty texel with least energy
+        auto extreme = [&](uint8_t value, bool highest) {
+            uint32_t best = 0;
+            float bestEnergy = highest ? -1.0f : 1e30f;
+            for (uint32_t i = 0; i < n; i++) {
+                if (pattern[i] == value &&
+                    (highest ? energy[i] > bestEnergy : energy[i] < bestEnergy)) {
+                    bestEnergy = energy[i];
+                    best = i;
+                }
+            }
+            return best;
+        };
+
+        // initial binary pattern: ~10% random texels, then swap cluster
+        // texels into voids until the pattern is evenly spread
+        const uint32_t nInitial = n / 10;
+        uint32_t h[4] = { 1, 2, 3, 4 };
+        for (uint32_t placed = 0; placed < nInitial; ) {
+            pcg4d(h);
+            const uint32_t idx = h[0] % n;
+            if (!pattern[idx]) {
+                pattern[idx] = 1;
+                splat(idx, 1.0f);
+                placed++;
+            }
+        }
+        while (true) {
+            const uint32_t cluster = extreme(1, true);
+            pattern[cluster] = 0;
+            splat(cluster, -1.0f);
+            const uint32_t voidIdx = extreme(0, false);
+            pattern[voidIdx] = 1;
+            splat(voidIdx, 1.0f);
+            if (voidIdx == cluster) {
+                break;
+            }
+        }
+
+        std::vector<uint32_t> rank(n, 0);
+        const std::vector<uint8_t> initialPattern = pattern;
+        const std::vector<float> initialEnergy = energy;
+
+        // phase 1: rank initial texels, tightest cluster removed first
+        // gets the highest rank
+        for (uint32_t r = nInitial; r > 0; r--) {
+            const uint32_t cluster = extreme(1, true);
+            pattern[cluster] = 0;
+            splat(cluster, -1.0f);
+            rank[cluster] = r - 1;
+        }
+
+        // phase 2: fill largest voids in order
+        pattern = initialPattern;
+        energy = initialEnergy;
+        for (uint32_t r = nInitial; r < n; r++) {
+            const uint32_t voidIdx = extreme(0, false);
+            pattern[voidIdx] = 1;
+            splat(voidIdx, 1.0f);
+            rank[voidIdx] = r;
+        }
+
+        std::vector<float> tile(n);
+        for (uint32_t i = 0; i < n; i++) {
+            tile[i] = ((float)rank[i] + 0.5f) / (float)n;
+        }
+        return tile;
+    }
+
+    const std::vector<float>* tile;
+};
+
+enum samplerType {
+    kIndependentSampler,
+    kStratifiedSampler,
+    kSobolSampler,
+    kBlueNoiseSampler,
+};
+
+inline const char* samplerName(samplerType type)
+{
+    switch (type) {
+        case kIndependentSampler: return "independent";
+        case kStratifiedSampler: return "stratified";
+        case kSobolSampler: return "sobol";
+        case kBlueNoiseSampler: return "bluenoise";
+    }
+    return "unknown";
+}
+
+// sampler of the given type
+// nSamples: samples per pixel the caller intends to take (stratification)
+inline sampler* createSampler(samplerType type,
+                              uint32_t seed,
+                              uint32_t nSamples)
+{
+    switch (type) {
+        case kStratifiedSampler: return new stratifiedSampler(seed, nSamples);
+        case kSobolSampler: return new sobolSampler(seed);
+        case kBlueNoiseSampler: return new blueNoiseSampler(seed);
+        case kIndependentSampler:
+        default: return new independentSampler(seed);
+    }
+}
+
+#endif /* sampler_h */
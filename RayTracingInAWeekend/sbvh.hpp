@@ -0,0 +1,407 @@
+//
+//  sbvh.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 9/1/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef sbvh_h
+#define sbvh_h
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "bvh.hpp"
+
+// Spatial split BVH (SBVH) builder
+//
+// A plain (object split) SAH build puts every primitive in exactly one
+// child, so big slanted primitives make children overlap a lot and rays
+// have to visit both. An SBVH may instead cut space with a plane and put
+// a primitive that straddles it into both children, each with only the
+// bounds of its part on that side (a "reference" to the primitive).
+//
+// At every node both kinds are evaluated with the SAH:
+// . object split: binned over centroids, as in bvhTree::build()
+// . spatial split: binned over the node bounds, each reference clipped
+//   into every bin it spans; a bin counts references entering / leaving
+//   it, so left / right counts include the duplicates
+// Spatial splits are only tried where the best object split's children
+// overlap noticeably (kMinOverlap of the root's area), and only while the
+// total number of references stays within (1 + maxDuplication) times the
+// number of primitives. Straddling references are kept whole on one side
+// instead of being split when that is cheaper (reference unsplitting).
+//
+// The result is a regular bvhTree (same nodes, traversal, wide / compressed
+// collapse); primIndices just may hold the same primitive more than once.
+//
+// The splitter gives the bounds of the parts of primitive prim inside
+// refBounds on either side of the plane p[axis] = pos:
+//     void split(uint32_t prim, const aabb& refBounds, int axis, float pos,
+//                aabb& left, aabb& right)
+// (splitBox() for anything, splitTriangleBounds() for triangles)
+template <typename Splitter>
+class spatialSplitBuilder
+{
+public:
+    enum {
+        kNumBins = bvhTree::kNumBins,
+        kNumSpatialBins = 32,
+        kMaxPrimsInLeaf = bvhTree::kMaxPrimsInLeaf,
+        kMaxSAHDepth = bvhTree::kMaxSAHDepth,
+    };
+    // child overlap (relative to root area) above which spatial splits are tried
+    static constexpr float kMinOverlap = 1e-5f;
+
+    spatialSplitBuilder(bvhTree& tree,
+                        Splitter split,
+                        float maxDuplication) : tree(tree),
+                                                split(split),
+                                                maxDuplication(maxDuplication) {}
+
+    // returns number of references in the tree (>= number of primitives)
+    uint32_t build(const std::vector<aabb>& primBounds)
+    {
+        tree.nodes.clear();
+        tree.primIndices.clear();
+        if (primBounds.empty()) {
+            return 0;
+        }
+
+        std::vector<reference> refs(primBounds.size());
+        aabb rootBounds;
+        for (uint32_t i = 0; i < primBounds.size(); i++) {
+            refs[i].bounds = primBounds[i];
+            refs[i].index = i;
+            rootBounds.grow(primBounds[i]);
+        }
+        nReferences = (uint32_t)refs.size();
+        maxReferences = (uint32_t)(refs.size() * (1.0f + maxDuplication));
+        minOverlapArea = kMinOverlap * rootBounds.surfaceArea();
+
+        tree.nodes.reserve(2 * refs.size());
+        tree.primIndices.reserve(maxReferences);
+        buildRecursive(refs, 0);
+        return nReferences;
+    }
+
+private:
+    struct reference
+    {
+        aabb bounds;
+        uint32_t index;
+    };
+
+    struct bin
+    {
+        aabb bounds;
+        uint32_t count = 0;
+    };
+
+    struct spatialBin
+    {
+        aabb bounds;
+        uint32_t enter = 0;
+        uint32_t exit = 0;
+    };
+
+    // best split found at a node
+    struct splitCandidate
+    {
+        float cost = FLT_MAX;
+        int axis = -1;
+        int bin = 0;
+        float pos = 0.0f;
+        aabb left, right;
+        uint32_t nLeft = 0, nRight = 0;
+    };
+
+    uint32_t makeLeaf(uint32_t nodeIdx, const std::vector<reference>& refs)
+    {
+        tree.nodes[nodeIdx].offset = (uint32_t)tree.primIndices.size();
+        tree.nodes[nodeIdx].nPrims = (uint16_t)refs.size();
+        tree.nodes[nodeIdx].axis = 0;
+        for (const reference& ref : refs) {
+            tree.primIndices.push_back(ref.index);
+        }
+        return nodeIdx;
+    }
+
+    // binned SAH over reference centroids (see bvhTree::buildRecursive)
+    void findObjectSplit(const std::vector<reference>& refs,
+                         const aabb& centroidBounds,
+                         float invArea,
+                         splitCandidate& best) const
+    {
+        for (int axis = 0; axis < 3; axis++) {
+            const float cMin = centroidBounds.pMin[axis];
+            const float cMax = centroidBounds.pMax[axis];
+            if (cMax <= cMin) {
+                continue;
+            }
+
+            bin bins[kNumBins];
+            const float scale = kNumBins / (cMax - cMin);
+            for (const reference& ref : refs) {
+                const int b = std::min((int)kNumBins - 1,
+                                       (int)((ref.bounds.centroid()[axis] - cMin) * scale));
+                bins[b].count++;
+                bins[b].bounds.grow(ref.bounds);
+            }
+
+            aabb rightBounds[kNumBins - 1];
+            uint32_t rightCount[kNumBins - 1];
+            aabb acc;
+            uint32_t count = 0;
+            for (int b = kNumBins - 1; b > 0; b--) {
+                acc.grow(bins[b].bounds);
+                count += bins[b].count;
+                rightBounds[b - 1] = acc;
+                rightCount[b - 1] = count;
+            }
+
+            acc = aabb();
+            count = 0;
+            for (int b = 0; b < kNumBins - 1; b++) {
+                acc.grow(bins[b].bounds);
+                count += bins[b].count;
+                const float cost = bvhTree::kTraversalCost +
+                                   (count * acc.surfaceArea() +
+                                    rightCount[b] * rightBounds[b].surfaceArea()) * invArea * bvhTree::kIntersectCost;
+                if (count > 0 && rightCount[b] > 0 && cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.bin = b + 1;
+                    best.left = acc;
+                    best.right = rightBounds[b];
+                    best.nLeft = count;
+                    best.nRight = rightCount[b];
+                }
+            }
+        }
+    }
+
+    // binned SAH over planes cutting the node bounds
+    void findSpatialSplit(const std::vector<reference>& refs,
+                          const aabb& bounds,
+                          float invArea,
+                          splitCandidate& best) const
+    {
+        const uint32_t nRefs = (uint32_t)refs.size();
+        for (int axis = 0; axis < 3; axis++) {
+            const float lo = bounds.pMin[axis];
+            const float width = (bounds.pMax[axis] - lo) / kNumSpatialBins;
+            if (!(width > 0.0f)) {
+                continue;
+            }
+            const float invWidth = 1.0f / width;
+
+            spatialBin bins[kNumSpatialBins];
+            for (const reference& ref : refs) {
+                const int first = std::min((int)kNumSpatialBins - 1,
+                                           std::max(0, (int)((ref.bounds.pMin[axis] - lo) * invWidth)));
+                const int last = std::min((int)kNumSpatialBins - 1,
+                                          std::max(first, (int)((ref.bounds.pMax[axis] - lo) * invWidth)));
+                // chop the reference into one piece per bin it spans
+                aabb piece = ref.bounds;
+                for (int b = first; b < last; b++) {
+                    aabb left, right;
+                    split(ref.index, piece, axis, lo + (b + 1) * width, left, right);
+                    bins[b].bounds.grow(left);
+                    piece = right;
+                }
+                bins[last].bounds.grow(piece);
+                bins[first].enter++;
+                bins[last].exit++;
+            }
+
+            aabb rightBounds[kNumSpatialBins - 1];
+            uint32_t rightCount[kNumSpatialBins - 1];
+            aabb acc;
+            uint32_t count = 0;
+            for (int b = kNumSpatialBins - 1; b > 0; b--) {
+                acc.grow(bins[b].bounds);
+                count += bins[b].exit;
+                rightBounds[b - 1] = acc;
+                rightCount[b - 1] = count;
+            }
+
+            acc = aabb();
+            count = 0;
+            for (int b = 0; b < kNumSpatialBins - 1; b++) {
+                acc.grow(bins[b].bounds);
+                count += bins[b].enter;
+                const uint32_t nLeft = count;
+                const uint32_t nRight = rightCount[b];
+                if (nLeft == 0 || nRight == 0) {
+                    continue;
+                }
+                if (nReferences + nLeft + nRight - nRefs > maxReferences) {
+                    continue;
+                }
+                const float cost = bvhTree::kTraversalCost +
+                                   (nLeft * acc.surfaceArea() +
+                                    nRight * rightBounds[b].surfaceArea()) * invArea * bvhTree::kIntersectCost;
+                if (cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.pos = lo + (b + 1) * width;
+                    best.left = acc;
+                    best.right = rightBounds[b];
+                    best.nLeft = nLeft;
+                    best.nRight = nRight;
+                }
+            }
+        }
+    }
+
+    // send every reference left, right or (split) to both sides of
+    // the plane; straddling ones stay whole when that is cheaper
+    void partitionSpatial(const std::vector<reference>& refs,
+                          const splitCandidate& s,
+                          std::vector<reference>& left,
+                          std::vector<reference>& right)
+    {
+        aabb leftBounds = s.left, rightBounds = s.right;
+        float nLeft = (float)s.nLeft, nRight = (float)s.nRight;
+        for (const reference& ref : refs) {
+            if (ref.bounds.pMax[s.axis] <= s.pos) {
+                left.push_back(ref);
+                continue;
+            }
+            if (ref.bounds.pMin[s.axis] >= s.pos) {
+                right.push_back(ref);
+                continue;
+            }
+
+            const float splitCost = leftBounds.surfaceArea() * nLeft + rightBounds.surfaceArea() * nRight;
+            const float leftCost = surroundingBox(leftBounds, ref.bounds).surfaceArea() * nLeft +
+                                   rightBounds.surfaceArea() * (nRight - 1.0f);
+            const float rightCost = leftBounds.surfaceArea() * (nLeft - 1.0f) +
+                                    surroundingBox(rightBounds, ref.bounds).surfaceArea() * nRight;
+
+            if (leftCost < splitCost && leftCost <= rightCost) {
+                left.push_back(ref);
+                leftBounds.grow(ref.bounds);
+                nRight -= 1.0f;
+            } else if (rightCost < splitCost) {
+                right.push_back(ref);
+                rightBounds.grow(ref.bounds);
+                nLeft -= 1.0f;
+            } else {
+                reference l = ref, r = ref;
+                split(ref.index, ref.bounds, s.axis, s.pos, l.bounds, r.bounds);
+                // a piece can come out empty when the primitive only
+                // touches the plane inside this reference
+                if (l.bounds.isEmpty()) {
+                    right.push_back(ref);
+                } else if (r.bounds.isEmpty()) {
+                    left.push_back(ref);
+                } else {
+                    left.push_back(l);
+                    right.push_back(r);
+                    nReferences++;
+                }
+            }
+        }
+    }
+
+    // builds subtree over refs (consumed), returns index of its root
+    uint32_t buildRecursive(std::vector<reference>& refs, uint32_t depth)
+    {
+        const uint32_t nodeIdx = (uint32_t)tree.nodes.size();
+        tree.nodes.emplace_back();
+
+        aabb bounds, centroidBounds;
+        for (const reference& ref : refs) {
+            bounds.grow(ref.bounds);
+            centroidBounds.grow(ref.bounds.centroid());
+        }
+        tree.nodes[nodeIdx].bounds = bounds;
+
+        const uint32_t nRefs = (uint32_t)refs.size();
+        if (nRefs == 1) {
+            return makeLeaf(nodeIdx, refs);
+        }
+
+        const float leafCost = nRefs * bvhTree::kIntersectCost;
+        const float invArea = 1.0f / std::max(bounds.surfaceArea(), FLT_MIN);
+        splitCandidate objectSplit, spatialSplit;
+        if (depth < kMaxSAHDepth) {
+            findObjectSplit(refs, centroidBounds, invArea, objectSplit);
+            aabb overlap = objectSplit.left;
+            overlap.clip(objectSplit.right);
+            if (nReferences < maxReferences &&
+                (objectSplit.axis < 0 || overlap.surfaceArea() > minOverlapArea)) {
+                findSpatialSplit(refs, bounds, invArea, spatialSplit);
+            }
+        }
+        const bool spatial = spatialSplit.cost < objectSplit.cost;
+        const splitCandidate& best = spatial ? spatialSplit : objectSplit;
+
+        if (nRefs <= kMaxPrimsInLeaf && (best.axis < 0 || leafCost <= best.cost)) {
+            return makeLeaf(nodeIdx, refs);
+        }
+
+        std::vector<reference> left, right;
+        int axis = best.axis;
+        if (spatial) {
+            partitionSpatial(refs, best, left, right);
+        } else if (best.axis >= 0) {
+            const float cMin = centroidBounds.pMin[axis];
+            const float scale = kNumBins / (centroidBounds.pMax[axis] - cMin);
+            for (const reference& ref : refs) {
+                const int b = std::min((int)kNumBins - 1, (int)((ref.bounds.centroid()[axis] - cMin) * scale));
+                (b < best.bin ? left : right).push_back(ref);
+            }
+        }
+        if (left.empty() || right.empty()) {
+            // too deep, all centroids coincide, or unsplitting moved
+            // everything to one side: split in the middle by count
+            left.clear();
+            right.clear();
+            axis = centroidBounds.maxExtentAxis();
+            const uint32_t mid = nRefs / 2;
+            std::nth_element(refs.begin(), refs.begin() + mid, refs.end(),
+                [=](const reference& a, const reference& b) {
+                    return a.bounds.centroid()[axis] < b.bounds.centroid()[axis];
+                });
+            left.assign(refs.begin(), refs.begin() + mid);
+            right.assign(refs.begin() + mid, refs.end());
+        }
+        // done with this node's references, free them before going deeper
+        std::vector<reference>().swap(refs);
+
+        buildRecursive(left, depth + 1);
+        const uint32_t secondChild = buildRecursive(right, depth + 1);
+        tree.nodes[nodeIdx].offset = secondChild;
+        tree.nodes[nodeIdx].nPrims = 0;
+        tree.nodes[nodeIdx].axis = (uint8_t)axis;
+        return nodeIdx;
+    }
+
+    bvhTree& tree;
+    Splitter split;
+    float maxDuplication;
+    uint32_t nReferences = 0;
+    uint32_t maxReferences = 0;
+    float minOverlapArea = 0.0f;
+};
+
+// default budget: up to 30% more references than primitives
+const float kDefaultMaxDuplication = 0.3f;
+
+// (re)build tree over primitives whose bounds are given, with spatial splits
+// returns number of references (primIndices.size())
+template <typename Splitter>
+uint32_t buildSpatialSplitBVH(bvhTree& tree,
+                              const std::vector<aabb>& primBounds,
+                              Splitter split,
+                              float maxDuplication = kDefaultMaxDuplication)
+{
+    spatialSplitBuilder<Splitter> builder(tree, split, maxDuplication);
+    return builder.build(primBounds);
+}
+
+#endif /* sbvh_h */
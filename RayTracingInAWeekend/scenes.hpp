@@ -0,0 +1,101 @@
+//
+//  scenes.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 7/28/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef scenes_h
+#define scenes_h
+
+#include <string>
+#include <vector>
+#include "hitable_list.hpp"
+#include "sphere.hpp"
+#include "triangle.hpp"
+#include "camera.hpp"
+
+// A snapshot is simply an image of the world taken from a certain angle
+// Also a label to identify the shot
+class snapshot {
+public:
+    camera cam;
+    std::string label;
+    
+    snapshot() = delete;
+    snapshot(camera c,
+             const char* id) :  cam(c),
+                                label(id) {}
+};
+
+// Create scene data
+void generateScene(scene &world)
+{
+    // hovering triangle
+    world.objects.emplace_back(new triangle(vec3(-3.0f, 0.0f, -3.0f),
+                                            vec3( 3.0f, 1.0f, -2.0f),
+                                            vec3(-2.0f, 2.0f, -1.5f),
+                                            new metal(vec3(0.8, 0.1, 0.5))));
+    // center metallic sphere
+    world.objects.emplace_back(new sphere(vec3(0.0f, 0.0f, -1.0f),
+                                          0.5f,
+                                          new metal(vec3(0.1, 0.2, 0.5))));
+    // left refracting sphere
+    world.objects.emplace_back(new sphere(vec3(-1.0f, 0.0f, -1.0f),
+                                          0.5f,
+                                          new dielectric(1.5)));
+    // right back fuzzy metal
+    world.objects.emplace_back(new sphere(vec3(1.0f, 0.0f, -2.0f),
+                                          0.6f,
+                                          new metal(vec3(0.8, 0.8, 0.8), 0.9f)));
+    {
+        // checkerboard hovering sphere
+        flatShade* shade0 = new flatShade(vec3(0.9, 0.5, 0.0f));
+        flatShade* shade1 = new flatShade(vec3(0.9, 0.9, 0.9));
+        checkerBoard* checkTex = new checkerBoard(shade0, shade1);
+        world.objects.emplace_back(new sphere(vec3(3.0f, 2.0f, -3.0f),
+                                              1.5f,
+                                              new lambertianTexture(checkTex)));
+    }
+    
+    // Green white patterned base
+    {
+        flatShade* shade0 = new flatShade(vec3(0.2, 0.3, 0.1));
+        flatShade* shade1 = new flatShade(vec3(0.9, 0.9, 0.9));
+        checkerBoard* checkTex = new checkerBoard(shade0, shade1);
+        world.objects.emplace_back(new sphere(vec3(0.0f, -100.5f, -1.0f),
+                                              100.0f,
+                                              new lambertianTexture(checkTex)));
+    }
+}
+
+// Each snapshot corresponds to some camera view of the world / scene
+std::vector<snapshot> generateSnapshots(float aspect)
+{
+    return {
+        snapshot(camera(50.0f,
+                        aspect),
+                 "RayTrace_Image_1"),
+
+        snapshot(camera(15.0f,
+                        aspect,
+                        vec3(5.0f, 1.0f, 3.0f), // from
+                        vec3(0.0f, 1.0f, -1.0f), // At
+                        0.125f, // aperture
+                        10.0f // focal dist
+                 ),
+                 "RayTrace_Image_2"),
+        
+        snapshot(camera(25.0f,
+                        aspect,
+                        vec3(-3.5f, 0.0f, 0.0f), // from
+                        vec3(0.0f, 1.0f, -1.0f), // At
+                        0.125f, // aperture
+                        10.0f // focal dist
+                        ),
+                 "RayTrace_Image_3"),
+    };
+}
+
+#endif /* scenes_h */
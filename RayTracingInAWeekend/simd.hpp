@@ -0,0 +1,755 @@
+//
+//  simd.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 8/4/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef simd_h
+#define simd_h
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "vec3.hpp"
+
+// Wide vector math layer
+//
+// floatx4 / floatx8: 4 / 8 floats processed by one instruction
+// maskx4 / maskx8:   per lane true / false, result of comparisons,
+//                    used to select between two values lane by lane
+// vec3a:             single vec3 held in a SIMD register (w lane unused)
+// vec3x4 / vec3x8:   4 / 8 vec3s stored as structure of arrays
+//                    (x of all lanes, then y, then z), so dot, cross and
+//                    normalize work on all lanes at once with no shuffling
+//
+// The backend is picked at compile time:
+// . SSE (always there on x86_64), AVX when built with -mavx (see Makefile SIMD)
+// . NEON on arm64
+// . plain loops otherwise, or when SIMD_SCALAR is defined
+// Without AVX a floatx8 is simply two floatx4.
+//
+// vec3 itself stays 3 packed floats, so the BVH / aabb layouts are
+// untouched and every existing call site still compiles. Kernels that do
+// a lot of math on one vector load it into a vec3a; kernels that work on
+// groups of rays or primitives (packets, streams, SoA batches) use the
+// wide types.
+
+#if !defined(SIMD_SCALAR)
+#if defined(__SSE2__) || defined(_M_X64)
+#define SIMD_SSE 1
+#include <immintrin.h>
+#if defined(__AVX__)
+#define SIMD_AVX 1
+#endif
+#elif defined(__ARM_NEON)
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
+
+struct maskx4
+{
+#if SIMD_SSE
+    __m128 v;
+#elif SIMD_NEON
+    uint32x4_t v;
+#else
+    uint32_t v[4];
+#endif
+
+    // bit i is set when lane i is true
+    inline int bits() const
+    {
+#if SIMD_SSE
+        return _mm_movemask_ps(v);
+#else
+        uint32_t m[4];
+#if SIMD_NEON
+        vst1q_u32(m, v);
+#else
+        m[0] = v[0]; m[1] = v[1]; m[2] = v[2]; m[3] = v[3];
+#endif
+        return (m[0] >> 31) | ((m[1] >> 31) << 1) | ((m[2] >> 31) << 2) | ((m[3] >> 31) << 3);
+#endif
+    }
+
+    inline bool any() const { return bits() != 0; }
+    inline bool all() const { return bits() == 0xf; }
+    inline bool none() const { return bits() == 0; }
+    inline bool operator[](int i) const { return (bits() >> i) & 1; }
+};
+
+inline maskx4 operator&(const maskx4& a, const maskx4& b)
+{
+    maskx4 r;
+#if SIMD_SSE
+    r.v = _mm_and_ps(a.v, b.v);
+#elif SIMD_NEON
+    r.v = vandq_u32(a.v, b.v);
+#else
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] & b.v[i];
+#endif
+    return r;
+}
+
+inline maskx4 operator|(const maskx4& a, const maskx4& b)
+{
+    maskx4 r;
+#if SIMD_SSE
+    r.v = _mm_or_ps(a.v, b.v);
+#elif SIMD_NEON
+    r.v = vorrq_u32(a.v, b.v);
+#else
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] | b.v[i];
+#endif
+    return r;
+}
+
+// a and not b
+inline maskx4 andNot(const maskx4& a, const maskx4& b)
+{
+    maskx4 r;
+#if SIMD_SSE
+    r.v = _mm_andnot_ps(b.v, a.v);
+#elif SIMD_NEON
+    r.v = vbicq_u32(a.v, b.v);
+#else
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] & ~b.v[i];
+#endif
+    return r;
+}
+
+struct floatx4
+{
+    enum { kWidth = 4 };
+    typedef maskx4 mask;
+
+#if SIMD_SSE
+    __m128 v;
+#elif SIMD_NEON
+    float32x4_t v;
+#else
+    float v[4];
+#endif
+
+    floatx4() {}
+#if SIMD_SSE
+    floatx4(__m128 x) : v(x) {}
+    floatx4(float s) : v(_mm_set1_ps(s)) {}
+    floatx4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) {}
+#elif SIMD_NEON
+    floatx4(float32x4_t x) : v(x) {}
+    floatx4(float s) : v(vdupq_n_f32(s)) {}
+    floatx4(float a, float b, float c, float d)
+    {
+        const float t[4] = { a, b, c, d };
+        v = vld1q_f32(t);
+    }
+#else
+    floatx4(float s) { v[0] = s; v[1] = s; v[2] = s; v[3] = s; }
+    floatx4(float a, float b, float c, float d) { v[0] = a; v[1] = b; v[2] = c; v[3] = d; }
+#endif
+
+    // p needs no particular alignment
+    static inline floatx4 load(const float *p)
+    {
+#if SIMD_SSE
+        return floatx4(_mm_loadu_ps(p));
+#elif SIMD_NEON
+        return floatx4(vld1q_f32(p));
+#else
+        return floatx4(p[0], p[1], p[2], p[3]);
+#endif
+    }
+
+    // 4 bytes (0 - 255) converted to float, e.g. quantized box planes
+    static inline floatx4 loadBytes(const uint8_t *p)
+    {
+#if SIMD_SSE
+        int32_t bytes;
+        memcpy(&bytes, p, sizeof(bytes));
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+        return floatx4(_mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero)));
+#elif SIMD_NEON
+        uint32_t word;
+        memcpy(&word, p, sizeof(word));
+        const uint8x8_t bytes = vreinterpret_u8_u32(vset_lane_u32(word, vdup_n_u32(0), 0));
+        return floatx4(vcvtq_f32_u32(vmovl_u16(vget_low_u16(vmovl_u8(bytes)))));
+#else
+        return floatx4(p[0], p[1], p[2], p[3]);
+#endif
+    }
+
+    inline void store(float *p) const
+    {
+#if SIMD_SSE
+        _mm_storeu_ps(p, v);
+#elif SIMD_NEON
+        vst1q_f32(p, v);
+#else
+        p[0] = v[0]; p[1] = v[1]; p[2] = v[2]; p[3] = v[3];
+#endif
+    }
+
+    // lane 0
+    inline float first() const
+    {
+#if SIMD_SSE
+        return _mm_cvtss_f32(v);
+#elif SIMD_NEON
+        return vgetq_lane_f32(v, 0);
+#else
+        return v[0];
+#endif
+    }
+
+    // slow (goes through memory), for debugging / scalar fallbacks
+    inline float operator[](int i) const
+    {
+        float t[4];
+        store(t);
+        return t[i];
+    }
+};
+
+#if SIMD_SSE
+inline floatx4 operator+(const floatx4& a, const floatx4& b) { return _mm_add_ps(a.v, b.v); }
+inline floatx4 operator-(const floatx4& a, const floatx4& b) { return _mm_sub_ps(a.v, b.v); }
+inline floatx4 operator*(const floatx4& a, const floatx4& b) { return _mm_mul_ps(a.v, b.v); }
+inline floatx4 operator/(const floatx4& a, const floatx4& b) { return _mm_div_ps(a.v, b.v); }
+inline floatx4 operator-(const floatx4& a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+inline floatx4 min(const floatx4& a, const floatx4& b) { return _mm_min_ps(a.v, b.v); }
+inline floatx4 max(const floatx4& a, const floatx4& b) { return _mm_max_ps(a.v, b.v); }
+inline floatx4 sqrt(const floatx4& a) { return _mm_sqrt_ps(a.v); }
+inline floatx4 abs(const floatx4& a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+
+inline maskx4 makeMask(__m128 m) { maskx4 r; r.v = m; return r; }
+inline maskx4 operator<(const floatx4& a, const floatx4& b) { return makeMask(_mm_cmplt_ps(a.v, b.v)); }
+inline maskx4 operator<=(const floatx4& a, const floatx4& b) { return makeMask(_mm_cmple_ps(a.v, b.v)); }
+inline maskx4 operator>(const floatx4& a, const floatx4& b) { return makeMask(_mm_cmpgt_ps(a.v, b.v)); }
+inline maskx4 operator>=(const floatx4& a, const floatx4& b) { return makeMask(_mm_cmpge_ps(a.v, b.v)); }
+inline maskx4 operator==(const floatx4& a, const floatx4& b) { return makeMask(_mm_cmpeq_ps(a.v, b.v)); }
+
+// a where m is set, b elsewhere
+inline floatx4 select(const maskx4& m, const floatx4& a, const floatx4& b)
+{
+#if defined(__SSE4_1__)
+    return _mm_blendv_ps(b.v, a.v, m.v);
+#else
+    return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v));
+#endif
+}
+
+// a * b + c
+inline floatx4 fmadd(const floatx4& a, const floatx4& b, const floatx4& c)
+{
+#if defined(__FMA__)
+    return _mm_fmadd_ps(a.v, b.v, c.v);
+#else
+    return _mm_add_ps(_mm_mul_ps(a.v, b.v), c.v);
+#endif
+}
+
+// lanes of a rearranged, lane i of the result is lane Ii of a
+template <int I0, int I1, int I2, int I3>
+inline floatx4 shuffle(const floatx4& a)
+{
+    return _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(I3, I2, I1, I0));
+}
+#elif SIMD_NEON
+inline floatx4 operator+(const floatx4& a, const floatx4& b) { return vaddq_f32(a.v, b.v); }
+inline floatx4 operator-(const floatx4& a, const floatx4& b) { return vsubq_f32(a.v, b.v); }
+inline floatx4 operator*(const floatx4& a, const floatx4& b) { return vmulq_f32(a.v, b.v); }
+inline floatx4 operator/(const floatx4& a, const floatx4& b) { return vdivq_f32(a.v, b.v); }
+inline floatx4 operator-(const floatx4& a) { return vnegq_f32(a.v); }
+inline floatx4 min(const floatx4& a, const floatx4& b) { return vminq_f32(a.v, b.v); }
+inline floatx4 max(const floatx4& a, const floatx4& b) { return vmaxq_f32(a.v, b.v); }
+inline floatx4 sqrt(const floatx4& a) { return vsqrtq_f32(a.v); }
+inline floatx4 abs(const floatx4& a) { return vabsq_f32(a.v); }
+
+inline maskx4 makeMask(uint32x4_t m) { maskx4 r; r.v = m; return r; }
+inline maskx4 operator<(const floatx4& a, const floatx4& b) { return makeMask(vcltq_f32(a.v, b.v)); }
+inline maskx4 operator<=(const floatx4& a, const floatx4& b) { return makeMask(vcleq_f32(a.v, b.v)); }
+inline maskx4 operator>(const floatx4& a, const floatx4& b) { return makeMask(vcgtq_f32(a.v, b.v)); }
+inline maskx4 operator>=(const floatx4& a, const floatx4& b) { return makeMask(vcgeq_f32(a.v, b.v)); }
+inline maskx4 operator==(const floatx4& a, const floatx4& b) { return makeMask(vceqq_f32(a.v, b.v)); }
+
+inline floatx4 select(const maskx4& m, const floatx4& a, const floatx4& b)
+{
+    return vbslq_f32(m.v, a.v, b.v);
+}
+
+inline floatx4 fmadd(const floatx4& a, const floatx4& b, const floatx4& c)
+{
+    return vfmaq_f32(c.v, a.v, b.v);
+}
+
+template <int I0, int I1, int I2, int I3>
+inline floatx4 shuffle(const floatx4& a)
+{
+    float t[4];
+    a.store(t);
+    return floatx4(t[I0], t[I1], t[I2], t[I3]);
+}
+#else
+inline floatx4 operator+(const floatx4& a, const floatx4& b) { return floatx4(a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]); }
+inline floatx4 operator-(const floatx4& a, const floatx4& b) { return floatx4(a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]); }
+inline floatx4 operator*(const floatx4& a, const floatx4& b) { return floatx4(a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]); }
+inline floatx4 operator/(const floatx4& a, const floatx4& b) { return floatx4(a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3]); }
+inline floatx4 operator-(const floatx4& a) { return floatx4(-a.v[0], -a.v[1], -a.v[2], -a.v[3]); }
+inline floatx4 min(const floatx4& a, const floatx4& b) { return floatx4(std::min(a.v[0], b.v[0]), std::min(a.v[1], b.v[1]), std::min(a.v[2], b.v[2]), std::min(a.v[3], b.v[3])); }
+inline floatx4 max(const floatx4& a, const floatx4& b) { return floatx4(std::max(a.v[0], b.v[0]), std::max(a.v[1], b.v[1]), std::max(a.v[2], b.v[2]), std::max(a.v[3], b.v[3])); }
+inline floatx4 sqrt(const floatx4& a) { return floatx4(sqrtf(a.v[0]), sqrtf(a.v[1]), sqrtf(a.v[2]), sqrtf(a.v[3])); }
+inline floatx4 abs(const floatx4& a) { return floatx4(fabsf(a.v[0]), fabsf(a.v[1]), fabsf(a.v[2]), fabsf(a.v[3])); }
+
+inline maskx4 makeMask(bool a, bool b, bool c, bool d)
+{
+    maskx4 r;
+    r.v[0] = a ? ~0u : 0u; r.v[1] = b ? ~0u : 0u; r.v[2] = c ? ~0u : 0u; r.v[3] = d ? ~0u : 0u;
+    return r;
+}
+inline maskx4 operator<(const floatx4& a, const floatx4& b) { return makeMask(a.v[0] < b.v[0], a.v[1] < b.v[1], a.v[2] < b.v[2], a.v[3] < b.v[3]); }
+inline maskx4 operator<=(const floatx4& a, const floatx4& b) { return makeMask(a.v[0] <= b.v[0], a.v[1] <= b.v[1], a.v[2] <= b.v[2], a.v[3] <= b.v[3]); }
+inline maskx4 operator>(const floatx4& a, const floatx4& b) { return makeMask(a.v[0] > b.v[0], a.v[1] > b.v[1], a.v[2] > b.v[2], a.v[3] > b.v[3]); }
+inline maskx4 operator>=(const floatx4& a, const floatx4& b) { return makeMask(a.v[0] >= b.v[0], a.v[1] >= b.v[1], a.v[2] >= b.v[2], a.v[3] >= b.v[3]); }
+inline maskx4 operator==(const floatx4& a, const floatx4& b) { return makeMask(a.v[0] == b.v[0], a.v[1] == b.v[1], a.v[2] == b.v[2], a.v[3] == b.v[3]); }
+
+inline floatx4 select(const maskx4& m, const floatx4& a, const floatx4& b)
+{
+    return floatx4(m.v[0] ? a.v[0] : b.v[0], m.v[1] ? a.v[1] : b.v[1],
+                   m.v[2] ? a.v[2] : b.v[2], m.v[3] ? a.v[3] : b.v[3]);
+}
+
+inline floatx4 fmadd(const floatx4& a, const floatx4& b, const floatx4& c)
+{
+    return a * b + c;
+}
+
+template <int I0, int I1, int I2, int I3>
+inline floatx4 shuffle(const floatx4& a)
+{
+    return floatx4(a.v[I0], a.v[I1], a.v[I2], a.v[I3]);
+}
+#endif
+
+inline floatx4& operator+=(floatx4& a, const floatx4& b) { return a = a + b; }
+inline floatx4& operator-=(floatx4& a, const floatx4& b) { return a = a - b; }
+inline floatx4& operator*=(floatx4& a, const floatx4& b) { return a = a * b; }
+inline floatx4& operator/=(floatx4& a, const floatx4& b) { return a = a / b; }
+
+// smallest / largest lane
+inline float hmin(const floatx4& a)
+{
+    const floatx4 m = min(a, shuffle<1, 0, 3, 2>(a));
+    return min(m, shuffle<2, 3, 0, 1>(m)).first();
+}
+
+inline float hmax(const floatx4& a)
+{
+    const floatx4 m = max(a, shuffle<1, 0, 3, 2>(a));
+    return max(m, shuffle<2, 3, 0, 1>(m)).first();
+}
+
+// 8 wide: native with AVX, otherwise a pair of 4 wide halves
+struct maskx8
+{
+#if SIMD_AVX
+    __m256 v;
+    inline int bits() const { return _mm256_movemask_ps(v); }
+#else
+    maskx4 lo, hi;
+    inline int bits() const { return lo.bits() | (hi.bits() << 4); }
+#endif
+
+    inline bool any() const { return bits() != 0; }
+    inline bool all() const { return bits() == 0xff; }
+    inline bool none() const { return bits() == 0; }
+    inline bool operator[](int i) const { return (bits() >> i) & 1; }
+};
+
+struct floatx8
+{
+    enum { kWidth = 8 };
+    typedef maskx8 mask;
+
+#if SIMD_AVX
+    __m256 v;
+
+    floatx8() {}
+    floatx8(__m256 x) : v(x) {}
+    floatx8(float s) : v(_mm256_set1_ps(s)) {}
+    floatx8(float a, float b, float c, float d,
+            float e, float f, float g, float h) : v(_mm256_setr_ps(a, b, c, d, e, f, g, h)) {}
+
+    static inline floatx8 load(const float *p) { return floatx8(_mm256_loadu_ps(p)); }
+    static inline floatx8 loadBytes(const uint8_t *p)
+    {
+#if defined(__AVX2__)
+        const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+        return floatx8(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)));
+#else
+        return floatx8(_mm256_insertf128_ps(_mm256_castps128_ps256(floatx4::loadBytes(p).v),
+                                            floatx4::loadBytes(p + 4).v, 1));
+#endif
+    }
+    inline void store(float *p) const { _mm256_storeu_ps(p, v); }
+    inline float first() const { return _mm256_cvtss_f32(v); }
+#else
+    floatx4 lo, hi;
+
+    floatx8() {}
+    floatx8(const floatx4& l, const floatx4& h) : lo(l), hi(h) {}
+    floatx8(float s) : lo(s), hi(s) {}
+    floatx8(float a, float b, float c, float d,
+            float e, float f, float g, float h) : lo(a, b, c, d), hi(e, f, g, h) {}
+
+    static inline floatx8 load(const float *p) { return floatx8(floatx4::load(p), floatx4::load(p + 4)); }
+    static inline floatx8 loadBytes(const uint8_t *p) { return floatx8(floatx4::loadBytes(p), floatx4::loadBytes(p + 4)); }
+    inline void store(float *p) const { lo.store(p); hi.store(p + 4); }
+    inline float first() const { return lo.first(); }
+#endif
+
+    inline float operator[](int i) const
+    {
+        float t[8];
+        store(t);
+        return t[i];
+    }
+};
+
+#if SIMD_AVX
+inline maskx8 makeMask(__m256 m) { maskx8 r; r.v = m; return r; }
+inline maskx8 operator&(const maskx8& a, const maskx8& b) { return makeMask(_mm256_and_ps(a.v, b.v)); }
+inline maskx8 operator|(const maskx8& a, const maskx8& b) { return makeMask(_mm256_or_ps(a.v, b.v)); }
+inline maskx8 andNot(const maskx8& a, const maskx8& b) { return makeMask(_mm256_andnot_ps(b.v, a.v)); }
+
+inline floatx8 operator+(const floatx8& a, const floatx8& b) { return _mm256_add_ps(a.v, b.v); }
+inline floatx8 operator-(const floatx8& a, const floatx8& b) { return _mm256_sub_ps(a.v, b.v); }
+inline floatx8 operator*(const floatx8& a, const floatx8& b) { return _mm256_mul_ps(a.v, b.v); }
+inline floatx8 operator/(const floatx8& a, const floatx8& b) { return _mm256_div_ps(a.v, b.v); }
+inline floatx8 operator-(const floatx8& a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+inline floatx8 min(const floatx8& a, const floatx8& b) { return _mm256_min_ps(a.v, b.v); }
+inline floatx8 max(const floatx8& a, const floatx8& b) { return _mm256_max_ps(a.v, b.v); }
+inline floatx8 sqrt(const floatx8& a) { return _mm256_sqrt_ps(a.v); }
+inline floatx8 abs(const floatx8& a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+
+inline maskx8 operator<(const floatx8& a, const floatx8& b) { return makeMask(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+inline maskx8 operator<=(const floatx8& a, const floatx8& b) { return makeMask(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)); }
+inline maskx8 operator>(const floatx8& a, const floatx8& b) { return makeMask(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+inline maskx8 operator>=(const floatx8& a, const floatx8& b) { return makeMask(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)); }
+inline maskx8 operator==(const floatx8& a, const floatx8& b) { return makeMask(_mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ)); }
+
+inline floatx8 select(const maskx8& m, const floatx8& a, const floatx8& b)
+{
+    return _mm256_blendv_ps(b.v, a.v, m.v);
+}
+
+inline floatx8 fmadd(const floatx8& a, const floatx8& b, const floatx8& c)
+{
+#if defined(__FMA__)
+    return _mm256_fmadd_ps(a.v, b.v, c.v);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a.v, b.v), c.v);
+#endif
+}
+
+inline float hmin(const floatx8& a)
+{
+    return hmin(min(floatx4(_mm256_castps256_ps128(a.v)), floatx4(_mm256_extractf128_ps(a.v, 1))));
+}
+
+inline float hmax(const floatx8& a)
+{
+    return hmax(max(floatx4(_mm256_castps256_ps128(a.v)), floatx4(_mm256_extractf128_ps(a.v, 1))));
+}
+#else
+inline maskx8 makeMask(const maskx4& lo, const maskx4& hi) { maskx8 r; r.lo = lo; r.hi = hi; return r; }
+inline maskx8 operator&(const maskx8& a, const maskx8& b) { return makeMask(a.lo & b.lo, a.hi & b.hi); }
+inline maskx8 operator|(const maskx8& a, const maskx8& b) { return makeMask(a.lo | b.lo, a.hi | b.hi); }
+inline maskx8 andNot(const maskx8& a, const maskx8& b) { return makeMask(andNot(a.lo, b.lo), andNot(a.hi, b.hi)); }
+
+inline floatx8 operator+(const floatx8& a, const floatx8& b) { return floatx8(a.lo + b.lo, a.hi + b.hi); }
+inline floatx8 operator-(const floatx8& a, const floatx8& b) { return floatx8(a.lo - b.lo, a.hi - b.hi); }
+inline floatx8 operator*(const floatx8& a, const floatx8& b) { return floatx8(a.lo * b.lo, a.hi * b.hi); }
+inline floatx8 operator/(const floatx8& a, const floatx8& b) { return floatx8(a.lo / b.lo, a.hi / b.hi); }
+inline floatx8 operator-(const floatx8& a) { return floatx8(-a.lo, -a.hi); }
+inline floatx8 min(const floatx8& a, const floatx8& b) { return floatx8(min(a.lo, b.lo), min(a.hi, b.hi)); }
+inline floatx8 max(const floatx8& a, const floatx8& b) { return floatx8(max(a.lo, b.lo), max(a.hi, b.hi)); }
+inline floatx8 sqrt(const floatx8& a) { return floatx8(sqrt(a.lo), sqrt(a.hi)); }
+inline floatx8 abs(const floatx8& a) { return floatx8(abs(a.lo), abs(a.hi)); }
+
+inline maskx8 operator<(const floatx8& a, const floatx8& b) { return makeMask(a.lo < b.lo, a.hi < b.hi); }
+inline maskx8 operator<=(const floatx8& a, const floatx8& b) { return makeMask(a.lo <= b.lo, a.hi <= b.hi); }
+inline maskx8 operator>(const floatx8& a, const floatx8& b) { return makeMask(a.lo > b.lo, a.hi > b.hi); }
+inline maskx8 operator>=(const floatx8& a, const floatx8& b) { return makeMask(a.lo >= b.lo, a.hi >= b.hi); }
+inline maskx8 operator==(const floatx8& a, const floatx8& b) { return makeMask(a.lo == b.lo, a.hi == b.hi); }
+
+inline floatx8 select(const maskx8& m, const floatx8& a, const floatx8& b)
+{
+    return floatx8(select(m.lo, a.lo, b.lo), select(m.hi, a.hi, b.hi));
+}
+
+inline floatx8 fmadd(const floatx8& a, const floatx8& b, const floatx8& c)
+{
+    return floatx8(fmadd(a.lo, b.lo, c.lo), fmadd(a.hi, b.hi, c.hi));
+}
+
+inline float hmin(const floatx8& a) { return hmin(min(a.lo, a.hi)); }
+inline float hmax(const floatx8& a) { return hmax(max(a.lo, a.hi)); }
+#endif
+
+inline floatx8& operator+=(floatx8& a, const floatx8& b) { return a = a + b; }
+inline floatx8& operator-=(floatx8& a, const floatx8& b) { return a = a - b; }
+inline floatx8& operator*=(floatx8& a, const floatx8& b) { return a = a * b; }
+inline floatx8& operator/=(floatx8& a, const floatx8& b) { return a = a / b; }
+
+// vec3 in a SIMD register
+// w lane is kept at 0 so that it never leaks into dot products.
+// Conversions to / from vec3 are explicit: each one is a trip through
+// memory, so they belong at the start / end of a run of vector math.
+class vec3a
+{
+public:
+    vec3a() {}
+    explicit vec3a(const floatx4& f) : v(f) {}
+    explicit vec3a(const vec3& a) : v(a.x(), a.y(), a.z(), 0.0f) {}
+    explicit vec3a(float s) : v(s, s, s, 0.0f) {}
+    vec3a(float x, float y, float z) : v(x, y, z, 0.0f) {}
+
+    inline vec3 toVec3() const
+    {
+        float t[4];
+        v.store(t);
+        return vec3(t[0], t[1], t[2]);
+    }
+
+    inline float x() const { return v.first(); }
+    inline float y() const { return shuffle<1, 1, 1, 1>(v).first(); }
+    inline float z() const { return shuffle<2, 2, 2, 2>(v).first(); }
+
+    inline vec3a operator-() const { return vec3a(-v); }
+    inline vec3a& operator+=(const vec3a& b) { v += b.v; return *this; }
+    inline vec3a& operator-=(const vec3a& b) { v -= b.v; return *this; }
+    inline vec3a& operator*=(const vec3a& b) { v *= b.v; return *this; }
+    inline vec3a& operator*=(float t) { v *= floatx4(t); return *this; }
+
+    floatx4 v;
+};
+
+inline vec3a operator+(const vec3a& a, const vec3a& b) { return vec3a(a.v + b.v); }
+inline vec3a operator-(const vec3a& a, const vec3a& b) { return vec3a(a.v - b.v); }
+inline vec3a operator*(const vec3a& a, const vec3a& b) { return vec3a(a.v * b.v); }
+inline vec3a operator*(float t, const vec3a& a) { return vec3a(floatx4(t) * a.v); }
+inline vec3a operator*(const vec3a& a, float t) { return vec3a(a.v * floatx4(t)); }
+inline vec3a operator/(const vec3a& a, float t) { return vec3a(a.v / floatx4(t)); }
+inline vec3a min(const vec3a& a, const vec3a& b) { return vec3a(min(a.v, b.v)); }
+inline vec3a max(const vec3a& a, const vec3a& b) { return vec3a(max(a.v, b.v)); }
+
+// x + y + z broadcast to every lane
+inline floatx4 dotSplat(const vec3a& a, const vec3a& b)
+{
+    const floatx4 m = a.v * b.v;
+    return shuffle<0, 0, 0, 0>(m) + shuffle<1, 1, 1, 1>(m) + shuffle<2, 2, 2, 2>(m);
+}
+
+inline float dot(const vec3a& a, const vec3a& b)
+{
+    return dotSplat(a, b).first();
+}
+
+// a x b = a.yzx * b.zxy - a.zxy * b.yzx (w stays 0)
+inline vec3a cross(const vec3a& a, const vec3a& b)
+{
+    return vec3a(shuffle<1, 2, 0, 3>(a.v) * shuffle<2, 0, 1, 3>(b.v) -
+                 shuffle<2, 0, 1, 3>(a.v) * shuffle<1, 2, 0, 3>(b.v));
+}
+
+inline float length(const vec3a& a)
+{
+    return sqrt(dotSplat(a, a)).first();
+}
+
+inline vec3a unit_vector(const vec3a& a)
+{
+    return vec3a(a.v / sqrt(dotSplat(a, a)));
+}
+
+// N vec3s as structure of arrays (floatN = floatx4 or floatx8)
+// Lane i of x, y, z together make up the i'th vector.
+// Operations apply to all lanes; lanes that should be left alone
+// (inactive rays, padding past the end of an array) are handled by
+// computing for every lane and keeping the old value where the mask
+// is not set, with select().
+template <typename floatN>
+class vec3xN
+{
+public:
+    enum { kWidth = floatN::kWidth };
+    typedef typename floatN::mask mask;
+
+    vec3xN() {}
+    vec3xN(const floatN& x, const floatN& y, const floatN& z) : x(x), y(y), z(z) {}
+    // same vector in every lane
+    explicit vec3xN(const vec3& a) : x(a.x()), y(a.y()), z(a.z()) {}
+
+    // from separate x, y, z arrays (kWidth floats each)
+    static inline vec3xN load(const float *xs, const float *ys, const float *zs)
+    {
+        return vec3xN(floatN::load(xs), floatN::load(ys), floatN::load(zs));
+    }
+
+    inline void store(float *xs, float *ys, float *zs) const
+    {
+        x.store(xs);
+        y.store(ys);
+        z.store(zs);
+    }
+
+    // gather from / scatter to kWidth consecutive vec3s
+    static inline vec3xN load(const vec3 *a)
+    {
+        float t[3][kWidth];
+        for (int i = 0; i < kWidth; i++) {
+            t[0][i] = a[i].x();
+            t[1][i] = a[i].y();
+            t[2][i] = a[i].z();
+        }
+        return load(t[0], t[1], t[2]);
+    }
+
+    inline void store(vec3 *a) const
+    {
+        float t[3][kWidth];
+        store(t[0], t[1], t[2]);
+        for (int i = 0; i < kWidth; i++) {
+            a[i] = vec3(t[0][i], t[1][i], t[2][i]);
+        }
+    }
+
+    // only lanes set in m are written
+    inline void store(vec3 *a, const mask& m) const
+    {
+        float t[3][kWidth];
+        store(t[0], t[1], t[2]);
+        const int bits = m.bits();
+        for (int i = 0; i < kWidth; i++) {
+            if (bits & (1 << i)) {
+                a[i] = vec3(t[0][i], t[1][i], t[2][i]);
+            }
+        }
+    }
+
+    // slow (goes through memory), for debugging / scalar fallbacks
+    inline vec3 operator[](int i) const { return vec3(x[i], y[i], z[i]); }
+
+    inline vec3xN operator-() const { return vec3xN(-x, -y, -z); }
+    inline vec3xN& operator+=(const vec3xN& b) { x += b.x; y += b.y; z += b.z; return *this; }
+    inline vec3xN& operator-=(const vec3xN& b) { x -= b.x; y -= b.y; z -= b.z; return *this; }
+    inline vec3xN& operator*=(const vec3xN& b) { x *= b.x; y *= b.y; z *= b.z; return *this; }
+    inline vec3xN& operator*=(const floatN& t) { x *= t; y *= t; z *= t; return *this; }
+
+    floatN x;
+    floatN y;
+    floatN z;
+};
+
+typedef vec3xN<floatx4> vec3x4;
+typedef vec3xN<floatx8> vec3x8;
+
+template <typename floatN>
+inline vec3xN<floatN> operator+(const vec3xN<floatN>& a, const vec3xN<floatN>& b)
+{
+    return vec3xN<floatN>(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+template <typename floatN>
+inline vec3xN<floatN> operator-(const vec3xN<floatN>& a, const vec3xN<floatN>& b)
+{
+    return vec3xN<floatN>(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+template <typename floatN>
+inline vec3xN<floatN> operator*(const vec3xN<floatN>& a, const vec3xN<floatN>& b)
+{
+    return vec3xN<floatN>(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+
+template <typename floatN>
+inline vec3xN<floatN> operator*(const floatN& t, const vec3xN<floatN>& a)
+{
+    return vec3xN<floatN>(t * a.x, t * a.y, t * a.z);
+}
+
+template <typename floatN>
+inline vec3xN<floatN> operator*(const vec3xN<floatN>& a, const floatN& t)
+{
+    return vec3xN<floatN>(a.x * t, a.y * t, a.z * t);
+}
+
+template <typename floatN>
+inline vec3xN<floatN> operator/(const vec3xN<floatN>& a, const floatN& t)
+{
+    const floatN k = floatN(1.0f) / t;
+    return vec3xN<floatN>(a.x * k, a.y * k, a.z * k);
+}
+
+// summed x, y, then z like vec3's dot, so that (without FMA) lanes round
+// exactly like the scalar code
+template <typename floatN>
+inline floatN dot(const vec3xN<floatN>& a, const vec3xN<floatN>& b)
+{
+    return fmadd(a.z, b.z, fmadd(a.y, b.y, a.x * b.x));
+}
+
+template <typename floatN>
+inline vec3xN<floatN> cross(const vec3xN<floatN>& a, const vec3xN<floatN>& b)
+{
+    return vec3xN<floatN>(a.y * b.z - a.z * b.y,
+                          a.z * b.x - a.x * b.z,
+                          a.x * b.y - a.y * b.x);
+}
+
+template <typename floatN>
+inline floatN squared_length(const vec3xN<floatN>& a)
+{
+    return dot(a, a);
+}
+
+template <typename floatN>
+inline floatN length(const vec3xN<floatN>& a)
+{
+    return sqrt(dot(a, a));
+}
+
+template <typename floatN>
+inline vec3xN<floatN> unit_vector(const vec3xN<floatN>& a)
+{
+    return a / length(a);
+}
+
+template <typename floatN>
+inline vec3xN<floatN> min(const vec3xN<floatN>& a, const vec3xN<floatN>& b)
+{
+    return vec3xN<floatN>(min(a.x, b.x), min(a.y, b.y), min(a.z, b.z));
+}
+
+template <typename floatN>
+inline vec3xN<floatN> max(const vec3xN<floatN>& a, const vec3xN<floatN>& b)
+{
+    return vec3xN<floatN>(max(a.x, b.x), max(a.y, b.y), max(a.z, b.z));
+}
+
+// a in lanes where m is set, b elsewhere
+template <typename floatN>
+inline vec3xN<floatN> select(const typename floatN::mask& m,
+                             const vec3xN<floatN>& a,
+                             const vec3xN<floatN>& b)
+{
+    return vec3xN<floatN>(select(m, a.x, b.x), select(m, a.y, b.y), select(m, a.z, b.z));
+}
+
+#endif /* simd_h */
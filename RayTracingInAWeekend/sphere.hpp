@@ -13,107 +13,282 @@
 #include "material.hpp"
 #include <cmath>
 
-// The math in the book seems off (even though output is similar) ??
-// Im guessing hes taken advantage of the fact that a in the quadratic
-// to solve is 1 for unit ray direction
-// so disabling
-#define SHIRLEY_ROOTS 0
+// Sphere root policies
+// basicSphere takes how the ray / sphere quadratic is solved as a template
+// parameter instead of a #define switch, so both solvers can be built into
+// one binary and picked per object with no runtime dispatch.
+//
+// Roots: nearestRoot(a, halfB, c, t_min, t_max, root) gives the nearest
+// root of a*t^2 + 2*halfB*t + c in (t_min, t_max); kPacketTest says the
+// SIMD packet test of basicSphere finds the same roots (else packets go
+// ray by ray).
 
-class sphere : public object
+// getQuadraticRoots(): q = -1/2 * (b + sign(b) * sqrt(discriminant)),
+// roots q / a and c / q, no cancellation when b and the root of the
+// discriminant are nearly equal
+struct quadraticRoots
 {
-public:
-    sphere() = delete;
-    sphere(vec3 cen,
-           float rad,
-           material* mat) : center(cen),
-                            radius(rad),
-                            surfaceMat(mat) {}
-    
-    bool hit(const ray& r,
-             float t_min,
-             float t_max,
-             intersectParams& rec) const
+    static constexpr bool kPacketTest = true;
+
+    static inline bool nearestRoot(float a, float halfB, float c, float t_min, float t_max, float& root)
     {
-        // For sphere whose center is located at C (<Cx, Cy, Cz>) with Radius R (scalar),
-        // Eqn for point P (<Px, Py, Pz>) on the spheres surface,
-        // (Px - Cx)^2 + (Py - Cy)^2 + (Px - Cx)^2 = R^2
-        // i.e. (P - C).(P - C) - R^2 = 0
-        //
-        // Substitute P = Ray eqn = O + t*D
-        // you get quadratic form: a*x^2 + b*x + c = 0
-        // a = |D|^2
-        // b = 2 *(O - C).(D)
-        // c = |(O - C)|^2 - R^2
-        //
-        // solving this,
-        // discriminant < 0 => no intersection
-        // otherwise use roots to determine point of intersection
-        vec3 oc = r.origin() - center;
-        float a = dot(r.direction(), r.direction());
-        float b = dot(oc, r.direction());
-        float c = dot(oc, oc) - radius * radius;
-        
-        float root = 0.0f;
-        bool didHit = false;
-#if SHIRLEY_ROOTS
-        float discriminant = b * b - a * c;
-        if (discriminant > 0) {
-            bool didHit = false;
-            float root = 0.0f;
-            
-            // 0 discriminant
-            if (discriminant < kEpsilon) {
-                root = -b / a * 0.5f;
-                didHit = true;
-            } else {
-                // check root 1
-                root = (-b - sqrt(discriminant)) / a;
-                if (root < t_max && root > t_min) {
-                    didHit = true;
-                } else {
-                    // root 2
-                    root = (-b + sqrt(discriminant)) / a;
-                    didHit = (root < t_max && root > t_min);
-                }
-            }
-        }
-#else
-        b *= 2.0f;
         float t0, t1;
-        if (getQuadraticRoots(a, b, c, t0, t1)) {
+        if (getQuadraticRoots(a, 2.0f * halfB, c, t0, t1)) {
             if (t0 < t_max && t0 > t_min) {
                 root = t0;
-                didHit = true;
+                return true;
             } else if (t1 < t_max && t1 > t_min) {
                 root = t1;
-                didHit = true;
+                return true;
             }
         }
-#endif
-        
-        if (didHit) {
-            rec.t = root;
-            // root is used to find point of intersection
-            rec.p = r.point_at_parameter(root);
-            // normal is simply outwards from center to that point
-            rec.normal = (rec.p - center) / radius;
-            rec.surfaceMat = surfaceMat;
-            // uv calc (cylindrical coords)
-            // divide by (2 x PI) to convert the returned angle to [-0.5, 0.5] range
-            // N.y = v
-            // 0.5 add to shift to [0,1] range
-            rec.u = atan2(rec.normal.x(), rec.normal.z()) / (2 * M_PI) + 0.5f;
-            rec.v = rec.normal.y() * 0.5f + 0.5f;
+        return false;
+    }
+};
+
+// The book's roots: (-halfB -/+ sqrt(halfB^2 - a*c)) / a
+// The 2s cancel (b is 2 * halfB), one multiply less, but the smaller
+// root loses precision when halfB^2 is much bigger than a*c
+struct shirleyRoots
+{
+    static constexpr bool kPacketTest = false;
+
+    static inline bool nearestRoot(float a, float halfB, float c, float t_min, float t_max, float& root)
+    {
+        const float discriminant = halfB * halfB - a * c;
+        if (discriminant <= 0) {
+            return false;
+        }
+        // check root 1
+        root = (-halfB - sqrt(discriminant)) / a;
+        if (root < t_max && root > t_min) {
             return true;
         }
-        
-        return false;
+        // root 2
+        root = (-halfB + sqrt(discriminant)) / a;
+        return root < t_max && root > t_min;
+    }
+};
+
+// Nearest root of the ray / sphere quadratic in (t_min, t_max)
+// (free function, shared by sphere and the flat scene's sphere array,
+// see flatscene.hpp)
+template <typename Roots = quadraticRoots>
+inline bool intersectSphere(const vec3& center,
+                            float radius,
+                            const ray& r,
+                            float t_min,
+                            float t_max,
+                            float& root)
+{
+    // For sphere whose center is located at C (<Cx, Cy, Cz>) with Radius R (scalar),
+    // Eqn for point P (<Px, Py, Pz>) on the spheres surface,
+    // (Px - Cx)^2 + (Py - Cy)^2 + (Px - Cx)^2 = R^2
+    // i.e. (P - C).(P - C) - R^2 = 0
+    //
+    // Substitute P = Ray eqn = O + t*D
+    // you get quadratic form: a*x^2 + b*x + c = 0
+    // a = |D|^2
+    // b = 2 *(O - C).(D)
+    // c = |(O - C)|^2 - R^2
+    //
+    // solving this,
+    // discriminant < 0 => no intersection
+    // otherwise use roots to determine point of intersection
+    vec3 oc = r.origin() - center;
+    float a = dot(r.direction(), r.direction());
+    float halfB = dot(oc, r.direction());
+    float c = dot(oc, oc) - radius * radius;
+    
+    root = 0.0f;
+    return Roots::nearestRoot(a, halfB, c, t_min, t_max, root);
+}
+
+// t, p, normal and (if asked for) uv of the hit at root, see
+// intersectSphere() (surfaceMat is left to the caller)
+inline void sphereHitRecord(const vec3& center,
+                            float radius,
+                            const ray& r,
+                            float root,
+                            uint32_t attributes,
+                            intersectParams& rec)
+{
+    rec.t = root;
+    // root is used to find point of intersection
+    rec.p = r.point_at_parameter(root);
+    // normal is simply outwards from center to that point
+    rec.normal = (rec.p - center) / radius;
+    rec.twoSided = false;
+    if ((attributes & kSurfaceUV) == 0) {
+        return;
+    }
+    // uv calc (cylindrical coords)
+    // divide by (2 x PI) to convert the returned angle to [-0.5, 0.5] range
+    // N.y = v
+    // 0.5 add to shift to [0,1] range
+    rec.u = atan2(rec.normal.x(), rec.normal.z()) / (2 * M_PI) + 0.5f;
+    rec.v = rec.normal.y() * 0.5f + 0.5f;
+}
+
+// Sphere object, with the quadratic solver (Roots) picked at compile
+// time, see the policies above. sphere is the default (quadraticRoots).
+template <typename Roots = quadraticRoots>
+class basicSphere : public object
+{
+public:
+    typedef Roots roots;
+
+    basicSphere() = delete;
+    basicSphere(vec3 cen,
+                float rad,
+                material* mat) : center(cen),
+                                 radius(rad),
+                                 surfaceMat(mat) {}
+    
+    bool closestHit(const ray& r,
+                    float t_min,
+                    float t_max,
+                    primitiveHit& h) const
+    {
+        float root;
+        if (!intersectRoot(r, t_min, t_max, root)) {
+            return false;
+        }
+        h.t = root;
+        h.prim = this;
+        h.nInstances = 0;
+        return true;
+    }
+
+    material* hitMaterial(const primitiveHit& h, uint32_t level) const
+    {
+        return surfaceMat;
+    }
+
+    // the atan2 based uv is the costly part, skipped unless asked for
+    void hitAttributes(const ray& r,
+                       const primitiveHit& h,
+                       uint32_t level,
+                       uint32_t attributes,
+                       intersectParams& rec) const
+    {
+        fillHitRecord(r, h.t, rec, attributes);
+    }
+
+    // same roots as hit(), without the hit record
+    bool occluded(const ray& r,
+                  float t_min,
+                  float t_max) const
+    {
+        float root;
+        return intersectRoot(r, t_min, t_max, root);
+    }
+
+    uint32_t hitPacket(rayPacket4& p, uint32_t active, intersectParams *rec) const
+    {
+        return intersectPacket(p, active, rec);
+    }
+    uint32_t hitPacket(rayPacket8& p, uint32_t active, intersectParams *rec) const
+    {
+        return intersectPacket(p, active, rec);
+    }
+    uint32_t hitPacket(rayPacket16& p, uint32_t active, intersectParams *rec) const
+    {
+        return intersectPacket(p, active, rec);
+    }
+    
+    // bounds at the current center, for any time interval (spheres
+    // only move between frames: after changing center or radius of a
+    // sphere in a scene, tell the scene with scene::objectMoved())
+    using object::boundingBox;
+    bool boundingBox(aabb& box) const
+    {
+        box = aabb(center - vec3(radius), center + vec3(radius));
+        return true;
     }
     
     vec3 center;
     float radius;
     material *surfaceMat;
+
+private:
+    // nearest root of the ray / sphere quadratic in (t_min, t_max)
+    bool intersectRoot(const ray& r,
+                       float t_min,
+                       float t_max,
+                       float& root) const
+    {
+        return intersectSphere<Roots>(center, radius, r, t_min, t_max, root);
+    }
+
+    void fillHitRecord(const ray& r,
+                       float root,
+                       intersectParams& rec,
+                       uint32_t attributes = kAllSurfaceAttributes) const
+    {
+        sphereHitRecord(center, radius, r, root, attributes, rec);
+        rec.surfaceMat = surfaceMat;
+    }
+
+    // Same roots as hit() with quadraticRoots (getQuadraticRoots()), for
+    // a chunk of rays at a time, with misses masked off instead of
+    // returned early. Only the rays that hit go through the scalar hit
+    // record code. Other solvers go ray by ray.
+    template <int N>
+    uint32_t intersectPacket(rayPacket<N>& p, uint32_t active, intersectParams *rec) const
+    {
+        if (!Roots::kPacketTest) {
+            return hitEachRay(p, active, rec);
+        }
+        typedef typename rayPacket<N>::floatN floatN;
+        typedef typename rayPacket<N>::vec3N vec3N;
+        const vec3N c(center);
+        const floatN tMin(p.tMin);
+
+        uint32_t hitLanes = 0;
+        for (int chunk = 0; chunk < rayPacket<N>::kChunks; chunk++) {
+            const uint32_t bits = rayPacket<N>::chunkLanes(active, chunk);
+            if (bits == 0) {
+                continue;
+            }
+            const vec3N d = p.direction(chunk);
+            const vec3N oc = p.origin(chunk) - c;
+            const floatN a = dot(d, d);
+            const floatN b = dot(oc, d) * floatN(2.0f);
+            const floatN cc = dot(oc, oc) - floatN(radius * radius);
+            const floatN discriminant = b * b - floatN(4.0f) * a * cc;
+            const floatN sq = sqrt(max(discriminant, floatN(0.0f)));
+            const floatN q = select(b > floatN(0.0f), floatN(-0.5f) * (b + sq), floatN(-0.5f) * (b - sq));
+            const floatN r0 = q / a;
+            // double root: both are -b / 2a, like getQuadraticRoots()
+            const floatN r1 = select(discriminant == floatN(0.0f), r0, cc / q);
+            const floatN t0 = min(r0, r1);
+            const floatN t1 = max(r0, r1);
+
+            const floatN tMax = p.farT(chunk);
+            const typename floatN::mask real = discriminant >= floatN(0.0f);
+            const typename floatN::mask hit0 = real & (t0 < tMax) & (t0 > tMin);
+            const typename floatN::mask hit1 = andNot(real & (t1 < tMax) & (t1 > tMin), hit0);
+            const uint32_t chunkHits = (uint32_t)(hit0 | hit1).bits() & bits;
+            if (chunkHits == 0) {
+                continue;
+            }
+
+            float roots[rayPacket<N>::kChunkWidth];
+            select(hit0, t0, t1).store(roots);
+            for (uint32_t laneBits = chunkHits; laneBits; laneBits &= laneBits - 1) {
+                const int i = __builtin_ctz(laneBits);
+                const int lane = chunk * rayPacket<N>::kChunkWidth + i;
+                fillHitRecord(p.getRay(lane), roots[i], rec[lane]);
+                p.tMax[lane] = roots[i];
+            }
+            hitLanes |= chunkHits << (chunk * rayPacket<N>::kChunkWidth);
+        }
+        return hitLanes;
+    }
 };
 
+typedef basicSphere<> sphere;
+
 
 #endif /* sphere_h */
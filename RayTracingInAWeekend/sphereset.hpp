@@ -0,0 +1,531 @@
+//
+//  sphereset.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 10/24/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef sphereset_h
+#define sphereset_h
+
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+#include "hitable.hpp"
+#include "sphere.hpp"
+#include "simd.hpp"
+#include "bvh.hpp"
+#include "wbvh.hpp"
+
+// Many spheres as one object (particle clouds, fields of small spheres)
+//
+// Spheres are kept as structure of arrays, and build() groups them into
+// batches of kSphereBatchWidth neighbours (in the order of a BVH over the
+// spheres) with a 4 wide BVH over the batches. A ray is tested against a whole
+// batch at once: every lane solves its quadratic like intersectSphere(),
+// and the closest root in (t_min, t_max) is picked by a masked min across
+// lanes. Ties go to the lowest lane, as testing the spheres in order would.
+//
+// The batch test (kernel) is picked at run time from what the CPU has:
+// . AVX-512:  all 16 spheres of a batch in one go
+// . AVX2:     8 at a time
+// . SSE:      4 at a time (NEON on arm64, plain loops with SIMD_SCALAR)
+// . scalar:   one at a time, with intersectSphere()
+// AVX2 / AVX-512 kernels are compiled for their instruction set on their
+// own (target attribute, GCC / clang on x86_64 only), so they're there
+// without building everything with -mavx2. None of the kernels fuse
+// multiplies and adds, so all give the same roots as sphere::hit().
+
+enum { kSphereBatchWidth = 16 };
+
+// kSphereBatchWidth spheres, unused lanes have NaN centers (never hit)
+struct sphereBatch
+{
+    float cx[kSphereBatchWidth];
+    float cy[kSphereBatchWidth];
+    float cz[kSphereBatchWidth];
+    float radius[kSphereBatchWidth];
+};
+
+enum sphereKernel
+{
+    kScalarSphereKernel,
+    kSSESphereKernel,
+    kAVX2SphereKernel,
+    kAVX512SphereKernel,
+};
+
+#if SIMD_SSE && defined(__GNUC__)
+#define SPHERE_KERNEL_DISPATCH 1
+#endif
+
+// Closest sphere of batch hit in (t_min, t_max): returns its lane and
+// shrinks t_max to the hit, or returns -1
+typedef int (*sphereBatchIntersector)(const sphereBatch& batch,
+                                      const ray& r,
+                                      float t_min,
+                                      float& t_max);
+
+inline int intersectSphereBatchScalar(const sphereBatch& batch,
+                                      const ray& r,
+                                      float t_min,
+                                      float& t_max)
+{
+    int hitLane = -1;
+    for (int i = 0; i < kSphereBatchWidth; i++) {
+        float root;
+        if (intersectSphere(vec3(batch.cx[i], batch.cy[i], batch.cz[i]), batch.radius[i],
+                            r, t_min, t_max, root)) {
+            t_max = root;
+            hitLane = i;
+        }
+    }
+    return hitLane;
+}
+
+// Same roots as getQuadraticRoots() (and the arithmetic in the same
+// order), floatN::kWidth lanes at a time, see sphere::intersectPacket()
+template <typename floatN>
+inline int intersectSphereBatchN(const sphereBatch& batch,
+                                 const ray& r,
+                                 float t_min,
+                                 float& t_max)
+{
+    const vec3& o = r.origin();
+    const vec3& d = r.direction();
+    const floatN dx(d.x()), dy(d.y()), dz(d.z());
+    const floatN a(dot(d, d));
+    const floatN tMin(t_min);
+
+    int hitLane = -1;
+    for (int base = 0; base < kSphereBatchWidth; base += floatN::kWidth) {
+        const floatN ocx = floatN(o.x()) - floatN::load(batch.cx + base);
+        const floatN ocy = floatN(o.y()) - floatN::load(batch.cy + base);
+        const floatN ocz = floatN(o.z()) - floatN::load(batch.cz + base);
+        const floatN rad = floatN::load(batch.radius + base);
+        const floatN b = (ocx * dx + ocy * dy + ocz * dz) * floatN(2.0f);
+        const floatN c = (ocx * ocx + ocy * ocy + ocz * ocz) - rad * rad;
+        const floatN discriminant = b * b - floatN(4.0f) * a * c;
+        const floatN sq = sqrt(max(discriminant, floatN(0.0f)));
+        const floatN q = select(b > floatN(0.0f), floatN(-0.5f) * (b + sq), floatN(-0.5f) * (b - sq));
+        const floatN r0 = q / a;
+        const floatN r1 = select(discriminant == floatN(0.0f), r0, c / q);
+        const floatN t0 = min(r0, r1);
+        const floatN t1 = max(r0, r1);
+
+        const floatN tMax(t_max);
+        const typename floatN::mask real = discriminant >= floatN(0.0f);
+        const typename floatN::mask hit0 = real & (t0 < tMax) & (t0 > tMin);
+        const typename floatN::mask hit1 = real & (t1 < tMax) & (t1 > tMin);
+        if ((hit0 | hit1).none()) {
+            continue;
+        }
+        // closest lane: min of the roots, misses at infinity
+        const floatN t = select(hit0, t0, select(hit1, t1, floatN(INFINITY)));
+        t_max = hmin(t);
+        hitLane = base + __builtin_ctz((t == floatN(t_max)).bits());
+    }
+    return hitLane;
+}
+
+#if SPHERE_KERNEL_DISPATCH
+// AVX-512 implies FMA, keep GCC from fusing the multiplies and adds below
+// (clang only fuses within one expression, never across intrinsics)
+#if !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+// GCC 12's AVX-512 headers start some intrinsics from an undefined
+// register (_mm512_undefined_ps()), and -Wall flags that as uninitialized
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx2")))
+inline int intersectSphereBatchAVX2(const sphereBatch& batch,
+                                    const ray& r,
+                                    float t_min,
+                                    float& t_max)
+{
+    const vec3& o = r.origin();
+    const vec3& d = r.direction();
+    const __m256 dx = _mm256_set1_ps(d.x()), dy = _mm256_set1_ps(d.y()), dz = _mm256_set1_ps(d.z());
+    const __m256 a = _mm256_set1_ps(dot(d, d));
+    const __m256 tMin = _mm256_set1_ps(t_min);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(-0.5f);
+
+    int hitLane = -1;
+    for (int base = 0; base < kSphereBatchWidth; base += 8) {
+        const __m256 ocx = _mm256_sub_ps(_mm256_set1_ps(o.x()), _mm256_loadu_ps(batch.cx + base));
+        const __m256 ocy = _mm256_sub_ps(_mm256_set1_ps(o.y()), _mm256_loadu_ps(batch.cy + base));
+        const __m256 ocz = _mm256_sub_ps(_mm256_set1_ps(o.z()), _mm256_loadu_ps(batch.cz + base));
+        const __m256 rad = _mm256_loadu_ps(batch.radius + base);
+        const __m256 b = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)),
+                                                     _mm256_mul_ps(ocz, dz)),
+                                       _mm256_set1_ps(2.0f));
+        const __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)),
+                                                     _mm256_mul_ps(ocz, ocz)),
+                                       _mm256_mul_ps(rad, rad));
+        const __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b),
+                                                  _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), a), c));
+        const __m256 sq = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+        const __m256 q = _mm256_blendv_ps(_mm256_mul_ps(half, _mm256_sub_ps(b, sq)),
+                                          _mm256_mul_ps(half, _mm256_add_ps(b, sq)),
+                                          _mm256_cmp_ps(b, zero, _CMP_GT_OQ));
+        const __m256 r0 = _mm256_div_ps(q, a);
+        const __m256 r1 = _mm256_blendv_ps(_mm256_div_ps(c, q), r0, _mm256_cmp_ps(discriminant, zero, _CMP_EQ_OQ));
+        const __m256 t0 = _mm256_min_ps(r0, r1);
+        const __m256 t1 = _mm256_max_ps(r0, r1);
+
+        const __m256 tMax = _mm256_set1_ps(t_max);
+        const __m256 real = _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ);
+        const __m256 hit0 = _mm256_and_ps(real, _mm256_and_ps(_mm256_cmp_ps(t0, tMax, _CMP_LT_OQ),
+                                                              _mm256_cmp_ps(t0, tMin, _CMP_GT_OQ)));
+        const __m256 hit1 = _mm256_and_ps(real, _mm256_and_ps(_mm256_cmp_ps(t1, tMax, _CMP_LT_OQ),
+                                                              _mm256_cmp_ps(t1, tMin, _CMP_GT_OQ)));
+        if (_mm256_movemask_ps(_mm256_or_ps(hit0, hit1)) == 0) {
+            continue;
+        }
+        const __m256 t = _mm256_blendv_ps(_mm256_blendv_ps(_mm256_set1_ps(INFINITY), t1, hit1), t0, hit0);
+        // min across lanes, broadcast to all of them
+        __m256 m = _mm256_min_ps(t, _mm256_permute2f128_ps(t, t, 1));
+        m = _mm256_min_ps(m, _mm256_permute_ps(m, _MM_SHUFFLE(1, 0, 3, 2)));
+        m = _mm256_min_ps(m, _mm256_permute_ps(m, _MM_SHUFFLE(2, 3, 0, 1)));
+        t_max = _mm256_cvtss_f32(m);
+        hitLane = base + __builtin_ctz(_mm256_movemask_ps(_mm256_cmp_ps(t, m, _CMP_EQ_OQ)));
+    }
+    return hitLane;
+}
+
+__attribute__((target("avx512f")))
+inline int intersectSphereBatchAVX512(const sphereBatch& batch,
+                                      const ray& r,
+                                      float t_min,
+                                      float& t_max)
+{
+    static_assert(kSphereBatchWidth == 16, "one AVX-512 vector per batch");
+    const vec3& o = r.origin();
+    const vec3& d = r.direction();
+    const __m512 a = _mm512_set1_ps(dot(d, d));
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(-0.5f);
+
+    const __m512 ocx = _mm512_sub_ps(_mm512_set1_ps(o.x()), _mm512_loadu_ps(batch.cx));
+    const __m512 ocy = _mm512_sub_ps(_mm512_set1_ps(o.y()), _mm512_loadu_ps(batch.cy));
+    const __m512 ocz = _mm512_sub_ps(_mm512_set1_ps(o.z()), _mm512_loadu_ps(batch.cz));
+    const __m512 rad = _mm512_loadu_ps(batch.radius);
+    const __m512 b = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, _mm512_set1_ps(d.x())),
+                                                               _mm512_mul_ps(ocy, _mm512_set1_ps(d.y()))),
+                                                 _mm512_mul_ps(ocz, _mm512_set1_ps(d.z()))),
+                                   _mm512_set1_ps(2.0f));
+    const __m512 c = _mm512_sub_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, ocx), _mm512_mul_ps(ocy, ocy)),
+                                                 _mm512_mul_ps(ocz, ocz)),
+                                   _mm512_mul_ps(rad, rad));
+    const __m512 discriminant = _mm512_sub_ps(_mm512_mul_ps(b, b),
+                                              _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(4.0f), a), c));
+    const __mmask16 real = _mm512_cmp_ps_mask(discriminant, zero, _CMP_GE_OQ);
+    if (real == 0) {
+        return -1;
+    }
+    const __m512 sq = _mm512_sqrt_ps(_mm512_max_ps(discriminant, zero));
+    const __m512 q = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(b, zero, _CMP_GT_OQ),
+                                          _mm512_mul_ps(half, _mm512_sub_ps(b, sq)),
+                                          _mm512_mul_ps(half, _mm512_add_ps(b, sq)));
+    const __m512 r0 = _mm512_div_ps(q, a);
+    const __m512 r1 = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(discriminant, zero, _CMP_EQ_OQ),
+                                           _mm512_div_ps(c, q), r0);
+    const __m512 t0 = _mm512_min_ps(r0, r1);
+    const __m512 t1 = _mm512_max_ps(r0, r1);
+
+    const __m512 tMax = _mm512_set1_ps(t_max);
+    const __m512 tMin = _mm512_set1_ps(t_min);
+    const __mmask16 hit0 = _mm512_mask_cmp_ps_mask(_mm512_mask_cmp_ps_mask(real, t0, tMax, _CMP_LT_OQ),
+                                                   t0, tMin, _CMP_GT_OQ);
+    const __mmask16 hit1 = _mm512_mask_cmp_ps_mask(_mm512_mask_cmp_ps_mask(real, t1, tMax, _CMP_LT_OQ),
+                                                   t1, tMin, _CMP_GT_OQ);
+    if ((hit0 | hit1) == 0) {
+        return -1;
+    }
+    const __m512 t = _mm512_mask_blend_ps(hit0, _mm512_mask_blend_ps(hit1, _mm512_set1_ps(INFINITY), t1), t0);
+    t_max = _mm512_reduce_min_ps(t);
+    return __builtin_ctz(_mm512_cmp_ps_mask(t, _mm512_set1_ps(t_max), _CMP_EQ_OQ));
+}
+
+#if !defined(__clang__)
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
+#endif
+
+inline const char* sphereKernelName(sphereKernel kernel)
+{
+    switch (kernel) {
+        case kSSESphereKernel:
+#if SIMD_NEON
+            return "neon";
+#else
+            return "sse";
+#endif
+        case kAVX2SphereKernel: return "avx2";
+        case kAVX512SphereKernel: return "avx512";
+        default: return "scalar";
+    }
+}
+
+// can kernel run on this CPU?
+inline bool sphereKernelSupported(sphereKernel kernel)
+{
+    switch (kernel) {
+        case kScalarSphereKernel:
+        case kSSESphereKernel:
+            return true;
+#if SPHERE_KERNEL_DISPATCH
+        case kAVX2SphereKernel:
+            return __builtin_cpu_supports("avx2");
+        case kAVX512SphereKernel:
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return false;
+    }
+}
+
+// widest supported kernel
+inline sphereKernel bestSphereKernel()
+{
+    static const sphereKernel best = sphereKernelSupported(kAVX512SphereKernel) ? kAVX512SphereKernel :
+                                     sphereKernelSupported(kAVX2SphereKernel) ? kAVX2SphereKernel :
+                                     kSSESphereKernel;
+    return best;
+}
+
+inline sphereBatchIntersector sphereBatchIntersectorFor(sphereKernel kernel)
+{
+    switch (kernel) {
+#if SPHERE_KERNEL_DISPATCH
+        case kAVX512SphereKernel: return intersectSphereBatchAVX512;
+        case kAVX2SphereKernel: return intersectSphereBatchAVX2;
+#endif
+        case kSSESphereKernel: return intersectSphereBatchN<floatx4>;
+        default: return intersectSphereBatchScalar;
+    }
+}
+
+class sphereSet : public object
+{
+public:
+    sphereSet() { setKernel(bestSphereKernel()); }
+
+    inline uint32_t numSpheres() const { return (uint32_t)cx.size(); }
+    inline vec3 center(uint32_t i) const { return vec3(cx[i], cy[i], cz[i]); }
+
+    // returns index of the new sphere (until the next build())
+    // drops the batches and BVH: every sphere is tested until build()
+    uint32_t addSphere(const vec3& c, float radius, material *mat)
+    {
+        batches.clear();
+        accel = bvhTree();
+        wideAccel = bvh4Tree();
+        cx.push_back(c.x());
+        cy.push_back(c.y());
+        cz.push_back(c.z());
+        radii.push_back(radius);
+        materials.push_back(mat);
+        return numSpheres() - 1;
+    }
+
+    // Use kernel for batch tests, if this CPU has it (returns false and
+    // keeps the current one otherwise)
+    bool setKernel(sphereKernel k)
+    {
+        if (!sphereKernelSupported(k)) {
+            return false;
+        }
+        kernel = k;
+        intersectBatch = sphereBatchIntersectorFor(k);
+        return true;
+    }
+    inline sphereKernel currentKernel() const { return kernel; }
+
+    // Sort spheres into BVH order, group them into batches and build a
+    // BVH over those. Sphere indices change.
+    // Must be called again after spheres are added or changed. Until then
+    // hit() falls back to testing every sphere.
+    void build()
+    {
+        batches.clear();
+        bounds = aabb();
+        const uint32_t n = numSpheres();
+        std::vector<aabb> sphereBounds(n);
+        for (uint32_t i = 0; i < n; i++) {
+            sphereBounds[i] = aabb(center(i) - vec3(radii[i]), center(i) + vec3(radii[i]));
+            bounds.grow(sphereBounds[i]);
+        }
+        accel.build(sphereBounds);
+        reorder(accel.primIndices);
+
+        const uint32_t nBatches = (n + kSphereBatchWidth - 1) / kSphereBatchWidth;
+        batches.resize(nBatches);
+        std::vector<aabb> batchBounds(nBatches);
+        for (uint32_t b = 0; b < nBatches; b++) {
+            for (uint32_t lane = 0; lane < kSphereBatchWidth; lane++) {
+                const uint32_t i = b * kSphereBatchWidth + lane;
+                const bool used = i < n;
+                batches[b].cx[lane] = used ? cx[i] : NAN;
+                batches[b].cy[lane] = used ? cy[i] : NAN;
+                batches[b].cz[lane] = used ? cz[i] : NAN;
+                batches[b].radius[lane] = used ? radii[i] : 0.0f;
+                if (used) {
+                    batchBounds[b].grow(aabb(center(i) - vec3(radii[i]), center(i) + vec3(radii[i])));
+                }
+            }
+        }
+        accel.build(batchBounds);
+        wideAccel.build(accel);
+    }
+
+    inline bool isBuilt() const { return wideAccel.isBuilt(); }
+
+    bool closestHit(const ray& r,
+                    float t_min,
+                    float t_max,
+                    primitiveHit& h) const
+    {
+        uint32_t hitSphere = 0;
+        float hitT = t_max;
+        bool didHit = false;
+        if (isBuilt()) {
+            didHit = wideAccel.traverse(r, t_min, t_max,
+                [&](uint32_t b, const ray& r, float t_min, float& t_max) {
+                    const int lane = intersectBatch(batches[b], r, t_min, t_max);
+                    if (lane < 0) {
+                        return false;
+                    }
+                    hitSphere = b * kSphereBatchWidth + lane;
+                    hitT = t_max;
+                    return true;
+                });
+        } else {
+            for (uint32_t i = 0; i < numSpheres(); i++) {
+                float root;
+                if (intersectSphere(center(i), radii[i], r, t_min, hitT, root)) {
+                    hitT = root;
+                    hitSphere = i;
+                    didHit = true;
+                }
+            }
+        }
+        if (!didHit) {
+            return false;
+        }
+
+        h.t = hitT;
+        h.primId = hitSphere;
+        h.prim = this;
+        h.nInstances = 0;
+        return true;
+    }
+
+    material* hitMaterial(const primitiveHit& h, uint32_t level) const
+    {
+        return materials[h.primId];
+    }
+
+    void hitAttributes(const ray& r,
+                       const primitiveHit& h,
+                       uint32_t level,
+                       uint32_t attributes,
+                       intersectParams& rec) const
+    {
+        sphereHitRecord(center(h.primId), radii[h.primId], r, h.t, attributes, rec);
+        rec.surfaceMat = materials[h.primId];
+    }
+
+    // any sphere in (t_min, t_max): the first batch with a hit ends the walk
+    bool occluded(const ray& r,
+                  float t_min,
+                  float t_max) const
+    {
+        if (isBuilt()) {
+            return wideAccel.traverse<true>(r, t_min, t_max,
+                [&](uint32_t b, const ray& r, float t_min, float& t_max) {
+                    float batchMax = t_max;
+                    return intersectBatch(batches[b], r, t_min, batchMax) >= 0;
+                });
+        }
+        for (uint32_t i = 0; i < numSpheres(); i++) {
+            float root;
+            if (intersectSphere(center(i), radii[i], r, t_min, t_max, root)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    using object::boundingBox;
+    bool boundingBox(aabb& box) const
+    {
+        if (numSpheres() == 0) {
+            return false;
+        }
+        if (isBuilt()) {
+            box = bounds;
+            return true;
+        }
+        box = aabb();
+        for (uint32_t i = 0; i < numSpheres(); i++) {
+            box.grow(aabb(center(i) - vec3(radii[i]), center(i) + vec3(radii[i])));
+        }
+        return true;
+    }
+
+    // bytes used by sphere, batch and BVH data
+    size_t memoryUsage() const
+    {
+        return sizeof(float) * (cx.capacity() + cy.capacity() + cz.capacity() + radii.capacity()) +
+               sizeof(material*) * materials.capacity() +
+               sizeof(sphereBatch) * batches.capacity() +
+               sizeof(uint32_t) * accel.primIndices.capacity() +
+               sizeof(bvhNode) * accel.nodes.capacity() +
+               wideAccel.memoryUsage();
+    }
+
+    // sphere centers and radii (kept for hit records and rebuilds)
+    std::vector<float> cx, cy, cz;
+    std::vector<float> radii;
+    std::vector<material*> materials;
+
+    // sphere i is lane i % kSphereBatchWidth of batch i / kSphereBatchWidth
+    std::vector<sphereBatch> batches;
+    // BVH over batches: binary as built, and the wide one traversed
+    bvhTree accel;
+    bvh4Tree wideAccel;
+    aabb bounds;
+
+private:
+    // sphere i becomes the one at order[i]
+    void reorder(const std::vector<uint32_t>& order)
+    {
+        permute(cx, order);
+        permute(cy, order);
+        permute(cz, order);
+        permute(radii, order);
+        permute(materials, order);
+    }
+
+    template <typename T>
+    static void permute(std::vector<T>& values, const std::vector<uint32_t>& order)
+    {
+        std::vector<T> sorted(values.size());
+        for (uint32_t i = 0; i < order.size(); i++) {
+            sorted[i] = values[order[i]];
+        }
+        values.swap(sorted);
+    }
+
+    sphereKernel kernel;
+    sphereBatchIntersector intersectBatch;
+};
+
+#endif /* sphereset_h */
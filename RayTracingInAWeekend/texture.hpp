@@ -14,6 +14,8 @@
 class texture
 {
 public:
+    virtual ~texture() {}
+
     virtual vec3 texelAt(float u,
                          float v,
                          const vec3& p) const = 0;
@@ -33,6 +35,22 @@ public:
     vec3 color;
 };
 
+// Is uv in an odd square of the checkerboard below?
+// (shared with the flat scene's texture table, see flatscene.hpp)
+inline bool isOddChecker(float u, float v)
+{
+    constexpr float tileFactor = 25.0f;
+    // scale uv to tile factor
+    // the tile factor determines how many pixels
+    // each check will cover.
+    // # of checkers is proportional to tileFactor
+    // i.e. checkerSize is inversely proportional
+    const float a = floor(u * tileFactor);
+    const float b = floor(v * tileFactor);
+    // use (a + b) to decide if we're in even or odd square
+    return fmod(a + b, 2.0) > 0.5;
+}
+
 class checkerBoard : public texture
 {
 public:
@@ -43,16 +61,7 @@ public:
     
     virtual vec3 texelAt(float u, float v, const vec3& p) const
     {
-        constexpr float tileFactor = 25.0f;
-        // scale uv to tile factor
-        // the tile factor determines how many pixels
-        // each check will cover.
-        // # of checkers is proportional to tileFactor
-        // i.e. checkerSize is inversely proportional
-        const float a = floor(u * tileFactor);
-        const float b = floor(v * tileFactor);
-        // use (a + b) to decide if we're in even or odd square
-        if (fmod(a + b, 2.0) > 0.5) {
+        if (isOddChecker(u, v)) {
             // odd shade
             return shade0->texelAt(u, v, p);
         }
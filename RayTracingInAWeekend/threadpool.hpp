@@ -0,0 +1,182 @@
+//
+//  threadpool.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 7/21/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef threadpool_h
+#define threadpool_h
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+// Persistent pool of worker threads with work stealing
+//
+// parallelFor() hands out task indices as contiguous blocks, one block
+// per thread queue. Each thread works through its own queue front to back
+// (neighbouring tasks, e.g. neighbouring image tiles, stay on one thread)
+// and once it runs dry steals from the back of another thread's queue.
+// Threads sleep between jobs instead of being re-spawned for each one.
+//
+// The calling thread takes part as thread 0, so a pool of N threads
+// spawns N - 1 workers.
+class threadPool
+{
+public:
+    typedef std::function<void(uint32_t task, uint32_t threadIdx)> taskFn;
+
+    // nThreads = 0 uses all hardware threads
+    explicit threadPool(uint32_t nThreads = 0) : job(nullptr),
+                                                 jobId(0),
+                                                 nBusy(0),
+                                                 quit(false)
+    {
+        if (nThreads == 0) {
+            nThreads = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        for (uint32_t i = 0; i < nThreads; i++) {
+            queues.emplace_back(new workQueue());
+        }
+        for (uint32_t i = 1; i < nThreads; i++) {
+            workers.emplace_back(&threadPool::workerLoop, this, i);
+        }
+    }
+
+    ~threadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(jobLock);
+            quit = true;
+        }
+        jobStart.notify_all();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+
+    threadPool(const threadPool&) = delete;
+    threadPool& operator=(const threadPool&) = delete;
+
+    inline uint32_t size() const { return (uint32_t)queues.size(); }
+
+    // run task(i, threadIdx) for every i in [0, nTasks)
+    // returns once all tasks are done
+    void parallelFor(uint32_t nTasks, const taskFn& task)
+    {
+        if (nTasks == 0) {
+            return;
+        }
+
+        // deal out contiguous blocks of tasks
+        const uint32_t nThreads = size();
+        for (uint32_t t = 0; t < nThreads; t++) {
+            const uint32_t first = (uint32_t)((uint64_t)nTasks * t / nThreads);
+            const uint32_t last = (uint32_t)((uint64_t)nTasks * (t + 1) / nThreads);
+            std::lock_guard<std::mutex> lock(queues[t]->lock);
+            for (uint32_t i = first; i < last; i++) {
+                queues[t]->tasks.push_back(i);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(jobLock);
+            job = &task;
+            jobId++;
+            nBusy = nThreads;
+        }
+        jobStart.notify_all();
+
+        runTasks(0, task);
+
+        // wait for workers to drain the rest
+        std::unique_lock<std::mutex> lock(jobLock);
+        jobDone.wait(lock, [this] { return nBusy == 0; });
+        job = nullptr;
+    }
+
+private:
+    struct workQueue
+    {
+        std::mutex lock;
+        std::deque<uint32_t> tasks;
+    };
+
+    // own queue first, then try to steal from everybody else
+    bool nextTask(uint32_t threadIdx, uint32_t& task)
+    {
+        {
+            workQueue& own = *queues[threadIdx];
+            std::lock_guard<std::mutex> lock(own.lock);
+            if (!own.tasks.empty()) {
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+
+        const uint32_t nThreads = size();
+        for (uint32_t i = 1; i < nThreads; i++) {
+            workQueue& victim = *queues[(threadIdx + i) % nThreads];
+            std::lock_guard<std::mutex> lock(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void runTasks(uint32_t threadIdx, const taskFn& task)
+    {
+        uint32_t taskIdx;
+        while (nextTask(threadIdx, taskIdx)) {
+            task(taskIdx, threadIdx);
+        }
+
+        std::lock_guard<std::mutex> lock(jobLock);
+        if (--nBusy == 0) {
+            jobDone.notify_all();
+        }
+    }
+
+    void workerLoop(uint32_t threadIdx)
+    {
+        uint64_t lastJob = 0;
+        while (true) {
+            const taskFn* task;
+            {
+                std::unique_lock<std::mutex> lock(jobLock);
+                jobStart.wait(lock, [&] { return quit || jobId != lastJob; });
+                if (quit) {
+                    return;
+                }
+                lastJob = jobId;
+                task = job;
+            }
+            runTasks(threadIdx, *task);
+        }
+    }
+
+    std::vector<std::unique_ptr<workQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex jobLock;
+    std::condition_variable jobStart;
+    std::condition_variable jobDone;
+    const taskFn* job;
+    uint64_t jobId;
+    uint32_t nBusy;
+    bool quit;
+};
+
+#endif /* threadpool_h */
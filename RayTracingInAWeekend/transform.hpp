@@ -0,0 +1,154 @@
+//
+//  transform.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 9/22/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef transform_h
+#define transform_h
+
+#include <cmath>
+#include "vec3.hpp"
+#include "aabb.hpp"
+
+// Affine transform, 3 x 4 row major matrix
+// p' = M * p + T, with the linear part M in columns 0 - 2 and the
+// translation T in column 3 (the implicit last row is 0 0 0 1)
+//
+// Transforms compose right to left like matrices: (a * b) applies b first.
+struct transform
+{
+    float m[3][4];
+
+    static transform identity()
+    {
+        return scale(vec3(1.0f));
+    }
+
+    static transform translate(const vec3& t)
+    {
+        transform x = identity();
+        x.m[0][3] = t.x();
+        x.m[1][3] = t.y();
+        x.m[2][3] = t.z();
+        return x;
+    }
+
+    static transform scale(const vec3& s)
+    {
+        transform x;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                x.m[i][j] = i == j ? s[i] : 0.0f;
+            }
+        }
+        return x;
+    }
+
+    // rotation by degrees around axis (through the origin),
+    // counter clockwise looking down the axis towards the origin
+    static transform rotate(const vec3& axis, float degrees)
+    {
+        const vec3 a = unit_vector(axis);
+        const float theta = degrees * (float)M_PI / 180.0f;
+        const float s = sinf(theta);
+        const float c = cosf(theta);
+        transform x = identity();
+        x.m[0][0] = a.x() * a.x() + (1.0f - a.x() * a.x()) * c;
+        x.m[0][1] = a.x() * a.y() * (1.0f - c) - a.z() * s;
+        x.m[0][2] = a.x() * a.z() * (1.0f - c) + a.y() * s;
+        x.m[1][0] = a.x() * a.y() * (1.0f - c) + a.z() * s;
+        x.m[1][1] = a.y() * a.y() + (1.0f - a.y() * a.y()) * c;
+        x.m[1][2] = a.y() * a.z() * (1.0f - c) - a.x() * s;
+        x.m[2][0] = a.x() * a.z() * (1.0f - c) - a.y() * s;
+        x.m[2][1] = a.y() * a.z() * (1.0f - c) + a.x() * s;
+        x.m[2][2] = a.z() * a.z() + (1.0f - a.z() * a.z()) * c;
+        return x;
+    }
+
+    transform operator*(const transform& b) const
+    {
+        transform x;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                x.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j];
+            }
+            x.m[i][3] += m[i][3];
+        }
+        return x;
+    }
+
+    // M^-1 from the adjugate, T' = -M^-1 * T
+    // (the linear part must not be singular)
+    transform inverse() const
+    {
+        transform x;
+        const float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+        const float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+        const float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+        const float invDet = 1.0f / (m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02);
+        x.m[0][0] = c00 * invDet;
+        x.m[1][0] = c01 * invDet;
+        x.m[2][0] = c02 * invDet;
+        x.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet;
+        x.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+        x.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet;
+        x.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+        x.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet;
+        x.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+        for (int i = 0; i < 3; i++) {
+            x.m[i][3] = -(x.m[i][0] * m[0][3] + x.m[i][1] * m[1][3] + x.m[i][2] * m[2][3]);
+        }
+        return x;
+    }
+
+    inline vec3 applyPoint(const vec3& p) const
+    {
+        return vec3(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                    m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                    m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    // directions ignore the translation
+    inline vec3 applyVector(const vec3& v) const
+    {
+        return vec3(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+                    m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+                    m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+    }
+
+    // Normals transform by the inverse transpose (so they stay perpendicular
+    // to surfaces under non uniform scales): call this on the inverse of the
+    // transform the surface went through. Result is not normalized.
+    inline vec3 applyNormal(const vec3& n) const
+    {
+        return vec3(m[0][0] * n.x() + m[1][0] * n.y() + m[2][0] * n.z(),
+                    m[0][1] * n.x() + m[1][1] * n.y() + m[2][1] * n.z(),
+                    m[0][2] * n.x() + m[1][2] * n.y() + m[2][2] * n.z());
+    }
+
+    // Box around the transformed box (Arvo, "Transforming axis-aligned
+    // bounding boxes", 1990): per output axis, each input axis contributes
+    // its smaller / larger product to the min / max corner
+    aabb applyBox(const aabb& b) const
+    {
+        if (b.isEmpty()) {
+            return b;
+        }
+        vec3 lo, hi;
+        for (int i = 0; i < 3; i++) {
+            lo[i] = hi[i] = m[i][3];
+            for (int j = 0; j < 3; j++) {
+                const float a = m[i][j] * b.pMin[j];
+                const float c = m[i][j] * b.pMax[j];
+                lo[i] += std::min(a, c);
+                hi[i] += std::max(a, c);
+            }
+        }
+        return aabb(lo, hi);
+    }
+};
+
+#endif /* transform_h */
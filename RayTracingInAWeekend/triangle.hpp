@@ -12,47 +12,36 @@
 #include "hitable.hpp"
 #include "material.hpp"
 
-// TODO: Add these to compiler flags
-#define OPTIMIZE_INTERSECT 1
-#define MOLLER_TRUMBORE OPTIMIZE_INTERSECT
-#define CULLING OPTIMIZE_INTERSECT
-#define INTERPOLATE_PARAMETRIC_NORM 1
-
-class triangle : public object
+// Moller Trumbore ray / triangle intersection
+// v0: first vertex, e1, e2: edges (v1 - v0), (v2 - v0)
+// On a hit inside [t_min, t_max] returns ray parameter t and
+// barycentric coords u, v of the hit (weights of v1 and v2).
+// Back facing triangles are skipped when cull is set.
+inline bool mollerTrumbore(const ray& r,
+                           const vec3& v0,
+                           const vec3& e1,
+                           const vec3& e2,
+                           bool cull,
+                           float t_min,
+                           float t_max,
+                           float& t,
+                           float& u,
+                           float& v)
 {
-public:
-    triangle() = delete;
-    triangle(vec3 a,
-             vec3 b,
-             vec3 c,
-             material *mat) : vtx0(a),
-                              vtx1(b),
-                              vtx2(c),
-                              norm(cross(vtx1 - vtx0, vtx2 - vtx0)),
-                              D(dot(norm, vtx0)),
-                              surfaceMat(mat)
-    {}
-    
-    bool hit(const ray& r, float t_min, float t_max, intersectParams& rec) const
-    {
-        const vec3 e1 = vtx1 - vtx0;
-        const vec3 e2 = vtx2 - vtx0;
-
-#if MOLLER_TRUMBORE
-        // We can use simple in / out tri edge test or
-        // use optimized Barycentric coordinates (MOLLER TRUMBORE)
-        // we solve:
-        // [t u v] = 1 / (E1 x E2).R * [ (T x E1).E2 ]
-        //                             [ (R x E2).T  ]
-        //                             [ (T x E1).R  ]
-        // E1, E2: triangle egde vectors (v1 - v0), (v2 - v0)
-        // T: ray_origin - v0
-        // R: dirn vector of ray
-        //
-        const vec3 pvec = cross(r.direction(), e2);
-        const float det = dot(e1, pvec);
+    // We can use simple in / out tri edge test or
+    // use optimized Barycentric coordinates (MOLLER TRUMBORE)
+    // we solve:
+    // [t u v] = 1 / (E1 x E2).R * [ (T x E1).E2 ]
+    //                             [ (R x E2).T  ]
+    //                             [ (T x E1).R  ]
+    // E1, E2: triangle egde vectors (v1 - v0), (v2 - v0)
+    // T: ray_origin - v0
+    // R: dirn vector of ray
+    //
+    const vec3 pvec = cross(r.direction(), e2);
+    const float det = dot(e1, pvec);
 
-#if CULLING
+    if (cull) {
         // enables check on if tri is front facing or back facing the ray
         //
         // NOTE: when culling is off and the determinant negative, you have
@@ -71,121 +60,564 @@ public:
         if (det < kEpsilon) {
             return false;
         }
-#else
+    } else {
         // ray and triangle are parallel if det is close to 0
         if (fabs(det) < kEpsilon) {
             return false;
         }
-#endif
-        // inverse determinant for cramers rule application
-        // to calculate u,v and hence t
-        const float invDet = 1 / det;
-        
-        // calculate u
-        const vec3 tvec = r.origin() - vtx0;
-        const float u = dot(tvec, pvec) * invDet;
-        // u belongs to [0,1] for intersect
+    }
+    // inverse determinant for cramers rule application
+    // to calculate u,v and hence t
+    const float invDet = 1 / det;
+    
+    // calculate u
+    const vec3 tvec = r.origin() - v0;
+    u = dot(tvec, pvec) * invDet;
+    // u belongs to [0,1] for intersect
+    if (u < 0 || u > 1) {
+        return false;
+    }
+    
+    // calculate v
+    const vec3 qvec = cross(tvec, e1);
+    v = dot(qvec, r.direction()) * invDet;
+    // v should be > 0 and u + v should be <= 1 for intersect
+    if (v < 0 || u + v > 1) {
+        return false;
+    }
+    
+    // calculate t
+    t = dot(e2, qvec) * invDet;
+    // intersection must lie within the ray interval
+    if (t < t_min || t > t_max) {
+        return false;
+    }
+
+    return true;
+}
+
+// Same test for a chunk of rays (o, d) against one triangle, see
+// rayPacket: every step is done for all lanes, and instead of returning
+// early a lane that fails a test is masked off. Returns the lanes that hit,
+// with t, u, v set for them.
+template <typename floatN>
+inline typename floatN::mask mollerTrumbore(const vec3xN<floatN>& o,
+                                            const vec3xN<floatN>& d,
+                                            const vec3& v0,
+                                            const vec3& e1,
+                                            const vec3& e2,
+                                            bool cull,
+                                            const floatN& t_min,
+                                            const floatN& t_max,
+                                            floatN& t,
+                                            floatN& u,
+                                            floatN& v)
+{
+    typedef typename floatN::mask mask;
+    const vec3xN<floatN> edge1(e1);
+    const vec3xN<floatN> edge2(e2);
+
+    const vec3xN<floatN> pvec = cross(d, edge2);
+    const floatN det = dot(edge1, pvec);
+    mask valid = cull ? det >= floatN(kEpsilon) : abs(det) >= floatN(kEpsilon);
+    if (valid.none()) {
+        return valid;
+    }
+    const floatN invDet = floatN(1.0f) / det;
+
+    const vec3xN<floatN> tvec = o - vec3xN<floatN>(v0);
+    u = dot(tvec, pvec) * invDet;
+    valid = valid & (u >= floatN(0.0f)) & (u <= floatN(1.0f));
+
+    const vec3xN<floatN> qvec = cross(tvec, edge1);
+    v = dot(qvec, d) * invDet;
+    valid = valid & (v >= floatN(0.0f)) & (u + v <= floatN(1.0f));
+
+    t = dot(edge2, qvec) * invDet;
+    return valid & (t >= t_min) & (t <= t_max);
+}
+
+// Triangle policies
+// basicTriangle / basicTriangleMesh (mesh.hpp) take the ray / triangle
+// test, back face handling and hit normal as template parameters instead
+// of #define switches, so every variant can be built into one binary and
+// picked per object (or per mesh) with no runtime dispatch: the policy's
+// static functions and constants inline into the intersection code.
+//
+// Intersector: intersect(ray, v0, e1, e2, cull, t_min, t_max, t, u, v),
+// scalar and for a chunk of rays (o, d), same contract as mollerTrumbore()
+
+// Moller Trumbore (barycentrics straight from Cramer's rule)
+struct mollerTrumboreIntersector
+{
+    static inline bool intersect(const ray& r,
+                                 const vec3& v0,
+                                 const vec3& e1,
+                                 const vec3& e2,
+                                 bool cull,
+                                 float t_min,
+                                 float t_max,
+                                 float& t,
+                                 float& u,
+                                 float& v)
+    {
+        return mollerTrumbore(r, v0, e1, e2, cull, t_min, t_max, t, u, v);
+    }
+
+    template <typename floatN>
+    static inline typename floatN::mask intersect(const vec3xN<floatN>& o,
+                                                  const vec3xN<floatN>& d,
+                                                  const vec3& v0,
+                                                  const vec3& e1,
+                                                  const vec3& e2,
+                                                  bool cull,
+                                                  const floatN& t_min,
+                                                  const floatN& t_max,
+                                                  floatN& t,
+                                                  floatN& u,
+                                                  floatN& v)
+    {
+        return mollerTrumbore(o, d, v0, e1, e2, cull, t_min, t_max, t, u, v);
+    }
+};
+
+// Plane hit, then inside-outside test of the hit point against each edge
+// u, v come out as the same barycentrics Moller Trumbore gives (weights
+// of v1 and v2: areas of the sub triangles opposite them over the area
+// of the triangle), so hit records match.
+struct insideOutsideIntersector
+{
+    static inline bool intersect(const ray& r,
+                                 const vec3& v0,
+                                 const vec3& e1,
+                                 const vec3& e2,
+                                 bool cull,
+                                 float t_min,
+                                 float t_max,
+                                 float& t,
+                                 float& u,
+                                 float& v)
+    {
+        // Step 1: finding P
+        const vec3 norm = cross(e1, e2);
+        const float NdotRayDirection = dot(norm, r.direction());
+        // back facing (the ray goes along the normal) or parallel
+        // (almost 0): no hit, same as Moller Trumbore's det (= -N.D)
+        if (cull ? -NdotRayDirection < kEpsilon : fabs(NdotRayDirection) < kEpsilon) {
+            return false;
+        }
+        t = dot(norm, v0 - r.origin()) / NdotRayDirection;
+        // behind the ray or beyond the closest hit so far
+        if (t < t_min || t > t_max) {
+            return false;
+        }
+
+        // Step 2: inside-outside test
+        // P is inside when it's on the left of every edge, i.e. every
+        // sub triangle (edge, P) faces the same way as the triangle
+        const vec3 vp0 = r.point_at_parameter(t) - v0;
+        const float invDenom = 1 / norm.squared_length();
+        // edge v2 -> v0
+        u = dot(norm, cross(vp0, e2)) * invDenom;
         if (u < 0 || u > 1) {
             return false;
         }
-        
-        // calculate v
-        const vec3 qvec = cross(tvec, e1);
-        const float v =  dot(qvec, r.direction()) * invDet;
-        // v should be > 0 and u + v should be <= 1 for intersect
+        // edge v0 -> v1, then v1 -> v2 (its weight is 1 - u - v)
+        v = dot(norm, cross(e1, vp0)) * invDenom;
         if (v < 0 || u + v > 1) {
             return false;
         }
-        
-        // calculate t
-        const float t = dot(e2, qvec) * invDet;
-        
-        // compute the intersection point
-        const vec3 P = r.point_at_parameter(t);
-#else
-        // n.n
-        float denom = norm.squared_length();
-        
-        // Step 1: finding P
-        
-        // check if ray and plane are parallel
-        const float NdotRayDirection = dot(norm, r.direction());
-        if (fabs(NdotRayDirection) < kEpsilon) // almost 0
-        {
-            return false; // they are parallel so they don't intersect.
+        return true;
+    }
+
+    template <typename floatN>
+    static inline typename floatN::mask intersect(const vec3xN<floatN>& o,
+                                                  const vec3xN<floatN>& d,
+                                                  const vec3& v0,
+                                                  const vec3& e1,
+                                                  const vec3& e2,
+                                                  bool cull,
+                                                  const floatN& t_min,
+                                                  const floatN& t_max,
+                                                  floatN& t,
+                                                  floatN& u,
+                                                  floatN& v)
+    {
+        typedef typename floatN::mask mask;
+        const vec3 n = cross(e1, e2);
+        const vec3xN<floatN> norm(n);
+        const floatN NdotRayDirection = dot(norm, d);
+        mask valid = cull ? NdotRayDirection <= floatN(-kEpsilon) : abs(NdotRayDirection) >= floatN(kEpsilon);
+        if (valid.none()) {
+            return valid;
         }
-        
-        // compute t
-        const float t = (dot(norm, r.origin()) + D) / NdotRayDirection;
-        // check if the triangle is in behind the ray
-        if (t < 0) {
-            return false; // the triangle is behind
+        t = dot(norm, vec3xN<floatN>(v0) - o) / NdotRayDirection;
+        valid = valid & (t >= t_min) & (t <= t_max);
+
+        const vec3xN<floatN> vp0 = o + d * t - vec3xN<floatN>(v0);
+        const floatN invDenom(1 / n.squared_length());
+        u = dot(norm, cross(vp0, vec3xN<floatN>(e2))) * invDenom;
+        valid = valid & (u >= floatN(0.0f)) & (u <= floatN(1.0f));
+        v = dot(norm, cross(vec3xN<floatN>(e1), vp0)) * invDenom;
+        return valid & (v >= floatN(0.0f)) & (u + v <= floatN(1.0f));
+    }
+};
+
+// Facing: kCull skips back faces (the ray going along the normal,
+// e.g. leaving a closed mesh)
+struct cullBackFaces
+{
+    static constexpr bool kCull = true;
+};
+
+struct twoSidedFaces
+{
+    static constexpr bool kCull = false;
+};
+
+// Normal: normal(norm, u, v) of a hit at barycentrics u, v of a triangle
+// with (unnormalized) plane normal norm
+// You can return the common surface plane normal (norm), or better yet
+// the normal interpolated along the edges: for the latter simply use the
+// u, v, w parametric offsets
+struct parametricNormal
+{
+    static inline vec3 normal(const vec3& norm, float u, float v)
+    {
+        return vec3(norm.x() + u, norm.y() + v, norm.z() + (1 - u - v));
+    }
+};
+
+struct planeNormal
+{
+    static inline vec3 normal(const vec3& norm, float u, float v)
+    {
+        return norm;
+    }
+};
+
+// Packed leaf of kWidth triangles (triangle4 / triangle8)
+// First vertex and both edges of every triangle, precomputed and stored
+// as structure of arrays, so one ray is tested against all of them at
+// once: the same Moller Trumbore steps as above, with the triangles in
+// the lanes instead of the rays. Unused lanes are degenerate (zero edges,
+// so det is 0) and never hit.
+template <typename floatType>
+struct packedTriangles
+{
+    typedef floatType floatN;
+    typedef typename floatN::mask mask;
+    enum { kWidth = floatN::kWidth };
+
+    // all lanes unused
+    packedTriangles()
+    {
+        for (int i = 0; i < kWidth; i++) {
+            set(i, vec3(0.0f), vec3(0.0f), vec3(0.0f), 0);
         }
-        
-        // compute the intersection point
-        const vec3 P = r.point_at_parameter(t);
-        
-        // Step 2: inside-outside test
-        vec3 tmp; // vector perpendicular to triangle's plane
-        
-        // edge 0
-        const vec3 edge0 = vtx1 - vtx0;
-        const vec3 vp0 = P - vtx0;
-        tmp = cross(edge0, vp0);
-        if (dot(norm, tmp) < 0) {
-            return false; // P is on the right side
+    }
+
+    // triangle v0 v1 v2 (with id, e.g. face of a mesh) in lane i
+    void set(int i, const vec3& v0, const vec3& v1, const vec3& v2, uint32_t id)
+    {
+        const vec3 e1 = v1 - v0;
+        const vec3 e2 = v2 - v0;
+        v0x[i] = v0.x(); v0y[i] = v0.y(); v0z[i] = v0.z();
+        e1x[i] = e1.x(); e1y[i] = e1.y(); e1z[i] = e1.z();
+        e2x[i] = e2.x(); e2y[i] = e2.y(); e2z[i] = e2.z();
+        primId[i] = id;
+    }
+
+    // Lanes hit in [t_min, t_max], with t, u, v set for them
+    // (back faces skipped when cull is set)
+    inline mask intersect(const ray& r,
+                          bool cull,
+                          const floatN& t_min,
+                          const floatN& t_max,
+                          floatN& t,
+                          floatN& u,
+                          floatN& v) const
+    {
+        const vec3xN<floatN> d(r.direction());
+        const vec3xN<floatN> edge1 = vec3xN<floatN>::load(e1x, e1y, e1z);
+        const vec3xN<floatN> edge2 = vec3xN<floatN>::load(e2x, e2y, e2z);
+
+        const vec3xN<floatN> pvec = cross(d, edge2);
+        const floatN det = dot(edge1, pvec);
+        mask valid = cull ? det >= floatN(kEpsilon) : abs(det) >= floatN(kEpsilon);
+        if (valid.none()) {
+            return valid;
+        }
+        const floatN invDet = floatN(1.0f) / det;
+
+        const vec3xN<floatN> tvec = vec3xN<floatN>(r.origin()) - vec3xN<floatN>::load(v0x, v0y, v0z);
+        u = dot(tvec, pvec) * invDet;
+        valid = valid & (u >= floatN(0.0f)) & (u <= floatN(1.0f));
+
+        const vec3xN<floatN> qvec = cross(tvec, edge1);
+        v = dot(qvec, d) * invDet;
+        valid = valid & (v >= floatN(0.0f)) & (u + v <= floatN(1.0f));
+
+        t = dot(edge2, qvec) * invDet;
+        return valid & (t >= t_min) & (t <= t_max);
+    }
+
+    // Closest lane hit in [t_min, t_max]: returns it, with t_max shrunk
+    // to the hit and its barycentrics in u, v, or -1
+    // (ties go to the lowest lane)
+    inline int closestHit(const ray& r,
+                          bool cull,
+                          float t_min,
+                          float& t_max,
+                          float& u,
+                          float& v) const
+    {
+        floatN tN(0.0f), uN(0.0f), vN(0.0f);
+        const mask hits = intersect(r, cull, floatN(t_min), floatN(t_max), tN, uN, vN);
+        if (hits.none()) {
+            return -1;
+        }
+        const floatN t = select(hits, tN, floatN(INFINITY));
+        t_max = hmin(t);
+        const int lane = __builtin_ctz((t == floatN(t_max)).bits());
+        u = uN[lane];
+        v = vN[lane];
+        return lane;
+    }
+
+    float v0x[kWidth], v0y[kWidth], v0z[kWidth];
+    float e1x[kWidth], e1y[kWidth], e1z[kWidth];
+    float e2x[kWidth], e2y[kWidth], e2z[kWidth];
+    uint32_t primId[kWidth];
+};
+
+typedef packedTriangles<floatx4> triangle4;
+typedef packedTriangles<floatx8> triangle8;
+
+// Hit record of a triangle with (unnormalized) plane normal norm, hit at
+// P = ray at t, barycentrics u, v, normal from the Normal policy
+// (surfaceMat is left to the caller)
+template <typename Normal = parametricNormal>
+inline void triangleHitRecord(const vec3& norm,
+                              const vec3& P,
+                              float t,
+                              float u,
+                              float v,
+                              intersectParams& rec)
+{
+    rec.t = t;
+    rec.u = u;
+    rec.v = v;
+    rec.p = P;
+    rec.normal = Normal::normal(norm, u, v);
+    rec.twoSided = false;
+}
+
+// Bounds of the parts of triangle v0 v1 v2 on either side of the plane
+// p[axis] = pos, clipped to refBounds (the piece of the triangle a spatial
+// split BVH reference covers, see sbvh.hpp)
+// Each side gets the vertices on that side plus the points where edges
+// cross the plane, so long slanted triangles get much smaller boxes than
+// halves of their bounds would be.
+inline void splitTriangleBounds(const vec3& v0,
+                                const vec3& v1,
+                                const vec3& v2,
+                                const aabb& refBounds,
+                                int axis,
+                                float pos,
+                                aabb& left,
+                                aabb& right)
+{
+    const vec3 v[3] = { v0, v1, v2 };
+    left = aabb();
+    right = aabb();
+    for (int i = 0; i < 3; i++) {
+        const vec3& a = v[i];
+        const vec3& b = v[(i + 1) % 3];
+        if (a[axis] <= pos) {
+            left.grow(a);
         }
-        
-        // edge 1
-        const vec3 edge1 = vtx2 - vtx1;
-        const vec3 vp1 = P - vtx1;
-        tmp = cross(edge1, vp1);
-        float u = dot(norm, tmp);
-        if (u < 0) {
-            return false; // P is on the right side
+        if (a[axis] >= pos) {
+            right.grow(a);
         }
-        
-        // edge 2
-        const vec3 edge2 = vtx0 - vtx2;
-        const vec3 vp2 = P - vtx2;
-        tmp = cross(edge2, vp2);
-        float v = dot(norm, tmp);
-        if (v < 0) {
-            return false; // P is on the right side;
+        if ((a[axis] < pos && b[axis] > pos) || (a[axis] > pos && b[axis] < pos)) {
+            vec3 p = a + ((pos - a[axis]) / (b[axis] - a[axis])) * (b - a);
+            p[axis] = pos;
+            left.grow(p);
+            right.grow(p);
         }
-        
-        u /= denom;
-        v /= denom;
-        
-#endif
-        rec.t = t;
-        rec.u = u;
-        rec.v = v;
-        rec.p = P;
-        // Note: You can return the common surface plane normal (norm)
-        // Or better yet - the normal interpolated along the edges
-        // For the latterm simply use the u,v,w parametric offsets
-#if INTERPOLATE_PARAMETRIC_NORM
-        rec.normal = vec3(norm.x() + u, norm.y() + v, norm.z() + (1 - u - v));
-#else
-        rec.normal = norm;
-#endif
-        rec.surfaceMat = surfaceMat;
+    }
+
+    aabb leftRef, rightRef;
+    splitBox(refBounds, axis, pos, leftRef, rightRef);
+    left.clip(leftRef);
+    right.clip(rightRef);
+}
+
+// Triangle object, with the ray / triangle test (Intersector), back face
+// handling (Facing) and hit normal (Normal) picked at compile time, see
+// the policies above. triangle is the default: Moller Trumbore, back
+// faces culled, parametric normal.
+template <typename Intersector = mollerTrumboreIntersector,
+          typename Facing = cullBackFaces,
+          typename Normal = parametricNormal>
+class basicTriangle : public object
+{
+public:
+    typedef Intersector intersector;
+    typedef Facing facing;
+    typedef Normal normalPolicy;
+
+    basicTriangle() = delete;
+    basicTriangle(vec3 a,
+                  vec3 b,
+                  vec3 c,
+                  material *mat) : vtx0(a),
+                                   vtx1(b),
+                                   vtx2(c),
+                                   e1(vtx1 - vtx0),
+                                   e2(vtx2 - vtx0),
+                                   norm(cross(e1, e2)),
+                                   D(dot(norm, vtx0)),
+                                   surfaceMat(mat)
+    {}
+    
+    bool closestHit(const ray& r, float t_min, float t_max, primitiveHit& h) const
+    {
+        float t, u, v;
+        if (!Intersector::intersect(r, vtx0, e1, e2, Facing::kCull, t_min, t_max, t, u, v)) {
+            return false;
+        }
+        h.t = t;
+        h.b1 = u;
+        h.b2 = v;
+        h.prim = this;
+        h.nInstances = 0;
         return true;
     }
+
+    material* hitMaterial(const primitiveHit& h, uint32_t level) const
+    {
+        return surfaceMat;
+    }
+
+    void hitAttributes(const ray& r,
+                       const primitiveHit& h,
+                       uint32_t level,
+                       uint32_t attributes,
+                       intersectParams& rec) const
+    {
+        fillHitRecord(r.point_at_parameter(h.t), h.t, h.b1, h.b2, rec);
+    }
+
+    // same test as closestHit() (back faces are culled alike)
+    bool occluded(const ray& r, float t_min, float t_max) const
+    {
+        float t, u, v;
+        return Intersector::intersect(r, vtx0, e1, e2, Facing::kCull, t_min, t_max, t, u, v);
+    }
+
+    uint32_t hitPacket(rayPacket4& p, uint32_t active, intersectParams *rec) const
+    {
+        return intersectPacket(p, active, rec);
+    }
+    uint32_t hitPacket(rayPacket8& p, uint32_t active, intersectParams *rec) const
+    {
+        return intersectPacket(p, active, rec);
+    }
+    uint32_t hitPacket(rayPacket16& p, uint32_t active, intersectParams *rec) const
+    {
+        return intersectPacket(p, active, rec);
+    }
     
-    // vertices
-    const vec3 vtx0;
-    const vec3 vtx1;
-    const vec3 vtx2;
+    // move the triangle (normal and plane follow)
+    // if it's in a scene, tell the scene with scene::objectMoved()
+    void setVertices(const vec3& a, const vec3& b, const vec3& c)
+    {
+        vtx0 = a;
+        vtx1 = b;
+        vtx2 = c;
+        e1 = vtx1 - vtx0;
+        e2 = vtx2 - vtx0;
+        norm = cross(e1, e2);
+        D = dot(norm, vtx0);
+    }
+
+    // bounds at the current position, for any time interval
+    // (triangles only move between frames, not within one)
+    using object::boundingBox;
+    bool boundingBox(aabb& box) const
+    {
+        box = aabb();
+        box.grow(vtx0);
+        box.grow(vtx1);
+        box.grow(vtx2);
+        return true;
+    }
+
+    void splitBounds(const aabb& refBounds, int axis, float pos, aabb& left, aabb& right) const
+    {
+        splitTriangleBounds(vtx0, vtx1, vtx2, refBounds, axis, pos, left, right);
+    }
+    
+    // vertices (change with setVertices())
+    vec3 vtx0;
+    vec3 vtx1;
+    vec3 vtx2;
+    // edges (vtx1 - vtx0), (vtx2 - vtx0), as the intersectors take them
+    vec3 e1;
+    vec3 e2;
     // Normal to triangle plane
-    const vec3 norm;
+    vec3 norm;
     // d
-    const float D;
+    float D;
     // material
     material* surfaceMat;
+
+private:
+    void fillHitRecord(const vec3& P, float t, float u, float v, intersectParams& rec) const
+    {
+        triangleHitRecord<Normal>(norm, P, t, u, v, rec);
+        rec.surfaceMat = surfaceMat;
+    }
+
+    template <int N>
+    uint32_t intersectPacket(rayPacket<N>& p, uint32_t active, intersectParams *rec) const
+    {
+        typedef typename rayPacket<N>::floatN floatN;
+        uint32_t hitLanes = 0;
+        for (int chunk = 0; chunk < rayPacket<N>::kChunks; chunk++) {
+            const uint32_t bits = rayPacket<N>::chunkLanes(active, chunk);
+            if (bits == 0) {
+                continue;
+            }
+            floatN t, u, v;
+            const uint32_t chunkHits = (uint32_t)Intersector::intersect(p.origin(chunk), p.direction(chunk),
+                                                                        vtx0, e1, e2, Facing::kCull,
+                                                                        floatN(p.tMin), p.farT(chunk),
+                                                                        t, u, v).bits() & bits;
+            if (chunkHits == 0) {
+                continue;
+            }
+
+            float ts[rayPacket<N>::kChunkWidth], us[rayPacket<N>::kChunkWidth], vs[rayPacket<N>::kChunkWidth];
+            t.store(ts);
+            u.store(us);
+            v.store(vs);
+            for (uint32_t laneBits = chunkHits; laneBits; laneBits &= laneBits - 1) {
+                const int i = __builtin_ctz(laneBits);
+                const int lane = chunk * rayPacket<N>::kChunkWidth + i;
+                fillHitRecord(p.getRay(lane).point_at_parameter(ts[i]), ts[i], us[i], vs[i], rec[lane]);
+                p.tMax[lane] = ts[i];
+            }
+            hitLanes |= chunkHits << (chunk * rayPacket<N>::kChunkWidth);
+        }
+        return hitLanes;
+    }
 };
 
+typedef basicTriangle<> triangle;
+
 
 
 #endif /* triangle_h */
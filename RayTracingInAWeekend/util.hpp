@@ -9,7 +9,9 @@
 #ifndef util_h
 #define util_h
 
+#include <algorithm>
 #include "vec3.hpp"
+#include "sampler.hpp"
 
 constexpr float kEpsilon = 1e-8;
 
@@ -69,14 +71,43 @@ bool refract(const vec3& I, const vec3& N, float eta, vec3& refracted) {
         return false;
 }
 
-vec3 unitSphereRandomRadVec()
+// random point inside the unit sphere
+// uniform direction (z = cos(θ) uniform in [-1, 1], φ uniform in [0, 2π))
+// at radius cbrt(u), since volume grows with r^3.
+// Takes exactly 3 dimensions from smp (no rejection loop), so every sample
+// uses the same dimensions for the same decision.
+vec3 unitSphereRandomRadVec(sampler& smp)
 {
-    vec3 rdm;
-    do {
-        rdm = 2.0f * vec3(drand48(), drand48(), drand48()) - vec3(1.0f);
-    } while (rdm.squared_length() >= 1.0f);
-    
-    return rdm;
+    float u0, u1;
+    smp.get2D(u0, u1);
+    const float r = cbrtf(smp.get1D());
+    const float z = 1.0f - 2.0f * u0;
+    const float rxy = sqrt(std::max(0.0f, 1.0f - z * z));
+    const float phi = 2.0f * (float)M_PI * u1;
+    return r * vec3(rxy * cos(phi), rxy * sin(phi), z);
+}
+
+// random point on the unit disk in the z = 0 plane
+// concentric mapping (Shirley & Chiu 1997) of a 2D sample, which keeps
+// the strata of low discrepancy samples compact on the disk
+vec3 unitDiskRandomVec(sampler& smp)
+{
+    float u0, u1;
+    smp.get2D(u0, u1);
+    const float a = 2.0f * u0 - 1.0f;
+    const float b = 2.0f * u1 - 1.0f;
+    if (a == 0.0f && b == 0.0f) {
+        return vec3(0.0f);
+    }
+    float r, phi;
+    if (a * a > b * b) {
+        r = a;
+        phi = (float)(M_PI / 4.0) * (b / a);
+    } else {
+        r = b;
+        phi = (float)(M_PI / 2.0) - (float)(M_PI / 4.0) * (a / b);
+    }
+    return vec3(r * cos(phi), r * sin(phi), 0.0f);
 }
 
 bool getQuadraticRoots(float a,
@@ -0,0 +1,324 @@
+//
+//  wavefront.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 10/13/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef wavefront_h
+#define wavefront_h
+
+#include <vector>
+#include <memory>
+#include "renderer.hpp"
+
+// Wavefront path tracer
+//
+// colorAtRay() follows one path at a time from intersection through
+// material scatter to the next intersection, so every bounce runs the
+// whole renderer's code, and the virtual scatter calls jump between
+// materials from one ray to the next. Here instead a big batch (wave) of
+// paths is advanced one stage at a time, each stage a tight loop over a
+// queue of paths:
+// . generate:  camera rays for the next wavefrontPaths pixel samples
+// . intersect: closest hit of every path in the queue
+// . sort:      queue reordered by what hit it (missed, then each
+//              materialType), counting sort
+// . shade:     misses pick up the background, hits are scattered one
+//              material type at a time with direct calls to that type's
+//              scatter (kOtherMaterial goes through the virtual call)
+// . compact:   surviving paths make up the next bounce's queue
+// and intersect .. compact repeat until no path is left in the wave.
+//
+// Each bounce of a path draws the same sample values as colorAtRay()
+// (the sampler is restarted on the path's pixel sample, then set to the
+// bounce's dimensions), and a pixel's samples are summed in the same
+// order, so the image is identical to traceInto()'s for the same settings.
+// Samples are traced with a fixed nSamples per pixel (no adaptive sampling)
+// and camera rays one at a time (settings.packetSize is ignored).
+
+// paths per wave (bounded memory, ~150 bytes per path)
+constexpr uint32_t wavefrontPaths = 1 << 16;
+// paths per parallelFor task within a stage
+constexpr uint32_t wavefrontTaskSize = 256;
+
+// state of one path in flight
+struct wavefrontPath
+{
+    ray r;
+    vec3 throughput;
+    // light gathered so far (stays 0 until the path escapes)
+    vec3 color;
+    uint32_t x;
+    uint32_t y;
+    uint32_t sample;
+    uint32_t bounce;
+};
+
+class wavefrontTracer
+{
+public:
+    wavefrontTracer(const renderSettings& settings,
+                    scene& world,
+                    camera& cam,
+                    threadPool& pool) : settings(settings),
+                                        world(world),
+                                        cam(cam),
+                                        pool(pool),
+                                        threadStats(pool.size()),
+                                        paths(wavefrontPaths),
+                                        hits(wavefrontPaths),
+                                        hitGroup(wavefrontPaths)
+    {
+        const uint32_t nSamples = std::max(1u, settings.nSamples);
+        for (uint32_t t = 0; t < pool.size(); t++) {
+            samplers.emplace_back(createSampler(settings.sampling, settings.seed, nSamples));
+        }
+        queue.reserve(wavefrontPaths);
+        sorted.reserve(wavefrontPaths);
+    }
+
+    // see traceInto()
+    renderStats trace(PixelRGBA *rgbaTarget, uint32_t *sampleCounts, vec3 *radiance)
+    {
+        const int width = settings.width;
+        const int height = settings.height;
+        const uint32_t nPixels = (uint32_t)(width * height);
+        const uint32_t nSamples = std::max(1u, settings.nSamples);
+        std::vector<vec3> gather(nPixels, vec3(0, 0, 0));
+
+        // paths in sample major order (every pixel's sample 0, then 1, ...)
+        // so pixel sums add up samples in the same order as traceInto()
+        const uint64_t nPaths = (uint64_t)nPixels * nSamples;
+        for (uint64_t waveStart = 0; waveStart < nPaths; waveStart += wavefrontPaths) {
+            const uint32_t waveSize = (uint32_t)std::min<uint64_t>(wavefrontPaths, nPaths - waveStart);
+            generate(waveStart, waveSize);
+            while (!queue.empty()) {
+                intersect();
+                sortByMaterial();
+                shade();
+                compact();
+            }
+            for (uint32_t i = 0; i < waveSize; i++) {
+                const wavefrontPath& path = paths[i];
+                gather[path.y * width + path.x] += path.color;
+            }
+        }
+
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                writePixel(rgbaTarget, width, height, i, j, gather[j * width + i], nSamples,
+                           sampleCounts, radiance);
+            }
+        }
+
+        renderStats total;
+        for (const renderStats& stats : threadStats) {
+            total += stats;
+        }
+        return total;
+    }
+
+private:
+    // hitGroup of missed paths, hits are grouped by material type
+    enum { kMissedGroup = kNumMaterialTypes, kNumGroups };
+
+    // run fn(queue position, threadIdx) over the current queue
+    template <typename Fn>
+    void forEachQueued(const std::vector<uint32_t>& q, Fn fn)
+    {
+        const uint32_t n = (uint32_t)q.size();
+        pool.parallelFor((n + wavefrontTaskSize - 1) / wavefrontTaskSize, [&](uint32_t task, uint32_t threadIdx) {
+            const uint32_t end = std::min(n, (task + 1) * wavefrontTaskSize);
+            for (uint32_t i = task * wavefrontTaskSize; i < end; i++) {
+                fn(i, threadIdx);
+            }
+        });
+    }
+
+    void generate(uint64_t waveStart, uint32_t waveSize)
+    {
+        const uint32_t nPixels = (uint32_t)(settings.width * settings.height);
+        queue.resize(waveSize);
+        for (uint32_t i = 0; i < waveSize; i++) {
+            queue[i] = i;
+        }
+        forEachQueued(queue, [&](uint32_t i, uint32_t threadIdx) {
+            sampler& smp = *samplers[threadIdx];
+            const uint64_t pathIdx = waveStart + i;
+            const uint32_t pixel = (uint32_t)(pathIdx % nPixels);
+            wavefrontPath& path = paths[i];
+            path.x = pixel % settings.width;
+            path.y = pixel / settings.width;
+            path.sample = (uint32_t)(pathIdx / nPixels);
+            path.bounce = 0;
+            path.throughput = vec3(1.0f);
+            path.color = vec3(0.0f);
+
+            smp.startPixelSample(path.x, path.y, path.sample);
+            float du, dv;
+            smp.setDimension(kPixelDimension);
+            smp.get2D(du, dv);
+            float u = (float(path.x) + du) / float(settings.width);
+            float v = (float(path.y) + dv) / float(settings.height);
+            smp.setDimension(kLensDimension);
+            path.r = cam.getRayAt(u, v, smp);
+            threadStats[threadIdx].nPaths++;
+        });
+    }
+
+    void intersect()
+    {
+        forEachQueued(queue, [&](uint32_t i, uint32_t threadIdx) {
+            const uint32_t p = queue[i];
+            threadStats[threadIdx].nSegments++;
+            if (world.hit(paths[p].r, minHitDistance, MAXFLOAT, hits[p])) {
+                hitGroup[p] = hits[p].surfaceMat->type;
+            } else {
+                hitGroup[p] = kMissedGroup;
+            }
+        });
+    }
+
+    // counting sort of the queue by hitGroup (stable, so paths of a group
+    // stay in pixel order)
+    void sortByMaterial()
+    {
+        for (uint32_t g = 0; g <= kNumGroups; g++) {
+            groupStart[g] = 0;
+        }
+        for (uint32_t p : queue) {
+            groupStart[hitGroup[p] + 1]++;
+        }
+        for (uint32_t g = 0; g < kNumGroups; g++) {
+            groupStart[g + 1] += groupStart[g];
+        }
+        uint32_t next[kNumGroups];
+        std::copy(groupStart, groupStart + kNumGroups, next);
+        sorted.resize(queue.size());
+        for (uint32_t p : queue) {
+            sorted[next[hitGroup[p]]++] = p;
+        }
+        queue.swap(sorted);
+    }
+
+    // one group after another, as a loop with the scatter call resolved
+    // at compile time for the built in material types
+    void shade()
+    {
+        shadeGroup(kMissedGroup, [](const material *, const ray&, const intersectParams&,
+                                    vec3&, ray&, sampler&) { return false; });
+        shadeGroup(kLambertian, [](const material *mat, const ray& r, const intersectParams& rec,
+                                   vec3& attenuation, ray& scattered, sampler& smp) {
+            return static_cast<const lambertian *>(mat)->lambertian::scatter(r, rec, attenuation, scattered, smp);
+        });
+        shadeGroup(kLambertianTexture, [](const material *mat, const ray& r, const intersectParams& rec,
+                                          vec3& attenuation, ray& scattered, sampler& smp) {
+            return static_cast<const lambertianTexture *>(mat)->lambertianTexture::scatter(r, rec, attenuation, scattered, smp);
+        });
+        shadeGroup(kMetal, [](const material *mat, const ray& r, const intersectParams& rec,
+                              vec3& attenuation, ray& scattered, sampler& smp) {
+            return static_cast<const metal *>(mat)->metal::scatter(r, rec, attenuation, scattered, smp);
+        });
+        shadeGroup(kDielectric, [](const material *mat, const ray& r, const intersectParams& rec,
+                                   vec3& attenuation, ray& scattered, sampler& smp) {
+            return static_cast<const dielectric *>(mat)->dielectric::scatter(r, rec, attenuation, scattered, smp);
+        });
+        shadeGroup(kOtherMaterial, [](const material *mat, const ray& r, const intersectParams& rec,
+                                      vec3& attenuation, ray& scattered, sampler& smp) {
+            return mat->scatter(r, rec, attenuation, scattered, smp);
+        });
+    }
+
+    // Same steps as a bounce of colorAtHit(): paths that end (escaped,
+    // absorbed, past maxBounces or culled by russian roulette) are marked
+    // with bounce = UINT32_MAX, the rest carry on along the scattered ray.
+    template <typename ScatterFn>
+    void shadeGroup(uint32_t group, ScatterFn scatter)
+    {
+        const uint32_t begin = groupStart[group];
+        const uint32_t n = groupStart[group + 1] - begin;
+        pool.parallelFor((n + wavefrontTaskSize - 1) / wavefrontTaskSize, [&](uint32_t task, uint32_t threadIdx) {
+            sampler& smp = *samplers[threadIdx];
+            const uint32_t end = begin + std::min(n, (task + 1) * wavefrontTaskSize);
+            for (uint32_t i = begin + task * wavefrontTaskSize; i < end; i++) {
+                wavefrontPath& path = paths[queue[i]];
+                if (group == kMissedGroup) {
+                    path.color = path.throughput * bgColorAtRay(path.r);
+                    path.bounce = UINT32_MAX;
+                    continue;
+                }
+
+                const intersectParams& rec = hits[queue[i]];
+                smp.startPixelSample(path.x, path.y, path.sample);
+                smp.setDimension(bounceDimension(path.bounce));
+                ray scattered;
+                vec3 attenuation;
+                if (path.bounce >= maxBounces ||
+                    !scatter(rec.surfaceMat, path.r, rec, attenuation, scattered, smp)) {
+                    path.bounce = UINT32_MAX;
+                    continue;
+                }
+                path.throughput *= attenuation;
+
+                if (settings.russianRoulette && path.bounce >= rouletteStartBounce) {
+                    smp.setDimension(bounceDimension(path.bounce) + kDimensionsPerBounce - 1);
+                    const float survive = std::min(1.0f, std::max(path.throughput.x(),
+                                                         std::max(path.throughput.y(), path.throughput.z())));
+                    if (smp.get1D() >= survive) {
+                        path.bounce = UINT32_MAX;
+                        continue;
+                    }
+                    path.throughput /= survive;
+                }
+                path.r = scattered;
+                path.bounce++;
+            }
+        });
+    }
+
+    void compact()
+    {
+        sorted.clear();
+        for (uint32_t p : queue) {
+            if (paths[p].bounce != UINT32_MAX) {
+                sorted.push_back(p);
+            }
+        }
+        queue.swap(sorted);
+    }
+
+    const renderSettings& settings;
+    scene& world;
+    camera& cam;
+    threadPool& pool;
+    std::vector<std::unique_ptr<sampler>> samplers;
+    std::vector<renderStats> threadStats;
+
+    // per path slot of the wave
+    std::vector<wavefrontPath> paths;
+    std::vector<intersectParams> hits;
+    std::vector<uint8_t> hitGroup;
+
+    // slots of the paths still going, and scratch space to reorder them
+    std::vector<uint32_t> queue;
+    std::vector<uint32_t> sorted;
+    // queue range of every group after sortByMaterial()
+    uint32_t groupStart[kNumGroups + 1];
+};
+
+// Same as traceInto(), with the wavefront tracer above
+renderStats traceWavefront(PixelRGBA *rgbaTarget,
+                           const renderSettings& settings,
+                           scene& world,
+                           camera& cam,
+                           threadPool& pool,
+                           uint32_t *sampleCounts = nullptr,
+                           vec3 *radiance = nullptr)
+{
+    wavefrontTracer tracer(settings, world, cam, pool);
+    return tracer.trace(rgbaTarget, sampleCounts, radiance);
+}
+
+#endif /* wavefront_h */
@@ -0,0 +1,258 @@
+//
+//  wbvh.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 8/18/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+
+#ifndef wbvh_h
+#define wbvh_h
+
+#include <vector>
+#include <cstdint>
+#include "bvh.hpp"
+#include "simd.hpp"
+
+// Wide BVH node (kWidth = 4 or 8 children)
+// Child boxes are stored as structure of arrays (all min x, then all
+// min y, ...) so that one slab test checks the ray against every child.
+// Per child:
+// . interior: child = index of wide node, nPrims = 0
+// . leaf:     child = index of first primitive in primIndices, nPrims > 0
+// Unused slots have an inverted (empty) box, which no ray can hit.
+//
+// order holds, for each of the 8 octants of ray direction (sign of x, y, z),
+// the child slots front to back, 4 bits per slot (first slot lowest)
+template <int kWidth>
+struct wideBvhNode
+{
+    float bMin[3][kWidth];
+    float bMax[3][kWidth];
+    uint32_t child[kWidth];
+    uint16_t nPrims[kWidth];
+    uint32_t order[8];
+    uint32_t nChildren;
+};
+
+// Wide BVH, made by collapsing a binary SAH bvhTree
+// (floatN = floatx4 for a 4 wide tree, floatx8 for 8 wide)
+//
+// Each wide node takes the place of up to kWidth - 1 binary nodes: starting
+// from a binary node's two children, the child with the biggest surface
+// area is replaced by its own two children until kWidth children are
+// gathered (or only leaves are left). A ray then tests all of them at once
+// instead of walking down the binary levels one box at a time.
+//
+// Children are visited front to back by ray direction sign, the same way
+// binary traversal picks the near child by the sign along the split axis:
+// the collapsed binary splits are replayed per octant at build time, which
+// gives order[].
+//
+// traverse() takes the same intersect callback as bvhTree::traverse(),
+// and primitive indices are the same as those of the binary tree.
+template <typename floatN>
+class wideBvhTree
+{
+public:
+    enum {
+        kWidth = floatN::kWidth,
+        kStackSize = 64 * kWidth,
+    };
+    typedef wideBvhNode<kWidth> node;
+
+    wideBvhTree() {}
+
+    void build(const bvhTree& binary)
+    {
+        nodes.clear();
+        primIndices = binary.primIndices;
+        if (!binary.isBuilt()) {
+            return;
+        }
+        nodes.reserve(binary.nodes.size() / (kWidth - 1) + 1);
+        collapse(binary, 0);
+    }
+
+    inline bool isBuilt() const { return !nodes.empty(); }
+
+    // anyHit: stop at the first hit (see bvhTree::traverse())
+    template <bool anyHit = false, typename Intersector>
+    bool traverse(const ray& r,
+                  float t_min,
+                  float t_max,
+                  Intersector intersect) const
+    {
+        if (nodes.empty()) {
+            return false;
+        }
+
+        const rayInv rInv(r);
+        const uint32_t octant = rInv.dirIsNeg[0] | (rInv.dirIsNeg[1] << 1) | (rInv.dirIsNeg[2] << 2);
+        const floatN origin[3] = { rInv.origin.x(), rInv.origin.y(), rInv.origin.z() };
+        const floatN invDir[3] = { rInv.invDir.x(), rInv.invDir.y(), rInv.invDir.z() };
+
+        // pending children, nearest on top
+        struct stackEntry
+        {
+            uint32_t child;
+            uint32_t nPrims;
+            float tNear;
+        };
+        stackEntry stack[kStackSize];
+        uint32_t stackPtr = 0;
+        stack[stackPtr++] = { 0, 0, t_min };
+
+        bool hitAnything = false;
+        while (stackPtr > 0) {
+            const stackEntry entry = stack[--stackPtr];
+            // a closer hit may have been found since this was pushed
+            if (entry.tNear > t_max) {
+                continue;
+            }
+
+            if (entry.nPrims > 0) {
+                for (uint32_t i = 0; i < entry.nPrims; i++) {
+                    if (intersect(primIndices[entry.child + i], r, t_min, t_max)) {
+                        if (anyHit) {
+                            return true;
+                        }
+                        hitAnything = true;
+                    }
+                }
+                continue;
+            }
+
+            // slab test against all children at once (see aabb::hit)
+            const node& n = nodes[entry.child];
+            floatN tNear(t_min);
+            floatN tFar(t_max);
+            for (int a = 0; a < 3; a++) {
+                const float *nearPlane = rInv.dirIsNeg[a] ? n.bMax[a] : n.bMin[a];
+                const float *farPlane = rInv.dirIsNeg[a] ? n.bMin[a] : n.bMax[a];
+                tNear = max(tNear, (floatN::load(nearPlane) - origin[a]) * invDir[a]);
+                tFar = min(tFar, (floatN::load(farPlane) - origin[a]) * invDir[a]);
+            }
+            const int hitMask = (tNear <= tFar).bits();
+            if (hitMask == 0) {
+                continue;
+            }
+
+            float tNears[kWidth];
+            tNear.store(tNears);
+            // push back to front, so the nearest child is popped first
+            const uint32_t order = n.order[octant];
+            for (int k = (int)n.nChildren - 1; k >= 0; k--) {
+                const uint32_t slot = (order >> (4 * k)) & 0xf;
+                if (hitMask & (1 << slot)) {
+                    stack[stackPtr++] = { n.child[slot], n.nPrims[slot], tNears[slot] };
+                }
+            }
+        }
+
+        return hitAnything;
+    }
+
+    // bytes used by nodes and primitive indices
+    size_t memoryUsage() const
+    {
+        return sizeof(node) * nodes.capacity() + sizeof(uint32_t) * primIndices.capacity();
+    }
+
+    std::vector<node> nodes;
+    std::vector<uint32_t> primIndices;
+
+private:
+    // appends slots of the gathered children (binIdx[]) below binary node
+    // n, in the order binary traversal would reach them for this octant
+    static void orderChildren(const bvhTree& binary,
+                              uint32_t n,
+                              uint32_t octant,
+                              const uint32_t *binIdx,
+                              uint32_t nChildren,
+                              uint32_t& order,
+                              uint32_t& nOrdered)
+    {
+        for (uint32_t slot = 0; slot < nChildren; slot++) {
+            if (binIdx[slot] == n) {
+                order |= slot << (4 * nOrdered++);
+                return;
+            }
+        }
+        const bvhNode& bn = binary.nodes[n];
+        const bool secondFirst = (octant >> bn.axis) & 1;
+        orderChildren(binary, secondFirst ? bn.offset : n + 1, octant, binIdx, nChildren, order, nOrdered);
+        orderChildren(binary, secondFirst ? n + 1 : bn.offset, octant, binIdx, nChildren, order, nOrdered);
+    }
+
+    // builds wide node for binary subtree at binRoot, returns its index
+    uint32_t collapse(const bvhTree& binary, uint32_t binRoot)
+    {
+        const uint32_t nodeIdx = (uint32_t)nodes.size();
+        nodes.emplace_back();
+
+        // gather children: open up the biggest interior child until full
+        uint32_t binIdx[kWidth];
+        uint32_t nChildren = 0;
+        const bvhNode& root = binary.nodes[binRoot];
+        if (root.isLeaf()) {
+            binIdx[nChildren++] = binRoot;
+        } else {
+            binIdx[nChildren++] = binRoot + 1;
+            binIdx[nChildren++] = root.offset;
+        }
+        while (nChildren < kWidth) {
+            int best = -1;
+            float bestArea = -1.0f;
+            for (uint32_t i = 0; i < nChildren; i++) {
+                const bvhNode& bn = binary.nodes[binIdx[i]];
+                if (!bn.isLeaf() && bn.bounds.surfaceArea() > bestArea) {
+                    best = (int)i;
+                    bestArea = bn.bounds.surfaceArea();
+                }
+            }
+            if (best < 0) {
+                break;
+            }
+            const uint32_t opened = binIdx[best];
+            binIdx[best] = opened + 1;
+            binIdx[nChildren++] = binary.nodes[opened].offset;
+        }
+
+        node& n = nodes[nodeIdx];
+        n.nChildren = nChildren;
+        for (uint32_t octant = 0; octant < 8; octant++) {
+            uint32_t nOrdered = 0;
+            n.order[octant] = 0;
+            orderChildren(binary, binRoot, octant, binIdx, nChildren, n.order[octant], nOrdered);
+        }
+
+        for (uint32_t slot = 0; slot < kWidth; slot++) {
+            const aabb box = slot < nChildren ? binary.nodes[binIdx[slot]].bounds : aabb();
+            for (int a = 0; a < 3; a++) {
+                nodes[nodeIdx].bMin[a][slot] = box.pMin[a];
+                nodes[nodeIdx].bMax[a][slot] = box.pMax[a];
+            }
+            nodes[nodeIdx].child[slot] = 0;
+            nodes[nodeIdx].nPrims[slot] = 0;
+        }
+
+        // nodes may be reallocated while recursing, so index every time
+        for (uint32_t slot = 0; slot < nChildren; slot++) {
+            const bvhNode& bn = binary.nodes[binIdx[slot]];
+            if (bn.isLeaf()) {
+                nodes[nodeIdx].child[slot] = bn.offset;
+                nodes[nodeIdx].nPrims[slot] = bn.nPrims;
+            } else {
+                const uint32_t childIdx = collapse(binary, binIdx[slot]);
+                nodes[nodeIdx].child[slot] = childIdx;
+            }
+        }
+        return nodeIdx;
+    }
+};
+
+typedef wideBvhTree<floatx4> bvh4Tree;
+typedef wideBvhTree<floatx8> bvh8Tree;
+
+#endif /* wbvh_h */
@@ -0,0 +1,163 @@
+//
+//  accelcache_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 9/29/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Time from nothing to a traceable BVH: OBJ load + build vs loading the
+//  accelerator cache (mesh), and scene BVH build vs cache (spheres).
+//  Also checks the cached trees trace exactly like the built ones.
+//
+
+#include <cstdio>
+#include <unistd.h>
+#include "accelcache.hpp"
+#include "benchutil.hpp"
+
+static const char *kCacheDir = "/tmp";
+static const char *kObjPath = "/tmp/accelcache_bench.obj";
+
+// nRings x nSegments quads on a unit sphere centered at <0, 0, -3>, as OBJ
+void writeSphereObj(const char *path, uint32_t nRings, uint32_t nSegments)
+{
+    FILE *obj = fopen(path, "w");
+    for (uint32_t i = 0; i <= nRings; i++) {
+        const float theta = (float)M_PI * i / nRings;
+        for (uint32_t j = 0; j <= nSegments; j++) {
+            const float phi = 2.0f * (float)M_PI * j / nSegments;
+            fprintf(obj, "v %.6f %.6f %.6f\n", sinf(theta) * cosf(phi), cosf(theta), -3.0f - sinf(theta) * sinf(phi));
+        }
+    }
+    for (uint32_t i = 0; i < nRings; i++) {
+        for (uint32_t j = 0; j < nSegments; j++) {
+            const uint32_t a = i * (nSegments + 1) + j + 1;
+            const uint32_t b = a + nSegments + 1;
+            fprintf(obj, "f %u %u %u\nf %u %u %u\n", a, b, a + 1, a + 1, b, b + 1);
+        }
+    }
+    fclose(obj);
+}
+
+// number of rays on which a and b disagree on the closest hit (exactly:
+// a cached tree is the same tree)
+uint32_t countMismatches(const object& a, const object& b, const std::vector<ray>& rays)
+{
+    return countMismatches(closestHits(a, rays), closestHits(b, rays), 0.0f);
+}
+
+double fileSizeMB(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size / (1024.0 * 1024.0) : 0.0;
+}
+
+inline double msSince(benchClock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+}
+
+void printRow(const char *what, const char *path, double hashMs, double loadMs, double buildMs,
+              double saveMs, double totalMs, double baseMs, const char *mismatches)
+{
+    fprintf(stderr, "%-8s %-12s %9.1f %9.1f %10.1f %9.1f %10.1f %8.1fx %9s\n",
+            what, path, hashMs, loadMs, buildMs, saveMs, totalMs, baseMs / totalMs, mismatches);
+}
+
+int main(int argc, const char * argv[]) {
+    threadPool pool;
+    lambertian mat(vec3(0.5f));
+
+    fprintf(stderr, "\n%-8s %-12s %9s %9s %10s %9s %10s %9s %9s\n",
+            "scene", "path", "hash (ms)", "load (ms)", "build (ms)", "save (ms)", "total (ms)",
+            "speedup", "mismatch");
+
+    // mesh: OBJ parse + BVH build, then the cache
+    {
+        writeSphereObj(kObjPath, 512, 1024);
+        const std::vector<ray> rays = generateRays(100000, 40.0f);
+
+        triangleMesh built(&mat);
+        auto start = benchClock::now();
+        uint64_t key = 0;
+        hashFile(kObjPath, key);
+        const double hashMs = msSince(start);
+        const std::string cachePath = accelCachePath(kCacheDir, key);
+        remove(cachePath.c_str());
+
+        auto t = benchClock::now();
+        loadMesh(kObjPath, built, pool);
+        const double loadMs = msSince(t);
+        t = benchClock::now();
+        built.buildBVH();
+        const double buildMs = msSince(t);
+        const double coldMs = msSince(start);
+        t = benchClock::now();
+        saveMeshCache(cachePath.c_str(), built, key);
+        const double saveMs = msSince(t);
+        printRow("mesh", "OBJ + build", hashMs, loadMs, buildMs, saveMs, coldMs, coldMs, "-");
+
+        triangleMesh cached(&mat);
+        start = benchClock::now();
+        hashFile(kObjPath, key);
+        const double cachedHashMs = msSince(start);
+        t = benchClock::now();
+        const bool ok = loadMeshCache(cachePath.c_str(), cached, key);
+        const double cachedLoadMs = msSince(t);
+        const double warmMs = msSince(start);
+        char mismatches[16];
+        snprintf(mismatches, sizeof(mismatches), "%u", ok ? countMismatches(built, cached, rays) : (uint32_t)rays.size());
+        printRow("mesh", ok ? "cache" : "cache FAIL", cachedHashMs, cachedLoadMs, 0.0, 0.0, warmMs, coldMs, mismatches);
+
+        fprintf(stderr, "%-8s %u faces, OBJ %.1f MB, cache %.1f MB\n", "",
+                built.numTriangles(), fileSizeMB(kObjPath), fileSizeMB(cachePath.c_str()));
+        remove(cachePath.c_str());
+        remove(kObjPath);
+    }
+
+    // scene of spheres: SAH build, then the cache (objects are made either way)
+    {
+        scene built;
+        generateSphereCloud(built, 1000000, &mat, 0.25f);
+        const std::vector<ray> rays = generateRays(100000, 60.0f);
+
+        auto start = benchClock::now();
+        const uint64_t key = sceneContentHash(built);
+        const double hashMs = msSince(start);
+        const std::string cachePath = accelCachePath(kCacheDir, key);
+        remove(cachePath.c_str());
+        auto t = benchClock::now();
+        built.buildBVH();
+        const double buildMs = msSince(t);
+        const double coldMs = msSince(start);
+        t = benchClock::now();
+        saveSceneCache(cachePath.c_str(), built, key);
+        const double saveMs = msSince(t);
+        printRow("spheres", "build", hashMs, 0.0, buildMs, saveMs, coldMs, coldMs, "-");
+
+        scene cached;
+        cached.objects = built.objects;
+        start = benchClock::now();
+        const uint64_t cachedKey = sceneContentHash(cached);
+        const double cachedHashMs = msSince(start);
+        t = benchClock::now();
+        const bool ok = loadSceneCache(cachePath.c_str(), cached, cachedKey);
+        const double loadMs = msSince(t);
+        const double warmMs = msSince(start);
+        char mismatches[16];
+        snprintf(mismatches, sizeof(mismatches), "%u", ok ? countMismatches(built, cached, rays) : (uint32_t)rays.size());
+        printRow("spheres", ok ? "cache" : "cache FAIL", cachedHashMs, loadMs, 0.0, 0.0, warmMs, coldMs, mismatches);
+
+        // a moved object changes the key, the stale file is not picked up
+        static_cast<sphere*>(cached.objects[0])->center += vec3(1.0f);
+        fprintf(stderr, "%-8s after moving one sphere: cache %s\n", "",
+                loadSceneCache(cachePath.c_str(), cached, sceneContentHash(cached)) ? "HIT (stale!)" : "miss");
+
+        remove(cachePath.c_str());
+        for (object* obj : built.objects) {
+            delete obj;
+        }
+    }
+
+    return 0;
+}
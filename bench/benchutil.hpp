@@ -0,0 +1,256 @@
+//
+//  benchutil.hpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 7/14/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Scaffolding shared by the benchmarks: ray sets, the timing loop, hit
+//  comparison and the generated scenes they run on. Everything random
+//  takes a seed, so a bench traces the same set on every run.
+//
+
+#ifndef benchutil_h
+#define benchutil_h
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include "hitable_list.hpp"
+#include "sphere.hpp"
+#include "triangle.hpp"
+#include "mesh.hpp"
+#include "camera.hpp"
+
+typedef std::chrono::steady_clock benchClock;
+
+// nRays camera rays through random points of the image
+inline std::vector<ray> generateRays(camera cam, uint32_t nRays, uint32_t seed = 5678)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> distr;
+    independentSampler smp;
+    std::vector<ray> rays(nRays);
+    for (ray& r : rays) {
+        r = cam.getRayAt(distr(gen), distr(gen), smp);
+    }
+    return rays;
+}
+
+// same, from a square camera at the origin looking down -z
+inline std::vector<ray> generateRays(uint32_t nRays, float vfov, uint32_t seed = 5678)
+{
+    return generateRays(camera(vfov, 1.0f), nRays, seed);
+}
+
+// random directions from around center (within spread on each axis),
+// like secondary bounces
+inline std::vector<ray> generateIncoherentRays(uint32_t nRays, const vec3& center, float spread, uint32_t seed = 8765)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> distr(-1.0f, 1.0f);
+    std::vector<ray> rays(nRays);
+    for (ray& r : rays) {
+        vec3 dir;
+        do {
+            dir = vec3(distr(gen), distr(gen), distr(gen));
+        } while (dir.squared_length() > 1.0f || dir.squared_length() < 1e-4f);
+        const vec3 origin = center + spread * vec3(distr(gen), distr(gen), distr(gen));
+        r = ray(origin, unit_vector(dir));
+    }
+    return rays;
+}
+
+// call trace(r) for every ray until at least minSeconds have passed,
+// return rays / second
+template <typename Trace>
+double measureRaysPerSecond(const std::vector<ray>& rays, Trace trace, double minSeconds = 1.0)
+{
+    uint64_t nTraced = 0;
+    auto start = benchClock::now();
+    double elapsed = 0.0;
+    do {
+        for (const ray& r : rays) {
+            trace(r);
+        }
+        nTraced += rays.size();
+        elapsed = std::chrono::duration<double>(benchClock::now() - start).count();
+    } while (elapsed < minSeconds);
+    return nTraced / elapsed;
+}
+
+// closest hit rays / second of world (a scene, mesh, any object)
+template <typename World>
+double measureRaysPerSecond(const World& world, const std::vector<ray>& rays, double minSeconds = 1.0)
+{
+    return measureRaysPerSecond(rays, [&](const ray& r) {
+        intersectParams rec;
+        world.hit(r, 0.0001f, FLT_MAX, rec);
+    }, minSeconds);
+}
+
+// closest hit t per ray, FLT_MAX on a miss
+template <typename World>
+std::vector<float> closestHits(const World& world, const std::vector<ray>& rays)
+{
+    std::vector<float> ts(rays.size(), FLT_MAX);
+    for (size_t i = 0; i < rays.size(); i++) {
+        intersectParams rec;
+        if (world.hit(rays[i], 0.0001f, FLT_MAX, rec)) {
+            ts[i] = rec.t;
+        }
+    }
+    return ts;
+}
+
+// same closest hit (or both missed), up to tolerance: absolute for hits
+// closer than 1, relative further away (rounding grows with t, and with
+// FMA, make SIMD=avx2, scalar and SIMD code round differently)
+inline bool sameHitT(float a, float b, float tolerance = 1e-4f)
+{
+    return a == b || fabsf(a - b) <= tolerance * std::max(1.0f, fabsf(b));
+}
+
+// rays whose closest hits (see closestHits()) differ
+inline uint32_t countMismatches(const std::vector<float>& a, const std::vector<float>& b, float tolerance = 1e-4f)
+{
+    uint32_t mismatches = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (!sameHitT(a[i], b[i], tolerance)) {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+// n points scattered uniformly in a box of side 2 * halfSize around center
+inline std::vector<vec3> generatePoints(uint32_t n,
+                                        const vec3& center = vec3(0.0f, 0.0f, -20.0f),
+                                        float halfSize = 10.0f,
+                                        uint32_t seed = 1234)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> distr(-halfSize, halfSize);
+    std::vector<vec3> points(n);
+    for (vec3& p : points) {
+        p = center + vec3(distr(gen), distr(gen), distr(gen));
+    }
+    return points;
+}
+
+// radius of nSpheres spheres in a box of side 2 * halfSize, radiusScale
+// times the spacing between them, so clouds of any count are as dense
+// (big scales overlap, and their boxes too)
+inline float sphereCloudRadius(uint32_t nSpheres, float radiusScale, float halfSize = 10.0f)
+{
+    return radiusScale * 2.0f * halfSize / cbrtf((float)nSpheres);
+}
+
+// nSpheres sphere objects at generatePoints() in a 20 x 20 x 20 box
+// around center, see sphereCloudRadius()
+inline void generateSphereCloud(scene& world,
+                                uint32_t nSpheres,
+                                material* mat,
+                                float radiusScale = 0.5f,
+                                const vec3& center = vec3(0.0f, 0.0f, -20.0f),
+                                uint32_t seed = 1234)
+{
+    const float radius = sphereCloudRadius(nSpheres, radiusScale);
+    for (const vec3& c : generatePoints(nSpheres, center, 10.0f, seed)) {
+        world.objects.emplace_back(new sphere(c, radius, mat));
+    }
+}
+
+// unit sphere centered at <0, 0, -3> as nRings x nSegments quads of
+// triangle objects (2 each), plus nSoup small random triangles scattered
+// around it, so rays see both a closed surface and a cluttered soup
+inline void generateTriangles(scene& world, uint32_t nRings, uint32_t nSoup, material* mat, uint32_t seed = 4321)
+{
+    const uint32_t nSegments = 2 * nRings;
+    const vec3 center(0.0f, 0.0f, -3.0f);
+    auto at = [&](uint32_t i, uint32_t j) {
+        const float theta = (float)M_PI * i / nRings;
+        const float phi = 2.0f * (float)M_PI * j / nSegments;
+        return center + vec3(sin(theta) * cos(phi), cos(theta), -sin(theta) * sin(phi));
+    };
+    for (uint32_t i = 0; i < nRings; i++) {
+        for (uint32_t j = 0; j < nSegments; j++) {
+            world.objects.emplace_back(new triangle(at(i, j), at(i + 1, j), at(i, j + 1), mat));
+            world.objects.emplace_back(new triangle(at(i, j + 1), at(i + 1, j), at(i + 1, j + 1), mat));
+        }
+    }
+
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> pos(-2.0f, 2.0f);
+    std::uniform_real_distribution<float> edge(-0.05f, 0.05f);
+    for (uint32_t i = 0; i < nSoup; i++) {
+        const vec3 v0 = center + vec3(pos(gen), pos(gen), pos(gen));
+        world.objects.emplace_back(new triangle(v0,
+                                                v0 + vec3(edge(gen), edge(gen), edge(gen)),
+                                                v0 + vec3(edge(gen), edge(gen), edge(gen)),
+                                                mat));
+    }
+}
+
+// the book's final scene, roughly: a huge sphere to stand on (first),
+// then small spheres on a (2 * halfSize)^2 grid, jittered
+inline void generateSphereField(std::vector<vec3>& centers,
+                                std::vector<float>& radii,
+                                int halfSize = 11,
+                                uint32_t seed = 4321)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> distr;
+    centers.push_back(vec3(0.0f, -1000.0f, 0.0f));
+    radii.push_back(1000.0f);
+    for (int a = -halfSize; a < halfSize; a++) {
+        for (int b = -halfSize; b < halfSize; b++) {
+            centers.push_back(vec3(a + 0.9f * distr(gen), 0.2f, b + 0.9f * distr(gen)));
+            radii.push_back(0.2f);
+        }
+    }
+}
+
+// sphere of radius ~radius around center with bumps of bumpHeight (times
+// radius), nRings x nSegments grid of quads (2 faces each), wound
+// counter clockwise seen from outside
+template <typename meshT>
+void generateBumpySphere(meshT& mesh,
+                         uint32_t nRings,
+                         uint32_t nSegments,
+                         const vec3& center = vec3(0.0f, 0.0f, -3.0f),
+                         float radius = 1.0f,
+                         float bumpHeight = 0.2f)
+{
+    for (uint32_t i = 0; i <= nRings; i++) {
+        const float theta = (float)M_PI * i / nRings;
+        for (uint32_t j = 0; j <= nSegments; j++) {
+            const float phi = 2.0f * (float)M_PI * j / nSegments;
+            const float r = radius * (1.0f + bumpHeight * sinf(13.0f * theta) * sinf(17.0f * phi));
+            mesh.addVertex(center + vec3(r * sinf(theta) * cosf(phi), r * cosf(theta), -r * sinf(theta) * sinf(phi)));
+        }
+    }
+    for (uint32_t i = 0; i < nRings; i++) {
+        for (uint32_t j = 0; j < nSegments; j++) {
+            const uint32_t a = i * (nSegments + 1) + j;
+            const uint32_t b = a + nSegments + 1;
+            mesh.addTriangle(a, b, a + 1);
+            mesh.addTriangle(a + 1, b, b + 1);
+        }
+    }
+}
+
+// smooth sphere of radius radius around center
+template <typename meshT>
+void generateSphereMesh(meshT& mesh,
+                        uint32_t nRings,
+                        uint32_t nSegments,
+                        const vec3& center = vec3(0.0f, 0.0f, -3.0f),
+                        float radius = 1.0f)
+{
+    generateBumpySphere(mesh, nRings, nSegments, center, radius, 0.0f);
+}
+
+#endif /* benchutil_h */
@@ -0,0 +1,43 @@
+//
+//  bvh_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 7/14/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Rays / second of the linear scene scan vs the SAH BVH
+//  on random sphere clouds of increasing size
+//
+
+#include <cstdio>
+#include "benchutil.hpp"
+
+int main(int argc, const char * argv[]) {
+    const uint32_t sceneSizes[] = { 10, 1000, 100000 };
+    lambertian mat(vec3(0.5f));
+
+    fprintf(stderr, "\n%10s %12s %10s %16s %16s %10s %10s\n",
+            "spheres", "build (ms)", "nodes", "linear (rays/s)", "bvh (rays/s)", "speedup", "mismatch");
+    for (uint32_t nSpheres : sceneSizes) {
+        scene linear;
+        generateSphereCloud(linear, nSpheres, &mat);
+        scene accelerated(linear.objects);
+
+        auto start = benchClock::now();
+        accelerated.buildBVH();
+        auto end = benchClock::now();
+        double buildMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+        // the linear scan is very slow on big scenes, so shoot fewer rays at it
+        std::vector<ray> rays = generateRays(nSpheres > 10000 ? 1000 : 100000, 30.0f);
+        double linearRate = measureRaysPerSecond(linear, rays);
+        double bvhRate = measureRaysPerSecond(accelerated, rays);
+
+        fprintf(stderr, "%10u %12.2f %10zu %16.0f %16.0f %9.1fx %10u\n",
+                nSpheres, buildMs, accelerated.accel.nodes.size(),
+                linearRate, bvhRate, bvhRate / linearRate,
+                countMismatches(closestHits(linear, rays), closestHits(accelerated, rays), 1e-5f));
+    }
+
+    return 0;
+}
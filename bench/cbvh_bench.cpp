@@ -0,0 +1,79 @@
+//
+//  cbvh_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 8/25/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  BVH memory per primitive and rays / second of the compressed (8 bit
+//  quantized) wide BVH vs the same wide tree with float bounds, and vs the
+//  binary tree, on sphere heavy and triangle heavy scenes
+//
+
+#include <cstdio>
+#include "benchutil.hpp"
+
+struct layout
+{
+    const char *name;
+    uint32_t width;
+    bool compressed;
+};
+
+// every layout on the same scene and rays, one row each
+// (compressed rows are compared to the float tree of the same width)
+void compareLayouts(const char *name, scene& world, const std::vector<ray>& rays)
+{
+    const layout layouts[] = {
+        { "binary", 2, false },
+        { "4 wide", 4, false },
+        { "4 wide comp.", 4, true },
+        { "8 wide", 8, false },
+        { "8 wide comp.", 8, true },
+    };
+    std::vector<float> binaryHits;
+    double floatRate = 0.0;
+    size_t floatBytes = 0;
+    for (const layout& l : layouts) {
+        world.buildBVH(l.width, l.compressed);
+        const double nPrims = world.bvhObjects.size();
+        const size_t bytes = world.accelMemoryUsage();
+        const double rate = measureRaysPerSecond(world, rays);
+        const std::vector<float> hits = closestHits(world, rays);
+        if (l.width == 2) {
+            binaryHits = hits;
+        }
+        if (!l.compressed) {
+            floatRate = rate;
+            floatBytes = bytes;
+        }
+        fprintf(stderr, "%-22s %8u %-13s %10.1f %10.2f %14.0f %9.2fx %10u\n",
+                name, (uint32_t)nPrims, l.name, bytes / nPrims, (double)bytes / floatBytes,
+                rate, rate / floatRate, countMismatches(binaryHits, hits));
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    lambertian mat(vec3(0.5f));
+    const uint32_t nRays = 200000;
+
+    fprintf(stderr, "\n%-22s %8s %-13s %10s %10s %14s %10s %10s\n",
+            "scene", "prims", "layout", "B/prim", "mem ratio", "rays/s", "speed", "mismatch");
+
+    const uint32_t sphereCounts[] = { 100000, 1000000 };
+    for (uint32_t nSpheres : sphereCounts) {
+        scene world;
+        generateSphereCloud(world, nSpheres, &mat);
+        compareLayouts("spheres primary", world, generateRays(nRays, 30.0f));
+        compareLayouts("spheres incoherent", world,
+                       generateIncoherentRays(nRays, vec3(0.0f, 0.0f, -20.0f), 10.0f));
+    }
+
+    scene world;
+    generateTriangles(world, 224, 4 * 224 * 224, &mat);
+    compareLayouts("triangles primary", world, generateRays(nRays, 60.0f));
+    compareLayouts("triangles incoherent", world,
+                   generateIncoherentRays(nRays, vec3(0.0f, 0.0f, -3.0f), 1.5f));
+
+    return 0;
+}
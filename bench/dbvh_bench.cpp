@@ -0,0 +1,167 @@
+//
+//  dbvh_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 9/15/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Keeping a BVH current while a fraction of the scene moves every frame
+//  (and objects get added / removed): full SAH / LBVH rebuild vs dynamic
+//  BVH refit. Per frame update time, SAH cost drift, rebuilds triggered
+//  and rays / second after the last frame.
+//
+
+#include <cstdio>
+#include <random>
+#include "benchutil.hpp"
+
+// spheres and small triangles in a 20 x 20 x 20 box centered at <0, 0, -20>
+void generateScene(scene& world, uint32_t nObjects, material* mat)
+{
+    std::mt19937 gen(1234);
+    std::uniform_real_distribution<float> pos(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> offset(-0.1f, 0.1f);
+    const vec3 center(0.0f, 0.0f, -20.0f);
+    const float radius = sphereCloudRadius(nObjects, 0.25f);
+    for (uint32_t i = 0; i < nObjects; i++) {
+        const vec3 p = center + vec3(pos(gen), pos(gen), pos(gen));
+        if (i & 1) {
+            world.objects.push_back(new sphere(p, radius, mat));
+        } else {
+            world.objects.push_back(new triangle(p,
+                                                 p + vec3(offset(gen), offset(gen), offset(gen)),
+                                                 p + vec3(offset(gen), offset(gen), offset(gen)),
+                                                 mat));
+        }
+    }
+}
+
+void freeScene(scene& world)
+{
+    for (object* obj : world.objects) {
+        delete obj;
+    }
+    world.objects.clear();
+}
+
+// move an object by delta
+void moveObject(object* obj, const vec3& delta)
+{
+    if (sphere* s = dynamic_cast<sphere*>(obj)) {
+        s->center += delta;
+    } else if (triangle* t = dynamic_cast<triangle*>(obj)) {
+        t->setVertices(t->vtx0 + delta, t->vtx1 + delta, t->vtx2 + delta);
+    }
+}
+
+enum updateMethod
+{
+    kRebuildSAH,
+    kRebuildLBVH,
+    kRefit,
+};
+
+static const char *methodNames[] = { "SAH rebuild", "LBVH rebuild", "refit" };
+
+void printHeader()
+{
+    fprintf(stderr, "\n%-8s %7s %-13s %11s %9s %9s %9s %12s %9s\n",
+            "objects", "moving", "update", "ms / frame", "speedup", "SAH cost", "rebuilds",
+            "rays/s", "mismatch");
+}
+
+// nFrames of moving fraction of the objects by a small random step (with
+// a few objects removed and added back every frame), updating the BVH
+// with method after each
+void runFrames(uint32_t nObjects, float fraction, uint32_t nFrames,
+               const std::vector<ray>& rays, threadPool& pool)
+{
+    lambertian mat(vec3(0.5f));
+    double rebuildMs = 0.0;
+    std::vector<float> refHits;
+    const updateMethod methods[] = { kRebuildSAH, kRebuildLBVH, kRefit };
+    for (updateMethod method : methods) {
+        scene world;
+        generateScene(world, nObjects, &mat);
+        if (method == kRefit) {
+            world.buildDynamicBVH();
+        } else {
+            world.buildBVH(2, false, method == kRebuildLBVH ? kLinearBuilder : kSAHBuilder, &pool);
+        }
+
+        std::mt19937 gen(4321);
+        std::uniform_real_distribution<float> step(-0.2f, 0.2f);
+        const uint32_t nMoving = std::max(1u, (uint32_t)(fraction * nObjects));
+        const uint32_t nSwapped = std::max(1u, nMoving / 100);
+        uint32_t nRebuilds = 0;
+        double updateMs = 0.0;
+        for (uint32_t frame = 0; frame < nFrames; frame++) {
+            // same objects and steps for every method
+            std::vector<object*> moved(nMoving);
+            for (uint32_t i = 0; i < nMoving; i++) {
+                moved[i] = world.objects[(uint32_t)((uint64_t)i * nObjects / nMoving + frame) % nObjects];
+                moveObject(moved[i], vec3(step(gen), step(gen), step(gen)));
+            }
+            std::vector<object*> swapped(world.objects.begin(), world.objects.begin() + nSwapped);
+
+            auto start = benchClock::now();
+            if (method == kRefit) {
+                for (object* obj : moved) {
+                    world.objectMoved(obj);
+                }
+                for (object* obj : swapped) {
+                    world.removeObject(obj);
+                    world.addObject(obj);
+                }
+                if (world.refitBVH()) {
+                    nRebuilds++;
+                }
+            } else {
+                for (object* obj : swapped) {
+                    world.objects.erase(world.objects.begin());
+                    world.objects.push_back(obj);
+                }
+                world.buildBVH(2, false, method == kRebuildLBVH ? kLinearBuilder : kSAHBuilder, &pool);
+                nRebuilds++;
+            }
+            updateMs += std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+        }
+        updateMs /= nFrames;
+
+        const double rate = measureRaysPerSecond(world, rays);
+        const std::vector<float> hits = closestHits(world, rays);
+        if (method == kRebuildSAH) {
+            refHits = hits;
+        }
+        const uint32_t mismatches = countMismatches(refHits, hits);
+        if (method == kRebuildSAH) {
+            rebuildMs = updateMs;
+        }
+
+        const float cost = method == kRefit ? world.dynamicAccel.sahCost() : world.accel.sahCost();
+        fprintf(stderr, "%-8u %6.1f%% %-13s %11.2f %8.1fx %9.1f %9u %12.0f %9u\n",
+                nObjects, 100.0f * fraction, methodNames[method], updateMs, rebuildMs / updateMs,
+                cost, nRebuilds, rate, mismatches);
+        freeScene(world);
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    threadPool pool;
+    const std::vector<ray> rays = generateRays(100000, 30.0f);
+    const uint32_t nFrames = 20;
+
+    fprintf(stderr, "\n%u frames, %u threads, rebuild when SAH cost > %.2fx the last build",
+            nFrames, pool.size(), kDefaultMaxBVHCostRatio);
+    printHeader();
+
+    const uint32_t objectCounts[] = { 10000, 100000 };
+    const float fractions[] = { 0.001f, 0.01f, 0.1f, 1.0f };
+    for (uint32_t nObjects : objectCounts) {
+        for (float fraction : fractions) {
+            runFrames(nObjects, fraction, nFrames, rays, pool);
+        }
+    }
+
+    return 0;
+}
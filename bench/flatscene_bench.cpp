@@ -0,0 +1,229 @@
+//
+//  flatscene_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 10/22/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Virtual object / material / texture classes (scene) vs the same scene
+//  flattened into per type arrays and tagged union materials (flatScene):
+//  memory, closest hit rays / second and path traced samples / second
+//  (1 thread, so only dispatch and data layout differ), on the main scene,
+//  a field of mixed material spheres and a big sphere / triangle cloud.
+//  Checks both give the same hits and the same colors.
+//
+
+#include <cstdio>
+#include <random>
+#include "benchutil.hpp"
+#include "flatscene.hpp"
+#include "scenes.hpp"
+
+constexpr uint32_t kNumRays = 200000;
+constexpr uint32_t kImageSize = 128;
+constexpr uint32_t kSamplesPerPixel = 8;
+
+// random one of the four flattenable materials
+material* randomMaterial(std::mt19937& gen, std::vector<texture*>& textures)
+{
+    std::uniform_real_distribution<float> distr;
+    const float pick = distr(gen);
+    if (pick < 0.5f) {
+        return new lambertian(vec3(distr(gen) * distr(gen), distr(gen) * distr(gen), distr(gen) * distr(gen)));
+    } else if (pick < 0.7f) {
+        flatShade *shade0 = new flatShade(vec3(distr(gen), distr(gen), distr(gen)));
+        flatShade *shade1 = new flatShade(vec3(0.9f));
+        checkerBoard *checker = new checkerBoard(shade0, shade1);
+        textures.push_back(shade0);
+        textures.push_back(shade1);
+        textures.push_back(checker);
+        return new lambertianTexture(checker);
+    } else if (pick < 0.9f) {
+        return new metal(vec3(0.5f * (1.0f + distr(gen)), 0.5f * (1.0f + distr(gen)), 0.5f * (1.0f + distr(gen))),
+                         0.3f * distr(gen));
+    }
+    return new dielectric(1.5f);
+}
+
+// generateSphereField() with a random material per small sphere
+void generateSphereField(scene& world, std::vector<material*>& materials, std::vector<texture*>& textures)
+{
+    std::vector<vec3> centers;
+    std::vector<float> radii;
+    generateSphereField(centers, radii);
+    std::mt19937 gen(1234);
+    for (uint32_t i = 0; i < centers.size(); i++) {
+        materials.push_back(i == 0 ? new lambertian(vec3(0.5f)) : randomMaterial(gen, textures));
+        world.objects.emplace_back(new sphere(centers[i], radii[i], materials.back()));
+    }
+}
+
+// spheres and triangles scattered in a 20 x 20 x 20 box centered at
+// <0, 0, -20>, sharing nMaterials random materials
+void generateCloud(scene& world,
+                   uint32_t nPrimitives,
+                   uint32_t nMaterials,
+                   std::vector<material*>& materials,
+                   std::vector<texture*>& textures)
+{
+    std::mt19937 gen(4321);
+    std::uniform_real_distribution<float> distr(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> offset(-0.3f, 0.3f);
+    const size_t firstMaterial = materials.size();
+    for (uint32_t i = 0; i < nMaterials; i++) {
+        materials.push_back(randomMaterial(gen, textures));
+    }
+    const float radius = sphereCloudRadius(nPrimitives, 0.3f);
+    for (uint32_t i = 0; i < nPrimitives; i++) {
+        const vec3 c(distr(gen), distr(gen), distr(gen) - 20.0f);
+        material *mat = materials[firstMaterial + i % nMaterials];
+        if (i & 1) {
+            world.objects.emplace_back(new triangle(c + vec3(offset(gen), offset(gen), offset(gen)),
+                                                    c + vec3(offset(gen), offset(gen), offset(gen)),
+                                                    c + vec3(offset(gen), offset(gen), offset(gen)),
+                                                    mat));
+        } else {
+            world.objects.emplace_back(new sphere(c, radius, mat));
+        }
+    }
+}
+
+// traceInto()'s sample loop over a kImageSize^2 image, single threaded:
+// samples / second and the sum of all colors
+template <typename World>
+double measureSamplesPerSecond(World& world, camera& cam, vec3& sum)
+{
+    independentSampler smp;
+    renderStats stats;
+    sum = vec3(0.0f);
+    auto start = benchClock::now();
+    for (uint32_t j = 0; j < kImageSize; j++) {
+        for (uint32_t i = 0; i < kImageSize; i++) {
+            for (uint32_t s = 0; s < kSamplesPerPixel; s++) {
+                smp.startPixelSample(i, j, s);
+                float du, dv;
+                smp.setDimension(kPixelDimension);
+                smp.get2D(du, dv);
+                smp.setDimension(kLensDimension);
+                const ray r = cam.getRayAt((i + du) / kImageSize, (j + dv) / kImageSize, smp);
+                sum += colorAtRay(r, world, smp, true, stats);
+            }
+        }
+    }
+    const double elapsed = std::chrono::duration<double>(benchClock::now() - start).count();
+    return stats.nPaths / elapsed;
+}
+
+// the scene's objects (heap allocated, the size of their classes), their
+// pointers and BVH
+size_t sceneMemoryUsage(const scene& world)
+{
+    size_t bytes = world.accelMemoryUsage() +
+                   sizeof(object*) * (world.objects.capacity() + world.bvhObjects.capacity());
+    for (const object* obj : world.objects) {
+        bytes += dynamic_cast<const sphere*>(obj) ? sizeof(sphere) : sizeof(triangle);
+    }
+    return bytes;
+}
+
+void benchScene(const char *name, scene& world, camera& cam, uint32_t width)
+{
+    world.buildBVH(width);
+    flatScene flat;
+    if (!flat.fromScene(world, width)) {
+        fprintf(stderr, "%-14s can't be flattened\n", name);
+        return;
+    }
+
+    // same closest hits?
+    const std::vector<ray> rays = generateRays(cam, kNumRays);
+    uint32_t mismatches = 0;
+    for (const ray& r : rays) {
+        intersectParams a, b;
+        materialId mat;
+        const bool hitA = world.hit(r, minHitDistance, MAXFLOAT, a);
+        const bool hitB = flat.hit(r, minHitDistance, MAXFLOAT, b, mat);
+        if (hitA != hitB || (hitA && (a.t != b.t || (a.normal - b.normal).squared_length() != 0.0f))) {
+            mismatches++;
+        }
+    }
+
+    const double virtualRate = measureRaysPerSecond(world, rays);
+    const double flatRate = measureRaysPerSecond(rays, [&](const ray& r) {
+        intersectParams rec;
+        materialId mat;
+        flat.hit(r, minHitDistance, MAXFLOAT, rec, mat);
+    });
+
+    vec3 virtualSum, flatSum;
+    const double virtualSamples = measureSamplesPerSecond(world, cam, virtualSum);
+    const double flatSamples = measureSamplesPerSecond(flat, cam, flatSum);
+    const bool sameColors = (virtualSum - flatSum).squared_length() == 0.0f;
+
+    fprintf(stderr, "%-14s %5u %9.2f %9.2f %13.0f %13.0f %7.2fx %11.0f %11.0f %7.2fx %9u %6s\n",
+            name, width,
+            sceneMemoryUsage(world) / (1024.0 * 1024.0), flat.memoryUsage() / (1024.0 * 1024.0),
+            virtualRate, flatRate, flatRate / virtualRate,
+            virtualSamples, flatSamples, flatSamples / virtualSamples,
+            mismatches, sameColors ? "yes" : "NO");
+}
+
+int main(int argc, const char * argv[]) {
+    fprintf(stderr, "\n%u closest hit rays, %u x %u x %u spp paths (1 thread)\n",
+            kNumRays, kImageSize, kImageSize, kSamplesPerPixel);
+    fprintf(stderr, "%-14s %5s %9s %9s %13s %13s %8s %11s %11s %8s %9s %6s\n",
+            "scene", "width", "virt MB", "flat MB", "virt rays/s", "flat rays/s", "speedup",
+            "virt spp/s", "flat spp/s", "speedup", "mismatch", "same");
+
+    const uint32_t widths[] = { 2, 4, 8 };
+    {
+        scene world;
+        generateScene(world);
+        std::vector<snapshot> snapshots = generateSnapshots(1.0f);
+        for (uint32_t width : widths) {
+            benchScene("main", world, snapshots.front().cam, width);
+        }
+    }
+
+    {
+        scene world;
+        std::vector<material*> materials;
+        std::vector<texture*> textures;
+        generateSphereField(world, materials, textures);
+        camera cam(10.0f, 1.0f, vec3(13.0f, 2.0f, 3.0f), vec3(0.0f));
+        for (uint32_t width : widths) {
+            benchScene("sphere field", world, cam, width);
+        }
+        for (object* obj : world.objects) {
+            delete obj;
+        }
+        for (material* mat : materials) {
+            delete mat;
+        }
+        for (texture* tex : textures) {
+            delete tex;
+        }
+    }
+
+    {
+        scene world;
+        std::vector<material*> materials;
+        std::vector<texture*> textures;
+        generateCloud(world, 200000, 64, materials, textures);
+        camera cam(20.0f, 1.0f);
+        for (uint32_t width : widths) {
+            benchScene("cloud", world, cam, width);
+        }
+        for (object* obj : world.objects) {
+            delete obj;
+        }
+        for (material* mat : materials) {
+            delete mat;
+        }
+        for (texture* tex : textures) {
+            delete tex;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+//
+//  hitattr_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 10/20/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Closest hit rays / second with every candidate hit getting its full hit
+//  record (point, normal, uv, material, copied out; as hit() used to)
+//  vs two phase hits (primitiveHit while searching, completeHit() once),
+//  on scenes where rays find several closer hits on the way: spheres with
+//  no BVH (tested in order), big overlapping spheres, a sphere cloud
+//  (plain and textured) and a forest of mesh instances. Both walk the
+//  binary scene BVH.
+//
+
+#include <cstdio>
+#include <random>
+#include "benchutil.hpp"
+#include "instance.hpp"
+
+constexpr uint32_t kNumRays = 200000;
+
+// scene::closestHit() as it was before the two phases: each closer
+// candidate fills in a whole hit record, which is copied out
+// (objects in order when the scene has no BVH)
+bool eagerHit(const scene& world, const ray& r, float t_min, float t_max, intersectParams& rec, uint32_t& nCandidates)
+{
+    intersectParams tempRec;
+    auto intersect = [&](uint32_t idx, const ray& r, float t_min, float& t_max) {
+        primitiveHit h;
+        const object *obj = world.accel.isBuilt() ? world.bvhObjects[idx] : world.objects[idx];
+        if (obj->closestHit(r, t_min, t_max, h)) {
+            const object *top = h.nInstances > 0 ? h.instances[h.nInstances - 1] : h.prim;
+            const uint32_t level = h.nInstances > 0 ? h.nInstances - 1 : 0;
+            top->hitAttributes(r, h, level, kAllSurfaceAttributes, tempRec);
+            tempRec.surfaceMat = top->hitMaterial(h, level);
+            t_max = tempRec.t;
+            rec = tempRec;
+            nCandidates++;
+            return true;
+        }
+        return false;
+    };
+    if (world.accel.isBuilt()) {
+        return world.accel.traverse(r, t_min, t_max, intersect);
+    }
+    bool hitAnything = false;
+    for (uint32_t i = 0; i < world.objects.size(); i++) {
+        if (intersect(i, r, t_min, t_max)) {
+            hitAnything = true;
+        }
+    }
+    return hitAnything;
+}
+
+// hit records differ in what materials read (uvs only where asked for)
+bool sameHit(const intersectParams& a, const intersectParams& b)
+{
+    if (a.t != b.t || a.surfaceMat != b.surfaceMat ||
+        (a.p - b.p).squared_length() != 0.0f || (a.normal - b.normal).squared_length() != 0.0f) {
+        return false;
+    }
+    return (a.surfaceMat->attributes & kSurfaceUV) == 0 || (a.u == b.u && a.v == b.v);
+}
+
+void benchScene(const char *name, const scene& world, const std::vector<ray>& rays)
+{
+    // closer hits found per ray, and agreement
+    uint64_t nCandidates = 0;
+    uint32_t nHits = 0, mismatches = 0;
+    for (const ray& r : rays) {
+        intersectParams eager, lazy;
+        uint32_t n = 0;
+        const bool hitA = eagerHit(world, r, 0.0001f, FLT_MAX, eager, n);
+        const bool hitB = world.hit(r, 0.0001f, FLT_MAX, lazy);
+        nCandidates += n;
+        nHits += hitA;
+        if (hitA != hitB || (hitA && !sameHit(eager, lazy))) {
+            mismatches++;
+        }
+    }
+
+    const double eagerRate = measureRaysPerSecond(rays, [&](const ray& r) {
+        intersectParams rec;
+        uint32_t n = 0;
+        eagerHit(world, r, 0.0001f, FLT_MAX, rec, n);
+    });
+    const double lazyRate = measureRaysPerSecond(world, rays);
+    fprintf(stderr, "%-16s %12.2f %14.0f %14.0f %9.2fx %9u\n", name,
+            nHits ? (double)nCandidates / nHits : 0.0, eagerRate, lazyRate, lazyRate / eagerRate, mismatches);
+}
+
+int main(int argc, const char * argv[]) {
+    lambertian plain(vec3(0.5f));
+    flatShade white(vec3(0.9f)), black(vec3(0.1f));
+    checkerBoard checker(&white, &black);
+    lambertianTexture textured(&checker);
+
+    fprintf(stderr, "\n%u camera rays\n", kNumRays);
+    fprintf(stderr, "%-16s %12s %14s %14s %10s %9s\n",
+            "scene", "cand / hit", "eager rays/s", "2 phase rays/s", "speedup", "mismatch");
+
+    {
+        scene world;
+        generateSphereCloud(world, 2000, &plain, 0.3f);
+        benchScene("spheres, no bvh", world, generateRays(kNumRays, 40.0f));
+        for (object* obj : world.objects) {
+            delete obj;
+        }
+    }
+
+    {
+        scene world;
+        // big enough to overlap, and their boxes too, so the BVH can't
+        // sort them by distance
+        generateSphereCloud(world, 10000, &plain, 2.0f);
+        world.buildBVH(2);
+        benchScene("big spheres", world, generateRays(kNumRays, 40.0f));
+        for (object* obj : world.objects) {
+            delete obj;
+        }
+    }
+
+    {
+        scene world;
+        generateSphereCloud(world, 100000, &plain, 0.3f);
+        world.buildBVH(2);
+        benchScene("spheres", world, generateRays(kNumRays, 40.0f));
+        for (object* obj : world.objects) {
+            static_cast<sphere*>(obj)->surfaceMat = &textured;
+        }
+        benchScene("spheres textured", world, generateRays(kNumRays, 40.0f));
+        for (object* obj : world.objects) {
+            delete obj;
+        }
+    }
+
+    {
+        // rows of mesh instances one behind the other
+        triangleMesh mesh(&plain);
+        generateBumpySphere(mesh, 64, 128, vec3(0.0f));
+        mesh.buildBVH();
+        std::mt19937 gen(4321);
+        std::uniform_real_distribution<float> angle(0.0f, 360.0f);
+        scene forest;
+        for (int x = 0; x < 10; x++) {
+            for (int y = 0; y < 10; y++) {
+                for (int z = 0; z < 20; z++) {
+                    const transform t = transform::translate(vec3(1.5f * x - 6.75f, 1.5f * y - 6.75f, -3.0f - 1.5f * z)) *
+                                        transform::rotate(vec3(0.0f, 1.0f, 0.0f), angle(gen));
+                    forest.objects.emplace_back(new instance(&mesh, t));
+                }
+            }
+        }
+        forest.buildBVH(2);
+        benchScene("instances", forest, generateRays(kNumRays, 60.0f));
+        for (object* obj : forest.objects) {
+            delete obj;
+        }
+    }
+
+    return 0;
+}
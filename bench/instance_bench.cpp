@@ -0,0 +1,129 @@
+//
+//  instance_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 9/22/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Forests of one shared mesh placed with instances: memory, top level
+//  build time and rays / second vs instance count, and against the same
+//  forest flattened into one big mesh while that still fits
+//
+
+#include <cstdio>
+#include <random>
+#include "benchutil.hpp"
+#include "instance.hpp"
+
+// "tree": unit sphere stretched into a cone-ish blob standing on y = 0,
+// nRings x nSegments grid of quads (2 faces each)
+void generateTreeMesh(triangleMesh& mesh, uint32_t nRings, uint32_t nSegments)
+{
+    for (uint32_t i = 0; i <= nRings; i++) {
+        const float theta = (float)M_PI * i / nRings;
+        const float radius = sin(theta) * (0.3f + 0.7f * i / nRings);
+        for (uint32_t j = 0; j <= nSegments; j++) {
+            const float phi = 2.0f * (float)M_PI * j / nSegments;
+            mesh.addVertex(vec3(radius * cos(phi), 1.0f + 1.5f * cos(theta), -radius * sin(phi)));
+        }
+    }
+    for (uint32_t i = 0; i < nRings; i++) {
+        for (uint32_t j = 0; j < nSegments; j++) {
+            const uint32_t a = i * (nSegments + 1) + j;
+            const uint32_t b = a + nSegments + 1;
+            mesh.addTriangle(a, b, a + 1);
+            mesh.addTriangle(a + 1, b, b + 1);
+        }
+    }
+}
+
+// placements of nTrees over a square patch of ground in front of the
+// camera (side grows with count so density stays the same), random
+// rotation around y and size
+std::vector<transform> generatePlacements(uint32_t nTrees)
+{
+    std::mt19937 gen(1234);
+    const float side = 2.0f * sqrtf((float)nTrees);
+    std::uniform_real_distribution<float> pos(-0.5f * side, 0.5f * side);
+    std::uniform_real_distribution<float> angle(0.0f, 360.0f);
+    std::uniform_real_distribution<float> size(0.5f, 1.5f);
+    std::vector<transform> placements(nTrees);
+    for (transform& t : placements) {
+        const float s = size(gen);
+        t = transform::translate(vec3(pos(gen), -2.0f, -0.5f * side - 3.0f + pos(gen))) *
+            transform::rotate(vec3(0.0f, 1.0f, 0.0f), angle(gen)) *
+            transform::scale(vec3(s, s * size(gen), s));
+    }
+    return placements;
+}
+
+void printHeader()
+{
+    fprintf(stderr, "\n%-10s %9s %12s %10s %10s %11s %10s %12s %9s\n",
+            "layout", "instances", "triangles", "geom (MB)", "inst (MB)", "total (MB)",
+            "build (ms)", "rays/s", "mismatch");
+}
+
+int main(int argc, const char * argv[]) {
+    lambertian mat(vec3(0.5f));
+    const std::vector<ray> rays = generateRays(100000, 60.0f);
+
+    triangleMesh tree(&mat);
+    generateTreeMesh(tree, 64, 128);
+    tree.buildBVH();
+    const double meshMB = tree.memoryUsage() / (1024.0 * 1024.0);
+
+    printHeader();
+
+    const uint32_t instanceCounts[] = { 100, 1000, 10000, 100000 };
+    for (uint32_t nInstances : instanceCounts) {
+        const std::vector<transform> placements = generatePlacements(nInstances);
+
+        scene forest;
+        for (const transform& t : placements) {
+            forest.objects.push_back(new instance(&tree, t));
+        }
+        auto start = benchClock::now();
+        forest.buildBVH();
+        const double buildMs = std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+        const double instMB = (nInstances * (sizeof(instance) + sizeof(object*)) +
+                               forest.accelMemoryUsage()) / (1024.0 * 1024.0);
+        const double rate = measureRaysPerSecond(forest, rays);
+        fprintf(stderr, "%-10s %9u %12llu %10.1f %10.1f %11.1f %10.1f %12.0f %9s\n",
+                "instanced", nInstances, (unsigned long long)nInstances * tree.numTriangles(),
+                meshMB, instMB, meshMB + instMB, buildMs, rate, "-");
+
+        // flattened copy (every vertex transformed into one mesh), as long
+        // as it's small enough to build
+        if (nInstances <= 100) {
+            triangleMesh flat(&mat);
+            for (const transform& t : placements) {
+                const uint32_t base = flat.numVertices();
+                for (uint32_t v = 0; v < tree.numVertices(); v++) {
+                    flat.addVertex(t.applyPoint(tree.position(v)));
+                }
+                for (uint32_t f = 0; f < tree.numTriangles(); f++) {
+                    flat.addTriangle(base + tree.indices[3 * f],
+                                     base + tree.indices[3 * f + 1],
+                                     base + tree.indices[3 * f + 2]);
+                }
+            }
+            start = benchClock::now();
+            flat.buildBVH();
+            const double flatBuildMs = std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+            const double flatRate = measureRaysPerSecond(flat, rays);
+
+            const uint32_t mismatches = countMismatches(closestHits(forest, rays), closestHits(flat, rays), 1e-3f);
+            const double flatMB = flat.memoryUsage() / (1024.0 * 1024.0);
+            fprintf(stderr, "%-10s %9u %12u %10.1f %10.1f %11.1f %10.1f %12.0f %9u\n",
+                    "flattened", nInstances, flat.numTriangles(), flatMB, 0.0, flatMB,
+                    flatBuildMs, flatRate, mismatches);
+        }
+
+        for (object* obj : forest.objects) {
+            delete obj;
+        }
+    }
+
+    return 0;
+}
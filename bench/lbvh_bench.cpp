@@ -0,0 +1,127 @@
+//
+//  lbvh_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 9/8/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Binned SAH vs LBVH builds (30 / 63 bit Morton codes, with and without
+//  treelet restructuring) on meshes of millions of triangles: build time,
+//  SAH cost, tree depth and rays / second of the resulting trees
+//
+
+#include <cstdio>
+#include <random>
+#include "benchutil.hpp"
+#include "threadpool.hpp"
+
+// small triangles scattered through a 4 x 4 x 4 box centered at <0, 0, -6>
+void generateTriangleSoup(triangleMesh& mesh, uint32_t nTriangles)
+{
+    std::mt19937 gen(1234);
+    std::uniform_real_distribution<float> pos(-2.0f, 2.0f);
+    std::uniform_real_distribution<float> offset(-0.02f, 0.02f);
+    const vec3 center(0.0f, 0.0f, -6.0f);
+    for (uint32_t i = 0; i < nTriangles; i++) {
+        const vec3 p = center + vec3(pos(gen), pos(gen), pos(gen));
+        const uint32_t a = mesh.addVertex(p);
+        const uint32_t b = mesh.addVertex(p + vec3(offset(gen), offset(gen), offset(gen)));
+        const uint32_t c = mesh.addVertex(p + vec3(offset(gen), offset(gen), offset(gen)));
+        mesh.addTriangle(a, b, c);
+    }
+}
+
+// levels from the root down to the deepest leaf
+uint32_t treeDepth(const bvhTree& tree, uint32_t idx = 0)
+{
+    const bvhNode& node = tree.nodes[idx];
+    if (node.isLeaf()) {
+        return 1;
+    }
+    return 1 + std::max(treeDepth(tree, idx + 1), treeDepth(tree, node.offset));
+}
+
+struct buildConfig
+{
+    const char *name;
+    bool linear;
+    lbvhSettings settings;
+};
+
+void printHeader()
+{
+    fprintf(stderr, "\n%-14s %9s %-14s %10s %9s %9s %6s %12s %9s %9s\n",
+            "mesh", "faces", "build", "build (ms)", "vs SAH", "SAH cost", "depth",
+            "rays/s", "vs SAH", "mismatch");
+}
+
+void compareBuilds(const char *name, triangleMesh& mesh, threadPool& pool, const std::vector<ray>& rays)
+{
+    buildConfig configs[5];
+    configs[0] = { "SAH", false, lbvhSettings() };
+    for (int i = 0; i < 4; i++) {
+        lbvhSettings settings;
+        settings.mortonBits = i & 1 ? 63 : 30;
+        settings.optimizeTreelets = i >= 2;
+        static const char *names[] = { "LBVH 30", "LBVH 63", "LBVH 30 + opt", "LBVH 63 + opt" };
+        configs[i + 1] = { names[i], true, settings };
+    }
+
+    double sahBuildMs = 0.0, sahRate = 0.0;
+    std::vector<float> sahHits;
+    for (const buildConfig& config : configs) {
+        // best of a few builds, the first one also pays for page faults
+        double buildMs = FLT_MAX;
+        for (int run = 0; run < 3; run++) {
+            auto start = benchClock::now();
+            if (config.linear) {
+                mesh.buildBVH(pool, config.settings);
+            } else {
+                mesh.buildBVH();
+            }
+            buildMs = std::min(buildMs, std::chrono::duration<double, std::milli>(benchClock::now() - start).count());
+            if (!config.linear) {
+                // one SAH build is plenty slow
+                break;
+            }
+        }
+
+        const double rate = measureRaysPerSecond(mesh, rays);
+        const std::vector<float> hits = closestHits(mesh, rays);
+        if (!config.linear) {
+            sahHits = hits;
+        }
+        const uint32_t mismatches = countMismatches(sahHits, hits);
+        if (!config.linear) {
+            sahBuildMs = buildMs;
+            sahRate = rate;
+        }
+
+        fprintf(stderr, "%-14s %9u %-14s %10.1f %8.2fx %9.1f %6u %12.0f %8.2fx %9u\n",
+                name, mesh.numTriangles(), config.name, buildMs, sahBuildMs / buildMs,
+                mesh.accel.sahCost(), treeDepth(mesh.accel), rate, rate / sahRate, mismatches);
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    lambertian mat(vec3(0.5f));
+    threadPool pool;
+    const std::vector<ray> rays = generateRays(100000, 40.0f);
+
+    fprintf(stderr, "\n%u threads", pool.size());
+    printHeader();
+
+    {
+        triangleMesh mesh(&mat);
+        generateSphereMesh(mesh, 1024, 1024);
+        compareBuilds("sphere", mesh, pool, rays);
+    }
+
+    {
+        triangleMesh mesh(&mat);
+        generateTriangleSoup(mesh, 1000000);
+        compareBuilds("soup", mesh, pool, rays);
+    }
+
+    return 0;
+}
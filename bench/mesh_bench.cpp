@@ -0,0 +1,64 @@
+//
+//  mesh_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 8/4/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Memory and rays / second of one triangle object per face vs a single
+//  indexed triangleMesh, on tessellated spheres of increasing size
+//
+
+#include <cstdio>
+#include "benchutil.hpp"
+
+// what a scene of triangle objects holds per face: the object and its heap
+// block header, pointers in scene::objects and scene::bvhObjects, BVH data
+size_t triangleSceneMemory(const scene& world)
+{
+    const size_t heapHeader = 16;
+    return world.objects.size() * (sizeof(triangle) + heapHeader) +
+           sizeof(object*) * (world.objects.capacity() + world.bvhObjects.capacity()) +
+           sizeof(bvhNode) * world.accel.nodes.capacity() +
+           sizeof(uint32_t) * world.accel.primIndices.capacity();
+}
+
+int main(int argc, const char * argv[]) {
+    const uint32_t ringCounts[] = { 16, 224, 708 };
+    lambertian mat(vec3(0.5f));
+    const std::vector<ray> rays = generateRays(100000, 20.0f);
+
+    fprintf(stderr, "\n%10s %14s %14s %16s %16s %10s %10s\n",
+            "faces", "tris (B/face)", "mesh (B/face)", "tris (rays/s)", "mesh (rays/s)",
+            "speedup", "mismatch");
+    for (uint32_t nRings : ringCounts) {
+        triangleMesh *mesh = new triangleMesh(&mat);
+        generateSphereMesh(*mesh, nRings, 2 * nRings);
+        mesh->buildBVH();
+        scene meshScene;
+        meshScene.objects.push_back(mesh);
+        meshScene.buildBVH();
+
+        scene triScene;
+        for (uint32_t f = 0; f < mesh->numTriangles(); f++) {
+            triScene.objects.push_back(new triangle(mesh->position(mesh->indices[3 * f]),
+                                                    mesh->position(mesh->indices[3 * f + 1]),
+                                                    mesh->position(mesh->indices[3 * f + 2]),
+                                                    &mat));
+        }
+        triScene.buildBVH(2);
+
+        const double nFaces = mesh->numTriangles();
+        const double triRate = measureRaysPerSecond(triScene, rays);
+        const double meshRate = measureRaysPerSecond(meshScene, rays);
+        fprintf(stderr, "%10u %14.1f %14.1f %16.0f %16.0f %9.1fx %10u\n",
+                mesh->numTriangles(),
+                triangleSceneMemory(triScene) / nFaces, mesh->memoryUsage() / nFaces,
+                triRate, meshRate, meshRate / triRate,
+                countMismatches(closestHits(triScene, rays), closestHits(meshScene, rays)));
+
+        delete mesh;
+    }
+
+    return 0;
+}
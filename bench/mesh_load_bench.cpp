@@ -0,0 +1,133 @@
+//
+//  mesh_load_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 8/11/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Load time, throughput and peak resident memory of the OBJ / PLY loaders
+//
+//  ./mesh_load_bench [faces]        writes a tessellated sphere with that
+//                                   many faces (default 2M) as OBJ and PLY
+//                                   to /tmp and loads both
+//  ./mesh_load_bench file.obj ...   loads the given files
+//
+
+#include <cstdio>
+#include <chrono>
+#include <string>
+#include "meshloader.hpp"
+
+typedef std::chrono::steady_clock benchClock;
+
+// nRings x nSegments quads on a unit sphere, streamed straight to file
+// (never held in memory, so it doesn't show up in the peak RSS)
+// OBJ gets per vertex normals (v//vn faces), PLY gets binary float / int
+void writeSphereFiles(const char *objPath, const char *plyPath, uint32_t nRings, uint32_t nSegments)
+{
+    const uint32_t nVertices = (nRings + 1) * (nSegments + 1);
+    const uint32_t nFaces = 2 * nRings * nSegments;
+
+    FILE *obj = fopen(objPath, "w");
+    FILE *ply = fopen(plyPath, "wb");
+    fprintf(ply, "ply\nformat binary_little_endian 1.0\ncomment mesh_load_bench sphere\n"
+                 "element vertex %u\nproperty float x\nproperty float y\nproperty float z\n"
+                 "element face %u\nproperty list uchar int vertex_indices\nend_header\n",
+            nVertices, nFaces);
+
+    for (uint32_t i = 0; i <= nRings; i++) {
+        const float theta = (float)M_PI * i / nRings;
+        for (uint32_t j = 0; j <= nSegments; j++) {
+            const float phi = 2.0f * (float)M_PI * j / nSegments;
+            const float p[3] = { sinf(theta) * cosf(phi), cosf(theta), -sinf(theta) * sinf(phi) };
+            fprintf(obj, "v %.6f %.6f %.6f\n", p[0], p[1], p[2]);
+            fprintf(obj, "vn %.6f %.6f %.6f\n", p[0], p[1], p[2]);
+            fwrite(p, sizeof(float), 3, ply);
+        }
+    }
+    for (uint32_t i = 0; i < nRings; i++) {
+        for (uint32_t j = 0; j < nSegments; j++) {
+            const uint32_t a = i * (nSegments + 1) + j;
+            const uint32_t b = a + nSegments + 1;
+            const uint32_t faces[2][3] = { { a, b, a + 1 }, { a + 1, b, b + 1 } };
+            for (const uint32_t *f : faces) {
+                fprintf(obj, "f %u//%u %u//%u %u//%u\n", f[0] + 1, f[0] + 1, f[1] + 1, f[1] + 1, f[2] + 1, f[2] + 1);
+                const uint8_t n = 3;
+                fwrite(&n, 1, 1, ply);
+                fwrite(f, sizeof(uint32_t), 3, ply);
+            }
+        }
+    }
+    fclose(obj);
+    fclose(ply);
+}
+
+size_t fileSize(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+// load and report, returns false if loading failed
+bool measureLoad(const char *path, threadPool& pool, triangleMesh& mesh)
+{
+    auto start = benchClock::now();
+    const bool loaded = loadMesh(path, mesh, pool);
+    auto end = benchClock::now();
+    if (!loaded) {
+        fprintf(stderr, "\n");
+        return false;
+    }
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    const double mb = fileSize(path) / (1024.0 * 1024.0);
+    fprintf(stderr, "%-28s %10.1f %12u %12u %10.0f %10.1f %14.1f\n",
+            path, mb, mesh.numVertices(), mesh.numTriangles(),
+            seconds * 1000.0, mb / seconds, peakResidentBytes() / (1024.0 * 1024.0));
+    return true;
+}
+
+int main(int argc, const char * argv[]) {
+    threadPool pool;
+    std::vector<std::string> paths;
+    bool generated = false;
+    if (argc > 1 && strchr(argv[1], '.') == nullptr) {
+        // faces = 4 * nRings^2
+        const uint32_t nFaces = (uint32_t)strtoul(argv[1], nullptr, 10);
+        const uint32_t nRings = std::max(2u, (uint32_t)sqrt(nFaces / 4.0));
+        writeSphereFiles("/tmp/mesh_load_bench.obj", "/tmp/mesh_load_bench.ply", nRings, 2 * nRings);
+        generated = true;
+    } else if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            paths.push_back(argv[i]);
+        }
+    } else {
+        writeSphereFiles("/tmp/mesh_load_bench.obj", "/tmp/mesh_load_bench.ply", 708, 1416);
+        generated = true;
+    }
+    if (generated) {
+        paths.push_back("/tmp/mesh_load_bench.obj");
+        paths.push_back("/tmp/mesh_load_bench.ply");
+    }
+
+    fprintf(stderr, "\n%u threads\n%-28s %10s %12s %12s %10s %10s %14s\n",
+            pool.size(), "file", "size (MB)", "vertices", "faces", "load (ms)", "MB/s", "peak RSS (MB)");
+    std::vector<triangleMesh> meshes(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        measureLoad(paths[i].c_str(), pool, meshes[i]);
+    }
+
+    if (generated) {
+        // both files describe the same mesh
+        const triangleMesh& obj = meshes[0];
+        const triangleMesh& ply = meshes[1];
+        bool same = obj.indices == ply.indices && obj.numVertices() == ply.numVertices();
+        for (uint32_t i = 0; same && i < obj.numVertices(); i++) {
+            same = (obj.position(i) - ply.position(i)).length() < 1e-5f;
+        }
+        fprintf(stderr, "OBJ and PLY meshes %s\n", same ? "match" : "DIFFER");
+        remove("/tmp/mesh_load_bench.obj");
+        remove("/tmp/mesh_load_bench.ply");
+    }
+
+    return 0;
+}
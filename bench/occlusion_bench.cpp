@@ -0,0 +1,121 @@
+//
+//  occlusion_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 10/16/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Shadow rays / second answered with a closest hit (hit()) vs an any hit
+//  query (occluded()), for every BVH layout of a sphere scene, a triangle
+//  mesh and an instanced forest of it, checking both agree on every ray
+//
+
+#include <cstdio>
+#include <random>
+#include "benchutil.hpp"
+#include "instance.hpp"
+
+constexpr uint32_t kNumRays = 200000;
+
+// results of the occlusion tests go here, so they can't be optimized away
+volatile bool gSink;
+
+// shadow ray segments between random points of a (2 * extent)^3 box
+// centered at the origin: t in (tMin, 1) covers the segment
+std::vector<ray> generateShadowRays(float extent)
+{
+    std::mt19937 gen(5678);
+    std::uniform_real_distribution<float> distr(-extent, extent);
+    std::vector<ray> rays(kNumRays);
+    for (ray& r : rays) {
+        const vec3 from(distr(gen), distr(gen), distr(gen));
+        const vec3 to(distr(gen), distr(gen), distr(gen));
+        r = ray(from, to - from);
+    }
+    return rays;
+}
+
+constexpr float kShadowTMin = 0.0001f;
+constexpr float kShadowTMax = 1.0f;
+
+void benchLayout(const char *sceneName, const char *layout, const object& world, const std::vector<ray>& rays)
+{
+    std::vector<bool> closest(rays.size()), any(rays.size());
+    for (size_t i = 0; i < rays.size(); i++) {
+        intersectParams rec;
+        closest[i] = world.hit(rays[i], kShadowTMin, kShadowTMax, rec);
+        any[i] = world.occluded(rays[i], kShadowTMin, kShadowTMax);
+    }
+    const double hitRate = measureRaysPerSecond(rays, [&](const ray& r) {
+        intersectParams rec;
+        gSink = world.hit(r, kShadowTMin, kShadowTMax, rec);
+    });
+    const double occludedRate = measureRaysPerSecond(rays, [&](const ray& r) {
+        gSink = world.occluded(r, kShadowTMin, kShadowTMax);
+    });
+
+    uint32_t nBlocked = 0, mismatches = 0;
+    for (size_t i = 0; i < rays.size(); i++) {
+        nBlocked += closest[i];
+        mismatches += closest[i] != any[i];
+    }
+    fprintf(stderr, "%-9s %-12s %8.1f%% %14.0f %14.0f %9.2fx %9u\n", sceneName, layout,
+            100.0 * nBlocked / rays.size(), hitRate, occludedRate, occludedRate / hitRate, mismatches);
+}
+
+int main(int argc, const char * argv[]) {
+    lambertian mat(vec3(0.5f));
+
+    fprintf(stderr, "\n%u shadow rays\n", kNumRays);
+    fprintf(stderr, "%-9s %-12s %9s %14s %14s %10s %9s\n",
+            "scene", "bvh", "blocked", "hit() rays/s", "occluded() /s", "speedup", "mismatch");
+
+    {
+        scene world;
+        // small spheres around the origin, sparse enough to let about half
+        // the shadow rays through
+        generateSphereCloud(world, 100000, &mat, 0.1f, vec3(0.0f));
+        const std::vector<ray> rays = generateShadowRays(10.0f);
+        world.buildBVH(2);
+        benchLayout("spheres", "binary", world, rays);
+        world.buildBVH(4);
+        benchLayout("spheres", "4 wide", world, rays);
+        world.buildBVH(8);
+        benchLayout("spheres", "8 wide", world, rays);
+        world.buildBVH(4, true);
+        benchLayout("spheres", "compressed 4", world, rays);
+        world.buildDynamicBVH();
+        benchLayout("spheres", "dynamic", world, rays);
+        for (object* obj : world.objects) {
+            delete obj;
+        }
+    }
+
+    triangleMesh mesh(&mat);
+    generateBumpySphere(mesh, 512, 1024, vec3(0.0f));
+    mesh.buildBVH();
+    benchLayout("mesh", "binary", mesh, generateShadowRays(1.5f));
+
+    {
+        // 10 x 10 x 10 grid of randomly rotated mesh instances
+        std::mt19937 gen(4321);
+        std::uniform_real_distribution<float> angle(0.0f, 360.0f);
+        scene forest;
+        for (int x = 0; x < 10; x++) {
+            for (int y = 0; y < 10; y++) {
+                for (int z = 0; z < 10; z++) {
+                    const transform t = transform::translate(vec3(3.0f * x - 13.5f, 3.0f * y - 13.5f, 3.0f * z - 13.5f)) *
+                                        transform::rotate(vec3(0.0f, 1.0f, 0.0f), angle(gen));
+                    forest.objects.emplace_back(new instance(&mesh, t));
+                }
+            }
+        }
+        forest.buildBVH();
+        benchLayout("instances", "4 wide", forest, generateShadowRays(15.0f));
+        for (object* obj : forest.objects) {
+            delete obj;
+        }
+    }
+
+    return 0;
+}
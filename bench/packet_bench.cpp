@@ -0,0 +1,209 @@
+//
+//  packet_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 10/6/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Camera rays / second traced one at a time vs in packets of 4, 8 and 16
+//  (over blocks of pixels), on a sphere scene and a triangle mesh, checking
+//  packets find the same hits. Then whole renders with and without packets,
+//  counting pixels that differ (none, unless built with FMA).
+//  (build with make SIMD=avx2 to get native 8 wide packet chunks)
+//
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include "renderer.hpp"
+#include "benchutil.hpp"
+
+constexpr int kImageWidth = 512;
+constexpr int kImageHeight = 512;
+
+// one jittered camera ray per pixel, row major
+std::vector<ray> generateCameraRays(float vfov)
+{
+    camera cam(vfov, (float)kImageWidth / (float)kImageHeight);
+    std::mt19937 gen(5678);
+    std::uniform_real_distribution<float> distr;
+    independentSampler smp;
+    std::vector<ray> rays(kImageWidth * kImageHeight);
+    for (int j = 0; j < kImageHeight; j++) {
+        for (int i = 0; i < kImageWidth; i++) {
+            const float u = (i + distr(gen)) / kImageWidth;
+            const float v = (j + distr(gen)) / kImageHeight;
+            rays[j * kImageWidth + i] = cam.getRayAt(u, v, smp);
+        }
+    }
+    return rays;
+}
+
+// closest hit distance per ray (FLT_MAX: missed)
+typedef std::vector<float> hitDistances;
+
+// every ray on its own, returns rays / second
+double traceSingle(const object& world, const std::vector<ray>& rays, hitDistances& hits, double minSeconds)
+{
+    hits.assign(rays.size(), FLT_MAX);
+    intersectParams rec;
+    uint64_t nTraced = 0;
+    auto start = benchClock::now();
+    double elapsed = 0.0;
+    do {
+        for (size_t i = 0; i < rays.size(); i++) {
+            if (world.hit(rays[i], minHitDistance, FLT_MAX, rec)) {
+                hits[i] = rec.t;
+            }
+        }
+        nTraced += rays.size();
+        elapsed = std::chrono::duration<double>(benchClock::now() - start).count();
+    } while (elapsed < minSeconds);
+    return nTraced / elapsed;
+}
+
+// packets of N rays over blocks of pixels (as in traceInto()),
+// returns rays / second
+template <int N>
+double tracePackets(const object& world, const std::vector<ray>& rays, hitDistances& hits, double minSeconds)
+{
+    const int blockWidth = N == 4 ? 2 : 4;
+    const int blockHeight = N / blockWidth;
+    hits.assign(rays.size(), FLT_MAX);
+    rayPacket<N> packet;
+    intersectParams rec[N];
+    uint64_t nTraced = 0;
+    auto start = benchClock::now();
+    double elapsed = 0.0;
+    do {
+        for (int by = 0; by < kImageHeight; by += blockHeight) {
+            for (int bx = 0; bx < kImageWidth; bx += blockWidth) {
+                packet.tMin = minHitDistance;
+                for (int lane = 0; lane < N; lane++) {
+                    const int idx = (by + lane / blockWidth) * kImageWidth + bx + lane % blockWidth;
+                    packet.setRay(lane, rays[idx]);
+                    packet.tMax[lane] = FLT_MAX;
+                }
+                const uint32_t hitLanes = world.hitPacket(packet, rayPacket<N>::kAllLanes, rec);
+                for (uint32_t bits = hitLanes; bits; bits &= bits - 1) {
+                    const int lane = __builtin_ctz(bits);
+                    hits[(by + lane / blockWidth) * kImageWidth + bx + lane % blockWidth] = rec[lane].t;
+                }
+            }
+        }
+        nTraced += rays.size();
+        elapsed = std::chrono::duration<double>(benchClock::now() - start).count();
+    } while (elapsed < minSeconds);
+    return nTraced / elapsed;
+}
+
+// closest hits of packets vs single rays (see countMismatches())
+// Without FMA packets round exactly like single rays. With it (make
+// SIMD=avx2) SIMD and scalar math round differently, and a few rays
+// grazing sphere silhouettes can go from hit to miss.
+constexpr float kHitTolerance = 1e-3f;
+
+void benchScene(const char *name, const object& world, const object& wideWorld, const std::vector<ray>& rays)
+{
+    hitDistances reference, hits;
+    const double binaryRate = traceSingle(world, rays, reference, 1.0);
+    fprintf(stderr, "%-8s %-14s %12.0f %9.2fx %9s\n", name, "single binary", binaryRate, 1.0, "-");
+    if (&wideWorld != &world) {
+        const double wideRate = traceSingle(wideWorld, rays, hits, 1.0);
+        fprintf(stderr, "%-8s %-14s %12.0f %9.2fx %9u\n", name, "single wide", wideRate,
+                wideRate / binaryRate, countMismatches(reference, hits, kHitTolerance));
+    }
+
+    const double rate4 = tracePackets<4>(world, rays, hits, 1.0);
+    fprintf(stderr, "%-8s %-14s %12.0f %9.2fx %9u\n", name, "packet 4", rate4,
+            rate4 / binaryRate, countMismatches(reference, hits, kHitTolerance));
+    const double rate8 = tracePackets<8>(world, rays, hits, 1.0);
+    fprintf(stderr, "%-8s %-14s %12.0f %9.2fx %9u\n", name, "packet 8", rate8,
+            rate8 / binaryRate, countMismatches(reference, hits, kHitTolerance));
+    const double rate16 = tracePackets<16>(world, rays, hits, 1.0);
+    fprintf(stderr, "%-8s %-14s %12.0f %9.2fx %9u\n", name, "packet 16", rate16,
+            rate16 / binaryRate, countMismatches(reference, hits, kHitTolerance));
+}
+
+// small mix of all the materials, as in the main scene
+void generateRenderScene(scene& world)
+{
+    world.objects.emplace_back(new triangle(vec3(-3.0f, 0.0f, -3.0f),
+                                            vec3( 3.0f, 1.0f, -2.0f),
+                                            vec3(-2.0f, 2.0f, -1.5f),
+                                            new metal(vec3(0.8, 0.1, 0.5))));
+    world.objects.emplace_back(new sphere(vec3(0.0f, 0.0f, -1.0f), 0.5f,
+                                          new metal(vec3(0.1, 0.2, 0.5))));
+    world.objects.emplace_back(new sphere(vec3(-1.0f, 0.0f, -1.0f), 0.5f,
+                                          new dielectric(1.5)));
+    world.objects.emplace_back(new sphere(vec3(1.0f, 0.0f, -2.0f), 0.6f,
+                                          new metal(vec3(0.8, 0.8, 0.8), 0.9f)));
+    world.objects.emplace_back(new sphere(vec3(0.0f, -100.5f, -1.0f), 100.0f,
+                                          new lambertian(vec3(0.5f))));
+    world.buildBVH();
+}
+
+int main(int argc, const char * argv[]) {
+    lambertian mat(vec3(0.5f));
+
+    fprintf(stderr, "\n%d x %d camera rays\n", kImageWidth, kImageHeight);
+    fprintf(stderr, "%-8s %-14s %12s %10s %9s\n", "scene", "tracing", "rays/s", "speedup", "mismatch");
+
+    {
+        scene binary;
+        generateSphereCloud(binary, 100000, &mat);
+        binary.buildBVH(2);
+        scene wide;
+        wide.objects = binary.objects;
+        wide.buildBVH();
+        benchScene("spheres", binary, wide, generateCameraRays(30.0f));
+        for (object* obj : binary.objects) {
+            delete obj;
+        }
+    }
+
+    {
+        triangleMesh mesh(&mat);
+        generateBumpySphere(mesh, 512, 1024, vec3(0.0f, 0.0f, -3.0f), 1.0f, 0.05f);
+        mesh.buildBVH();
+        benchScene("mesh", mesh, mesh, generateCameraRays(20.0f));
+    }
+
+    // whole renders: only camera rays go in packets, bounces don't
+    {
+        scene world;
+        generateRenderScene(world);
+        renderSettings settings;
+        settings.nSamples = 16;
+        settings.seed = 7;
+        settings.nThreads = 1;
+        camera cam(50.0f, (float)settings.width / (float)settings.height);
+        threadPool pool(settings.nThreads);
+
+        const uint32_t nPixels = settings.width * settings.height;
+        std::vector<PixelRGBA> reference(nPixels), image(nPixels);
+        fprintf(stderr, "\n%u x %u render, %u spp, 1 thread\n", settings.width, settings.height, settings.nSamples);
+        fprintf(stderr, "%-10s %12s %10s %12s\n", "packet", "time (ms)", "speedup", "pixels diff");
+        double baseMs = 0.0;
+        const uint32_t packetSizes[] = { 0, 4, 8, 16 };
+        for (uint32_t packetSize : packetSizes) {
+            settings.packetSize = packetSize;
+            std::vector<PixelRGBA>& target = packetSize ? image : reference;
+            auto start = benchClock::now();
+            traceInto(target.data(), settings, world, cam, pool);
+            const double ms = std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+            if (packetSize == 0) {
+                baseMs = ms;
+            }
+            uint32_t nDifferent = 0;
+            for (uint32_t i = 0; i < nPixels; i++) {
+                if (memcmp(&reference[i], &target[i], sizeof(PixelRGBA))) {
+                    nDifferent++;
+                }
+            }
+            fprintf(stderr, "%-10u %12.1f %9.2fx %12u\n", packetSize, ms, baseMs / ms, nDifferent);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+//
+//  policy_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 10/28/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Every combination of the triangle, mesh and sphere policies (see
+//  triangle.hpp, mesh.hpp, sphere.hpp), built into this one binary:
+//  closest hit and occlusion rays / second of a triangle soup, a bumpy
+//  sphere mesh and a sphere cloud. Checks every intersector / solver finds
+//  the same hits as the default one with the same back face handling.
+//
+
+#include <cstdio>
+#include <random>
+#include "benchutil.hpp"
+
+constexpr uint32_t kNumRays = 200000;
+
+// results of the occlusion tests go here, so they can't be optimized away
+volatile bool gSink;
+
+// Closest hit / occlusion rays per second of world, and how many rays
+// don't find the reference hit (same closest t up to rounding, both
+// tests agreeing). Prints a row, returns the closest hit rate.
+template <typename World>
+double benchWorld(const char *name,
+                  const char *variant,
+                  const World& world,
+                  const std::vector<ray>& rays,
+                  const std::vector<float>& reference,
+                  double baseRate)
+{
+    const std::vector<float> ts = closestHits(world, rays);
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < rays.size(); i++) {
+        if (!sameHitT(ts[i], reference[i]) || world.occluded(rays[i], 0.0001f, FLT_MAX) != (ts[i] < FLT_MAX)) {
+            mismatches++;
+        }
+    }
+
+    const double rate = measureRaysPerSecond(world, rays);
+    const double occludedRate = measureRaysPerSecond(rays, [&](const ray& r) {
+        gSink = world.occluded(r, 0.0001f, FLT_MAX);
+    }, 1.0);
+    fprintf(stderr, "%-14s %-38s %13.0f %7.2fx %13.0f %9u\n", name, variant,
+            rate, baseRate > 0.0 ? rate / baseRate : 1.0, occludedRate, mismatches);
+    return rate;
+}
+
+struct soupTriangle
+{
+    vec3 v0, v1, v2;
+};
+
+// one triangle object per face, in a scene BVH
+template <typename triangleT>
+double benchTriangles(const char *variant,
+                      const std::vector<soupTriangle>& tris,
+                      const std::vector<ray>& rays,
+                      std::vector<float>& reference,
+                      double baseRate)
+{
+    lambertian mat(vec3(0.5f));
+    scene world;
+    for (const soupTriangle& tri : tris) {
+        world.objects.emplace_back(new triangleT(tri.v0, tri.v1, tri.v2, &mat));
+    }
+    world.buildBVH();
+    if (reference.empty()) {
+        reference = closestHits(world, rays);
+    }
+    const double rate = benchWorld("triangle soup", variant, world, rays, reference, baseRate);
+    for (object* obj : world.objects) {
+        delete obj;
+    }
+    return rate;
+}
+
+template <typename meshT>
+double benchMesh(const char *variant,
+                 const triangleMesh& source,
+                 const std::vector<ray>& rays,
+                 std::vector<float>& reference,
+                 double baseRate)
+{
+    meshT mesh;
+    mesh.px = source.px;
+    mesh.py = source.py;
+    mesh.pz = source.pz;
+    mesh.indices = source.indices;
+    mesh.buildBVH();
+    if (reference.empty()) {
+        reference = closestHits(mesh, rays);
+    }
+    return benchWorld("bumpy sphere", variant, mesh, rays, reference, baseRate);
+}
+
+template <typename sphereT>
+double benchSpheres(const char *variant,
+                    const std::vector<vec3>& centers,
+                    const std::vector<ray>& rays,
+                    std::vector<float>& reference,
+                    double baseRate)
+{
+    lambertian mat(vec3(0.5f));
+    scene world;
+    const float radius = sphereCloudRadius((uint32_t)centers.size(), 0.3f);
+    for (const vec3& c : centers) {
+        world.objects.emplace_back(new sphereT(c, radius, &mat));
+    }
+    world.buildBVH();
+    if (reference.empty()) {
+        reference = closestHits(world, rays);
+    }
+    const double rate = benchWorld("sphere cloud", variant, world, rays, reference, baseRate);
+    for (object* obj : world.objects) {
+        delete obj;
+    }
+    return rate;
+}
+
+int main(int argc, const char * argv[]) {
+    typedef mollerTrumboreIntersector mt;
+    typedef insideOutsideIntersector io;
+
+    fprintf(stderr, "\n%u camera rays, speedups vs the default policies (first row of each)\n", kNumRays);
+    fprintf(stderr, "%-14s %-38s %13s %8s %13s %9s\n", "objects", "policies", "closest/s", "", "occluded/s", "mismatch");
+
+    {
+        // reference: Moller Trumbore with the same back face handling
+        const std::vector<ray> rays = generateRays(kNumRays, 20.0f);
+        const std::vector<vec3> centers = generatePoints(200000);
+        std::mt19937 gen(4321);
+        std::uniform_real_distribution<float> offset(-0.3f, 0.3f);
+        std::vector<soupTriangle> tris(centers.size());
+        for (uint32_t i = 0; i < tris.size(); i++) {
+            tris[i].v0 = centers[i] + vec3(offset(gen), offset(gen), offset(gen));
+            tris[i].v1 = centers[i] + vec3(offset(gen), offset(gen), offset(gen));
+            tris[i].v2 = centers[i] + vec3(offset(gen), offset(gen), offset(gen));
+        }
+        std::vector<float> culled, twoSided;
+        const double base = benchTriangles<triangle>("moller trumbore, culled, parametric", tris, rays, culled, 0.0);
+        benchTriangles<basicTriangle<mt, cullBackFaces, planeNormal>>("moller trumbore, culled, plane", tris, rays, culled, base);
+        benchTriangles<basicTriangle<mt, twoSidedFaces, parametricNormal>>("moller trumbore, two sided, parametric", tris, rays, twoSided, base);
+        benchTriangles<basicTriangle<mt, twoSidedFaces, planeNormal>>("moller trumbore, two sided, plane", tris, rays, twoSided, base);
+        benchTriangles<basicTriangle<io, cullBackFaces, parametricNormal>>("inside-outside, culled, parametric", tris, rays, culled, base);
+        benchTriangles<basicTriangle<io, cullBackFaces, planeNormal>>("inside-outside, culled, plane", tris, rays, culled, base);
+        benchTriangles<basicTriangle<io, twoSidedFaces, parametricNormal>>("inside-outside, two sided, parametric", tris, rays, twoSided, base);
+        benchTriangles<basicTriangle<io, twoSidedFaces, planeNormal>>("inside-outside, two sided, plane", tris, rays, twoSided, base);
+    }
+
+    {
+        const std::vector<ray> rays = generateRays(kNumRays, 20.0f);
+        triangleMesh source;
+        generateBumpySphere(source, 256, 512);
+        std::vector<float> culled, twoSided;
+        const double base = benchMesh<triangleMesh>("moller trumbore, two sided", source, rays, twoSided, 0.0);
+        benchMesh<basicTriangleMesh<mt, cullBackFaces>>("moller trumbore, culled", source, rays, culled, base);
+        benchMesh<basicTriangleMesh<io, twoSidedFaces>>("inside-outside, two sided", source, rays, twoSided, base);
+        benchMesh<basicTriangleMesh<io, cullBackFaces>>("inside-outside, culled", source, rays, culled, base);
+    }
+
+    {
+        const std::vector<ray> rays = generateRays(kNumRays, 20.0f);
+        const std::vector<vec3> centers = generatePoints(100000);
+        std::vector<float> reference;
+        const double base = benchSpheres<sphere>("quadratic roots", centers, rays, reference, 0.0);
+        benchSpheres<basicSphere<shirleyRoots>>("shirley roots", centers, rays, reference, base);
+    }
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+//
+//  render_scaling_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 7/21/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Tile renderer scaling over thread counts, and check that the
+//  image is bit identical to the single threaded one for a fixed seed
+//
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include "renderer.hpp"
+#include "sphere.hpp"
+#include "triangle.hpp"
+
+typedef std::chrono::steady_clock benchClock;
+
+// small mix of all the materials, as in the main scene
+void generateBenchScene(scene& world)
+{
+    world.objects.emplace_back(new triangle(vec3(-3.0f, 0.0f, -3.0f),
+                                            vec3( 3.0f, 1.0f, -2.0f),
+                                            vec3(-2.0f, 2.0f, -1.5f),
+                                            new metal(vec3(0.8, 0.1, 0.5))));
+    world.objects.emplace_back(new sphere(vec3(0.0f, 0.0f, -1.0f), 0.5f,
+                                          new metal(vec3(0.1, 0.2, 0.5))));
+    world.objects.emplace_back(new sphere(vec3(-1.0f, 0.0f, -1.0f), 0.5f,
+                                          new dielectric(1.5)));
+    world.objects.emplace_back(new sphere(vec3(1.0f, 0.0f, -2.0f), 0.6f,
+                                          new metal(vec3(0.8, 0.8, 0.8), 0.9f)));
+    world.objects.emplace_back(new sphere(vec3(0.0f, -100.5f, -1.0f), 100.0f,
+                                          new lambertian(vec3(0.5f))));
+    world.buildBVH();
+}
+
+double renderMs(std::vector<PixelRGBA>& image,
+                const renderSettings& settings,
+                scene& world,
+                camera& cam)
+{
+    threadPool pool(settings.nThreads);
+    auto start = benchClock::now();
+    traceInto(image.data(), settings, world, cam, pool);
+    return std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+}
+
+int main(int argc, const char * argv[]) {
+    scene world;
+    generateBenchScene(world);
+
+    renderSettings settings;
+    settings.nSamples = 32;
+    settings.seed = 7;
+    camera cam(50.0f, (float)settings.width / (float)settings.height);
+
+    const uint32_t nPixels = settings.width * settings.height;
+    std::vector<PixelRGBA> reference(nPixels), image(nPixels);
+    settings.nThreads = 1;
+    const double singleMs = renderMs(reference, settings, world, cam);
+
+    const uint32_t hwThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<uint32_t> threadCounts;
+    for (uint32_t n = 1; n < hwThreads; n *= 2) {
+        threadCounts.push_back(n);
+    }
+    threadCounts.push_back(hwThreads);
+    // oversubscribed, exercises stealing even on small machines
+    threadCounts.push_back(2 * hwThreads);
+
+    fprintf(stderr, "\n%u x %u, %u spp, %u hardware threads\n",
+            settings.width, settings.height, settings.nSamples, hwThreads);
+    fprintf(stderr, "%8s %6s %12s %10s %12s %10s\n",
+            "threads", "tile", "time (ms)", "speedup", "efficiency", "identical");
+    const uint32_t tileSizes[] = { 8, 16, 32 };
+    for (uint32_t nThreads : threadCounts) {
+        for (uint32_t tileSize : tileSizes) {
+            settings.nThreads = nThreads;
+            settings.tileSize = tileSize;
+            const double ms = renderMs(image, settings, world, cam);
+            const bool identical = !memcmp(image.data(), reference.data(),
+                                           nPixels * sizeof(PixelRGBA));
+            fprintf(stderr, "%8u %6u %12.1f %9.2fx %11.0f%% %10s\n",
+                    nThreads, tileSize, ms, singleMs / ms,
+                    100.0 * singleMs / ms / std::min(nThreads, hwThreads),
+                    identical ? "yes" : "NO");
+        }
+    }
+
+    return 0;
+}
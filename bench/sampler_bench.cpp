@@ -0,0 +1,106 @@
+//
+//  sampler_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 7/28/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Error vs samples per pixel for each sampler on the bundled snapshots,
+//  and the spp each sampler needs to match independent sampling's error
+//
+
+#include <cstdio>
+#include <cmath>
+#include "renderer.hpp"
+#include "scenes.hpp"
+
+// RMS error against the reference, on [0, 1] clamped (displayable) values
+double rmse(const std::vector<vec3>& image, const std::vector<vec3>& reference)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < image.size(); i++) {
+        for (int c = 0; c < 3; c++) {
+            const double d = std::min(image[i][c], 1.0f) - std::min(reference[i][c], 1.0f);
+            sum += d * d;
+        }
+    }
+    return sqrt(sum / (3.0 * image.size()));
+}
+
+void render(std::vector<vec3>& radiance,
+            renderSettings settings,
+            scene& world,
+            camera& cam,
+            threadPool& pool)
+{
+    std::vector<PixelRGBA> rgba(settings.width * settings.height);
+    traceInto(rgba.data(), settings, world, cam, pool, nullptr, radiance.data());
+}
+
+int main(int argc, const char * argv[]) {
+    scene world;
+    generateScene(world);
+    world.buildBVH();
+
+    renderSettings settings;
+    settings.width = 200;
+    settings.height = 100;
+    const uint32_t referenceSpp = argc > 1 ? (uint32_t)atoi(argv[1]) : 1024;
+    const uint32_t testSpp[] = { 4, 8, 16, 32, 64 };
+    const uint32_t nTests = sizeof(testSpp) / sizeof(testSpp[0]);
+    const samplerType samplers[] = { kIndependentSampler, kStratifiedSampler,
+                                     kSobolSampler, kBlueNoiseSampler };
+
+    threadPool pool;
+    std::vector<snapshot> snapshots = generateSnapshots((float)settings.width / (float)settings.height);
+    std::vector<vec3> reference(settings.width * settings.height);
+    std::vector<vec3> image(settings.width * settings.height);
+
+    for (snapshot& snap : snapshots) {
+        fprintf(stderr, "\n%s (%d x %d, reference %u spp)\n",
+                snap.label.c_str(), settings.width, settings.height, referenceSpp);
+
+        renderSettings refSettings = settings;
+        refSettings.nSamples = referenceSpp;
+        refSettings.seed = 12345;
+        render(reference, refSettings, world, snap.cam, pool);
+
+        fprintf(stderr, "%12s", "RMSE @ spp");
+        for (uint32_t spp : testSpp) {
+            fprintf(stderr, " %9u", spp);
+        }
+        fprintf(stderr, " %14s %9s\n", "equal err spp", "saving");
+
+        double independentError = 0.0;
+        for (samplerType type : samplers) {
+            double errors[nTests];
+            fprintf(stderr, "%12s", samplerName(type));
+            for (uint32_t t = 0; t < nTests; t++) {
+                renderSettings testSettings = settings;
+                testSettings.nSamples = testSpp[t];
+                testSettings.sampling = type;
+                render(image, testSettings, world, snap.cam, pool);
+                errors[t] = rmse(image, reference);
+                fprintf(stderr, " %9.5f", errors[t]);
+            }
+
+            // spp at which this sampler reaches the error independent
+            // sampling has at the highest spp (log-log interpolation)
+            if (type == kIndependentSampler) {
+                independentError = errors[nTests - 1];
+            }
+            double equalSpp = testSpp[nTests - 1];
+            for (uint32_t t = 1; t < nTests; t++) {
+                if (errors[t] <= independentError || t == nTests - 1) {
+                    const double slope = log(errors[t] / errors[t - 1]) /
+                                         log((double)testSpp[t] / testSpp[t - 1]);
+                    equalSpp = testSpp[t] * pow(independentError / errors[t], 1.0 / slope);
+                    break;
+                }
+            }
+            fprintf(stderr, " %14.1f %8.2fx\n", equalSpp, testSpp[nTests - 1] / equalSpp);
+        }
+    }
+
+    return 0;
+}
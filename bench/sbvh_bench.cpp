@@ -0,0 +1,255 @@
+//
+//  sbvh_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 9/1/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Plain SAH vs spatial split (SBVH) builds: references, SAH cost, nodes
+//  visited and primitives tested per ray, rays / second, on scenes with
+//  long slanted triangles (scene objects and an indexed mesh)
+//
+
+#include <cstdio>
+#include <random>
+#include "benchutil.hpp"
+#include "triangle.hpp"
+#include "scenes.hpp"
+
+// long thin triangles in random directions through a 10 x 10 x 10 box
+// centered at <0, 0, -10> (think grass blades, hair, debris), each one
+// spanning a good part of the box so their bounds overlap heavily
+void generateSlivers(scene& world, uint32_t nSlivers, material* mat)
+{
+    std::mt19937 gen(2468);
+    std::uniform_real_distribution<float> pos(-5.0f, 5.0f);
+    std::uniform_real_distribution<float> dir(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> len(2.0f, 6.0f);
+    const vec3 center(0.0f, 0.0f, -10.0f);
+    for (uint32_t i = 0; i < nSlivers; i++) {
+        const vec3 a = center + vec3(pos(gen), pos(gen), pos(gen));
+        const vec3 d = unit_vector(vec3(dir(gen), dir(gen), dir(gen)));
+        const vec3 side = 0.05f * unit_vector(cross(d, vec3(dir(gen), dir(gen), dir(gen))));
+        const vec3 b = a + len(gen) * d;
+        world.objects.emplace_back(new triangle(a, b, a + side, mat));
+    }
+}
+
+// big slanted triangles cutting through a cloud of small spheres in a
+// 20 x 20 x 20 box centered at <0, 0, -20> (walls / ramps among clutter)
+void generatePanelsAndSpheres(scene& world, uint32_t nPanels, uint32_t nSpheres, material* mat)
+{
+    std::mt19937 gen(1357);
+    std::uniform_real_distribution<float> pos(-10.0f, 10.0f);
+    const vec3 center(0.0f, 0.0f, -20.0f);
+    for (uint32_t i = 0; i < nPanels; i++) {
+        world.objects.emplace_back(new triangle(center + vec3(pos(gen), pos(gen), pos(gen)),
+                                                center + vec3(pos(gen), pos(gen), pos(gen)),
+                                                center + vec3(pos(gen), pos(gen), pos(gen)),
+                                                mat));
+    }
+    const float radius = sphereCloudRadius(nSpheres, 0.25f);
+    for (uint32_t i = 0; i < nSpheres; i++) {
+        world.objects.emplace_back(new sphere(center + vec3(pos(gen), pos(gen), pos(gen)), radius, mat));
+    }
+}
+
+// cylinder of radius 1 along a slanted axis, nSegments around and only
+// a few rings long, so every face is a long sliver at an angle
+void generateSlantedCylinder(triangleMesh& mesh, uint32_t nRings, uint32_t nSegments)
+{
+    const vec3 base(-3.0f, -3.0f, -12.0f);
+    const vec3 axis = vec3(6.0f, 6.0f, 4.0f);
+    const vec3 u = unit_vector(cross(axis, vec3(0.0f, 0.0f, 1.0f)));
+    const vec3 v = unit_vector(cross(axis, u));
+    for (uint32_t i = 0; i <= nRings; i++) {
+        for (uint32_t j = 0; j < nSegments; j++) {
+            const float phi = 2.0f * (float)M_PI * j / nSegments;
+            mesh.addVertex(base + (float)i / nRings * axis + cos(phi) * u + sin(phi) * v);
+        }
+    }
+    for (uint32_t i = 0; i < nRings; i++) {
+        for (uint32_t j = 0; j < nSegments; j++) {
+            const uint32_t a = i * nSegments + j;
+            const uint32_t b = i * nSegments + (j + 1) % nSegments;
+            mesh.addTriangle(a, a + nSegments, b);
+            mesh.addTriangle(b, a + nSegments, b + nSegments);
+        }
+    }
+}
+
+// same walk as bvhTree::traverse(), counting nodes visited (boxes tested)
+// and primitives tested
+template <typename Intersector>
+void countSteps(const bvhTree& tree,
+                const ray& r,
+                Intersector intersect,
+                uint64_t& nNodes,
+                uint64_t& nPrims)
+{
+    const rayInv rInv(r);
+    float t_min = 0.0001f, t_max = FLT_MAX;
+    uint32_t stack[bvhTree::kStackSize];
+    uint32_t stackPtr = 0;
+    uint32_t current = 0;
+    while (true) {
+        const bvhNode& node = tree.nodes[current];
+        nNodes++;
+        if (node.bounds.hit(rInv, t_min, t_max)) {
+            if (node.isLeaf()) {
+                for (uint32_t i = 0; i < node.nPrims; i++) {
+                    nPrims++;
+                    intersect(tree.primIndices[node.offset + i], r, t_min, t_max);
+                }
+                if (stackPtr == 0) {
+                    break;
+                }
+                current = stack[--stackPtr];
+            } else if (rInv.dirIsNeg[node.axis]) {
+                stack[stackPtr++] = current + 1;
+                current = node.offset;
+            } else {
+                stack[stackPtr++] = node.offset;
+                current = current + 1;
+            }
+        } else {
+            if (stackPtr == 0) {
+                break;
+            }
+            current = stack[--stackPtr];
+        }
+    }
+}
+
+void printHeader()
+{
+    fprintf(stderr, "\n%-18s %8s %-6s %10s %9s %9s %11s %11s %12s %9s %9s\n",
+            "scene", "prims", "build", "build (ms)", "refs/prim", "SAH cost",
+            "nodes/ray", "prims/ray", "rays/s", "speedup", "mismatch");
+}
+
+// scene of objects: SAH vs SBVH on the binary tree
+void compareScene(const char *name, scene& world, const std::vector<ray>& rays)
+{
+    const bvhBuilder builders[] = { kSAHBuilder, kSpatialSplitBuilder };
+    double sahRate = 0.0;
+    std::vector<float> sahHits(rays.size());
+    for (bvhBuilder builder : builders) {
+        auto start = benchClock::now();
+        world.buildBVH(2, false, builder);
+        const double buildMs = std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+
+        uint64_t nNodes = 0, nPrims = 0;
+        intersectParams rec;
+        for (const ray& r : rays) {
+            countSteps(world.accel, r,
+                       [&](uint32_t idx, const ray& r, float t_min, float& t_max) {
+                           if (world.bvhObjects[idx]->hit(r, t_min, t_max, rec)) {
+                               t_max = rec.t;
+                           }
+                       },
+                       nNodes, nPrims);
+        }
+        const double rate = measureRaysPerSecond(world, rays);
+
+        uint32_t mismatches = 0;
+        for (size_t i = 0; i < rays.size(); i++) {
+            const float t = world.hit(rays[i], 0.0001f, FLT_MAX, rec) ? rec.t : FLT_MAX;
+            if (builder == kSAHBuilder) {
+                sahHits[i] = t;
+                sahRate = rate;
+            } else if (!sameHitT(t, sahHits[i])) {
+                mismatches++;
+            }
+        }
+
+        fprintf(stderr, "%-18s %8zu %-6s %10.1f %9.2f %9.1f %11.1f %11.1f %12.0f %8.2fx %9u\n",
+                name, world.bvhObjects.size(), builder == kSAHBuilder ? "SAH" : "SBVH", buildMs,
+                (double)world.accel.primIndices.size() / world.bvhObjects.size(), world.accel.sahCost(),
+                (double)nNodes / rays.size(), (double)nPrims / rays.size(),
+                rate, rate / sahRate, mismatches);
+    }
+}
+
+// indexed mesh: SAH vs SBVH on the mesh's own BVH
+void compareMesh(const char *name, triangleMesh& mesh, const std::vector<ray>& rays)
+{
+    double sahRate = 0.0;
+    std::vector<float> sahHits(rays.size());
+    for (int spatial = 0; spatial < 2; spatial++) {
+        auto start = benchClock::now();
+        mesh.buildBVH(spatial != 0);
+        const double buildMs = std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+
+        uint64_t nNodes = 0, nPrims = 0;
+        for (const ray& r : rays) {
+            countSteps(mesh.accel, r,
+                       [&](uint32_t face, const ray& r, float t_min, float& t_max) {
+                           const vec3 v0 = mesh.position(mesh.indices[3 * face]);
+                           float t, u, v;
+                           if (mollerTrumbore(r, v0,
+                                              mesh.position(mesh.indices[3 * face + 1]) - v0,
+                                              mesh.position(mesh.indices[3 * face + 2]) - v0,
+                                              false, t_min, t_max, t, u, v)) {
+                               t_max = t;
+                           }
+                       },
+                       nNodes, nPrims);
+        }
+        intersectParams rec;
+        const double rate = measureRaysPerSecond(mesh, rays);
+
+        uint32_t mismatches = 0;
+        for (size_t i = 0; i < rays.size(); i++) {
+            const float t = mesh.hit(rays[i], 0.0001f, FLT_MAX, rec) ? rec.t : FLT_MAX;
+            if (!spatial) {
+                sahHits[i] = t;
+                sahRate = rate;
+            } else if (!sameHitT(t, sahHits[i])) {
+                mismatches++;
+            }
+        }
+
+        fprintf(stderr, "%-18s %8u %-6s %10.1f %9.2f %9.1f %11.1f %11.1f %12.0f %8.2fx %9u\n",
+                name, mesh.numTriangles(), spatial ? "SBVH" : "SAH", buildMs,
+                (double)mesh.accel.primIndices.size() / mesh.numTriangles(), mesh.accel.sahCost(),
+                (double)nNodes / rays.size(), (double)nPrims / rays.size(),
+                rate, rate / sahRate, mismatches);
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    lambertian mat(vec3(0.5f));
+    const uint32_t nRays = 100000;
+    camera cam(40.0f, 1.0f);
+
+    printHeader();
+
+    {
+        // the default render scene, hovering triangle included
+        scene world;
+        generateScene(world);
+        compareScene("default scene", world, generateRays(camera(50.0f, 2.0f), nRays));
+    }
+
+    const uint32_t sliverCounts[] = { 10000, 100000 };
+    for (uint32_t nSlivers : sliverCounts) {
+        scene world;
+        generateSlivers(world, nSlivers, &mat);
+        compareScene("slivers", world, generateRays(cam, nRays));
+    }
+
+    {
+        scene world;
+        generatePanelsAndSpheres(world, 100, 100000, &mat);
+        compareScene("panels + spheres", world, generateRays(camera(30.0f, 1.0f), nRays));
+    }
+
+    {
+        triangleMesh mesh(&mat);
+        generateSlantedCylinder(mesh, 4, 20000);
+        compareMesh("slanted cylinder", mesh, generateRays(cam, nRays));
+    }
+
+    return 0;
+}
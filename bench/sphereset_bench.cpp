@@ -0,0 +1,145 @@
+//
+//  sphereset_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 10/24/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Closest hit and occlusion rays / second of sphere objects under the
+//  scene BVH vs one sphereSet with every batch kernel this CPU has
+//  (scalar, SSE, AVX2, AVX-512), on a particle cloud and the book's final
+//  scene (many small spheres on a big one). Checks every kernel finds the
+//  same hits as sphere::hit().
+//
+//  The BVH can't stand in for sphere::hit() on every ray: a ray passing
+//  far from a small sphere can get a (false) root from the quadratic's
+//  float cancellation, just outside the sphere, and so outside its box.
+//  The BVH culls the box, the kernels (which test every sphere of a batch)
+//  don't. Rays where a kernel and the BVH disagree are checked again
+//  against all the spheres, with no boxes.
+//
+
+#include <cstdio>
+#include "benchutil.hpp"
+#include "sphereset.hpp"
+
+constexpr uint32_t kNumRays = 200000;
+
+// results of the occlusion tests go here, so they can't be optimized away
+volatile bool gSink;
+
+// closest hit of r over every object, without the BVH
+bool hitEveryObject(const scene& world, const ray& r, intersectParams& rec)
+{
+    primitiveHit h;
+    float closest = FLT_MAX;
+    bool didHit = false;
+    for (const object* obj : world.objects) {
+        if (obj->closestHit(r, 0.0001f, closest, h)) {
+            closest = h.t;
+            didHit = true;
+        }
+    }
+    if (didHit) {
+        completeHit(r, h, rec);
+    }
+    return didHit;
+}
+
+void benchScene(const char *name, const std::vector<vec3>& centers, const std::vector<float>& radii, camera& cam)
+{
+    lambertian mat(vec3(0.5f));
+    scene world;
+    sphereSet spheres;
+    for (uint32_t i = 0; i < centers.size(); i++) {
+        world.objects.emplace_back(new sphere(centers[i], radii[i], &mat));
+        spheres.addSphere(centers[i], radii[i], &mat);
+    }
+    world.buildBVH();
+    spheres.build();
+
+    const std::vector<ray> rays = generateRays(cam, kNumRays);
+    std::vector<intersectParams> reference(rays.size());
+    std::vector<bool> referenceHit(rays.size());
+    for (uint32_t i = 0; i < rays.size(); i++) {
+        referenceHit[i] = world.hit(rays[i], 0.0001f, FLT_MAX, reference[i]);
+    }
+
+    const double sceneRate = measureRaysPerSecond(world, rays);
+    const double sceneOccluded = measureRaysPerSecond(rays, [&](const ray& r) {
+        gSink = world.occluded(r, 0.0001f, FLT_MAX);
+    });
+    fprintf(stderr, "%-8s %8zu %-8s %13.0f %7s %13.0f %7s %8s %11s\n", name, centers.size(), "objects",
+            sceneRate, "", sceneOccluded, "", "", "");
+
+    double scalarRate = 0.0, scalarOccluded = 0.0;
+    for (sphereKernel kernel : { kScalarSphereKernel, kSSESphereKernel, kAVX2SphereKernel, kAVX512SphereKernel }) {
+        if (!spheres.setKernel(kernel)) {
+            continue;
+        }
+        // same hits as the sphere objects (hit / miss, t and normal)?
+        uint32_t mismatches = 0;
+        float maxError = 0.0f;
+        for (uint32_t i = 0; i < rays.size(); i++) {
+            intersectParams rec;
+            const bool didHit = spheres.hit(rays[i], 0.0001f, FLT_MAX, rec);
+            bool expectHit = referenceHit[i];
+            intersectParams expected = reference[i];
+            if (didHit != expectHit || (didHit && fabsf(rec.t - expected.t) > 1e-4f * expected.t)) {
+                expectHit = hitEveryObject(world, rays[i], expected);
+            }
+            if (didHit != expectHit || spheres.occluded(rays[i], 0.0001f, FLT_MAX) != didHit) {
+                mismatches++;
+            } else if (didHit) {
+                const float error = std::max(fabsf(rec.t - expected.t) / expected.t,
+                                             (rec.normal - expected.normal).length());
+                maxError = std::max(maxError, error);
+                if (error > 1e-4f) {
+                    mismatches++;
+                }
+            }
+        }
+
+        const double rate = measureRaysPerSecond(spheres, rays);
+        const double occludedRate = measureRaysPerSecond(rays, [&](const ray& r) {
+            gSink = spheres.occluded(r, 0.0001f, FLT_MAX);
+        });
+        if (kernel == kScalarSphereKernel) {
+            scalarRate = rate;
+            scalarOccluded = occludedRate;
+        }
+        fprintf(stderr, "%-8s %8zu %-8s %13.0f %6.2fx %13.0f %6.2fx %8u %11.2g\n", name, centers.size(),
+                sphereKernelName(kernel), rate, rate / scalarRate, occludedRate, occludedRate / scalarOccluded,
+                mismatches, maxError);
+    }
+
+    for (object* obj : world.objects) {
+        delete obj;
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    fprintf(stderr, "\n%u camera rays, widest kernel here: %s (speedups vs scalar kernel)\n",
+            kNumRays, sphereKernelName(bestSphereKernel()));
+    fprintf(stderr, "%-8s %8s %-8s %13s %8s %13s %8s %8s %11s\n",
+            "scene", "spheres", "kernel", "closest/s", "", "occluded/s", "", "mismatch", "max error");
+
+    for (uint32_t nSpheres : { 10000u, 1000000u }) {
+        std::vector<vec3> centers;
+        std::vector<float> radii;
+        centers = generatePoints(nSpheres);
+        radii.assign(nSpheres, sphereCloudRadius(nSpheres, 0.3f));
+        camera cam(20.0f, 1.0f);
+        benchScene("cloud", centers, radii, cam);
+    }
+
+    for (int halfSize : { 11, 100 }) {
+        std::vector<vec3> centers;
+        std::vector<float> radii;
+        generateSphereField(centers, radii, halfSize);
+        camera cam(10.0f, 1.0f, vec3(13.0f, 2.0f, 3.0f), vec3(0.0f));
+        benchScene("field", centers, radii, cam);
+    }
+
+    return 0;
+}
@@ -0,0 +1,200 @@
+//
+//  triangle_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 10/26/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Ray / triangle tests per second of scalar Moller Trumbore (edges
+//  worked out per test, as triangle::hit() used to, and precomputed) vs
+//  packed triangle4 / triangle8 leaves, with and without back face
+//  culling, over a flat array of triangles. Then closest hit rays / second
+//  of a mesh walked face by face vs with packed 4 / 8 face leaves.
+//  Checks every variant finds the same closest hits.
+//
+
+#include <cstdio>
+#include <random>
+#include "benchutil.hpp"
+
+constexpr uint32_t kNumTriangles = 4096;
+constexpr uint32_t kNumArrayRays = 2048;
+constexpr uint32_t kNumMeshRays = 200000;
+
+// results of the array tests go here, so they can't be optimized away
+volatile float gSink;
+
+struct triangleVerts
+{
+    vec3 v0, v1, v2;
+};
+
+// small random triangles in a 2 x 2 x 2 box centered at <0, 0, -3>
+std::vector<triangleVerts> generateTriangleSoup(uint32_t n)
+{
+    std::mt19937 gen(4321);
+    std::uniform_real_distribution<float> offset(-0.1f, 0.1f);
+    const std::vector<vec3> centers = generatePoints(n, vec3(0.0f, 0.0f, -3.0f), 1.0f);
+    std::vector<triangleVerts> tris(n);
+    for (uint32_t i = 0; i < n; i++) {
+        tris[i].v0 = centers[i] + vec3(offset(gen), offset(gen), offset(gen));
+        tris[i].v1 = centers[i] + vec3(offset(gen), offset(gen), offset(gen));
+        tris[i].v2 = centers[i] + vec3(offset(gen), offset(gen), offset(gen));
+    }
+    return tris;
+}
+
+// closest t of every ray against every triangle (FLT_MAX on a miss)
+template <typename ClosestT>
+void benchArray(const char *name,
+                const std::vector<ray>& rays,
+                const std::vector<float>& reference,
+                ClosestT closestT,
+                double scalarRate)
+{
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < rays.size(); i++) {
+        if (!sameHitT(closestT(rays[i]), reference[i])) {
+            mismatches++;
+        }
+    }
+    const double rate = measureRaysPerSecond(rays, [&](const ray& r) {
+        gSink = closestT(r);
+    }, 1.0) * kNumTriangles;
+    fprintf(stderr, "%-22s %14.0f %8.2fx %9u\n", name, rate, scalarRate > 0.0 ? rate / scalarRate : 1.0, mismatches);
+}
+
+template <typename packT>
+std::vector<packT> packTriangles(const std::vector<triangleVerts>& tris)
+{
+    std::vector<packT> packs((tris.size() + packT::kWidth - 1) / packT::kWidth);
+    for (uint32_t i = 0; i < tris.size(); i++) {
+        packs[i / packT::kWidth].set(i % packT::kWidth, tris[i].v0, tris[i].v1, tris[i].v2, i);
+    }
+    return packs;
+}
+
+template <typename packT>
+float closestPackedT(const std::vector<packT>& packs, const ray& r, bool cull)
+{
+    float t_max = FLT_MAX;
+    for (const packT& pack : packs) {
+        float u, v;
+        pack.closestHit(r, cull, 0.0001f, t_max, u, v);
+    }
+    return t_max;
+}
+
+void benchTriangleArray(bool cull)
+{
+    const std::vector<triangleVerts> tris = generateTriangleSoup(kNumTriangles);
+    const std::vector<ray> rays = generateRays(kNumArrayRays, 20.0f);
+    std::vector<vec3> v0(kNumTriangles), e1(kNumTriangles), e2(kNumTriangles);
+    for (uint32_t i = 0; i < kNumTriangles; i++) {
+        v0[i] = tris[i].v0;
+        e1[i] = tris[i].v1 - tris[i].v0;
+        e2[i] = tris[i].v2 - tris[i].v0;
+    }
+    const std::vector<triangle4> packs4 = packTriangles<triangle4>(tris);
+    const std::vector<triangle8> packs8 = packTriangles<triangle8>(tris);
+
+    auto scalarEdges = [&](const ray& r) {
+        float t_max = FLT_MAX;
+        for (const triangleVerts& tri : tris) {
+            float t, u, v;
+            if (mollerTrumbore(r, tri.v0, tri.v1 - tri.v0, tri.v2 - tri.v0, cull, 0.0001f, t_max, t, u, v)) {
+                t_max = t;
+            }
+        }
+        return t_max;
+    };
+    auto scalarPrecomputed = [&](const ray& r) {
+        float t_max = FLT_MAX;
+        for (uint32_t i = 0; i < kNumTriangles; i++) {
+            float t, u, v;
+            if (mollerTrumbore(r, v0[i], e1[i], e2[i], cull, 0.0001f, t_max, t, u, v)) {
+                t_max = t;
+            }
+        }
+        return t_max;
+    };
+
+    std::vector<float> reference(rays.size());
+    uint32_t nHits = 0;
+    for (uint32_t i = 0; i < rays.size(); i++) {
+        reference[i] = scalarEdges(rays[i]);
+        nHits += reference[i] < FLT_MAX;
+    }
+    fprintf(stderr, "\n%u triangles x %u rays (%u hit), culling %s\n",
+            kNumTriangles, kNumArrayRays, nHits, cull ? "on" : "off");
+    fprintf(stderr, "%-22s %14s %9s %9s\n", "test", "triangles/s", "speedup", "mismatch");
+
+    const double scalarRate = measureRaysPerSecond(rays, [&](const ray& r) {
+        gSink = scalarEdges(r);
+    }, 1.0) * kNumTriangles;
+    fprintf(stderr, "%-22s %14.0f %8.2fx %9u\n", "scalar, edges per test", scalarRate, 1.0, 0u);
+    benchArray("scalar, precomputed", rays, reference, scalarPrecomputed, scalarRate);
+    benchArray("triangle4", rays, reference, [&](const ray& r) {
+        return closestPackedT(packs4, r, cull);
+    }, scalarRate);
+    benchArray("triangle8", rays, reference, [&](const ray& r) {
+        return closestPackedT(packs8, r, cull);
+    }, scalarRate);
+}
+
+void benchMesh(const char *name, triangleMesh& mesh, const std::vector<ray>& rays)
+{
+    mesh.buildBVH();
+    std::vector<float> reference(rays.size());
+    for (uint32_t i = 0; i < rays.size(); i++) {
+        primitiveHit h;
+        reference[i] = mesh.closestHit(rays[i], 0.0001f, FLT_MAX, h) ? h.t : FLT_MAX;
+    }
+    const double faceRate = measureRaysPerSecond(rays, [&](const ray& r) {
+        primitiveHit h;
+        mesh.closestHit(r, 0.0001f, FLT_MAX, h);
+    }, 1.0);
+    fprintf(stderr, "%-14s %9u %-6s %13.0f %8.2fx %9s\n", name, mesh.numTriangles(), "faces", faceRate, 1.0, "");
+
+    for (uint32_t width : { 4u, 8u }) {
+        mesh.packFaces(width);
+        uint32_t mismatches = 0;
+        for (uint32_t i = 0; i < rays.size(); i++) {
+            primitiveHit h;
+            const float t = mesh.closestHit(rays[i], 0.0001f, FLT_MAX, h) ? h.t : FLT_MAX;
+            if (!sameHitT(t, reference[i]) || mesh.occluded(rays[i], 0.0001f, FLT_MAX) != (t < FLT_MAX)) {
+                mismatches++;
+            }
+        }
+        const double rate = measureRaysPerSecond(rays, [&](const ray& r) {
+            primitiveHit h;
+            mesh.closestHit(r, 0.0001f, FLT_MAX, h);
+        }, 1.0);
+        fprintf(stderr, "%-14s %9u %-6s %13.0f %8.2fx %9u\n", name, mesh.numTriangles(),
+                width == 8 ? "pack 8" : "pack 4", rate, rate / faceRate, mismatches);
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    benchTriangleArray(true);
+    benchTriangleArray(false);
+
+    fprintf(stderr, "\n%u camera rays, closest hit on a mesh (two sided faces)\n", kNumMeshRays);
+    fprintf(stderr, "%-14s %9s %-6s %13s %9s %9s\n", "mesh", "faces", "leaves", "rays/s", "speedup", "mismatch");
+    const std::vector<ray> rays = generateRays(kNumMeshRays, 20.0f);
+    for (uint32_t rings : { 64u, 512u }) {
+        triangleMesh mesh;
+        generateBumpySphere(mesh, rings, 2 * rings);
+        benchMesh("bumpy sphere", mesh, rays);
+    }
+    {
+        triangleMesh mesh;
+        const std::vector<triangleVerts> tris = generateTriangleSoup(200000);
+        for (const triangleVerts& tri : tris) {
+            mesh.addTriangle(mesh.addVertex(tri.v0), mesh.addVertex(tri.v1), mesh.addVertex(tri.v2));
+        }
+        benchMesh("triangle soup", mesh, rays);
+    }
+
+    return 0;
+}
@@ -0,0 +1,180 @@
+//
+//  vec_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 8/4/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  dot / cross / normalize throughput of the scalar vec3 vs the
+//  SIMD vec3a and the structure of arrays vec3x4 / vec3x8
+//
+
+#include <cstdio>
+#include <random>
+#include <chrono>
+#include <vector>
+#include "simd.hpp"
+
+typedef std::chrono::steady_clock benchClock;
+
+// kept small enough to stay in L1 / L2, this measures math not memory
+constexpr uint32_t kNumVectors = 4096;
+
+// same input in both layouts
+struct inputData
+{
+    std::vector<vec3> a, b;
+    std::vector<float> ax, ay, az, bx, by, bz;
+};
+
+inputData generateInput()
+{
+    std::mt19937 gen(1234);
+    std::uniform_real_distribution<float> distr(-1.0f, 1.0f);
+    inputData in;
+    for (uint32_t i = 0; i < kNumVectors; i++) {
+        in.a.emplace_back(distr(gen), distr(gen), distr(gen));
+        in.b.emplace_back(distr(gen), distr(gen), distr(gen));
+        in.ax.push_back(in.a.back().x());
+        in.ay.push_back(in.a.back().y());
+        in.az.push_back(in.a.back().z());
+        in.bx.push_back(in.b.back().x());
+        in.by.push_back(in.b.back().y());
+        in.bz.push_back(in.b.back().z());
+    }
+    return in;
+}
+
+// run kernel over all vectors until at least minSeconds have passed,
+// return millions of operations per second
+template <typename Kernel>
+double measureMops(Kernel kernel, double minSeconds)
+{
+    uint64_t nOps = 0;
+    auto start = benchClock::now();
+    double elapsed = 0.0;
+    do {
+        kernel();
+        nOps += kNumVectors;
+        elapsed = std::chrono::duration<double>(benchClock::now() - start).count();
+    } while (elapsed < minSeconds);
+    return nOps / elapsed * 1e-6;
+}
+
+// largest difference between a result and the scalar vec3 one
+float maxError(const std::vector<float>& a, const std::vector<float>& b)
+{
+    float err = 0.0f;
+    for (size_t i = 0; i < a.size(); i++) {
+        err = std::max(err, fabsf(a[i] - b[i]));
+    }
+    return err;
+}
+
+enum benchOp { kDot, kCross, kNormalize };
+const char *opName(benchOp op)
+{
+    switch (op) {
+        case kDot: return "dot";
+        case kCross: return "cross";
+        case kNormalize: return "normalize";
+    }
+    return "";
+}
+
+// every kernel writes 3 floats per vector (x, y, z of the result; dot
+// writes its result to x) so the outputs can be compared across layouts
+struct outputData
+{
+    std::vector<float> x, y, z;
+    outputData() : x(kNumVectors), y(kNumVectors), z(kNumVectors) {}
+};
+
+void scalarKernel(benchOp op, const inputData& in, outputData& out)
+{
+    for (uint32_t i = 0; i < kNumVectors; i++) {
+        vec3 r(0.0f);
+        switch (op) {
+            case kDot: r = vec3(dot(in.a[i], in.b[i]), 0.0f, 0.0f); break;
+            case kCross: r = cross(in.a[i], in.b[i]); break;
+            case kNormalize: r = unit_vector(in.a[i]); break;
+        }
+        out.x[i] = r.x();
+        out.y[i] = r.y();
+        out.z[i] = r.z();
+    }
+}
+
+void vec3aKernel(benchOp op, const inputData& in, outputData& out)
+{
+    for (uint32_t i = 0; i < kNumVectors; i++) {
+        const vec3a a(in.a[i]);
+        const vec3a b(in.b[i]);
+        vec3 r(0.0f);
+        switch (op) {
+            case kDot: r = vec3(dot(a, b), 0.0f, 0.0f); break;
+            case kCross: r = cross(a, b).toVec3(); break;
+            case kNormalize: r = unit_vector(a).toVec3(); break;
+        }
+        out.x[i] = r.x();
+        out.y[i] = r.y();
+        out.z[i] = r.z();
+    }
+}
+
+template <typename floatN>
+void wideKernel(benchOp op, const inputData& in, outputData& out)
+{
+    typedef vec3xN<floatN> vec3N;
+    for (uint32_t i = 0; i < kNumVectors; i += floatN::kWidth) {
+        const vec3N a = vec3N::load(&in.ax[i], &in.ay[i], &in.az[i]);
+        const vec3N b = vec3N::load(&in.bx[i], &in.by[i], &in.bz[i]);
+        switch (op) {
+            case kDot: dot(a, b).store(&out.x[i]); break;
+            case kCross: cross(a, b).store(&out.x[i], &out.y[i], &out.z[i]); break;
+            case kNormalize: unit_vector(a).store(&out.x[i], &out.y[i], &out.z[i]); break;
+        }
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    const inputData in = generateInput();
+
+#if SIMD_AVX
+    const char *backend = "avx";
+#elif SIMD_SSE
+    const char *backend = "sse";
+#elif SIMD_NEON
+    const char *backend = "neon";
+#else
+    const char *backend = "scalar";
+#endif
+    fprintf(stderr, "\n%u vectors, %s backend (Mops/s, speedup over vec3, max error)\n",
+            kNumVectors, backend);
+    fprintf(stderr, "%10s %10s %24s %24s %24s\n", "op", "vec3", "vec3a", "vec3x4", "vec3x8");
+    for (benchOp op : { kDot, kCross, kNormalize }) {
+        outputData reference, out;
+        scalarKernel(op, in, reference);
+        const double scalarRate = measureMops([&]() { scalarKernel(op, in, out); }, 0.5);
+
+        double rates[3];
+        float errors[3];
+        rates[0] = measureMops([&]() { vec3aKernel(op, in, out); }, 0.5);
+        errors[0] = std::max(maxError(out.x, reference.x),
+                             std::max(maxError(out.y, reference.y), maxError(out.z, reference.z)));
+        rates[1] = measureMops([&]() { wideKernel<floatx4>(op, in, out); }, 0.5);
+        errors[1] = std::max(maxError(out.x, reference.x),
+                             std::max(maxError(out.y, reference.y), maxError(out.z, reference.z)));
+        rates[2] = measureMops([&]() { wideKernel<floatx8>(op, in, out); }, 0.5);
+        errors[2] = std::max(maxError(out.x, reference.x),
+                             std::max(maxError(out.y, reference.y), maxError(out.z, reference.z)));
+
+        fprintf(stderr, "%10s %10.0f", opName(op), scalarRate);
+        for (int i = 0; i < 3; i++) {
+            fprintf(stderr, " %10.0f %5.1fx %6.0e", rates[i], rates[i] / scalarRate, errors[i]);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    return 0;
+}
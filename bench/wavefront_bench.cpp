@@ -0,0 +1,109 @@
+//
+//  wavefront_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 10/13/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Render time of the path at a time integrator (traceInto) vs the
+//  wavefront tracer at increasing spp, on the main scene (all four
+//  material types) and a scene of many small mixed material spheres,
+//  checking both make the same image
+//
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include "benchutil.hpp"
+#include "wavefront.hpp"
+#include "scenes.hpp"
+
+// generateSphereField() with a random material per small sphere, and the
+// book's three big spheres
+void generateSphereField(scene& world)
+{
+    std::vector<vec3> centers;
+    std::vector<float> radii;
+    generateSphereField(centers, radii);
+    std::mt19937 gen(1234);
+    std::uniform_real_distribution<float> distr;
+    world.objects.emplace_back(new sphere(centers[0], radii[0], new lambertian(vec3(0.5f))));
+    for (uint32_t i = 1; i < centers.size(); i++) {
+        const float pick = distr(gen);
+        material *mat;
+        if (pick < 0.6f) {
+            mat = new lambertian(vec3(distr(gen) * distr(gen), distr(gen) * distr(gen), distr(gen) * distr(gen)));
+        } else if (pick < 0.85f) {
+            mat = new metal(vec3(0.5f * (1.0f + distr(gen)), 0.5f * (1.0f + distr(gen)), 0.5f * (1.0f + distr(gen))));
+        } else {
+            mat = new dielectric(1.5f);
+        }
+        world.objects.emplace_back(new sphere(centers[i], radii[i], mat));
+    }
+    world.objects.emplace_back(new sphere(vec3(0.0f, 1.0f, 0.0f), 1.0f, new dielectric(1.5f)));
+    world.objects.emplace_back(new sphere(vec3(-4.0f, 1.0f, 0.0f), 1.0f, new lambertian(vec3(0.4f, 0.2f, 0.1f))));
+    world.objects.emplace_back(new sphere(vec3(4.0f, 1.0f, 0.0f), 1.0f, new metal(vec3(0.7f, 0.6f, 0.5f))));
+    world.buildBVH();
+}
+
+double renderMs(bool wavefront,
+                std::vector<PixelRGBA>& image,
+                const renderSettings& settings,
+                scene& world,
+                camera& cam,
+                threadPool& pool,
+                renderStats& stats)
+{
+    auto start = benchClock::now();
+    stats = wavefront ? traceWavefront(image.data(), settings, world, cam, pool)
+                      : traceInto(image.data(), settings, world, cam, pool);
+    return std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+}
+
+void benchScene(const char *name, scene& world, camera& cam, renderSettings settings, threadPool& pool)
+{
+    const uint32_t nPixels = settings.width * settings.height;
+    std::vector<PixelRGBA> reference(nPixels), image(nPixels);
+    const uint32_t sppCounts[] = { 16, 64, 256 };
+    for (uint32_t spp : sppCounts) {
+        settings.nSamples = spp;
+        renderStats pathStats, waveStats;
+        const double pathMs = renderMs(false, reference, settings, world, cam, pool, pathStats);
+        const double waveMs = renderMs(true, image, settings, world, cam, pool, waveStats);
+        const bool identical = !memcmp(reference.data(), image.data(), nPixels * sizeof(PixelRGBA)) &&
+                               pathStats.nSegments == waveStats.nSegments;
+        fprintf(stderr, "%-8s %5u %10.2f %12.1f %14.1f %9.2fx %10s\n", name, spp,
+                (double)waveStats.nSegments / waveStats.nPaths, pathMs, waveMs, pathMs / waveMs,
+                identical ? "yes" : "NO");
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    threadPool pool;
+    renderSettings settings;
+    settings.width = 200;
+    settings.height = 100;
+    settings.seed = 7;
+    const float aspect = (float)settings.width / (float)settings.height;
+
+    fprintf(stderr, "\n%d x %d, %u threads\n", settings.width, settings.height, pool.size());
+    fprintf(stderr, "%-8s %5s %10s %12s %14s %10s %10s\n",
+            "scene", "spp", "path len", "path (ms)", "wavefront (ms)", "speedup", "identical");
+
+    {
+        scene world;
+        generateScene(world);
+        world.buildBVH();
+        camera cam = generateSnapshots(aspect)[0].cam;
+        benchScene("main", world, cam, settings, pool);
+    }
+
+    {
+        scene world;
+        generateSphereField(world);
+        camera cam(10.0f, aspect, vec3(13.0f, 2.0f, 3.0f), vec3(0.0f), 0.1f, 10.0f);
+        benchScene("field", world, cam, settings, pool);
+    }
+
+    return 0;
+}
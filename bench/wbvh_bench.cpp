@@ -0,0 +1,71 @@
+//
+//  wbvh_bench.cpp
+//  RayTracingInAWeekend
+//
+//  Created by Abhijit Bhelande on 8/18/19.
+//  Copyright © 2019 Abhijit Bhelande. All rights reserved.
+//
+//  Rays / second of binary vs 4 and 8 wide BVH traversal (same SAH tree,
+//  collapsed) on sphere heavy and triangle heavy scenes
+//  (build with make SIMD=avx2 to get native 8 wide slab tests)
+//
+
+#include <cstdio>
+#include "benchutil.hpp"
+
+// binary, 4 and 8 wide on the same scene and rays, one row per width
+void compareWidths(const char *name, scene& world, const std::vector<ray>& rays)
+{
+    const uint32_t widths[] = { 2, 4, 8 };
+    double binaryRate = 0.0;
+    std::vector<float> binaryHits;
+    for (uint32_t width : widths) {
+        auto start = benchClock::now();
+        world.buildBVH(width);
+        const double buildMs = std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+
+        const size_t nNodes = width == 8 ? world.accel8.nodes.size() :
+                              width == 4 ? world.accel4.nodes.size() : world.accel.nodes.size();
+        const size_t bytes = world.accelMemoryUsage();
+
+        const double rate = measureRaysPerSecond(world, rays);
+        const std::vector<float> hits = closestHits(world, rays);
+        if (width == 2) {
+            binaryRate = rate;
+            binaryHits = hits;
+        }
+        fprintf(stderr, "%-24s %8u %6u %10.1f %10zu %10.1f %14.0f %9.2fx %10u\n",
+                name, (uint32_t)world.objects.size(), width, buildMs, nNodes,
+                bytes / (1024.0 * 1024.0), rate, rate / binaryRate,
+                countMismatches(binaryHits, hits));
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    lambertian mat(vec3(0.5f));
+    const uint32_t nRays = 200000;
+
+    fprintf(stderr, "\n%-24s %8s %6s %10s %10s %10s %14s %10s %10s\n",
+            "scene", "objects", "width", "build (ms)", "nodes", "mem (MB)", "rays/s",
+            "speedup", "mismatch");
+
+    const uint32_t sphereCounts[] = { 1000, 100000 };
+    for (uint32_t nSpheres : sphereCounts) {
+        scene world;
+        generateSphereCloud(world, nSpheres, &mat);
+        compareWidths("spheres primary", world, generateRays(nRays, 30.0f));
+        compareWidths("spheres incoherent", world,
+                      generateIncoherentRays(nRays, vec3(0.0f, 0.0f, -20.0f), 10.0f));
+    }
+
+    const uint32_t ringCounts[] = { 64, 224 };
+    for (uint32_t nRings : ringCounts) {
+        scene world;
+        generateTriangles(world, nRings, 4 * nRings * nRings, &mat);
+        compareWidths("triangles primary", world, generateRays(nRays, 60.0f));
+        compareWidths("triangles incoherent", world,
+                      generateIncoherentRays(nRays, vec3(0.0f, 0.0f, -3.0f), 1.5f));
+    }
+
+    return 0;
+}